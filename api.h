@@ -0,0 +1,214 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Types of the handles, for loader objects bound to a handle.
+ */
+enum api_handle_e {
+	API_HANDLE_PLATFORM,
+	API_HANDLE_DEVICE,
+	API_HANDLE_QUEUE,
+	API_HANDLE_EVENT
+};
+
+/**
+ * Lists of the APIs defined in spec.h, to be used as X macros, in dispatch
+ * table order. params is the parenthesized parameter list of the API, and args
+ * the parenthesized argument list to forward a call. Driver APIs also provide
+ * the name of their handle parameter, APIs creating handles the name of their
+ * handle returning parameter, and batch APIs the name of the API they batch
+ * and of their count, parameters array and results array parameters. Bulk
+ * APIs, that create or are called on arrays of handles, provide the name of
+ * the API called on each handle and of their count and handles array
+ * parameters. APIs called on an array of handles are dispatched through the
+ * first one, the handle of the API being an expression giving it.
+ */
+
+/* X(api, params, args), loader implemented APIs, including enqueue APIs */
+#define API_LOADER(X) \
+	X(getPlatforms, (size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret), (num_platforms, platforms, num_platforms_ret)) \
+	X(platformAddLayer, (platform_t platform, const char *layer_name), (platform, layer_name)) \
+	X(platformGetFunc, (platform_t platform, const char *name, void **func_ret), (platform, name, func_ret)) \
+	X(platformCreateQueue, (platform_t platform, queue_t *queue_ret), (platform, queue_ret)) \
+	X(deviceCreateQueue, (device_t device, queue_t *queue_ret), (device, queue_ret)) \
+	X(queueDestroy, (queue_t queue), (queue)) \
+	X(eventQuery, (event_t event, int *complete_ret, int *result_ret), (event, complete_ret, result_ret)) \
+	X(eventWait, (size_t num_events, const event_t *events), (num_events, events)) \
+	X(eventRelease, (event_t event), (event)) \
+	X(platformCreateDeviceEnqueue, (queue_t queue, device_t *device_ret, event_t *event_ret), (queue, device_ret, event_ret)) \
+	X(deviceFunc1Enqueue, (queue_t queue, int param, event_t *event_ret), (queue, param, event_ret)) \
+	X(deviceFunc2Enqueue, (queue_t queue, int param, event_t *event_ret), (queue, param, event_ret)) \
+	X(deviceDestroyEnqueue, (queue_t queue, event_t *event_ret), (queue, event_ret)) \
+	X(deviceFunc1BatchEnqueue, (queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret), (queue, num_params, params, results, event_ret)) \
+	X(deviceFunc2BatchEnqueue, (queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret), (queue, num_params, params, results, event_ret)) \
+	X(layerSetEnabled, (const char *layer_name, int enabled), (layer_name, enabled)) \
+	X(platformRemoveLayer, (platform_t platform, const char *layer_name), (platform, layer_name)) \
+	X(addDriver, (const char *driver_name), (driver_name)) \
+	X(deviceAddLayer, (device_t device, const char *layer_name), (device, layer_name))
+
+/* X(api, handle, params, args), all driver implemented APIs */
+#define API_DRIVER(X) \
+	X(platformCreateDevice, platform, (platform_t platform, device_t *device_ret), (platform, device_ret)) \
+	X(deviceFunc1, device, (device_t device, int param), (device, param)) \
+	X(deviceFunc2, device, (device_t device, int param), (device, param)) \
+	X(deviceDestroy, device, (device_t device), (device)) \
+	X(deviceFunc1Batch, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results)) \
+	X(deviceFunc2Batch, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results)) \
+	X(platformCreateDevices, platform, (platform_t platform, size_t num_devices, device_t *devices), (platform, num_devices, devices)) \
+	X(devicesDestroy, (num_devices && devices ? devices[0] : NULL), (size_t num_devices, const device_t *devices), (num_devices, devices))
+
+/* X(api, handle, params, args), driver implemented APIs that are not fanned out */
+#define API_DRIVER_SINGLE(X) \
+	X(platformCreateDevice, platform, (platform_t platform, device_t *device_ret), (platform, device_ret)) \
+	X(deviceFunc1, device, (device_t device, int param), (device, param)) \
+	X(deviceFunc2, device, (device_t device, int param), (device, param)) \
+	X(deviceDestroy, device, (device_t device), (device))
+
+/* X(api, handle, params, args) */
+#define API_DRIVER_CALL(X) \
+	X(deviceFunc1, device, (device_t device, int param), (device, param)) \
+	X(deviceFunc2, device, (device_t device, int param), (device, param)) \
+	X(deviceDestroy, device, (device_t device), (device))
+
+/* X(api, handle, params, args, value, has_value), all driver implemented
+ * APIs, value being their first int parameter after the handle if has_value */
+#define API_DRIVER_FILTER(X) \
+	X(platformCreateDevice, platform, (platform_t platform, device_t *device_ret), (platform, device_ret), 0, 0) \
+	X(deviceFunc1, device, (device_t device, int param), (device, param), param, 1) \
+	X(deviceFunc2, device, (device_t device, int param), (device, param), param, 1) \
+	X(deviceDestroy, device, (device_t device), (device), 0, 0) \
+	X(deviceFunc1Batch, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results), 0, 0) \
+	X(deviceFunc2Batch, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results), 0, 0) \
+	X(platformCreateDevices, platform, (platform_t platform, size_t num_devices, device_t *devices), (platform, num_devices, devices), 0, 0) \
+	X(devicesDestroy, (num_devices && devices ? devices[0] : NULL), (size_t num_devices, const device_t *devices), (num_devices, devices), 0, 0)
+
+/* X(api, handle, params, args), driver APIs releasing their handle */
+#define API_DRIVER_DESTROY(X) \
+	X(deviceDestroy, device, (device_t device), (device))
+
+/* X(api, handle, params, args, handle_ret) */
+#define API_DRIVER_CREATE(X) \
+	X(platformCreateDevice, platform, (platform_t platform, device_t *device_ret), (platform, device_ret), device_ret)
+
+/* X(api, single, handle, params, args, num, elems, results) */
+#define API_DRIVER_BATCH(X) \
+	X(deviceFunc1Batch, deviceFunc1, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results), num_params, params, results) \
+	X(deviceFunc2Batch, deviceFunc2, device, (device_t device, size_t num_params, const int *params, int *results), (device, num_params, params, results), num_params, params, results)
+
+/* X(api, single, handle, params, args, num, handles_ret) */
+#define API_DRIVER_CREATE_BULK(X) \
+	X(platformCreateDevices, platformCreateDevice, platform, (platform_t platform, size_t num_devices, device_t *devices), (platform, num_devices, devices), num_devices, devices)
+
+/* X(api, single, handle, params, args, num, handles) */
+#define API_DRIVER_BULK(X) \
+	X(devicesDestroy, deviceDestroy, (num_devices && devices ? devices[0] : NULL), (size_t num_devices, const device_t *devices), (num_devices, devices), num_devices, devices)
+
+/**
+ * X(api, target, handle_type, queue, event_ret, params, args, fields, elems,
+ *   call)
+ * Enqueue APIs, target being the API they enqueue, and handle_type the type of
+ * its handle. queue and event_ret are the names of the queue and event
+ * parameters, fields the parameters of target as structure fields, elems the
+ * arguments to store after the handle, and call the arguments to call target
+ * with from a pointer to the stored fields named stored.
+ */
+#define API_ENQUEUE(X) \
+	X(platformCreateDeviceEnqueue, platformCreateDevice, API_HANDLE_PLATFORM, queue, event_ret, (queue_t queue, device_t *device_ret, event_t *event_ret), (queue, device_ret, event_ret), (platform_t platform; device_t *device_ret;), (device_ret), (stored->platform, stored->device_ret)) \
+	X(deviceFunc1Enqueue, deviceFunc1, API_HANDLE_DEVICE, queue, event_ret, (queue_t queue, int param, event_t *event_ret), (queue, param, event_ret), (device_t device; int param;), (param), (stored->device, stored->param)) \
+	X(deviceFunc2Enqueue, deviceFunc2, API_HANDLE_DEVICE, queue, event_ret, (queue_t queue, int param, event_t *event_ret), (queue, param, event_ret), (device_t device; int param;), (param), (stored->device, stored->param)) \
+	X(deviceDestroyEnqueue, deviceDestroy, API_HANDLE_DEVICE, queue, event_ret, (queue_t queue, event_t *event_ret), (queue, event_ret), (device_t device;), (), (stored->device)) \
+	X(deviceFunc1BatchEnqueue, deviceFunc1Batch, API_HANDLE_DEVICE, queue, event_ret, (queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret), (queue, num_params, params, results, event_ret), (device_t device; size_t num_params; const int *params; int *results;), (num_params, params, results), (stored->device, stored->num_params, stored->params, stored->results)) \
+	X(deviceFunc2BatchEnqueue, deviceFunc2Batch, API_HANDLE_DEVICE, queue, event_ret, (queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret), (queue, num_params, params, results, event_ret), (device_t device; size_t num_params; const int *params; int *results;), (num_params, params, results), (stored->device, stored->num_params, stored->params, stored->results))
+
+#define NUM_APIS 27
+
+/**
+ * Name lookup, in constant time irrespective of the number of APIs. The table
+ * is a perfect hash (hash and displace): the name is hashed once to find its
+ * bucket, and a second time with the seed of the bucket to find its entry,
+ * which gives the slot of the API in struct dispatch_s and in struct
+ * driver_dispatch_s (-1 for loader APIs).
+ */
+struct api_entry_s {
+	const char *name;
+	int         slot;
+	int         driver_slot;
+};
+
+#define API_HASH_BUCKETS 7
+#define API_HASH_SIZE 33
+
+static const uint32_t _api_hash_seeds[API_HASH_BUCKETS] __attribute__((unused)) = {
+	0x00000001,
+	0x00000004,
+	0x0000000c,
+	0x00000006,
+	0x00000002,
+	0x00000010,
+	0x00000008
+};
+
+static const struct api_entry_s _api_hash_entries[API_HASH_SIZE] __attribute__((unused)) = {
+	{ "deviceFunc1BatchEnqueue", 19, -1 },
+	{ "platformRemoveLayer", 24, -1 },
+	{ "eventWait", 13, -1 },
+	{ "platformGetFunc", 6, -1 },
+	{ "deviceFunc1Batch", 7, 4 },
+	{ NULL, -1, -1 },
+	{ "deviceFunc1Enqueue", 16, -1 },
+	{ "platformCreateQueue", 9, -1 },
+	{ "platformCreateDeviceEnqueue", 15, -1 },
+	{ "eventRelease", 14, -1 },
+	{ NULL, -1, -1 },
+	{ "layerSetEnabled", 23, -1 },
+	{ "eventQuery", 12, -1 },
+	{ "deviceDestroy", 5, 3 },
+	{ "deviceFunc2", 4, 2 },
+	{ "devicesDestroy", 22, 7 },
+	{ NULL, -1, -1 },
+	{ NULL, -1, -1 },
+	{ "platformCreateDevice", 2, 0 },
+	{ "deviceFunc2Batch", 8, 5 },
+	{ "platformCreateDevices", 21, 6 },
+	{ NULL, -1, -1 },
+	{ "deviceFunc2Enqueue", 17, -1 },
+	{ "deviceCreateQueue", 10, -1 },
+	{ "queueDestroy", 11, -1 },
+	{ "addDriver", 25, -1 },
+	{ "deviceFunc1", 3, 1 },
+	{ "platformAddLayer", 1, -1 },
+	{ "deviceFunc2BatchEnqueue", 20, -1 },
+	{ NULL, -1, -1 },
+	{ "deviceDestroyEnqueue", 18, -1 },
+	{ "getPlatforms", 0, -1 },
+	{ "deviceAddLayer", 26, -1 }
+};
+
+static inline uint32_t
+apiHash(uint32_t seed, const char *name) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/**
+ * Return the entry of the API named name, or NULL if there is no such API.
+ */
+static inline const struct api_entry_s *
+apiLookup(const char *name) {
+	uint32_t seed = _api_hash_seeds[apiHash(0, name) % API_HASH_BUCKETS];
+	const struct api_entry_s *entry = &_api_hash_entries[apiHash(seed, name) % API_HASH_SIZE];
+	if (entry->name && !strcmp(entry->name, name))
+		return entry;
+	return NULL;
+}
@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+/**
+ * Implementation of the cache line aligned arena of arena.h.
+ */
+
+/**
+ * Chunk header, occupying the first cache line of the chunk.
+ */
+struct arena_chunk_s {
+	struct arena_s       *arena;
+	struct arena_chunk_s *next;
+};
+
+struct arena_block_s {
+	struct arena_block_s *next;
+};
+
+#define ARENA_LINES(size) (((size) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE)
+#define ARENA_CHUNK(ptr) \
+	((struct arena_chunk_s *)((uintptr_t)(ptr) & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1)))
+
+struct arena_s *
+arenaCreate(void) {
+	struct arena_s *arena = (struct arena_s *)calloc(1, sizeof(struct arena_s));
+	if (!arena)
+		return NULL;
+	if (pthread_mutex_init(&arena->mutex, NULL)) {
+		free(arena);
+		return NULL;
+	}
+	arena->offset = ARENA_CHUNK_SIZE;
+	return arena;
+}
+
+void *
+arenaAlloc(struct arena_s *arena, size_t size) {
+	size_t lines = ARENA_LINES(size);
+	void *ptr = NULL;
+	if (!lines || lines >= ARENA_MAX_LINES)
+		return NULL;
+	pthread_mutex_lock(&arena->mutex);
+	if (arena->free[lines]) {
+		ptr = arena->free[lines];
+		arena->free[lines] = arena->free[lines]->next;
+		goto end;
+	}
+	if (arena->offset + lines * CACHE_LINE_SIZE > ARENA_CHUNK_SIZE) {
+		struct arena_chunk_s *chunk;
+		if (posix_memalign((void **)&chunk, ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE))
+			goto end;
+		chunk->arena = arena;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->offset = CACHE_LINE_SIZE;
+	}
+	ptr = (char *)arena->chunks + arena->offset;
+	arena->offset += lines * CACHE_LINE_SIZE;
+end:
+	pthread_mutex_unlock(&arena->mutex);
+	if (ptr)
+		memset(ptr, 0, lines * CACHE_LINE_SIZE);
+	return ptr;
+}
+
+void
+arenaFree(void *ptr, size_t size) {
+	if (!ptr)
+		return;
+	struct arena_s *arena = ARENA_CHUNK(ptr)->arena;
+	struct arena_block_s *block = (struct arena_block_s *)ptr;
+	size_t lines = ARENA_LINES(size);
+	pthread_mutex_lock(&arena->mutex);
+	block->next = arena->free[lines];
+	arena->free[lines] = block;
+	pthread_mutex_unlock(&arena->mutex);
+}
+
+void
+arenaDestroy(struct arena_s *arena) {
+	if (!arena)
+		return;
+	struct arena_chunk_s *chunk = arena->chunks;
+	while (chunk) {
+		struct arena_chunk_s *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	pthread_mutex_destroy(&arena->mutex);
+	free(arena);
+}
@@ -0,0 +1,63 @@
+/**
+ * Cache line aligned arena allocator, used by the loader to lay out the
+ * structures API calls go through (platform multiplexing structures, instance
+ * layer chains, global layers) next to each other, each starting on its own
+ * cache line, instead of scattering them over the heap.
+ *
+ * Memory is obtained in chunks aligned on their size, so the arena a block
+ * belongs to is found from the block address alone. Freed blocks are kept on
+ * free lists indexed by their size in cache lines, and reused by later
+ * allocations of the same size. Chunks are only released when the arena is
+ * destroyed.
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define ARENA_INTERNAL __attribute__((visibility("hidden")))
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define ARENA_MAX_LINES  (ARENA_CHUNK_SIZE / CACHE_LINE_SIZE)
+
+struct arena_chunk_s;
+struct arena_block_s;
+
+/**
+ * The current chunk is the first of the list, and offset the first free byte
+ * in it. Blocks can be freed from any thread, so the arena is locked.
+ */
+struct arena_s {
+	pthread_mutex_t       mutex;
+	struct arena_chunk_s *chunks;
+	size_t                offset;
+	struct arena_block_s *free[ARENA_MAX_LINES];
+};
+
+/**
+ * Create an empty arena. Returns NULL on failure.
+ */
+ARENA_INTERNAL struct arena_s *
+arenaCreate(void);
+
+/**
+ * Allocate a zeroed block of size bytes, rounded up to a multiple of the cache
+ * line size, and aligned on a cache line. Returns NULL on failure, or if size
+ * exceeds the size of a chunk minus its header.
+ */
+ARENA_INTERNAL void *
+arenaAlloc(struct arena_s *arena, size_t size);
+
+/**
+ * Return a block of size bytes to the arena it was allocated from.
+ */
+ARENA_INTERNAL void
+arenaFree(void *ptr, size_t size);
+
+/**
+ * Release the memory of the arena, and of every block allocated from it.
+ */
+ARENA_INTERNAL void
+arenaDestroy(struct arena_s *arena);
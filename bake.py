@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+"""
+Generate the sources of a baked loader from a configuration file listing
+drivers and global layers (see baked.conf). A baked loader is the loader
+built with BAKED_LOADER, statically linked with the listed drivers and
+layers, instead of loading them from the DRIVERS and LAYERS environment
+variables. Its global layer chain is made of direct calls, that link time
+optimization can inline across. Generated in the output directory:
+ - baked.h: the baked symbols the loader uses, included by exp-loader.c,
+ - baked_<name>.c: one translation unit per listed driver, layer or source,
+   including it with its macro definitions and its symbols renamed, and
+   defining the entry points of the link.
+
+Drivers and layers are listed in the order they would be in DRIVERS and
+LAYERS, under the name they would be listed with, so the platforms of the
+drivers are enumerated in the listed order and the last listed layer is the
+first to be called. Each line of the configuration file is one of:
+  driver <name> <source> [-D<macro>[=<value>]]...
+  layer <name> <source> [-D<macro>[=<value>]]...
+  source <source> [-D<macro>[=<value>]]...
+    a source the drivers or layers depend on, built once.
+
+Drivers and layers are built with their exported symbols renamed, so
+several can be built from the same source, and with hidden visibility, so
+the loader only exports the API. Drivers must return their
+static _dispatch table for all their platforms. Layers must intercept the
+APIs of their static _dispatch table, and call the next link through
+LAYER_TARGET when it is defined, see layer.c.
+
+Usage: bake.py [baked.conf [output_directory]]
+"""
+
+import os
+import re
+import sys
+
+import gen_api
+
+BANNER = "/* Generated from %s by bake.py, do not edit. */\n\n"
+
+DRIVER_SYMBOLS = ("getPlatformsExt", "platformGetFuncExt", "platformGetDispatchExt")
+LAYER_SYMBOLS = ("layerInit", "layerDeinit", "layerCallCount")
+RESERVED = ("loader", "fallback")
+
+
+class Entry:
+    def __init__(self, kind, name, source, defines):
+        self.kind = kind
+        self.name = name
+        self.source = source
+        self.defines = defines
+        self.ident = re.sub(r"\W", "_", name)
+
+    def symbol(self, name):
+        return "baked_%s_%s" % (self.ident, name)
+
+
+def parse_config(path):
+    entries = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            words = line.split("#", 1)[0].split()
+            if not words:
+                continue
+            kind = words[0]
+            if kind in ("driver", "layer") and len(words) >= 3:
+                entry = Entry(kind, words[1], words[2], words[3:])
+            elif kind == "source" and len(words) >= 2:
+                entry = Entry(kind, words[1], words[1], words[2:])
+            else:
+                sys.exit("%s:%d: invalid line" % (path, lineno))
+            for define in entry.defines:
+                if not re.match(r"^-D[A-Za-z_]\w*(=.*)?$", define):
+                    sys.exit("%s:%d: invalid macro definition: %s" % (path, lineno, define))
+            if entry.ident in RESERVED or entry.ident in [e.ident for e in entries]:
+                sys.exit("%s:%d: duplicate name: %s" % (path, lineno, entry.name))
+            entries.append(entry)
+    if not [e for e in entries if e.kind == "driver"]:
+        sys.exit("%s: no driver listed" % path)
+    return entries
+
+
+def prototype(name, api):
+    return "int %s(%s);\n" % (name, api.params_decl())
+
+
+def gen_defines(entry):
+    out = ""
+    for define in entry.defines:
+        macro, _, value = define[2:].partition("=")
+        out += "#define %s %s\n" % (macro, value if "=" in define else "1")
+    return out
+
+
+def gen_baked_h(config, spec, entries):
+    drivers = [e for e in entries if e.kind == "driver"]
+    layers = [e for e in entries if e.kind == "layer"]
+    out = BANNER % config
+    out += """/**
+ * Symbols of the drivers and global layers of the baked loader, listed in
+ * configuration order as X(name, listed_name).
+ */
+
+#define BAKED_INTERNAL __attribute__((visibility("hidden")))
+
+"""
+    out += "#define BAKED_DRIVERS(X) \\\n"
+    out += " \\\n".join('\tX(%s, "%s")' % (e.ident, e.name) for e in drivers) + "\n\n"
+    if layers:
+        out += "#define BAKED_LAYERS(X) \\\n"
+        out += " \\\n".join('\tX(%s, "%s")' % (e.ident, e.name) for e in layers) + "\n\n"
+    else:
+        out += "#define BAKED_LAYERS(X)\n\n"
+    for e in drivers:
+        out += "BAKED_INTERNAL int %s(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret);\n" % \
+            e.symbol("getPlatformsExt")
+        out += "BAKED_INTERNAL void *%s(platform_t platform, const char *name);\n" % e.symbol("platformGetFuncExt")
+        out += "BAKED_INTERNAL int %s(platform_t platform, size_t num_entries, " \
+               "struct driver_dispatch_s *dispatch, size_t *num_entries_ret) __attribute__((weak));\n" % \
+            e.symbol("platformGetDispatchExt")
+        for api in spec.driver_apis:
+            out += "BAKED_INTERNAL " + prototype(e.symbol(api.name), api)
+        out += "\n"
+    for e in layers:
+        out += "BAKED_INTERNAL int %s(struct dispatch_s *intercepts);\n" % e.symbol("init")
+        out += "BAKED_INTERNAL int %s(void);\n" % e.symbol("deinit")
+    chain = layers[-1].symbol("") if layers else "baked_loader_"
+    if layers:
+        for api in spec.apis:
+            out += "BAKED_INTERNAL " + prototype(chain + api.name, api)
+        out += "\n"
+    out += """/**
+ * Head of the global layer chain.
+ */
+#define BAKED_CHAIN(api) %s ## api
+
+""" % chain
+    out += """/**
+ * Call of a driver API on the driver of 1-based baked index index, or other
+ * for drivers that were not baked.
+ */
+#define BAKED_DRIVER_CALL(index, api, args, other) ( \\
+"""
+    for i, e in enumerate(drivers):
+        out += "\t(index) == %d ? %s ## api args : \\\n" % (i + 1, e.symbol(""))
+    out += "\tother)\n"
+    return out
+
+
+def gen_driver(config, spec, entry):
+    out = BANNER % config
+    out += "/**\n * Driver %s, built from %s.\n */\n\n" % (entry.name, entry.source)
+    out += gen_defines(entry)
+    for name in DRIVER_SYMBOLS:
+        out += "#define %s %s\n" % (name, entry.symbol(name))
+    out += "\nint %s() __attribute__((weak));\n" % entry.symbol("platformGetDispatchExt")
+    out += '#include "%s"\n\n' % entry.source
+    out += "/**\n * Entry points, APIs the driver doesn't implement are handled by the loader.\n */\n"
+    for api in spec.driver_apis:
+        out += prototype("baked_fallback_" + api.name, api)
+    for api in spec.driver_apis:
+        out += "\nint\n%s(%s) {\n" % (entry.symbol(api.name), api.params_decl())
+        out += "\tif (_dispatch.%s)\n\t\treturn _dispatch.%s(%s);\n" % (api.name, api.name, api.args())
+        out += "\treturn baked_fallback_%s(%s);\n}\n" % (api.name, api.args())
+    return out
+
+
+def gen_layer(config, spec, entry, next_entry):
+    target = entry.symbol("target")
+    nxt = next_entry.symbol("") if next_entry else "baked_loader_"
+    out = BANNER % config
+    out += "/**\n * Global layer %s, built from %s, calling %s.\n */\n\n" % (
+        entry.name, entry.source, next_entry.name if next_entry else "the loader")
+    out += gen_defines(entry)
+    for name in LAYER_SYMBOLS:
+        out += "#define %s %s\n" % (name, entry.symbol(name))
+    out += "#define LAYER_TARGET (&%s)\n" % target
+    out += "\nstruct dispatch_s;\n"
+    out += "extern const struct dispatch_s %s;\n" % target
+    out += "int %s() __attribute__((weak));\n" % entry.symbol("layerDeinit")
+    out += '#include "%s"\n\n' % entry.source
+    out += "/**\n * Next link of the chain.\n */\n"
+    for api in spec.apis:
+        out += prototype(nxt + api.name, api)
+    out += "\nconst struct dispatch_s %s = {\n" % target
+    out += "\n".join(gen_api.align_fields([(".%s" % a.name, "= &%s%s," % (nxt, a.name)) for a in spec.apis])) + "\n"
+    out += "};\n\n"
+    out += "/**\n * Entry points, APIs the layer doesn't intercept go to the next link.\n */\n"
+    for api in spec.apis:
+        out += "int\n%s(%s) {\n" % (entry.symbol(api.name), api.params_decl())
+        out += "\tif (_dispatch.%s)\n\t\treturn _dispatch.%s(%s);\n" % (api.name, api.name, api.args())
+        out += "\treturn %s%s(%s);\n}\n\n" % (nxt, api.name, api.args())
+    out += """/**
+ * The layer must intercept the APIs of its static dispatch table, as the entry
+ * points don't depend on the table it returns.
+ */
+int
+%s(struct dispatch_s *intercepts) {
+	if (layerInit(NUM_DISPATCH_ENTRIES, (struct dispatch_s *)LAYER_TARGET, intercepts))
+		return SPEC_ERROR;
+""" % entry.symbol("init")
+    out += "\tif (" + " ||\n\t    ".join("intercepts->%s != _dispatch.%s" % (a.name, a.name) for a in spec.apis) + ")\n"
+    out += "\t\treturn SPEC_ERROR;\n\treturn SPEC_SUCCESS;\n}\n\n"
+    out += """int
+%s(void) {
+	pfn_layerDeinit_t deinit = &layerDeinit;
+	if (!deinit)
+		return SPEC_SUCCESS;
+	return deinit();
+}
+""" % entry.symbol("deinit")
+    return out
+
+
+def gen_source(config, entry):
+    out = BANNER % config
+    out += gen_defines(entry)
+    out += '#include "%s"\n' % entry.source
+    return out
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    src = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "baked.conf")
+    dst = sys.argv[2] if len(sys.argv) > 2 else os.path.join(here, "baked")
+    config = os.path.basename(src)
+    spec = gen_api.parse(os.path.join(here, "spec.api"))
+    entries = parse_config(src)
+    layers = [e for e in entries if e.kind == "layer"]
+    os.makedirs(dst, exist_ok=True)
+    outputs = {"baked.h": gen_baked_h(config, spec, entries)}
+    for entry in entries:
+        if entry.kind == "driver":
+            out = gen_driver(config, spec, entry)
+        elif entry.kind == "layer":
+            i = layers.index(entry)
+            out = gen_layer(config, spec, entry, layers[i - 1] if i else None)
+        else:
+            out = gen_source(config, entry)
+        outputs["baked_%s.c" % entry.ident] = out
+    for name, out in outputs.items():
+        with open(os.path.join(dst, name), "w") as f:
+            f.write(out)
+
+
+if __name__ == "__main__":
+    main()
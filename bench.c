@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "spec.h"
+
+/**
+ * Dispatch overhead microbenchmark. Each configuration of the loader (no
+ * layers, N global layers, N instance layers, no layers with handle validation)
+ * is measured in a forked child process, as global layers are only read once by
+ * the loader at initialization. The driver and layers used are silent builds of
+ * driver.c, layer.c and instance_layer.c (see build.sh), so only the dispatch
+ * cost and the work of the pass-through layers is measured.
+ *
+ * Results are printed on the standard output as a JSON document.
+ *
+ * In cold mode (-c), single calls are measured after evicting the caches,
+ * at every chain depth, to show the cost of the cache lines the loader
+ * structures occupy. The L1 data cache read misses of the calls are counted
+ * with perf_event_open when the hardware counters are available.
+ */
+
+#ifndef FFI_INSTANCE_LAYERS
+#define FFI_INSTANCE_LAYERS 1
+#endif
+
+#define BENCH_DRIVER "libbench_driver.so"
+#define BENCH_LAYER "libbench_layer%d.so"
+#define BENCH_INSTANCE_LAYER "libbench_instance_layer%d.so"
+#define BENCH_MAX_DEPTH 16
+#define BENCH_BATCH_SIZE 64
+/* devices kept alive while measuring, so validated handles are looked up in
+ * a populated registry */
+#define BENCH_LIVE_DEVICES 4096
+/* written between cold calls, larger than the L1 and L2 caches */
+#define BENCH_EVICT_SIZE (8 * 1024 * 1024)
+
+enum bench_path {
+	BENCH_PATH_NONE,
+	BENCH_PATH_GLOBAL,
+	BENCH_PATH_INSTANCE,
+	BENCH_PATH_VALIDATE
+};
+
+static const char *_path_names[] = {
+	"none",
+	"global",
+#if FFI_INSTANCE_LAYERS
+	"instance_ffi",
+#else
+	"instance",
+#endif
+	"validate"
+};
+
+struct bench_config {
+	size_t num_samples;
+	size_t calls_per_sample;
+	int    max_depth;
+	int    cold;
+};
+
+static inline double
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int
+compare_doubles(const void *a, const void *b) {
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+/**
+ * Print a single result record, on its own line. samples are ns/call values
+ * and are sorted in place.
+ */
+static void
+report(enum bench_path path, int depth, const char *api,
+		size_t calls_per_sample, size_t num_samples, double *samples) {
+	qsort(samples, num_samples, sizeof(double), compare_doubles);
+	size_t p99 = (num_samples * 99 + 99) / 100 - 1;
+	double mean = 0.0;
+	for (size_t i = 0; i < num_samples; i++)
+		mean += samples[i];
+	mean /= num_samples;
+	printf("{\"path\": \"%s\", \"depth\": %d, \"api\": \"%s\", "
+		"\"samples\": %zu, \"calls_per_sample\": %zu, "
+		"\"min_ns\": %.3f, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"mean_ns\": %.3f}\n",
+		_path_names[path], depth, api,
+		num_samples, calls_per_sample,
+		samples[0], samples[num_samples / 2], samples[p99], mean);
+}
+
+/**
+ * Print a cold call record. ns and misses are per call values, from which the
+ * medians of the baseline (the same measurement without the call) have been
+ * subtracted, and are sorted in place. misses is NULL if the hardware counter
+ * is not available.
+ */
+static void
+report_cold(enum bench_path path, int depth, const char *api,
+		size_t num_samples, double *ns, double *misses) {
+	qsort(ns, num_samples, sizeof(double), compare_doubles);
+	size_t p99 = (num_samples * 99 + 99) / 100 - 1;
+	printf("{\"path\": \"%s\", \"depth\": %d, \"api\": \"%s\", \"cold\": true, "
+		"\"samples\": %zu, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"l1d_misses\": ",
+		_path_names[path], depth, api,
+		num_samples, ns[num_samples / 2], ns[p99]);
+	if (misses) {
+		qsort(misses, num_samples, sizeof(double), compare_doubles);
+		printf("%.1f}\n", misses[num_samples / 2]);
+	} else
+		printf("null}\n");
+}
+
+#define BENCH_LOOP(config, samples, body) do { \
+	for (size_t _s = 0; _s < (config)->num_samples / 10 + 1; _s++) \
+		for (size_t _i = 0; _i < (config)->calls_per_sample; _i++) \
+			body; \
+	for (size_t _s = 0; _s < (config)->num_samples; _s++) { \
+		double _start = now_ns(); \
+		for (size_t _i = 0; _i < (config)->calls_per_sample; _i++) \
+			body; \
+		(samples)[_s] = (now_ns() - _start) / (config)->calls_per_sample; \
+	} \
+} while (0)
+
+/**
+ * Count the user space L1 data cache read misses of the calling thread.
+ * Returns -1 if the counter is not available, as in most virtual machines.
+ */
+static int
+open_l1d_counter(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline uint64_t
+read_counter(int fd) {
+	uint64_t count = 0;
+	if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count))
+		count = 0;
+	return count;
+}
+
+static void
+evict(volatile unsigned char *buffer) {
+	for (size_t i = 0; i < BENCH_EVICT_SIZE; i += 64)
+		buffer[i]++;
+}
+
+#define BENCH_COLD_LOOP(config, buffer, fd, ns, misses, body) do { \
+	for (size_t _s = 0; _s < (config)->num_samples; _s++) { \
+		evict(buffer); \
+		uint64_t _count = read_counter(fd); \
+		double _start = now_ns(); \
+		body; \
+		(ns)[_s] = now_ns() - _start; \
+		(misses)[_s] = (double)(read_counter(fd) - _count); \
+	} \
+} while (0)
+
+static double
+median(size_t num_samples, const double *samples, double *scratch) {
+	memcpy(scratch, samples, num_samples * sizeof(double));
+	qsort(scratch, num_samples, sizeof(double), compare_doubles);
+	return scratch[num_samples / 2];
+}
+
+/**
+ * Measure single calls with cold caches. Each sample evicts the caches, then
+ * times one call, and the median of an empty measurement is subtracted.
+ */
+static int
+run_cold(const struct bench_config *config, enum bench_path path, int depth, device_t device) {
+	int err = 0;
+	int fd = open_l1d_counter();
+	unsigned char *buffer = (unsigned char *)calloc(1, BENCH_EVICT_SIZE);
+	double *samples = (double *)malloc(4 * config->num_samples * sizeof(double));
+	if (!buffer || !samples) {
+		free(buffer);
+		free(samples);
+		if (fd >= 0)
+			close(fd);
+		return SPEC_ERROR;
+	}
+	double *ns = samples;
+	double *misses = samples + config->num_samples;
+	double *base_ns = samples + 2 * config->num_samples;
+	double *base_misses = samples + 3 * config->num_samples;
+
+	BENCH_COLD_LOOP(config, buffer, fd, base_ns, base_misses, (void)0);
+	double base_ns_median = median(config->num_samples, base_ns, ns);
+	double base_misses_median = median(config->num_samples, base_misses, ns);
+
+#define BENCH_COLD(api, call) do { \
+	BENCH_COLD_LOOP(config, buffer, fd, ns, misses, err |= call); \
+	for (size_t i = 0; i < config->num_samples; i++) { \
+		ns[i] -= base_ns_median; \
+		misses[i] -= base_misses_median; \
+	} \
+	report_cold(path, depth, api, config->num_samples, ns, fd >= 0 ? misses : NULL); \
+} while (0)
+
+	BENCH_COLD("deviceFunc1", deviceFunc1(device, 1));
+	BENCH_COLD("deviceFunc2", deviceFunc2(device, 1));
+#undef BENCH_COLD
+
+	free(buffer);
+	free(samples);
+	if (fd >= 0)
+		close(fd);
+	return err ? SPEC_ERROR : SPEC_SUCCESS;
+}
+
+/**
+ * Run the measurements for a configuration, once the loader is set up.
+ */
+static int
+run_config(const struct bench_config *config, enum bench_path path, int depth) {
+	size_t num_platforms;
+	platform_t platform;
+	device_t device;
+	int err = 0;
+
+	if (getPlatforms(0, NULL, &num_platforms) || num_platforms != 1) {
+		fprintf(stderr, "bench: expected a single platform from %s\n", BENCH_DRIVER);
+		return SPEC_ERROR;
+	}
+	if (getPlatforms(1, &platform, NULL))
+		return SPEC_ERROR;
+	if (path == BENCH_PATH_INSTANCE)
+		for (int i = 1; i <= depth; i++) {
+			char name[64];
+			snprintf(name, sizeof(name), BENCH_INSTANCE_LAYER, i);
+			if (platformAddLayer(platform, name)) {
+				fprintf(stderr, "bench: could not add instance layer %s\n", name);
+				return SPEC_ERROR;
+			}
+		}
+	device_t *live_devices = (device_t *)malloc(BENCH_LIVE_DEVICES * sizeof(device_t));
+	if (!live_devices)
+		return SPEC_ERROR;
+	if (platformCreateDevices(platform, BENCH_LIVE_DEVICES, live_devices)) {
+		free(live_devices);
+		return SPEC_ERROR;
+	}
+	double *samples = (double *)malloc(config->num_samples * sizeof(double));
+	if (!samples)
+		goto error;
+	int params[BENCH_BATCH_SIZE], results[BENCH_BATCH_SIZE];
+	for (int i = 0; i < BENCH_BATCH_SIZE; i++)
+		params[i] = i;
+	if (platformCreateDevice(platform, &device))
+		goto error;
+
+	if (config->cold) {
+		err |= run_cold(config, path, depth, device);
+		err |= deviceDestroy(device);
+		goto done;
+	}
+
+	BENCH_LOOP(config, samples, err |= deviceFunc1(device, (int)_i));
+	report(path, depth, "deviceFunc1", config->calls_per_sample, config->num_samples, samples);
+
+	BENCH_LOOP(config, samples, err |= deviceFunc2(device, (int)_i));
+	report(path, depth, "deviceFunc2", config->calls_per_sample, config->num_samples, samples);
+
+	/* batches are reported per element, to compare with single calls */
+	BENCH_LOOP(config, samples, err |= deviceFunc1Batch(device, BENCH_BATCH_SIZE, params, results));
+	for (size_t i = 0; i < config->num_samples; i++)
+		samples[i] /= BENCH_BATCH_SIZE;
+	report(path, depth, "deviceFunc1Batch", config->calls_per_sample, config->num_samples, samples);
+
+	BENCH_LOOP(config, samples, err |= deviceFunc2Batch(device, BENCH_BATCH_SIZE, params, results));
+	for (size_t i = 0; i < config->num_samples; i++)
+		samples[i] /= BENCH_BATCH_SIZE;
+	report(path, depth, "deviceFunc2Batch", config->calls_per_sample, config->num_samples, samples);
+
+	if (deviceDestroy(device))
+		goto error;
+
+	BENCH_LOOP(config, samples, do {
+		err |= platformCreateDevice(platform, &device);
+		err |= deviceDestroy(device);
+	} while (0));
+	report(path, depth, "platformCreateDevice+deviceDestroy", config->calls_per_sample, config->num_samples, samples);
+
+	device_t devices[BENCH_BATCH_SIZE];
+	BENCH_LOOP(config, samples, do {
+		err |= platformCreateDevices(platform, BENCH_BATCH_SIZE, devices);
+		err |= devicesDestroy(BENCH_BATCH_SIZE, devices);
+	} while (0));
+	for (size_t i = 0; i < config->num_samples; i++)
+		samples[i] /= BENCH_BATCH_SIZE;
+	report(path, depth, "platformCreateDevices+devicesDestroy", config->calls_per_sample, config->num_samples, samples);
+
+done:
+	free(samples);
+	err |= devicesDestroy(BENCH_LIVE_DEVICES, live_devices);
+	free(live_devices);
+	if (err)
+		fprintf(stderr, "bench: API calls returned errors for path %s, depth %d\n",
+			_path_names[path], depth);
+	return err ? SPEC_ERROR : SPEC_SUCCESS;
+error:
+	free(samples);
+	devicesDestroy(BENCH_LIVE_DEVICES, live_devices);
+	free(live_devices);
+	return SPEC_ERROR;
+}
+
+/**
+ * Configure the loader through the environment before it initializes, in a
+ * child process, and run the measurements. The records printed by the child
+ * are forwarded as elements of the results array.
+ */
+static int
+bench_config(const struct bench_config *config, enum bench_path path, int depth, int *first) {
+	int fds[2];
+	if (pipe(fds))
+		return SPEC_ERROR;
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return SPEC_ERROR;
+	}
+	if (pid == 0) {
+		char layers[BENCH_MAX_DEPTH * 32] = "";
+		close(fds[0]);
+		if (dup2(fds[1], STDOUT_FILENO) < 0)
+			_exit(EXIT_FAILURE);
+		close(fds[1]);
+		setenv("DRIVERS", BENCH_DRIVER, 1);
+		if (path == BENCH_PATH_GLOBAL)
+			for (int i = 1; i <= depth; i++) {
+				size_t len = strlen(layers);
+				snprintf(layers + len, sizeof(layers) - len,
+					"%s" BENCH_LAYER, i == 1 ? "" : ":", i);
+			}
+		setenv("LAYERS", layers, 1);
+		if (path == BENCH_PATH_VALIDATE)
+			setenv("VALIDATE_HANDLES", "1", 1);
+		int res = run_config(config, path, depth);
+		fflush(stdout);
+		/* skip the loader destructor, that logs on the standard output */
+		_exit(res ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	close(fds[1]);
+	FILE *records = fdopen(fds[0], "r");
+	if (records) {
+		char *line = NULL;
+		size_t len = 0;
+		ssize_t read;
+		while ((read = getline(&line, &len, records)) > 0) {
+			/* strip the record newline, the separator provides it */
+			if (line[read - 1] == '\n')
+				line[read - 1] = '\0';
+			printf("%s    %s", *first ? "" : ",\n", line);
+			*first = 0;
+		}
+		free(line);
+		fclose(records);
+	} else
+		close(fds[0]);
+	int status;
+	if (waitpid(pid, &status, 0) != pid)
+		return SPEC_ERROR;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+		return SPEC_ERROR;
+	return SPEC_SUCCESS;
+}
+
+static void
+usage(const char *name) {
+	fprintf(stderr, "usage: %s [-c] [-s num_samples] [-n calls_per_sample] [-d max_depth]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_config config = { 200, 10000, BENCH_MAX_DEPTH, 0 };
+	int opt;
+	while ((opt = getopt(argc, argv, "cs:n:d:")) != -1) {
+		switch (opt) {
+		case 'c':
+			config.cold = 1;
+			break;
+		case 's':
+			config.num_samples = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			config.calls_per_sample = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			config.max_depth = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!config.num_samples || !config.calls_per_sample ||
+	    config.max_depth < 0 || config.max_depth > BENCH_MAX_DEPTH) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int err = 0;
+	int first = 1;
+	printf("{\n  \"ffi_instance_layers\": %s,\n  \"results\": [\n",
+		FFI_INSTANCE_LAYERS ? "true" : "false");
+	err |= bench_config(&config, BENCH_PATH_NONE, 0, &first);
+	err |= bench_config(&config, BENCH_PATH_VALIDATE, 0, &first);
+	/* cold calls are measured at every depth */
+	for (int depth = 1; depth <= config.max_depth; depth = config.cold ? depth + 1 : depth * 2) {
+		err |= bench_config(&config, BENCH_PATH_GLOBAL, depth, &first);
+		err |= bench_config(&config, BENCH_PATH_INSTANCE, depth, &first);
+	}
+	printf("\n  ]\n}\n");
+	fflush(stdout);
+	/* the loader was never initialized in this process, skip its destructor */
+	_exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,2 @@
+LD_LIBRARY_PATH=`pwd` ./bench "$@" > bench_output.txt
+LD_LIBRARY_PATH=`pwd` ./bench -c > bench_cache_output.txt
@@ -1,9 +1,24 @@
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DDRIVER_NUMBER=2 driver.c -o libdriver2.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared driver.c -o libdriver1.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_NUMBER=2 layer.c -o liblayer2.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared layer.c -o liblayer1.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_NUMBER=2 -DFFI_INSTANCE_LAYERS=0 instance_layer.c -o libinstance_layer2.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DFFI_INSTANCE_LAYERS=0 instance_layer.c -o libinstance_layer1.so
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DFFI_INSTANCE_LAYERS=0 exp-loader.c -o libexp-loader.so -ldl -lpthread
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g test.c -o test -L./ -lexp-loader
-gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g test.c -DNO_PROTOTYPES -o test_dlopen -L./ -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DDRIVER_NUMBER=2 driver.c -o libdriver2.so -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared driver.c -o libdriver1.so -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DDRIVER_NUMBER=3 driver.c -o libdriver3.so -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_NUMBER=2 layer.c trace.c -o liblayer2.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared layer.c trace.c -o liblayer1.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -shared histogram_layer.c -o libhistogram_layer.so -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_NUMBER=2 -DFFI_INSTANCE_LAYERS=0 instance_layer.c trace.c -o libinstance_layer2.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DFFI_INSTANCE_LAYERS=0 instance_layer.c trace.c -o libinstance_layer1.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_VERBOSE=0 -DLAYER_COUNT=1 -DFFI_INSTANCE_LAYERS=0 instance_layer.c trace.c -o libinstance_count_layer.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -shared -DLAYER_NUMBER=3 -DLAYER_FILTER -DFFI_INSTANCE_LAYERS=0 instance_layer.c trace.c -o libinstance_filter_layer.so -lpthread -ldl
+g++ -Wall -Wextra -pedantic -std=c++11 -fPIC -g -O2 -shared -DFFI_INSTANCE_LAYERS=0 sdk_layer.cpp -o libsdk_layer.so
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -shared -DDRIVER_VERBOSE=0 driver.c -o libbench_driver.so -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -shared -DLAYER_VERBOSE=0 layer.c trace.c -o libbench_layer.so -lpthread -ldl
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -shared -DLAYER_VERBOSE=0 -DFFI_INSTANCE_LAYERS=0 instance_layer.c trace.c -o libbench_instance_layer.so -lpthread -ldl
+# the loader identifies layers by library, so each layer of a chain is a copy
+for i in $(seq 1 16); do
+	cp libbench_layer.so libbench_layer$i.so
+	cp libbench_instance_layer.so libbench_instance_layer$i.so
+done
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -shared -DFFI_INSTANCE_LAYERS=0 exp-loader.c epoch.c queue.c registry.c profile.c arena.c discovery.c -o libexp-loader.so -ldl -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g test.c -o test -L./ -lexp-loader -ldl -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -DFFI_INSTANCE_LAYERS=0 bench.c -o bench -L./ -lexp-loader
+gcc -Wall -Wextra -pedantic -std=c99 -g trace_decode.c -o trace_decode
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g test.c -DNO_PROTOTYPES -o test_dlopen -L./ -ldl -lpthread
@@ -0,0 +1,9 @@
+# Baked loader, see bake.py, built in the baked directory with link time
+# optimization. Instance layers and runtime drivers are the ones of build.sh.
+python3 bake.py baked.conf baked
+for f in baked/baked_*.c; do
+	gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -flto=auto -fvisibility=hidden -DFFI_INSTANCE_LAYERS=0 -I. -c $f -o ${f%.c}.o
+done
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -flto=auto -shared -DFFI_INSTANCE_LAYERS=0 -DBAKED_LOADER -Ibaked exp-loader.c epoch.c queue.c registry.c profile.c arena.c discovery.c baked/baked_*.o -o baked/libexp-loader.so -ldl -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g test.c -o baked/test -Lbaked -lexp-loader -ldl -lpthread
+gcc -Wall -Wextra -pedantic -std=c99 -fPIC -g -O2 -DFFI_INSTANCE_LAYERS=0 bench.c -o baked/bench -Lbaked -lexp-loader
@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "discovery.h"
+
+/**
+ * Implementation of the discovery cache of discovery.h.
+ */
+
+#define DISCOVERY_MAGIC "LDRDISC1"
+
+struct discovery_header_s {
+	char     magic[8];
+	uint64_t num_entries;
+	uint64_t num_records;
+};
+
+/**
+ * Records added by this process, the record following its list element.
+ */
+struct discovery_pending_s;
+struct discovery_pending_s {
+	struct discovery_pending_s *next;
+	struct discovery_record_s  *record;
+};
+
+static char                             *_discovery_path = NULL;
+static size_t                            _discovery_num_entries = 0;
+static void                             *_discovery_map = NULL;
+static size_t                            _discovery_map_size = 0;
+static const struct discovery_header_s  *_discovery_header = NULL;
+static struct discovery_pending_s       *_discovery_pending = NULL;
+static int                               _discovery_dirty = 0;
+static pthread_mutex_t                   _discovery_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t
+discoveryRecordSize(size_t num_platforms) {
+	return sizeof(struct discovery_record_s) +
+		num_platforms * _discovery_num_entries * sizeof(int64_t);
+}
+
+#define FOR_EACH_MAPPED_RECORD(record) \
+	for (const struct discovery_record_s *record = _discovery_header ? \
+			(const struct discovery_record_s *)(_discovery_header + 1) : NULL, \
+		*record ## _end = _discovery_header ? \
+			(const struct discovery_record_s *)((const char *)_discovery_map + _discovery_map_size) : NULL; \
+	     record != record ## _end; \
+	     record = (const struct discovery_record_s *)((const char *)record + record->size))
+
+/**
+ * Records are checked once when mapping, so lookups can trust their sizes.
+ */
+static int
+discoveryValidate(void) {
+	const struct discovery_header_s *header = (const struct discovery_header_s *)_discovery_map;
+	const char *end = (const char *)_discovery_map + _discovery_map_size;
+	if (_discovery_map_size < sizeof(struct discovery_header_s) ||
+	    memcmp(header->magic, DISCOVERY_MAGIC, sizeof(header->magic)) ||
+	    header->num_entries != _discovery_num_entries)
+		return -1;
+	const char *cur = (const char *)(header + 1);
+	for (uint64_t i = 0; i < header->num_records; i++) {
+		const struct discovery_record_s *record = (const struct discovery_record_s *)cur;
+		if ((size_t)(end - cur) < sizeof(struct discovery_record_s) ||
+		    record->num_platforms > (_discovery_map_size / sizeof(int64_t)) ||
+		    record->size != discoveryRecordSize(record->num_platforms) ||
+		    record->size > (size_t)(end - cur))
+			return -1;
+		cur += record->size;
+	}
+	return cur == end ? 0 : -1;
+}
+
+int
+discoveryInit(const char *path, size_t num_entries) {
+	_discovery_path = strdup(path);
+	if (!_discovery_path)
+		return -1;
+	_discovery_num_entries = num_entries;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			_discovery_map = map;
+			_discovery_map_size = (size_t)st.st_size;
+			if (discoveryValidate()) {
+				munmap(_discovery_map, _discovery_map_size);
+				_discovery_map = NULL;
+				_discovery_map_size = 0;
+			} else
+				_discovery_header = (const struct discovery_header_s *)_discovery_map;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+struct discovery_build_id_s {
+	const char             *name;
+	struct discovery_key_s *key;
+};
+
+static int
+discoveryBuildId(struct dl_phdr_info *info, size_t size, void *arg) {
+	struct discovery_build_id_s *search = (struct discovery_build_id_s *)arg;
+	(void)size;
+	if (!info->dlpi_name || strcmp(info->dlpi_name, search->name))
+		return 0;
+	for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_NOTE)
+			continue;
+		const char *note = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+		const char *end = note + phdr->p_memsz;
+		while (note + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+			const char *name = note + sizeof(ElfW(Nhdr));
+			const char *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+			if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+			    !memcmp(name, "GNU", 4) && nhdr->n_descsz <= DISCOVERY_MAX_BUILD_ID &&
+			    desc + nhdr->n_descsz <= end) {
+				search->key->build_id_size = nhdr->n_descsz;
+				memcpy(search->key->build_id, desc, nhdr->n_descsz);
+				return 1;
+			}
+			note = desc + ((nhdr->n_descsz + 3) & ~3u);
+		}
+	}
+	return 1;
+}
+
+int
+discoveryKey(const char *path, const void *symbol, struct discovery_key_s *key, const void **base_ret) {
+	Dl_info info;
+	struct stat st;
+	if (strlen(path) >= DISCOVERY_MAX_PATH)
+		return -1;
+	if (!dladdr(symbol, &info) || !info.dli_fname || !info.dli_fbase)
+		return -1;
+	if (stat(info.dli_fname, &st))
+		return -1;
+	memset(key, 0, sizeof(struct discovery_key_s));
+	strcpy(key->path, path);
+	key->mtime_sec = (uint64_t)st.st_mtim.tv_sec;
+	key->mtime_nsec = (uint64_t)st.st_mtim.tv_nsec;
+	key->size = (uint64_t)st.st_size;
+	key->inode = (uint64_t)st.st_ino;
+	struct discovery_build_id_s search = { info.dli_fname, key };
+	dl_iterate_phdr(&discoveryBuildId, &search);
+	*base_ret = info.dli_fbase;
+	return 0;
+}
+
+int64_t
+discoveryOffset(const void *base, const void *entry) {
+	Dl_info info;
+	if (!dladdr(entry, &info) || info.dli_fbase != base)
+		return -1;
+	return (int64_t)((const char *)entry - (const char *)base);
+}
+
+const struct discovery_record_s *
+discoveryLookup(const struct discovery_key_s *key) {
+	FOR_EACH_MAPPED_RECORD(record)
+		if (!memcmp(&record->key, key, sizeof(struct discovery_key_s)))
+			return record;
+	return NULL;
+}
+
+/**
+ * A new record replaces pending records for the same driver name.
+ */
+void
+discoveryRecord(const struct discovery_key_s *key, size_t num_platforms, const int64_t *offsets) {
+	size_t size = discoveryRecordSize(num_platforms);
+	struct discovery_pending_s *pending = (struct discovery_pending_s *)
+		malloc(sizeof(struct discovery_pending_s) + size);
+	if (!pending)
+		return;
+	pending->record = (struct discovery_record_s *)(pending + 1);
+	pending->record->size = size;
+	pending->record->key = *key;
+	pending->record->num_platforms = num_platforms;
+	memcpy(pending->record->offsets, offsets, num_platforms * _discovery_num_entries * sizeof(int64_t));
+	pthread_mutex_lock(&_discovery_mutex);
+	struct discovery_pending_s **p = &_discovery_pending;
+	while (*p) {
+		if (!strcmp((*p)->record->key.path, key->path)) {
+			struct discovery_pending_s *old = *p;
+			*p = old->next;
+			free(old);
+		} else
+			p = &(*p)->next;
+	}
+	pending->next = _discovery_pending;
+	_discovery_pending = pending;
+	_discovery_dirty = 1;
+	pthread_mutex_unlock(&_discovery_mutex);
+}
+
+static int
+discoveryIsPending(const char *path) {
+	for (struct discovery_pending_s *p = _discovery_pending; p; p = p->next)
+		if (!strcmp(p->record->key.path, path))
+			return 1;
+	return 0;
+}
+
+void
+discoveryFlush(void) {
+	struct discovery_header_s header;
+	char *tmp_path = NULL;
+	FILE *file = NULL;
+	pthread_mutex_lock(&_discovery_mutex);
+	if (!_discovery_dirty)
+		goto end;
+	size_t len = strlen(_discovery_path) + 32;
+	tmp_path = (char *)malloc(len);
+	if (!tmp_path)
+		goto end;
+	snprintf(tmp_path, len, "%s.%ld.tmp", _discovery_path, (long)getpid());
+	file = fopen(tmp_path, "wb");
+	if (!file)
+		goto end;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DISCOVERY_MAGIC, sizeof(header.magic));
+	header.num_entries = _discovery_num_entries;
+	FOR_EACH_MAPPED_RECORD(record)
+		if (!discoveryIsPending(record->key.path))
+			header.num_records++;
+	for (struct discovery_pending_s *p = _discovery_pending; p; p = p->next)
+		header.num_records++;
+	int err = fwrite(&header, sizeof(header), 1, file) != 1;
+	FOR_EACH_MAPPED_RECORD(record)
+		if (!discoveryIsPending(record->key.path))
+			err |= fwrite(record, record->size, 1, file) != 1;
+	for (struct discovery_pending_s *p = _discovery_pending; p; p = p->next)
+		err |= fwrite(p->record, p->record->size, 1, file) != 1;
+	err |= fclose(file) != 0;
+	if (err || rename(tmp_path, _discovery_path))
+		unlink(tmp_path);
+	else
+		_discovery_dirty = 0;
+end:
+	pthread_mutex_unlock(&_discovery_mutex);
+	free(tmp_path);
+}
+
+void
+discoveryFini(void) {
+	if (_discovery_map)
+		munmap(_discovery_map, _discovery_map_size);
+	_discovery_map = NULL;
+	_discovery_map_size = 0;
+	_discovery_header = NULL;
+	while (_discovery_pending) {
+		struct discovery_pending_s *next = _discovery_pending->next;
+		free(_discovery_pending);
+		_discovery_pending = next;
+	}
+	free(_discovery_path);
+	_discovery_path = NULL;
+}
@@ -0,0 +1,98 @@
+/**
+ * Persistent cache of the driver discovery results, used by the loader to
+ * skip probing drivers it already probed in a previous process.
+ *
+ * For each driver, the cache records its number of platforms, and for each
+ * platform the driver entry points as offsets into the driver library, or -1
+ * for unsupported APIs. Records are keyed by the driver name as listed, and by
+ * the identity of the library that was loaded: its build-id, modification
+ * time, size and inode. A library that changes thus never matches its old
+ * record, which is replaced the next time the cache is written.
+ *
+ * The cache file is mapped read only, and lookups don't lock. New records are
+ * written to a temporary file that replaces the cache atomically, so processes
+ * sharing a cache never see a partially written one.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DISCOVERY_INTERNAL __attribute__((visibility("hidden")))
+
+#define DISCOVERY_MAX_PATH     256
+#define DISCOVERY_MAX_BUILD_ID 32
+
+/**
+ * Identity of a loaded library. Keys are zero initialized and compared as a
+ * whole.
+ */
+struct discovery_key_s {
+	char     path[DISCOVERY_MAX_PATH];
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint64_t size;
+	uint64_t inode;
+	uint32_t build_id_size;
+	uint8_t  build_id[DISCOVERY_MAX_BUILD_ID];
+};
+
+/**
+ * offsets holds num_platforms times the number of entries the cache was
+ * opened with.
+ */
+struct discovery_record_s {
+	uint64_t               size;
+	struct discovery_key_s key;
+	uint64_t               num_platforms;
+	int64_t                offsets[];
+};
+
+/**
+ * Map the cache file at path, for dispatch tables of num_entries entries. A
+ * missing, invalid or outdated cache file is treated as empty. Returns -1 if
+ * the cache can't be used at all.
+ */
+DISCOVERY_INTERNAL int
+discoveryInit(const char *path, size_t num_entries);
+
+/**
+ * Compute the key of the library symbol belongs to, loaded under the name
+ * path, and the base address offsets are relative to. Returns -1 if the
+ * library can't be identified, in which case it must not be cached.
+ */
+DISCOVERY_INTERNAL int
+discoveryKey(const char *path, const void *symbol, struct discovery_key_s *key, const void **base_ret);
+
+/**
+ * Offset of entry in the library mapped at base, or -1 if entry is not part
+ * of that library.
+ */
+DISCOVERY_INTERNAL int64_t
+discoveryOffset(const void *base, const void *entry);
+
+/**
+ * Find the record of a library. Returns NULL if the cache has no record for
+ * it.
+ */
+DISCOVERY_INTERNAL const struct discovery_record_s *
+discoveryLookup(const struct discovery_key_s *key);
+
+/**
+ * Add the record of a library, to be written by the next discoveryFlush.
+ * Thread safe.
+ */
+DISCOVERY_INTERNAL void
+discoveryRecord(const struct discovery_key_s *key, size_t num_platforms, const int64_t *offsets);
+
+/**
+ * Write the cache if records were added, keeping the records of the current
+ * cache that were not replaced.
+ */
+DISCOVERY_INTERNAL void
+discoveryFlush(void);
+
+/**
+ * Unmap the cache and release the pending records.
+ */
+DISCOVERY_INTERNAL void
+discoveryFini(void);
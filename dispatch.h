@@ -1,3 +1,5 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
 /**
  * Definition of the dispatch table used by the loader and global layers.
  * It gathers all the API entry points defined inn spec.h in a structure.
@@ -9,14 +11,56 @@ typedef int (*pfn_platformCreateDevice_t)(platform_t platform, device_t *device_
 typedef int (*pfn_deviceFunc1_t)(device_t device, int param);
 typedef int (*pfn_deviceFunc2_t)(device_t device, int param);
 typedef int (*pfn_deviceDestroy_t)(device_t device);
+typedef int (*pfn_platformGetFunc_t)(platform_t platform, const char *name, void **func_ret);
+typedef int (*pfn_deviceFunc1Batch_t)(device_t device, size_t num_params, const int *params, int *results);
+typedef int (*pfn_deviceFunc2Batch_t)(device_t device, size_t num_params, const int *params, int *results);
+typedef int (*pfn_platformCreateQueue_t)(platform_t platform, queue_t *queue_ret);
+typedef int (*pfn_deviceCreateQueue_t)(device_t device, queue_t *queue_ret);
+typedef int (*pfn_queueDestroy_t)(queue_t queue);
+typedef int (*pfn_eventQuery_t)(event_t event, int *complete_ret, int *result_ret);
+typedef int (*pfn_eventWait_t)(size_t num_events, const event_t *events);
+typedef int (*pfn_eventRelease_t)(event_t event);
+typedef int (*pfn_platformCreateDeviceEnqueue_t)(queue_t queue, device_t *device_ret, event_t *event_ret);
+typedef int (*pfn_deviceFunc1Enqueue_t)(queue_t queue, int param, event_t *event_ret);
+typedef int (*pfn_deviceFunc2Enqueue_t)(queue_t queue, int param, event_t *event_ret);
+typedef int (*pfn_deviceDestroyEnqueue_t)(queue_t queue, event_t *event_ret);
+typedef int (*pfn_deviceFunc1BatchEnqueue_t)(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret);
+typedef int (*pfn_deviceFunc2BatchEnqueue_t)(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret);
+typedef int (*pfn_platformCreateDevices_t)(platform_t platform, size_t num_devices, device_t *devices);
+typedef int (*pfn_devicesDestroy_t)(size_t num_devices, const device_t *devices);
+typedef int (*pfn_layerSetEnabled_t)(const char *layer_name, int enabled);
+typedef int (*pfn_platformRemoveLayer_t)(platform_t platform, const char *layer_name);
+typedef int (*pfn_addDriver_t)(const char *driver_name);
+typedef int (*pfn_deviceAddLayer_t)(device_t device, const char *layer_name);
 
 struct dispatch_s {
-	pfn_getPlatforms_t         getPlatforms;
-	pfn_platformAddLayer_t     platformAddLayer;
-	pfn_platformCreateDevice_t platformCreateDevice;
-	pfn_deviceFunc1_t          deviceFunc1;
-	pfn_deviceFunc2_t          deviceFunc2;
-	pfn_deviceDestroy_t        deviceDestroy;
+	pfn_getPlatforms_t                getPlatforms;
+	pfn_platformAddLayer_t            platformAddLayer;
+	pfn_platformCreateDevice_t        platformCreateDevice;
+	pfn_deviceFunc1_t                 deviceFunc1;
+	pfn_deviceFunc2_t                 deviceFunc2;
+	pfn_deviceDestroy_t               deviceDestroy;
+	pfn_platformGetFunc_t             platformGetFunc;
+	pfn_deviceFunc1Batch_t            deviceFunc1Batch;
+	pfn_deviceFunc2Batch_t            deviceFunc2Batch;
+	pfn_platformCreateQueue_t         platformCreateQueue;
+	pfn_deviceCreateQueue_t           deviceCreateQueue;
+	pfn_queueDestroy_t                queueDestroy;
+	pfn_eventQuery_t                  eventQuery;
+	pfn_eventWait_t                   eventWait;
+	pfn_eventRelease_t                eventRelease;
+	pfn_platformCreateDeviceEnqueue_t platformCreateDeviceEnqueue;
+	pfn_deviceFunc1Enqueue_t          deviceFunc1Enqueue;
+	pfn_deviceFunc2Enqueue_t          deviceFunc2Enqueue;
+	pfn_deviceDestroyEnqueue_t        deviceDestroyEnqueue;
+	pfn_deviceFunc1BatchEnqueue_t     deviceFunc1BatchEnqueue;
+	pfn_deviceFunc2BatchEnqueue_t     deviceFunc2BatchEnqueue;
+	pfn_platformCreateDevices_t       platformCreateDevices;
+	pfn_devicesDestroy_t              devicesDestroy;
+	pfn_layerSetEnabled_t             layerSetEnabled;
+	pfn_platformRemoveLayer_t         platformRemoveLayer;
+	pfn_addDriver_t                   addDriver;
+	pfn_deviceAddLayer_t              deviceAddLayer;
 };
 
 /**
@@ -24,8 +68,14 @@ struct dispatch_s {
  * Use by the loader to dispatch driver calls.
  */
 struct driver_dispatch_s {
-	pfn_platformCreateDevice_t platformCreateDevice;
-	pfn_deviceFunc1_t          deviceFunc1;
-	pfn_deviceFunc2_t          deviceFunc2;
-	pfn_deviceDestroy_t        deviceDestroy;
+	pfn_platformCreateDevice_t  platformCreateDevice;
+	pfn_deviceFunc1_t           deviceFunc1;
+	pfn_deviceFunc2_t           deviceFunc2;
+	pfn_deviceDestroy_t         deviceDestroy;
+	pfn_deviceFunc1Batch_t      deviceFunc1Batch;
+	pfn_deviceFunc2Batch_t      deviceFunc2Batch;
+	pfn_platformCreateDevices_t platformCreateDevices;
+	pfn_devicesDestroy_t        devicesDestroy;
 };
+
+#define NUM_DRIVER_DISPATCH_ENTRIES (sizeof(struct driver_dispatch_s)/sizeof(pfn_platformCreateDevice_t))
@@ -18,6 +18,12 @@ struct device_s {
 typedef struct platform_s * platform_t;
 typedef struct device_s * device_t;
 
+/**
+ * Loader objects, drivers only see them in the loader dispatch tables.
+ */
+typedef struct queue_s * queue_t;
+typedef struct event_s * event_t;
+
 /**
  * Query available platforms in this driver (see OpenCL clIcdGetPlatformIDsKHR).
  */
@@ -31,3 +37,20 @@ getPlatformsExt(size_t num_platforms, platform_t *platforms, size_t *num_platfor
  */
 void *
 platformGetFuncExt(platform_t platform, const char *name);
+
+/**
+ * Dispatch table of the driver implemented APIs, see dispatch.h.
+ */
+struct driver_dispatch_s;
+
+/**
+ * Optional bulk version of platformGetFuncExt, returning all the API entry
+ * points of a platform of this driver at once. The number of entries of the
+ * loader table is provided in num_entries: the driver must not write more
+ * entries than num_entries, and must write NULL for unsupported APIs. The
+ * number of entries the driver knows about is returned in num_entries_ret, so
+ * the loader can query entries added after the driver was built through
+ * platformGetFuncExt.
+ */
+int
+platformGetDispatchExt(platform_t platform, size_t num_entries, struct driver_dispatch_s *dispatch, size_t *num_entries_ret);
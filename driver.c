@@ -2,7 +2,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "driver-spec.h"
+#include "dispatch.h"
+#include "api.h"
+#include "spec_ext.h"
 
 /**
  * This file contain the implementation of the driver specification given in
@@ -10,6 +14,8 @@
  * DRIVER_NUMBER macro definition. only when DRIVER_NUMBER == 1 is the
  * deviceFunc2 supported.  This allows demonstrating the robustness of the
  * strategy toward unimplemented functions, which was problematic in OpenCL.
+ * Conversely, only when DRIVER_NUMBER == 2 is the deviceExtFunc extension
+ * (see spec_ext.h) supported.
  */
 
 #define SPEC_SUCCESS 0
@@ -19,13 +25,183 @@
 #define DRIVER_NUMBER 1
 #endif
 
+/**
+ * Drivers log every call by default. Building with DRIVER_VERBOSE=0 produces a
+ * silent driver, used when benchmarking the loader.
+ */
+#ifndef DRIVER_VERBOSE
+#define DRIVER_VERBOSE 1
+#endif
+
 #define DRIVER_LOG(format, ...) \
 do  { \
-	printf("DRIVER %d: " format "\n", DRIVER_NUMBER, __VA_ARGS__); \
+	if (DRIVER_VERBOSE) \
+		printf("DRIVER %d: " format "\n", DRIVER_NUMBER, __VA_ARGS__); \
 } while (0)
 
 static struct platform_s _platform;
 
+/**
+ * Devices are allocated from slabs of DEVICE_SLAB_SIZE devices, through a per
+ * thread cache, so that creating and destroying devices doesn't contend on
+ * malloc. Threads exchange free devices with a global pool by batches of
+ * DEVICE_CACHE_BATCH devices, and slabs are only freed when the driver is
+ * unloaded.
+ */
+#define DEVICE_SLAB_SIZE 256
+#define DEVICE_CACHE_BATCH 32
+
+union device_slot_u {
+	struct device_s      device;
+	union device_slot_u *next;
+};
+
+struct device_slab_s;
+struct device_slab_s {
+	struct device_slab_s *next;
+	union device_slot_u   slots[DEVICE_SLAB_SIZE];
+};
+
+struct device_cache_s {
+	union device_slot_u *first;
+	size_t               num_free;
+	int                  registered;
+};
+
+static __thread struct device_cache_s _device_cache;
+static union device_slot_u  *_device_pool = NULL;
+static size_t                _device_pool_size = 0;
+static struct device_slab_s *_device_slabs = NULL;
+static pthread_mutex_t       _device_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t         _device_cache_key;
+static pthread_once_t        _device_cache_once = PTHREAD_ONCE_INIT;
+static int                   _device_cache_key_created = 0;
+
+/**
+ * Move num devices from the front of a list to the front of another.
+ */
+static void
+deviceSlotsMove(union device_slot_u **from, union device_slot_u **to, size_t num) {
+	while (num--) {
+		union device_slot_u *slot = *from;
+		*from = slot->next;
+		slot->next = *to;
+		*to = slot;
+	}
+}
+
+/**
+ * Threads give their cached devices back to the pool when they exit.
+ */
+static void
+deviceCacheFlush(void *arg) {
+	struct device_cache_s *cache = (struct device_cache_s *)arg;
+	pthread_mutex_lock(&_device_mutex);
+	_device_pool_size += cache->num_free;
+	deviceSlotsMove(&cache->first, &_device_pool, cache->num_free);
+	pthread_mutex_unlock(&_device_mutex);
+	cache->num_free = 0;
+	cache->registered = 0;
+}
+
+static void
+deviceCacheInit(void) {
+	_device_cache_key_created = !pthread_key_create(&_device_cache_key, &deviceCacheFlush);
+}
+
+/**
+ * Register the cache of the calling thread the first time it is used, so
+ * that it is flushed when the thread exits, whether the thread allocates or
+ * only frees devices. A cache used again by a thread destructor after it was
+ * flushed registers again.
+ */
+static void
+deviceCacheRegister(struct device_cache_s *cache) {
+	if (cache->registered)
+		return;
+	pthread_once(&_device_cache_once, &deviceCacheInit);
+	if (_device_cache_key_created)
+		pthread_setspecific(_device_cache_key, cache);
+	cache->registered = 1;
+}
+
+/**
+ * Refill the cache of the calling thread, from the pool or with a new slab.
+ */
+static int
+deviceCacheRefill(struct device_cache_s *cache) {
+	deviceCacheRegister(cache);
+	pthread_mutex_lock(&_device_mutex);
+	if (_device_pool_size) {
+		size_t num = _device_pool_size < DEVICE_CACHE_BATCH ?
+			_device_pool_size : DEVICE_CACHE_BATCH;
+		deviceSlotsMove(&_device_pool, &cache->first, num);
+		_device_pool_size -= num;
+		cache->num_free += num;
+		pthread_mutex_unlock(&_device_mutex);
+		return SPEC_SUCCESS;
+	}
+	pthread_mutex_unlock(&_device_mutex);
+	struct device_slab_s *slab =
+		(struct device_slab_s *)malloc(sizeof(struct device_slab_s));
+	if (!slab)
+		return SPEC_ERROR;
+	for (size_t i = 0; i < DEVICE_SLAB_SIZE; i++) {
+		slab->slots[i].next = cache->first;
+		cache->first = &slab->slots[i];
+	}
+	cache->num_free += DEVICE_SLAB_SIZE;
+	pthread_mutex_lock(&_device_mutex);
+	slab->next = _device_slabs;
+	_device_slabs = slab;
+	pthread_mutex_unlock(&_device_mutex);
+	return SPEC_SUCCESS;
+}
+
+static struct device_s *
+deviceAlloc(void) {
+	struct device_cache_s *cache = &_device_cache;
+	if (!cache->num_free && deviceCacheRefill(cache))
+		return NULL;
+	union device_slot_u *slot = cache->first;
+	cache->first = slot->next;
+	cache->num_free--;
+	memset(&slot->device, 0, sizeof(struct device_s));
+	return &slot->device;
+}
+
+static void
+deviceFree(struct device_s *device) {
+	struct device_cache_s *cache = &_device_cache;
+	union device_slot_u *slot = (union device_slot_u *)device;
+	deviceCacheRegister(cache);
+	slot->next = cache->first;
+	cache->first = slot;
+	if (++cache->num_free < 2 * DEVICE_CACHE_BATCH)
+		return;
+	pthread_mutex_lock(&_device_mutex);
+	deviceSlotsMove(&cache->first, &_device_pool, DEVICE_CACHE_BATCH);
+	_device_pool_size += DEVICE_CACHE_BATCH;
+	pthread_mutex_unlock(&_device_mutex);
+	cache->num_free -= DEVICE_CACHE_BATCH;
+}
+
+/**
+ * The key is deleted so that threads exiting after the driver is unloaded
+ * don't call deviceCacheFlush.
+ */
+__attribute__((destructor))
+static void
+driverFini(void) {
+	if (_device_cache_key_created)
+		pthread_key_delete(_device_cache_key);
+	while (_device_slabs) {
+		struct device_slab_s *next = _device_slabs->next;
+		free(_device_slabs);
+		_device_slabs = next;
+	}
+}
+
 /**
  * Query available platforms in this driver (see OpenCL
  * clIcdGetPlatformIDsKHR).  These drivers only implement a single platform.
@@ -58,11 +234,38 @@ platformCreateDevice(platform_t platform, device_t *device_ret) {
 		return SPEC_ERROR;
 	if (!device_ret)
 		return SPEC_ERROR;
-	*device_ret = (struct device_s *)calloc(1, sizeof(struct device_s));
+	*device_ret = deviceAlloc();
+	if (!*device_ret)
+		return SPEC_ERROR;
 	DRIVER_LOG("allocated device %p", (void *)*device_ret);
 	return SPEC_SUCCESS;
 }
 
+/**
+ * Bulk creation either creates every device, or none, in which case every
+ * entry of devices is NULL.
+ */
+static int
+platformCreateDevices(platform_t platform, size_t num_devices, device_t *devices) {
+	DRIVER_LOG("entering platformCreateDevices(platform = %p, num_devices = %zu, devices = %p)",
+		(void *)platform, num_devices, (void *)devices);
+	if (platform != &_platform)
+		return SPEC_ERROR;
+	if (num_devices && !devices)
+		return SPEC_ERROR;
+	for (size_t i = 0; i < num_devices; i++) {
+		devices[i] = deviceAlloc();
+		if (!devices[i]) {
+			while (i--)
+				deviceFree(devices[i]);
+			memset(devices, 0, num_devices * sizeof(device_t));
+			return SPEC_ERROR;
+		}
+		DRIVER_LOG("allocated device %p", (void *)devices[i]);
+	}
+	return SPEC_SUCCESS;
+}
+
 static int
 deviceFunc1(device_t device, int param) {
 	DRIVER_LOG("entering deviceFunc1(device = %p, param %d)", (void *)device, param);
@@ -70,6 +273,21 @@ deviceFunc1(device_t device, int param) {
 }
 
 
+/**
+ * deviceFunc1 is also supported in batches, while deviceFunc2 batches are
+ * fanned out by the loader.
+ */
+static int
+deviceFunc1Batch(device_t device, size_t num_params, const int *params, int *results) {
+	DRIVER_LOG("entering deviceFunc1Batch(device = %p, num_params = %zu, params = %p, results = %p)",
+		(void *)device, num_params, (void *)params, (void *)results);
+	if (num_params && (!params || !results))
+		return SPEC_ERROR;
+	for (size_t i = 0; i < num_params; i++)
+		results[i] = SPEC_SUCCESS;
+	return SPEC_SUCCESS;
+}
+
 #if DRIVER_NUMBER == 1
 static int
 deviceFunc2(device_t device, int param) {
@@ -78,19 +296,55 @@ deviceFunc2(device_t device, int param) {
 }
 #endif
 
+#if DRIVER_NUMBER == 2
+static int
+deviceExtFunc(device_t device, int param) {
+	DRIVER_LOG("entering deviceExtFunc(device = %p, param %d)", (void *)device, param);
+	return SPEC_SUCCESS;
+}
+#endif
+
 static int
 deviceDestroy(device_t device) {
 	DRIVER_LOG("entering deviceDestroy(device = %p)", (void *)device);
-	free((void *)device);
+	deviceFree(device);
 	return SPEC_SUCCESS;
 }
 
+static int
+devicesDestroy(size_t num_devices, const device_t *devices) {
+	DRIVER_LOG("entering devicesDestroy(num_devices = %zu, devices = %p)",
+		num_devices, (void *)devices);
+	if (num_devices && !devices)
+		return SPEC_ERROR;
+	for (size_t i = 0; i < num_devices; i++)
+		deviceFree(devices[i]);
+	return SPEC_SUCCESS;
+}
+
+
+/**
+ * Dispatch table of the driver, unsupported APIs are NULL.
+ */
+static const struct driver_dispatch_s _dispatch = {
+	.platformCreateDevice  = &platformCreateDevice,
+	.deviceFunc1           = &deviceFunc1,
+#if DRIVER_NUMBER == 1
+	.deviceFunc2           = &deviceFunc2,
+#endif
+	.deviceDestroy         = &deviceDestroy,
+	.deviceFunc1Batch      = &deviceFunc1Batch,
+	.platformCreateDevices = &platformCreateDevices,
+	.devicesDestroy        = &devicesDestroy
+};
 
 /**
  * Simple method query similar API to clGetExtensionFunctionAddressForPlatform.
  * a signature of:
  * int platformGetFuncExt(platform_t platform, const char *name, void **func_ret)
- * could also be used here.
+ * could also be used here. Names are looked up in the API perfect hash table
+ * of api.h, giving the slot of the entry point in the driver dispatch table.
+ * Names that are not part of the API are extensions.
  */
 void *
 platformGetFuncExt(platform_t platform, const char *name) {
@@ -100,15 +354,34 @@ platformGetFuncExt(platform_t platform, const char *name) {
 		return NULL;
 	if (!name)
 		return NULL;
-	if (!strcmp(name, "platformCreateDevice"))
-		return (void *)(intptr_t)&platformCreateDevice;
-	if (!strcmp(name, "deviceFunc1"))
-		return (void *)(intptr_t)&deviceFunc1;
-#if DRIVER_NUMBER == 1
-	if (!strcmp(name, "deviceFunc2"))
-		return (void *)(intptr_t)&deviceFunc2;
+	const struct api_entry_s *entry = apiLookup(name);
+	if (!entry) {
+#if DRIVER_NUMBER == 2
+		if (!strcmp(name, DEVICE_EXT_FUNC_NAME))
+			return (void *)(intptr_t)&deviceExtFunc;
 #endif
-	if (!strcmp(name, "deviceDestroy"))
-		return (void *)(intptr_t)&deviceDestroy;
-	return NULL;
+		return NULL;
+	}
+	if (entry->driver_slot < 0)
+		return NULL;
+	return (void *)(intptr_t)((pfn_platformCreateDevice_t *)&_dispatch)[entry->driver_slot];
+}
+
+/**
+ * Bulk method query, filling the loader dispatch table in a single call.
+ */
+int
+platformGetDispatchExt(platform_t platform, size_t num_entries, struct driver_dispatch_s *dispatch, size_t *num_entries_ret) {
+	DRIVER_LOG("entering platformGetDispatchExt(platform = %p, num_entries = %zu, dispatch = %p, num_entries_ret = %p)",
+		(void *)platform, num_entries, (void *)dispatch, (void *)num_entries_ret);
+	if (platform != &_platform)
+		return SPEC_ERROR;
+	if (num_entries_ret)
+		*num_entries_ret = NUM_DRIVER_DISPATCH_ENTRIES;
+	if (num_entries && dispatch) {
+		if (num_entries > NUM_DRIVER_DISPATCH_ENTRIES)
+			num_entries = NUM_DRIVER_DISPATCH_ENTRIES;
+		memcpy(dispatch, &_dispatch, num_entries * sizeof(pfn_deviceFunc1_t));
+	}
+	return SPEC_SUCCESS;
 }
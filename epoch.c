@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/membarrier.h>
+#endif
+#include "epoch.h"
+
+/**
+ * Implementation of the writer side of epoch.h, and of the reader records
+ * management.
+ */
+
+__thread struct epoch_reader_s *_epoch_reader = NULL;
+uint64_t _epoch = 1;
+int      _epoch_reader_fence = 1;
+
+/**
+ * Deferred callback list element. The list is a lock-free stack, so callbacks
+ * can be deferred from read side critical sections while a writer holding the
+ * epoch mutex waits for the grace period.
+ */
+struct epoch_deferred_s;
+struct epoch_deferred_s {
+	epochCallback_t         *callback;
+	void                    *arg;
+	uint64_t                 epoch;
+	struct epoch_deferred_s *next;
+};
+
+static struct epoch_reader_s   *_first_reader = NULL;
+static struct epoch_deferred_s *_first_deferred = NULL;
+static pthread_mutex_t          _epoch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t            _epoch_key;
+static int                      _epoch_key_created = 0;
+static pthread_once_t           _epoch_initialized = PTHREAD_ONCE_INIT;
+
+/**
+ * Reader records are never freed while the loader is loaded, they are reused
+ * by new threads once their thread exits.
+ */
+static void
+epochThreadExit(void *arg) {
+	struct epoch_reader_s *reader = (struct epoch_reader_s *)arg;
+	reader->nesting = 0;
+	__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&reader->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+epochInit(void) {
+	_epoch_key_created = !pthread_key_create(&_epoch_key, &epochThreadExit);
+#if defined(__linux__) && defined(__NR_membarrier)
+	long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+	if (cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+	    !syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0))
+		__atomic_store_n(&_epoch_reader_fence, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+struct epoch_reader_s *
+epochRegister(void) {
+	pthread_once(&_epoch_initialized, &epochInit);
+	struct epoch_reader_s *reader;
+	for (reader = __atomic_load_n(&_first_reader, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&reader->in_use, &unused, 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			goto found;
+	}
+	reader = (struct epoch_reader_s *)calloc(1, sizeof(struct epoch_reader_s));
+	if (!reader) {
+		fprintf(stderr, "loader: could not allocate thread epoch record\n");
+		abort();
+	}
+	reader->in_use = 1;
+	reader->next = __atomic_load_n(&_first_reader, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_first_reader, &reader->next, reader, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+found:
+	if (_epoch_key_created)
+		pthread_setspecific(_epoch_key, reader);
+	_epoch_reader = reader;
+	return reader;
+}
+
+/**
+ * Push the list of deferred callbacks from first to last.
+ */
+static void
+epochPush(struct epoch_deferred_s *first, struct epoch_deferred_s *last) {
+	last->next = __atomic_load_n(&_first_deferred, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_first_deferred, &last->next, first, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+void
+epochDefer(epochCallback_t *callback, void *arg) {
+	struct epoch_deferred_s *deferred =
+		(struct epoch_deferred_s *)malloc(sizeof(struct epoch_deferred_s));
+	if (!deferred) {
+		/* wait for a grace period here instead, or leak if we can't */
+		if (_epoch_reader && _epoch_reader->nesting)
+			return;
+		epochSynchronize();
+		callback(arg);
+		return;
+	}
+	deferred->callback = callback;
+	deferred->arg = arg;
+	deferred->epoch = __atomic_load_n(&_epoch, __ATOMIC_SEQ_CST);
+	epochPush(deferred, deferred);
+}
+
+/**
+ * Order the memory accesses of all the threads of the process. Readers only
+ * issue compiler barriers when membarrier is available.
+ */
+static inline void
+epochBarrier(void) {
+#if defined(__linux__) && defined(__NR_membarrier)
+	if (!__atomic_load_n(&_epoch_reader_fence, __ATOMIC_ACQUIRE) &&
+	    !syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0))
+		return;
+#endif
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+epochSynchronize(void) {
+	struct epoch_deferred_s *due = NULL;
+	pthread_once(&_epoch_initialized, &epochInit);
+	pthread_mutex_lock(&_epoch_mutex);
+	uint64_t target = __atomic_add_fetch(&_epoch, 1, __ATOMIC_SEQ_CST);
+	epochBarrier();
+	if (_epoch_reader && _epoch_reader->nesting) {
+		pthread_mutex_unlock(&_epoch_mutex);
+		return;
+	}
+	for (struct epoch_reader_s *reader = __atomic_load_n(&_first_reader, __ATOMIC_ACQUIRE);
+			reader; reader = reader->next) {
+		uint64_t epoch;
+		while ((epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE)) &&
+		       epoch < target)
+			sched_yield();
+	}
+	struct epoch_deferred_s *deferred =
+		__atomic_exchange_n(&_first_deferred, NULL, __ATOMIC_ACQUIRE);
+	struct epoch_deferred_s *kept = NULL, *last_kept = NULL;
+	while (deferred) {
+		struct epoch_deferred_s *next = deferred->next;
+		if (deferred->epoch < target) {
+			deferred->next = due;
+			due = deferred;
+		} else {
+			deferred->next = kept;
+			if (!kept)
+				last_kept = deferred;
+			kept = deferred;
+		}
+		deferred = next;
+	}
+	if (kept)
+		epochPush(kept, last_kept);
+	pthread_mutex_unlock(&_epoch_mutex);
+	/* callbacks may call back into the loader */
+	while (due) {
+		struct epoch_deferred_s *next = due->next;
+		due->callback(due->arg);
+		free(due);
+		due = next;
+	}
+}
+
+void
+epochFini(void) {
+	struct epoch_deferred_s *deferred =
+		__atomic_exchange_n(&_first_deferred, NULL, __ATOMIC_ACQUIRE);
+	while (deferred) {
+		struct epoch_deferred_s *next = deferred->next;
+		deferred->callback(deferred->arg);
+		free(deferred);
+		deferred = next;
+	}
+	/* thread exit destructors can't outlive the loader */
+	if (_epoch_key_created)
+		pthread_key_delete(_epoch_key);
+	_epoch_key_created = 0;
+	struct epoch_reader_s *reader = _first_reader;
+	while (reader) {
+		struct epoch_reader_s *next = reader->next;
+		free(reader);
+		reader = next;
+	}
+	_first_reader = NULL;
+	_epoch_reader = NULL;
+}
@@ -0,0 +1,99 @@
+/**
+ * Epoch based reclamation, used by the loader to update the structures API
+ * calls go through (layer chains, platform lists...) while other threads are
+ * calling through them.
+ *
+ * Readers never lock: when entering the loader, a thread publishes in its own
+ * record the global epoch it observed, and clears it when leaving. Writers
+ * serialize among themselves, publish a new version of a structure with a
+ * single atomic store, and hand the old version to epochDefer. Once every
+ * reader that could have observed the old version has left the loader (a
+ * grace period), epochSynchronize reclaims it.
+ *
+ * On Linux, writers use the membarrier system call to order the readers
+ * memory accesses, so readers only pay for a few thread local loads and
+ * stores. When membarrier is not available, readers issue a full fence.
+ */
+
+#include <stdint.h>
+
+#define EPOCH_INTERNAL __attribute__((visibility("hidden")))
+
+/**
+ * Per thread reader record. epoch is 0 when the thread is not in a read side
+ * critical section, and the global epoch observed when entering it otherwise.
+ * Read side critical sections can be nested, for instance when a layer calls
+ * back into the loader.
+ */
+struct epoch_reader_s {
+	uint64_t               epoch;
+	uint64_t               nesting;
+	struct epoch_reader_s *next;
+	int                    in_use;
+};
+
+typedef void epochCallback_t(void *arg);
+
+extern __thread struct epoch_reader_s *_epoch_reader
+	__attribute__((tls_model("initial-exec"))) EPOCH_INTERNAL;
+extern uint64_t _epoch EPOCH_INTERNAL;
+extern int      _epoch_reader_fence EPOCH_INTERNAL;
+
+/**
+ * Allocate (or reuse) the reader record of the calling thread.
+ */
+EPOCH_INTERNAL struct epoch_reader_s *
+epochRegister(void);
+
+/**
+ * Enter a read side critical section. Structures obtained inside the critical
+ * section remain valid until the matching epochExit.
+ */
+static inline void
+epochEnter(void) {
+	struct epoch_reader_s *reader = _epoch_reader;
+	if (__builtin_expect(!reader, 0))
+		reader = epochRegister();
+	if (!reader->nesting++) {
+		__atomic_store_n(&reader->epoch,
+			__atomic_load_n(&_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+		if (__builtin_expect(_epoch_reader_fence, 0))
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		else
+			__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	}
+}
+
+/**
+ * Leave a read side critical section.
+ */
+static inline void
+epochExit(void) {
+	struct epoch_reader_s *reader = _epoch_reader;
+	if (!--reader->nesting)
+		__atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Defer a call to callback(arg) until every reader that could have observed a
+ * structure unpublished before this call has left its critical section. Can be
+ * called from a read side critical section.
+ */
+EPOCH_INTERNAL void
+epochDefer(epochCallback_t *callback, void *arg);
+
+/**
+ * Wait for a grace period, then run the deferred callbacks that are due. When
+ * called from inside a read side critical section (a layer calling back into
+ * the loader), waiting would deadlock, so the callbacks are left for a later
+ * call.
+ */
+EPOCH_INTERNAL void
+epochSynchronize(void);
+
+/**
+ * Run all the deferred callbacks and release the reader records. Only called
+ * when the loader is unloaded.
+ */
+EPOCH_INTERNAL void
+epochFini(void);
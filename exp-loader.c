@@ -1,4 +1,6 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <string.h>
 #include <dlfcn.h>
@@ -7,197 +9,555 @@
 #include "spec.h"
 #include "dispatch.h"
 #include "layer.h"
+#include "api.h"
+#include "epoch.h"
+#include "queue.h"
+#include "registry.h"
+#include "profile.h"
+#include "arena.h"
+#include "discovery.h"
+
+/**
+ * Baked loaders are statically linked with a fixed configuration of drivers
+ * and global layers, see bake.py.
+ */
+#ifndef BAKED_LOADER
+#define BAKED_LOADER 0
+#endif
+#if BAKED_LOADER
+#include "baked.h"
+#endif
+
+/**
+ * Per API functions and tables are expanded from the API lists of api.h.
+ */
+#define EXPAND(...) __VA_ARGS__
 
 /**
  * Terminators for the global layer chain, responsible for calling into the
  * instance layer chain.
  */
-static int
-getPlatforms_disp(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret);
-static int
-platformAddLayer_disp(platform_t platform, const char *layer_name);
-static int
-platformCreateDevice_disp(platform_t platform, device_t *device_ret);
-static int
-deviceFunc1_disp(device_t device, int param);
-static int
-deviceFunc2_disp(device_t device, int param);
-static int
-deviceDestroy_disp(device_t device);
+#define DECLARE_LOADER_DISP(api, params, args) \
+static int \
+api ## _disp params;
+API_LOADER(DECLARE_LOADER_DISP)
+
+#define DECLARE_DISP(api, handle, params, args) \
+static int \
+api ## _disp params;
+API_DRIVER(DECLARE_DISP)
 
 /**
  * Stub functions for unimplemented APIs.
  */
-static int
-platformCreateDevice_unsup(platform_t platform, device_t *device_ret);
-static int
-deviceFunc1_unsup(device_t device, int param);
-static int
-deviceFunc2_unsup(device_t device, int param);
-static int
-deviceDestroy_unsup(device_t device);
+#define DECLARE_UNSUP(api, handle, params, args) \
+static int \
+api ## _unsup params;
+API_DRIVER_SINGLE(DECLARE_UNSUP)
+
+/**
+ * Batch and bulk APIs drivers don't implement are fanned out to the API they
+ * batch.
+ */
+#define DECLARE_FANOUT(api, single, handle, params, args, num, elems, results) \
+static int \
+api ## _fanout params;
+API_DRIVER_BATCH(DECLARE_FANOUT)
+
+#define DECLARE_BULK_FANOUT(api, single, handle, params, args, num, handles) \
+static int \
+api ## _fanout params;
+API_DRIVER_CREATE_BULK(DECLARE_BULK_FANOUT)
+API_DRIVER_BULK(DECLARE_BULK_FANOUT)
+
+#if BAKED_LOADER
+/**
+ * Terminators of the baked global layer chain, and entries baked drivers
+ * call for the APIs they don't implement.
+ */
+#define DECLARE_BAKED_LOADER(api, params, args) \
+BAKED_INTERNAL int \
+baked_loader_ ## api params;
+API_LOADER(DECLARE_BAKED_LOADER)
+
+#define DECLARE_BAKED(api, handle, params, args) \
+BAKED_INTERNAL int \
+baked_loader_ ## api params; \
+BAKED_INTERNAL int \
+baked_fallback_ ## api params;
+API_DRIVER(DECLARE_BAKED)
+#endif
 
 /**
  * A dispatch table to initialize platform dispatch table with.
- * NULL entries are loader only APIs and should never be called.
  */
+#define UNSUP_ENTRY(api, handle, params, args) .api = &api ## _unsup,
+#define FANOUT_ENTRY(api, single, handle, params, args, num, elems, results) \
+	.api = &api ## _fanout,
+#define BULK_FANOUT_ENTRY(api, single, handle, params, args, num, handles) \
+	.api = &api ## _fanout,
 static struct driver_dispatch_s _unsup_dispatch = {
-	&platformCreateDevice_unsup,
-	&deviceFunc1_unsup,
-	&deviceFunc2_unsup,
-	&deviceDestroy_unsup
+	API_DRIVER_SINGLE(UNSUP_ENTRY)
+	API_DRIVER_BATCH(FANOUT_ENTRY)
+	API_DRIVER_CREATE_BULK(BULK_FANOUT_ENTRY)
+	API_DRIVER_BULK(BULK_FANOUT_ENTRY)
+};
+
+/**
+ * Resolver stubs for lazily resolved driver entry points. On first call, the
+ * stub queries the driver for the entry point, patches it into the dispatch
+ * tables, then forwards the call.
+ */
+#define DECLARE_LAZY(api, handle, params, args) \
+static int \
+api ## _lazy params;
+API_DRIVER(DECLARE_LAZY)
+
+/**
+ * A dispatch table to initialize platform dispatch table with when driver
+ * entry points are lazily resolved.
+ */
+#define LAZY_ENTRY(api, handle, params, args) .api = &api ## _lazy,
+static struct driver_dispatch_s _lazy_dispatch = {
+	API_DRIVER(LAZY_ENTRY)
 };
 
 /**
- * Global layer linked list element.
+ * Global layer linked list element. The structures API calls go through are
+ * cache line aligned, and allocated from arenas (see arena.h), with the
+ * fields used by API calls first, and the fields only used when the layers
+ * are loaded, unloaded or profiled last.
  */
 struct layer_s;
 struct layer_s {
-	// dispatch table of the layer
+	// dispatch table of the layer, as seen by the previous layer
 	struct dispatch_s  dispatch;
 	// next layer in the chain
 	struct layer_s    *next;
 	void              *library;
 	pfn_layerDeinit_t  layerDeinit;
-};
+	char              *path;
+	// entries provided by the layer, NULL for APIs it doesn't intercept
+	struct dispatch_s  intercepts;
+	int                enabled;
+} CACHE_ALIGNED;
 
 /**
- * Instance layer linked list element.
+ * Instance layer linked list element. For non FFI instance layers, the first
+ * fields map to instance_layer_proxy_s.
  */
 struct instance_layer_s;
 struct instance_layer_s {
-	struct instance_dispatch_s dispatch;
+	struct instance_dispatch_s   dispatch;
 #if !FFI_INSTANCE_LAYERS
-	struct layer_dispatch_s    layer_dispatch;
+	struct layer_dispatch_s      layer_dispatch;
 #endif
-	void                      *data;
-	struct instance_layer_s   *next;
-	void                      *library;
-	pfn_layerInstanceDeinit_t  layerInstanceDeinit;
-};
+	void                        *data;
+	struct instance_layer_s     *next;
+	void                        *library;
+	pfn_layerInstanceDeinit_t    layerInstanceDeinit;
+	// optional
+	pfn_layerInstanceWrapFunc_t  layerInstanceWrapFunc;
+	char                        *path;
+#if !FFI_INSTANCE_LAYERS
+	// next layers, when profiling replaces layer_dispatch by shims
+	struct layer_dispatch_s      profile_next;
+#endif
+	// batch APIs the layer requires to be fanned out
+	unsigned char                fanout[NUM_DRIVER_DISPATCH_ENTRIES];
+	// set once the layer wrapped an extension function
+	int                          wrapped;
+	// next removed layer of the multiplexing structure
+	struct instance_layer_s     *next_removed;
+#if !FFI_INSTANCE_LAYERS
+	// interception filters, NULL if the layer has none
+	struct filter_table_s       *filters;
+#endif
+} CACHE_ALIGNED;
 
+#if FFI_INSTANCE_LAYERS
 /**
- * Terminators for driver provided API entry points.  These will effectively
- * dispatch to the correct driver after the instance layer chain.
+ * The terminator for ffi instance layers. Each multiplexing structure embeds
+ * its own, whose dispatch table is the resolved dispatch table of the
+ * multiplexing structure, so the last instance layer calls directly into the
+ * global layer chain or the driver.
  */
-static inline int platformCreateDevice_term(platform_t platform, device_t *device_ret);
-static inline int deviceFunc1_term(device_t device, int param);
-static inline int deviceFunc2_term(device_t device, int param);
-static inline int deviceDestroy_term(device_t device);
-
-#if FFI_INSTANCE_LAYERS
-/* The terminator for ffi instance layer */
 static struct instance_layer_s _instance_layer_terminator = {
-	{
-		&platformCreateDevice_term,
-		&deviceFunc1_term,
-		&deviceFunc2_term,
-		&deviceDestroy_term
-	},
+	{ NULL },
+	NULL,
+	NULL,
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	{ 0 },
+	0,
 	NULL
 };
 #else
-static int platformCreateDevice_inst(struct instance_layer_s *layer, platform_t platform, device_t *device_ret);
-static int deviceFunc1_inst(struct instance_layer_s *layer, device_t device, int param);
-static int deviceFunc2_inst(struct instance_layer_s *layer, device_t device, int param);
-static int deviceDestroy_inst(struct instance_layer_s *layer, device_t device);
+#define DECLARE_INST(api, handle, params, args) \
+static int api ## _inst(struct instance_layer_s *layer, EXPAND params);
+API_DRIVER(DECLARE_INST)
 
-/* The terminator for non FFI instance layer */
+/**
+ * The terminator for non FFI instance layers. Each multiplexing structure
+ * embeds its own, whose data points to the resolved dispatch table of the
+ * multiplexing structure.
+ */
+#define INST_ENTRY(api, handle, params, args) \
+	.api ## _instance = (pfn_ ## api ## _instance_t)&api ## _inst,
 static struct instance_layer_s _instance_layer_terminator = {
 	{
-		(pfn_platformCreateDevice_instance_t)&platformCreateDevice_inst,
-		(pfn_deviceFunc1_instance_t)&deviceFunc1_inst,
-		(pfn_deviceFunc2_instance_t)&deviceFunc2_inst,
-		(pfn_deviceDestroy_instance_t)&deviceDestroy_inst
+		API_DRIVER(INST_ENTRY)
 	},
-	{ NULL, NULL, NULL, NULL },
+	{ NULL },
+	NULL,
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
+	{ NULL },
+	{ 0 },
+	0,
+	NULL,
 	NULL
 };
 
-/* The initializer for the layer dispatch */
-static struct layer_dispatch_s _instance_layer_dispatch_head = {
-	(struct instance_layer_proxy_s *)&_instance_layer_terminator,
-	(struct instance_layer_proxy_s *)&_instance_layer_terminator,
-	(struct instance_layer_proxy_s *)&_instance_layer_terminator,
-	(struct instance_layer_proxy_s *)&_instance_layer_terminator
+/**
+ * Interception filters of a non FFI instance layer, see layerInstanceFilters
+ * in layer.h. The entries of the filtered APIs in the layer dispatch table
+ * are replaced by the _filter shims, and kept in filtered. Handle sets are
+ * stored after the table, and the sampling counters, the only fields API
+ * calls write, on their own cache line.
+ */
+struct filter_s {
+	enum layer_filter_kind_e   kind;
+	unsigned int               period;
+	int                        min;
+	int                        max;
+	size_t                     num_handles;
+	const void * const        *handles;
+};
+
+struct filter_table_s {
+	size_t                      size;
+	struct instance_dispatch_s  filtered;
+	struct filter_s             filters[NUM_DRIVER_DISPATCH_ENTRIES];
+	unsigned int                counts[NUM_DRIVER_DISPATCH_ENTRIES] CACHE_ALIGNED;
+	const void                 *handles[];
+};
+
+#define DECLARE_FILTER(api, handle, params, args, value, has_value) \
+static int api ## _filter(struct instance_layer_s *layer, EXPAND params);
+API_DRIVER_FILTER(DECLARE_FILTER)
+
+#define FILTER_ENTRY(api, handle, params, args, value, has_value) \
+	.api ## _instance = (pfn_ ## api ## _instance_t)&api ## _filter,
+static struct instance_dispatch_s _filter_dispatch = {
+	API_DRIVER_FILTER(FILTER_ENTRY)
+};
+
+/**
+ * Set for the APIs range filters apply to.
+ */
+#define FILTER_VALUE_ENTRY(api, handle, params, args, value, has_value) \
+	[offsetof(struct instance_dispatch_s, api ## _instance) / sizeof(void *)] = has_value,
+static const unsigned char _filter_values[NUM_DRIVER_DISPATCH_ENTRIES] = {
+	API_DRIVER_FILTER(FILTER_VALUE_ENTRY)
 };
 #endif
 
+/**
+ * An instance layer chain, containing a pointer to the start of the chain and,
+ * for non FFI instance layers, the first layer dispatch indirection table.
+ * Chains are never modified once published: attaching a layer publishes a new
+ * chain, and the previous one is reclaimed after a grace period (see
+ * epoch.h), so API calls can go through the chains without locking. The
+ * generation of a chain is incremented each time a new chain is published, and
+ * identifies the chain extension functions were wrapped by. fanout is set for
+ * the batch APIs that must be fanned out by the entry point, as a layer of the
+ * chain intercepts the batched API but not the batch.
+ */
+struct chain_s {
+#if !FFI_INSTANCE_LAYERS
+	struct layer_dispatch_s   layer_dispatch;
+#endif
+	struct instance_layer_s  *first_layer;
+	unsigned char             fanout[NUM_DRIVER_DISPATCH_ENTRIES];
+	uint64_t                  generation;
+} CACHE_ALIGNED;
+
 /**
  * Every opaque handle from the API will be set to point to the multiplex_s
  * structure. This structure will contain the object dispatch table, as well as
- * a pointer to the start of the instance layer chain.
- * For non FFI instance layers, it will also contain the first layer dispatch
- * indirection table.
+ * the current instance layer chain.
+ * The resolved dispatch table contains, for each API, the target of the
+ * instance layer chain: the head of the global layer chain if a global layer
+ * intercepts the API, or directly the driver entry point. When no instance
+ * layer intercepts an API, entry points call the resolved target directly.
+ * Extension functions queried by the application are cached in ext_table,
+ * see getExtensionFunc. Instance layers removed from the chain are kept in
+ * the removed list until the loader is unloaded, see removeInstanceLayer.
+ * The chain and the resolved dispatch table, that every API call reads, come
+ * first.
+ * Devices with their own instance layers get their own multiplexing
+ * structure, whose parent is the platform's, see deviceAddLayer_disp. The
+ * platform's structure lists them, so they are updated along with it, and
+ * their chains follow the changes of the platform chain, see
+ * updateDeviceChains.
+ * The first word points to the platform's structure for both, so that
+ * layers can identify the platform of any handle, see histogram_layer.c.
  */
+struct ext_table_s;
+struct multiplex_s;
 struct multiplex_s {
+	struct multiplex_s       *platform;
+	struct chain_s           *chain;
+	struct driver_dispatch_s  resolved;
 	struct driver_dispatch_s  dispatch;
-	struct instance_layer_s  *first_layer;
-#if !FFI_INSTANCE_LAYERS
-	struct layer_dispatch_s   layer_dispatch;
+	struct instance_layer_s   terminator;
+	struct ext_table_s       *ext_table;
+	size_t                    num_ext_funcs;
+	struct instance_layer_s  *removed;
+	// platform multiplexing structure of a device one, NULL otherwise
+	struct multiplex_s       *parent;
+	// first platform layer of a device chain, below the device layers
+	struct instance_layer_s  *parent_layer;
+#if FFI_INSTANCE_LAYERS
+	// entries of the platform chain the bottom device layer calls into
+	struct instance_dispatch_s platform_dispatch;
 #endif
-};
+	struct multiplex_s       *devices;
+	struct multiplex_s       *next_device;
+} CACHE_ALIGNED;
 
 /**
  * Platform linked list element. Object created from platform and their descendants will reference
- * the platform's multiplexing structure.
+ * the platform's multiplexing structure. Each platform has its own arena, the
+ * list element, its instance layer chains and its instance layers are
+ * allocated from.
  */
 struct plt_s;
+struct driver_s;
 struct plt_s {
-	platform_t          platform;
 	struct multiplex_s  multiplex;
-	struct plt_s       *next;
+	platform_t          platform;
+	struct driver_s    *driver;
+	struct arena_s     *arena;
+};
+
+/**
+ * Platform array. Platforms are appended in place, the handle being stored
+ * before the count is published, so enumerating platforms is a single copy
+ * of the published prefix. When full, the array is copied into a larger one
+ * that is published instead, and the previous one is reclaimed after a grace
+ * period. Writers are serialized by _platform_mutex.
+ */
+struct platform_array_s {
+	size_t      num_platforms;
+	size_t      max_platforms;
+	platform_t  platforms[];
 };
+#define MIN_PLATFORMS 16
 
 /**
  * Definition of driver entry points.
  */
 typedef int (*pfn_getPlatformsExt_t)(size_t num_platform, platform_t *platforms, size_t *num_platform_ret);
 typedef void * (*pfn_platformGetFuncExt_t)(platform_t platform, const char *name);
+typedef int (*pfn_platformGetDispatchExt_t)(platform_t platform, size_t num_entries, struct driver_dispatch_s *dispatch, size_t *num_entries_ret);
 
 /**
  * Driver linked list element.
  */
 struct driver_s;
 struct driver_s {
-	void                     *library;
-	pfn_getPlatformsExt_t     getPlatformsExt;
-	pfn_platformGetFuncExt_t  platformGetFuncExt;
-	size_t                    num_platforms;
-	platform_t               *platforms;
-	struct driver_s          *next;
+	void                         *library;
+	pfn_getPlatformsExt_t        getPlatformsExt;
+	pfn_platformGetFuncExt_t     platformGetFuncExt;
+	// optional, NULL if not exported
+	pfn_platformGetDispatchExt_t platformGetDispatchExt;
+	size_t                       num_platforms;
+	platform_t                   *platforms;
+	struct driver_s              *next;
+	char                         *path;
+#if BAKED_LOADER
+	// 1-based index in the baked drivers, 0 for loaded drivers
+	size_t                        baked;
+#endif
 };
 
 /**
  * Global layer terminator.
  */
+#define LOADER_DISP_ENTRY(api, params, args) .api = &api ## _disp,
+#define DISP_ENTRY(api, handle, params, args) .api = &api ## _disp,
 static struct layer_s _layer_terminator = {
 	{
-		&getPlatforms_disp,
-		&platformAddLayer_disp,
-		&platformCreateDevice_disp,
-		&deviceFunc1_disp,
-		&deviceFunc2_disp,
-		&deviceDestroy_disp
+		API_LOADER(LOADER_DISP_ENTRY)
+		API_DRIVER(DISP_ENTRY)
 	},
 	NULL,
 	NULL,
-	NULL
+	NULL,
+	NULL,
+	{ NULL },
+	0
 };
 
 /**
  * Linked lists entry points.
  */
 static struct layer_s  *_first_layer = &_layer_terminator;
+// global layers are allocated from their own arena
+static struct arena_s  *_layer_arena = NULL;
 static struct driver_s *_first_driver = NULL;
-static struct plt_s    *_first_platform = NULL;
-static size_t           _num_platforms = 0;
+static struct platform_array_s  _no_platforms = { 0, 0 };
+static struct platform_array_s *_platforms = &_no_platforms;
+static pthread_mutex_t          _platform_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Entry of the global layer chain for an API, and call through it. The global
+ * layers of baked loaders are not part of the global layer list, and are
+ * called directly, their entries being the terminators for the APIs none of
+ * them intercepts.
+ */
+#if BAKED_LOADER
+static struct dispatch_s _baked_intercepts;
+#define GLOBAL_ENTRY(api) (_baked_intercepts.api ? &BAKED_CHAIN(api) : &api ## _disp)
+#define GLOBAL_CALL(api, args) BAKED_CHAIN(api) args
+#else
+#define GLOBAL_ENTRY(api) _first_layer->dispatch.api
+#define GLOBAL_CALL(api, args) _first_layer->dispatch.api args
+#endif
+
+/**
+ * Serializes instance layer chain updates, and updates of the dispatch tables
+ * instance layers copy entries from.
+ */
+static pthread_mutex_t _chain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Serializes global layer enabling and disabling.
+ */
+static pthread_mutex_t _layer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Serializes driver additions.
+ */
+static pthread_mutex_t _driver_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Serializes device instance layer attachments. Device multiplexing
+ * structure lists are protected by _chain_mutex.
+ */
+static pthread_mutex_t _device_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * When set (through the LAZY_DISPATCH environment variable), driver entry
+ * points are only queried on their first use.
+ */
+static int _lazy_resolution = 0;
+
+/**
+ * When set (through the LOADER_CACHE environment variable), driver discovery
+ * results are cached in a file, see discovery.h.
+ */
+static int _discovery = 0;
+
+/**
+ * When set (through the VALIDATE_HANDLES environment variable), handles are
+ * looked up in the registry of live handles (see registry.h) before being
+ * dereferenced, and API calls on unknown handles fail.
+ */
+static int               _validate_handles = 0;
+static struct registry_s _live_handles;
+
+/**
+ * Set for the batch APIs that must be fanned out by the entry point, as a
+ * global layer intercepts the batched API but not the batch.
+ */
+static unsigned char _global_fanout[NUM_DRIVER_DISPATCH_ENTRIES];
+
+/**
+ * When set (through the LAYER_PROFILE environment variable), timing shims are
+ * inserted between the links of the call chains (see profile.h). Entry points
+ * enter instance layer chains through the _prof_first shims, and instance
+ * layers call into the _prof_inst shims instead of the next layer. Global
+ * layers call into the _prof_next shims, and the global layer chain starts
+ * with _profile_head, whose _prof_head shims enter the first global layer.
+ */
+static int _profile = 0;
+
+#if FFI_INSTANCE_LAYERS
+#define PROFILE_INST_PARAMS(params) params
+#else
+#define PROFILE_INST_PARAMS(params) \
+	(struct instance_layer_s *self __attribute__((unused)), EXPAND params)
+#endif
+
+#define DECLARE_PROFILE_LOADER(api, params, args) \
+static int api ## _prof_head params; \
+static int api ## _prof_next params;
+API_LOADER(DECLARE_PROFILE_LOADER)
+
+#define DECLARE_PROFILE(api, handle, params, args) \
+static int api ## _prof_head params; \
+static int api ## _prof_next params; \
+static int api ## _prof_first(struct chain_s *chain, EXPAND params); \
+static int api ## _prof_inst PROFILE_INST_PARAMS(params);
+API_DRIVER(DECLARE_PROFILE)
+
+#define PROF_HEAD_LOADER_ENTRY(api, params, args) .api = &api ## _prof_head,
+#define PROF_HEAD_ENTRY(api, handle, params, args) .api = &api ## _prof_head,
+static struct layer_s _profile_head = {
+	{
+		API_LOADER(PROF_HEAD_LOADER_ENTRY)
+		API_DRIVER(PROF_HEAD_ENTRY)
+	},
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	{ NULL },
+	0
+};
+
+#define PROF_NEXT_LOADER_ENTRY(api, params, args) .api = &api ## _prof_next,
+#define PROF_NEXT_ENTRY(api, handle, params, args) .api = &api ## _prof_next,
+static struct dispatch_s _profile_next_dispatch = {
+	API_LOADER(PROF_NEXT_LOADER_ENTRY)
+	API_DRIVER(PROF_NEXT_ENTRY)
+};
+
+#if FFI_INSTANCE_LAYERS
+#define PROF_INST_ENTRY(api, handle, params, args) \
+	.api ## _instance = &api ## _prof_inst,
+static struct instance_dispatch_s _profile_inst_dispatch = {
+	API_DRIVER(PROF_INST_ENTRY)
+};
+#else
+#define PROF_INST_ENTRY(api, handle, params, args) \
+	.api ## _instance = (pfn_ ## api ## _instance_t)&api ## _prof_inst,
+static struct instance_layer_s _profile_inst_layer = {
+	{
+		API_DRIVER(PROF_INST_ENTRY)
+	},
+	{ NULL },
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	{ NULL },
+	{ 0 },
+	0,
+	NULL,
+	NULL
+};
+#endif
 
 /**
  * (Opaque) will be made to point to platform multiplexing structure.
@@ -227,6 +587,18 @@ char *get_next(char *paths) {
 	return next;
 }
 
+/**
+ * The platform list element a platform or device multiplexing structure
+ * belongs to.
+ */
+#define MULTIPLEX_PLT(m) \
+	((struct plt_s *)((intptr_t)((m)->parent ? (m)->parent : (m)) - offsetof(struct plt_s, multiplex)))
+
+/**
+ * Index of an API in driver dispatch tables.
+ */
+#define DRIVER_SLOT(api) (offsetof(struct driver_dispatch_s, api) / sizeof(void *))
+
 #define SET_API(api) do { \
 	plt->multiplex.dispatch.api = (pfn_ ## api ## _t)(intptr_t)pfn; \
 } while (0)
@@ -238,133 +610,892 @@ char *get_next(char *paths) {
 } while (0)
 
 /**
- * Load platforms from a driver, and insert them into the platform list.
+ * Query entries the driver bulk dispatch table did not provide.
+ */
+#define GET_API_FALLBACK(api, handle, params, args) do { \
+	if (DRIVER_SLOT(api) >= num_entries) \
+		GET_API(api); \
+} while (0);
+
+#define RESOLVE_API(api, handle, params, args) do { \
+	if (GLOBAL_ENTRY(api) != &api ## _disp) \
+		__atomic_store_n(&multiplex->resolved.api, GLOBAL_ENTRY(api), __ATOMIC_RELEASE); \
+	else \
+		__atomic_store_n(&multiplex->resolved.api, multiplex->dispatch.api, __ATOMIC_RELEASE); \
+} while (0);
+
+#define RESOLVE_CREATE_API(api, handle, params, args, handle_ret) \
+	__atomic_store_n(&multiplex->resolved.api, GLOBAL_ENTRY(api), __ATOMIC_RELEASE);
+
+#define RESOLVE_BATCH_API(api, single, handle, params, args, num, elems, results) \
+	RESOLVE_API(api, handle, params, args)
+
+#define RESOLVE_CREATE_BULK_API(api, single, handle, params, args, num, handles_ret) \
+	RESOLVE_CREATE_API(api, handle, params, args, handles_ret)
+
+#define RESOLVE_BULK_API(api, single, handle, params, args, num, handles) \
+	RESOLVE_API(api, handle, params, args)
+
+#if FFI_INSTANCE_LAYERS
+/**
+ * Replace the copies of an entry in the FFI instance layer dispatch tables of
+ * a multiplexing structure, including the tables of removed layers, with
+ * _chain_mutex held.
+ */
+static inline void
+patchEntry(struct instance_dispatch_s *dispatch, size_t index, void *old, void *pfn) {
+	__atomic_compare_exchange_n(&((void **)dispatch)[index],
+		&old, pfn, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static void
+patchInstanceLayers(struct multiplex_s *multiplex, size_t index, void *old, void *pfn) {
+	struct instance_layer_s *layer = multiplex->chain->first_layer;
+	for (; layer->library; layer = layer->next)
+		patchEntry(&layer->dispatch, index, old, pfn);
+	for (layer = multiplex->removed; layer; layer = layer->next_removed)
+		patchEntry(&layer->dispatch, index, old, pfn);
+	if (multiplex->parent)
+		patchEntry(&multiplex->platform_dispatch, index, old, pfn);
+}
+
+/**
+ * Replace the copies of an entry of the platform chain in the dispatch tables
+ * of the layers of a device multiplexing structure, the platform layers of
+ * its chain excepted, with _chain_mutex held.
+ */
+static void
+patchDeviceLayers(struct multiplex_s *multiplex, size_t index, void *old, void *pfn) {
+	struct instance_layer_s *layer = multiplex->chain->first_layer;
+	for (; layer != multiplex->parent_layer; layer = layer->next)
+		patchEntry(&layer->dispatch, index, old, pfn);
+	patchEntry(&multiplex->platform_dispatch, index, old, pfn);
+}
+#endif
+
+/**
+ * Compute the resolved dispatch table of a multiplexing structure, skipping
+ * the global layer chain for APIs no global layer intercepts. The global
+ * terminators of APIs creating handles are never skipped, as they set up the
+ * multiplexing of the created handles. For FFI instance layers, the terminator
+ * dispatch table is the resolved table.
+ * This must be called whenever the global layer chain or the driver dispatch
+ * table changes. FFI instance layers copy the entries of the next layer for
+ * the APIs they don't intercept, so the copies of the terminator entries that
+ * changed are replaced as well, with _chain_mutex held once API calls can be
+ * made.
+ */
+static void
+updateMultiplex(struct multiplex_s *multiplex) {
+	API_DRIVER_CREATE(RESOLVE_CREATE_API)
+	API_DRIVER_CALL(RESOLVE_API)
+	API_DRIVER_BATCH(RESOLVE_BATCH_API)
+	API_DRIVER_CREATE_BULK(RESOLVE_CREATE_BULK_API)
+	API_DRIVER_BULK(RESOLVE_BULK_API)
+#if FFI_INSTANCE_LAYERS
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++) {
+		void **slot = &((void **)&multiplex->terminator.dispatch)[i];
+		void *old = *slot;
+		void *pfn = ((void **)&multiplex->resolved)[i];
+		if (old == pfn)
+			continue;
+		patchInstanceLayers(multiplex, i, old, pfn);
+		__atomic_store_n(slot, pfn, __ATOMIC_RELEASE);
+	}
+#endif
+	/* entries not resolved yet by the platform may be by the device */
+	for (struct multiplex_s *device = multiplex->devices; device; device = device->next_device) {
+		for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++) {
+			void *pfn = __atomic_load_n(&((void **)&multiplex->dispatch)[i], __ATOMIC_ACQUIRE);
+			if (pfn != ((void **)&_lazy_dispatch)[i])
+				__atomic_store_n(&((void **)&device->dispatch)[i], pfn, __ATOMIC_RELEASE);
+		}
+		updateMultiplex(device);
+	}
+}
+
+/**
+ * Release the first num_platforms loaded platforms of a driver.
  */
 static void
-loadPlatforms(struct driver_s *driver) {
+unloadPlatforms(struct driver_s *driver, size_t num_platforms) {
+	for (size_t i = 0; i < num_platforms; i++) {
+		struct multiplex_s *multiplex = driver->platforms[i]->multiplex;
+		if (_validate_handles)
+			registryRemove(&_live_handles, driver->platforms[i]);
+		arenaDestroy(MULTIPLEX_PLT(multiplex)->arena);
+	}
+}
+
+/**
+ * Load platforms from a driver, and prepare them for insertion into the
+ * platform list. Does not modify global state, so several drivers can be
+ * loaded concurrently. When the driver has a discovery cache record, its
+ * entry points are computed from the offsets of the record instead of being
+ * queried. Otherwise, if offsets is not NULL, the offsets of the entry points
+ * are stored there, and *cacheable_ret is set to 0 if they can't all be
+ * cached. On failure, the platforms already loaded are released.
+ */
+static int
+loadPlatforms(struct driver_s *driver, const struct discovery_record_s *record,
+              const void *base, int64_t *offsets, int *cacheable_ret) {
+	int cacheable = 1;
 	for (size_t i = 0; i < driver->num_platforms; i++) {
+		/* the platform's multiplex and its first chain are contiguous */
+		struct arena_s *arena = arenaCreate();
+		if (!arena) {
+			unloadPlatforms(driver, i);
+			return SPEC_ERROR;
+		}
 		struct plt_s *plt = (struct plt_s *)
-			calloc(1, sizeof(struct plt_s));
+			arenaAlloc(arena, sizeof(struct plt_s));
+		struct chain_s *chain = (struct chain_s *)
+			arenaAlloc(arena, sizeof(struct chain_s));
+		if (!plt || !chain) {
+			arenaDestroy(arena);
+			unloadPlatforms(driver, i);
+			return SPEC_ERROR;
+		}
 		platform_t platform = driver->platforms[i];
 		plt->platform = platform;
+		plt->arena = arena;
+		plt->multiplex.platform = &plt->multiplex;
 		/* Initialize dispatch table and instance layer chains */
 		plt->multiplex.dispatch = _unsup_dispatch;
-		plt->multiplex.first_layer = &_instance_layer_terminator;
+		plt->multiplex.terminator = _instance_layer_terminator;
+		plt->multiplex.chain = chain;
+		plt->multiplex.chain->first_layer = &plt->multiplex.terminator;
 #if !FFI_INSTANCE_LAYERS
-		plt->multiplex.layer_dispatch = _instance_layer_dispatch_head;
+		plt->multiplex.terminator.data = &plt->multiplex.resolved;
+		for (size_t j = 0; j < NUM_INSTANCE_DISPATCH_ENTRIES; j++)
+			((struct instance_layer_s **)&(plt->multiplex.chain->layer_dispatch))[j] =
+				&plt->multiplex.terminator;
 #endif
-		/* fill dispatch table */
-		GET_API(platformCreateDevice);
-		GET_API(deviceFunc1);
-		GET_API(deviceFunc2);
-		GET_API(deviceDestroy);
+		plt->driver = driver;
+		if (record) {
+			const int64_t *entries = record->offsets + i * NUM_DRIVER_DISPATCH_ENTRIES;
+			for (size_t j = 0; j < NUM_DRIVER_DISPATCH_ENTRIES; j++)
+				((void **)&plt->multiplex.dispatch)[j] = entries[j] < 0 ?
+					((void **)&_unsup_dispatch)[j] : (void *)((intptr_t)base + entries[j]);
+			goto resolve;
+		}
+		/* fill dispatch table, in bulk if the driver supports it */
+		struct driver_dispatch_s dispatch = { NULL };
+		size_t num_entries = 0;
+		if (driver->platformGetDispatchExt &&
+		    driver->platformGetDispatchExt(platform, NUM_DRIVER_DISPATCH_ENTRIES, &dispatch, &num_entries))
+			num_entries = 0;
+		if (num_entries > NUM_DRIVER_DISPATCH_ENTRIES)
+			num_entries = NUM_DRIVER_DISPATCH_ENTRIES;
+		if (_lazy_resolution)
+			plt->multiplex.dispatch = _lazy_dispatch;
+		for (size_t j = 0; j < num_entries; j++)
+			((void **)&plt->multiplex.dispatch)[j] = ((void **)&dispatch)[j] ?
+				((void **)&dispatch)[j] : ((void **)&_unsup_dispatch)[j];
+		if (!_lazy_resolution) {
+			API_DRIVER(GET_API_FALLBACK)
+		}
+		/* lazily resolved entries are not in the driver, and not cached */
+		for (size_t j = 0; offsets && j < NUM_DRIVER_DISPATCH_ENTRIES; j++) {
+			void *entry = ((void **)&plt->multiplex.dispatch)[j];
+			int64_t *offset = &offsets[i * NUM_DRIVER_DISPATCH_ENTRIES + j];
+			if (entry == ((void **)&_unsup_dispatch)[j])
+				*offset = -1;
+			else if ((*offset = discoveryOffset(base, entry)) < 0)
+				cacheable = 0;
+		}
+resolve:
+		updateMultiplex(&plt->multiplex);
 		/* setup multiplex reference */
 		plt->platform->multiplex = &plt->multiplex;
-		/* Insert platform into platform list */
-		plt->next = _first_platform;
-		_first_platform = plt;
-		_num_platforms++;
+		if (_validate_handles)
+			registryInsert(&_live_handles, platform);
 	}
+	if (cacheable_ret)
+		*cacheable_ret = cacheable;
+	return SPEC_SUCCESS;
 }
 
 /**
- * Load a driver given it's library path, checking driver provide the two apis
- * defined in driver-spec.h, and that getPlatformsExt does indeed return a
- * platform.
+ * Load a driver given it's library path, checking driver provide the two
+ * mandatory apis defined in driver-spec.h, and that getPlatformsExt does
+ * indeed return a platform. The driver is not inserted into the driver list, see
+ * insertDriver. With the discovery cache, the number of platforms and the
+ * entry points of a driver that was already probed are taken from its
+ * record, the driver only being asked for its platform handles. A driver
+ * returning a different number of platforms than recorded is probed again.
  */
-static void
+static struct driver_s *
 loadDriver(const char *path) {
 	struct driver_s *driver = NULL;
 	size_t num_platforms;
+	struct discovery_key_s key;
+	const void *base = NULL;
+	const struct discovery_record_s *record = NULL;
+	int64_t *offsets = NULL;
 	void *lib = loadLibrary(path);
 	if (!lib)
-		return;
+		return NULL;
 	pfn_getPlatformsExt_t p_getPlatformsExt = (pfn_getPlatformsExt_t)(intptr_t)dlsym(lib, "getPlatformsExt");
 	if (!p_getPlatformsExt)
 		goto error;
 	pfn_platformGetFuncExt_t p_platformGetFuncExt = (pfn_platformGetFuncExt_t)(intptr_t)dlsym(lib, "platformGetFuncExt");
 	if (!p_platformGetFuncExt)
 		goto error;
-	if (p_getPlatformsExt(0, NULL, &num_platforms) || !num_platforms)
+	int cacheable = _discovery &&
+		!discoveryKey(path, (const void *)(intptr_t)p_getPlatformsExt, &key, &base);
+	if (cacheable)
+		record = discoveryLookup(&key);
+probe:
+	if (record)
+		num_platforms = record->num_platforms;
+	else if (p_getPlatformsExt(0, NULL, &num_platforms) || !num_platforms)
 		goto error;
 	driver = (struct driver_s *)calloc(1, sizeof(struct driver_s) + num_platforms * sizeof(platform_t));
+	if (!driver)
+		goto error;
 	driver->library = lib;
+	driver->path = strdup(path);
+	if (!driver->path)
+		goto error;
 	driver->getPlatformsExt = p_getPlatformsExt;
 	driver->platformGetFuncExt = p_platformGetFuncExt;
+	driver->platformGetDispatchExt = (pfn_platformGetDispatchExt_t)(intptr_t)dlsym(lib, "platformGetDispatchExt");
 	driver->num_platforms = num_platforms;
-	driver->platforms = (platform_t *)((intptr_t)driver + sizeof(struct platform_s));
-	if (p_getPlatformsExt(num_platforms, driver->platforms, NULL))
+	driver->platforms = (platform_t *)(driver + 1);
+	if (record) {
+		size_t count;
+		if (p_getPlatformsExt(num_platforms, driver->platforms, &count) || count != num_platforms) {
+			record = NULL;
+			free(driver->path);
+			free(driver);
+			driver = NULL;
+			goto probe;
+		}
+	} else if (p_getPlatformsExt(num_platforms, driver->platforms, NULL))
 		goto error;
-	loadPlatforms(driver);
-	driver->next = _first_driver;
-	_first_driver = driver;
-	return;
+	if (cacheable && !record)
+		offsets = (int64_t *)malloc(num_platforms * NUM_DRIVER_DISPATCH_ENTRIES * sizeof(int64_t));
+	if (loadPlatforms(driver, record, base, offsets, &cacheable)) {
+		free(offsets);
+		goto error;
+	}
+	if (cacheable && offsets)
+		discoveryRecord(&key, num_platforms, offsets);
+	free(offsets);
+	return driver;
 error:
-	if (driver)
+	if (driver) {
+		free(driver->path);
 		free(driver);
+	}
 	dlclose(lib);
+	return NULL;
 }
 
 /**
- * Load a global layer library given its path, and try to initialize it. If
- * successful insert it into the global layer list.
+ * Append platforms to the platform array, growing it if needed. They are
+ * published together, so enumerations see either none or all of them. Must
+ * be called with _platform_mutex held.
+ */
+static int
+appendPlatforms(size_t count, const platform_t *new_entries) {
+	struct platform_array_s *platforms = _platforms;
+	size_t num_platforms = platforms->num_platforms;
+	if (num_platforms + count > platforms->max_platforms) {
+		size_t max_platforms = platforms->max_platforms ? platforms->max_platforms : MIN_PLATFORMS;
+		while (max_platforms < num_platforms + count)
+			max_platforms *= 2;
+		struct platform_array_s *new_platforms = (struct platform_array_s *)
+			malloc(sizeof(struct platform_array_s) + max_platforms * sizeof(platform_t));
+		if (!new_platforms)
+			return SPEC_ERROR;
+		memcpy(new_platforms->platforms, platforms->platforms, num_platforms * sizeof(platform_t));
+		new_platforms->num_platforms = num_platforms;
+		new_platforms->max_platforms = max_platforms;
+		__atomic_store_n(&_platforms, new_platforms, __ATOMIC_RELEASE);
+		if (platforms != &_no_platforms)
+			epochDefer(&free, platforms);
+		platforms = new_platforms;
+	}
+	memcpy(platforms->platforms + num_platforms, new_entries, count * sizeof(platform_t));
+	__atomic_store_n(&platforms->num_platforms, num_platforms + count, __ATOMIC_RELEASE);
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Release a loaded driver that could not be inserted, and its platforms.
  */
 static void
-loadLayer(const char *path) {
-	struct layer_s *layer = NULL;
-	void *lib = loadLibrary(path);
-	if (!lib)
-		return;
-	pfn_layerInit_t p_layerInit = (pfn_layerInit_t)(intptr_t)dlsym(lib, "layerInit");
-	if (!p_layerInit)
-		goto error;
-	layer = (struct layer_s *)calloc(1, sizeof(struct layer_s));
-	layer->library = lib;
-	if (p_layerInit(NUM_DISPATCH_ENTRIES, &_first_layer->dispatch, &layer->dispatch))
-		goto error;
-	for (size_t i = 0; i < NUM_DISPATCH_ENTRIES; i++)
-		if (!((void **)&(layer->dispatch))[i])
-			((void **)&(layer->dispatch))[i] = ((void **)&(_first_layer->dispatch))[i];
-	layer->next = _first_layer;
-	layer->layerDeinit = (pfn_layerDeinit_t)(intptr_t)dlsym(lib, "layerDeinit");
-	_first_layer = layer;
-	return;
-error:
-	if (layer)
-		free(layer);
-	dlclose(lib);
+unloadDriver(struct driver_s *driver) {
+	unloadPlatforms(driver, driver->num_platforms);
+	if (driver->library)
+		dlclose(driver->library);
+	free(driver->path);
+	free(driver);
 }
 
 /**
- * Load an instance layer library into a multiplexing structure, inserting it
- * in front of the instance layer chain.
+ * Insert a loaded driver into the driver list, and append its platforms to
+ * the platform array. Must be called with _platform_mutex held.
  */
 static int
-loadInstanceLayer(struct multiplex_s *multiplex, const char *path) {
-	struct instance_layer_s *layer = NULL;
-	void *lib = loadLibrary(path);
-	if (!lib)
-		goto error;
-	pfn_layerInstanceInit_t p_layerInstanceInit =
-		(pfn_layerInstanceInit_t)(intptr_t)dlsym(lib, "layerInstanceInit");
-	if (!p_layerInstanceInit)
+insertDriver(struct driver_s *driver) {
+	if (appendPlatforms(driver->num_platforms, driver->platforms))
+		return SPEC_ERROR;
+	driver->next = _first_driver;
+	_first_driver = driver;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Update the multiplexing structures of all the platforms.
+ */
+static void
+updatePlatforms(void) {
+	pthread_mutex_lock(&_platform_mutex);
+	struct platform_array_s *platforms = _platforms;
+	for (size_t i = 0; i < platforms->num_platforms; i++)
+		updateMultiplex(platforms->platforms[i]->multiplex);
+	pthread_mutex_unlock(&_platform_mutex);
+}
+
+#if !BAKED_LOADER
+/**
+ * Drivers are loaded concurrently by a small pool of threads, as loading a
+ * driver requires several calls into it. The number of threads can be set with
+ * the DRIVER_THREADS environment variable.
+ */
+#define MAX_DRIVER_THREADS 8
+
+struct driver_pool_s {
+	size_t            num_drivers;
+	char            **paths;
+	struct driver_s **drivers;
+	size_t            next_driver;
+};
+
+static void *
+loadDriversWorker(void *arg) {
+	struct driver_pool_s *pool = (struct driver_pool_s *)arg;
+	size_t i;
+	while ((i = __atomic_fetch_add(&pool->next_driver, 1, __ATOMIC_RELAXED)) < pool->num_drivers)
+		pool->drivers[i] = loadDriver(pool->paths[i]);
+	return NULL;
+}
+
+/**
+ * Load the drivers in the colon separated list of paths, skipping empty
+ * entries. Drivers are inserted in the order they are listed, irrespective of
+ * the order they finished loading in, so their platforms are enumerated in
+ * that order.
+ */
+static void
+loadDrivers(char *paths) {
+	struct driver_pool_s pool = { 0, NULL, NULL, 0 };
+	pthread_t threads[MAX_DRIVER_THREADS - 1];
+	size_t num_threads = MAX_DRIVER_THREADS;
+	size_t num_started = 0;
+	size_t max_drivers = 1;
+	for (char *c = paths; *c; c++)
+		if (*c == ':')
+			max_drivers++;
+	pool.paths = (char **)calloc(max_drivers, sizeof(char *));
+	pool.drivers = (struct driver_s **)calloc(max_drivers, sizeof(struct driver_s *));
+	if (!pool.paths || !pool.drivers)
+		goto end;
+	char *next_file = paths;
+	while (NULL != next_file) {
+		char *cur_file = next_file;
+		next_file = get_next(cur_file);
+		if (*cur_file != '\0')
+			pool.paths[pool.num_drivers++] = cur_file;
+	}
+	if (!pool.num_drivers)
+		goto end;
+	char *threads_env = getenv("DRIVER_THREADS");
+	if (threads_env && atoi(threads_env) > 0 && atoi(threads_env) <= MAX_DRIVER_THREADS)
+		num_threads = atoi(threads_env);
+	if (num_threads > pool.num_drivers)
+		num_threads = pool.num_drivers;
+	/* the calling thread is part of the pool */
+	for (; num_started < num_threads - 1; num_started++)
+		if (pthread_create(&threads[num_started], NULL, &loadDriversWorker, &pool))
+			break;
+	loadDriversWorker(&pool);
+	for (size_t i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_lock(&_platform_mutex);
+	for (size_t i = 0; i < pool.num_drivers; i++)
+		if (pool.drivers[i] && insertDriver(pool.drivers[i])) {
+			fprintf(stderr, "Could not register the platforms of %s\n", pool.drivers[i]->path);
+			unloadDriver(pool.drivers[i]);
+		}
+	pthread_mutex_unlock(&_platform_mutex);
+end:
+	free(pool.paths);
+	free(pool.drivers);
+}
+#endif
+
+/**
+ * Batches (and bulk calls) must be fanned out before reaching a layer that
+ * intercepts the batched API but not the batch, so the layer sees every call.
+ */
+#define CHECK_GLOBAL_FANOUT(api, single, handle, params, args, num, elems, results) \
+	if (layer->enabled && layer->intercepts.single && !layer->intercepts.api) \
+		fanout[DRIVER_SLOT(api)] = 1;
+
+#define CHECK_CHAIN_FANOUT(api, single, handle, params, args, num, elems, results) \
+	if (layer->dispatch.single ## _instance && !layer->dispatch.api ## _instance) \
+		layer->fanout[DRIVER_SLOT(api)] = 1;
+
+#define CHECK_BULK_GLOBAL_FANOUT(api, single, handle, params, args, num, handles) \
+	CHECK_GLOBAL_FANOUT(api, single, handle, params, args, num, handles, NULL)
+
+#define CHECK_BULK_CHAIN_FANOUT(api, single, handle, params, args, num, handles) \
+	CHECK_CHAIN_FANOUT(api, single, handle, params, args, num, handles, NULL)
+
+/**
+ * Compute the batch APIs the enabled global layers require to be fanned out.
+ */
+static void
+globalFanout(unsigned char *fanout) {
+	memset(fanout, 0, NUM_DRIVER_DISPATCH_ENTRIES);
+	for (struct layer_s *layer = _first_layer; layer != &_layer_terminator; layer = layer->next) {
+		API_DRIVER_BATCH(CHECK_GLOBAL_FANOUT)
+		API_DRIVER_CREATE_BULK(CHECK_BULK_GLOBAL_FANOUT)
+		API_DRIVER_BULK(CHECK_BULK_GLOBAL_FANOUT)
+	}
+}
+
+/**
+ * Publish the dispatch table of a global layer and of the layers after it.
+ * Entries of a disabled layer, and of the APIs a layer doesn't intercept, are
+ * the entries of the next layer, so calls skip disabled layers entirely.
+ * Entries are replaced one at a time, concurrent calls going through either
+ * the previous or the new entry, as disabled layers stay loaded.
+ */
+static void
+publishLayer(struct layer_s *layer) {
+	if (layer == &_layer_terminator)
+		return;
+	publishLayer(layer->next);
+	if (layer == &_profile_head)
+		return;
+	void **target = _profile ? (void **)&_profile_next_dispatch : (void **)&layer->next->dispatch;
+	void **intercepts = (void **)&layer->intercepts;
+	for (size_t i = 0; i < NUM_DISPATCH_ENTRIES; i++)
+		__atomic_store_n(&((void **)&layer->dispatch)[i],
+			layer->enabled && intercepts[i] ? intercepts[i] : target[i], __ATOMIC_RELEASE);
+}
+
+#if !BAKED_LOADER
+/**
+ * Load a global layer library given its path, and try to initialize it. If
+ * successful insert it into the global layer list.
+ */
+static void
+loadLayer(const char *path) {
+	struct layer_s *layer = NULL;
+	void *lib = loadLibrary(path);
+	if (!lib)
+		return;
+	pfn_layerInit_t p_layerInit = (pfn_layerInit_t)(intptr_t)dlsym(lib, "layerInit");
+	if (!p_layerInit)
+		goto error;
+	if (!_layer_arena && !(_layer_arena = arenaCreate()))
+		goto error;
+	layer = (struct layer_s *)arenaAlloc(_layer_arena, sizeof(struct layer_s));
+	if (!layer)
+		goto error;
+	layer->library = lib;
+	layer->path = strdup(path);
+	if (!layer->path)
+		goto error;
+	struct dispatch_s *target = _profile ? &_profile_next_dispatch : &_first_layer->dispatch;
+	if (p_layerInit(NUM_DISPATCH_ENTRIES, target, &layer->intercepts))
+		goto error;
+	layer->enabled = 1;
+	layer->next = _first_layer;
+	layer->layerDeinit = (pfn_layerDeinit_t)(intptr_t)dlsym(lib, "layerDeinit");
+	_first_layer = layer;
+	publishLayer(layer);
+	globalFanout(_global_fanout);
+	updatePlatforms();
+	return;
+error:
+	if (layer) {
+		free(layer->path);
+		arenaFree(layer, sizeof(struct layer_s));
+	}
+	dlclose(lib);
+}
+#else
+/**
+ * Baked drivers are probed like loaded drivers, without the discovery cache.
+ */
+static struct driver_s *
+loadBakedDriver(const char *name,
+                pfn_getPlatformsExt_t p_getPlatformsExt,
+                pfn_platformGetFuncExt_t p_platformGetFuncExt,
+                pfn_platformGetDispatchExt_t p_platformGetDispatchExt) {
+	size_t num_platforms;
+	if (p_getPlatformsExt(0, NULL, &num_platforms) || !num_platforms)
+		return NULL;
+	struct driver_s *driver = (struct driver_s *)calloc(1, sizeof(struct driver_s) + num_platforms * sizeof(platform_t));
+	if (!driver)
+		return NULL;
+	driver->path = strdup(name);
+	if (!driver->path)
+		goto error;
+	driver->getPlatformsExt = p_getPlatformsExt;
+	driver->platformGetFuncExt = p_platformGetFuncExt;
+	driver->platformGetDispatchExt = p_platformGetDispatchExt;
+	driver->num_platforms = num_platforms;
+	driver->platforms = (platform_t *)(driver + 1);
+	if (p_getPlatformsExt(num_platforms, driver->platforms, NULL))
+		goto error;
+	if (loadPlatforms(driver, NULL, NULL, NULL, NULL))
+		goto error;
+	return driver;
+error:
+	free(driver->path);
+	free(driver);
+	return NULL;
+}
+
+#define BAKED_DRIVER_ENTRY(name, listed_name) \
+	{ listed_name, &baked_ ## name ## _getPlatformsExt, &baked_ ## name ## _platformGetFuncExt, \
+	  &baked_ ## name ## _platformGetDispatchExt },
+
+static const struct {
+	const char                   *name;
+	pfn_getPlatformsExt_t        getPlatformsExt;
+	pfn_platformGetFuncExt_t     platformGetFuncExt;
+	pfn_platformGetDispatchExt_t platformGetDispatchExt;
+} _baked_drivers[] = {
+	BAKED_DRIVERS(BAKED_DRIVER_ENTRY)
+};
+#define NUM_BAKED_DRIVERS (sizeof(_baked_drivers) / sizeof(_baked_drivers[0]))
+
+/**
+ * Load the baked drivers, inserted in the order they are listed.
+ */
+static void
+loadBakedDrivers(void) {
+	struct driver_s *drivers[NUM_BAKED_DRIVERS];
+	for (size_t i = 0; i < NUM_BAKED_DRIVERS; i++) {
+		drivers[i] = loadBakedDriver(_baked_drivers[i].name, _baked_drivers[i].getPlatformsExt,
+			_baked_drivers[i].platformGetFuncExt, _baked_drivers[i].platformGetDispatchExt);
+		if (drivers[i])
+			drivers[i]->baked = i + 1;
+	}
+	pthread_mutex_lock(&_platform_mutex);
+	for (size_t i = 0; i < NUM_BAKED_DRIVERS; i++)
+		if (drivers[i] && insertDriver(drivers[i])) {
+			fprintf(stderr, "Could not register the platforms of %s\n", drivers[i]->path);
+			unloadDriver(drivers[i]);
+		}
+	pthread_mutex_unlock(&_platform_mutex);
+}
+
+#define BAKED_LAYER_ENTRY(name, listed_name) \
+	{ listed_name, &baked_ ## name ## _init, &baked_ ## name ## _deinit },
+
+static const struct {
+	const char *name;
+	int       (*init)(struct dispatch_s *intercepts);
+	int       (*deinit)(void);
+} _baked_layers[] = {
+	BAKED_LAYERS(BAKED_LAYER_ENTRY)
+	{ NULL, NULL, NULL }
+};
+#define NUM_BAKED_LAYERS (sizeof(_baked_layers) / sizeof(_baked_layers[0]) - 1)
+
+#define CHECK_BAKED_FANOUT(api, single, handle, params, args, num, elems, results) \
+	if (intercepts.single && !intercepts.api) \
+		_global_fanout[DRIVER_SLOT(api)] = 1;
+
+#define CHECK_BULK_BAKED_FANOUT(api, single, handle, params, args, num, handles) \
+	CHECK_BAKED_FANOUT(api, single, handle, params, args, num, handles, NULL)
+
+#define MERGE_BAKED_LOADER_INTERCEPT(api, params, args) \
+	if (intercepts.api) \
+		_baked_intercepts.api = intercepts.api;
+
+#define MERGE_BAKED_INTERCEPT(api, handle, params, args) \
+	MERGE_BAKED_LOADER_INTERCEPT(api, params, args)
+
+/**
+ * Initialize the baked global layers, in the order they are listed. Their
+ * calls can't skip them, so a layer failing to initialize is fatal.
+ */
+static void
+loadBakedLayers(void) {
+	for (size_t i = 0; i < NUM_BAKED_LAYERS; i++) {
+		struct dispatch_s intercepts = { NULL };
+		if (_baked_layers[i].init(&intercepts)) {
+			fprintf(stderr, "Could not initialize baked layer %s\n", _baked_layers[i].name);
+			abort();
+		}
+		API_LOADER(MERGE_BAKED_LOADER_INTERCEPT)
+		API_DRIVER(MERGE_BAKED_INTERCEPT)
+		API_DRIVER_BATCH(CHECK_BAKED_FANOUT)
+		API_DRIVER_CREATE_BULK(CHECK_BULK_BAKED_FANOUT)
+		API_DRIVER_BULK(CHECK_BULK_BAKED_FANOUT)
+	}
+	updatePlatforms();
+}
+#endif
+
+static void
+freeChain(void *chain) {
+	arenaFree(chain, sizeof(struct chain_s));
+}
+
+#if !FFI_INSTANCE_LAYERS
+/**
+ * Query the interception filters of an instance layer, and replace the
+ * entries of the filtered APIs in its dispatch table by the filter shims.
+ */
+static int
+loadFilters(struct instance_layer_s *layer, struct arena_s *arena,
+            pfn_layerInstanceFilters_t p_layerInstanceFilters) {
+	struct layer_filter_s filters[NUM_INSTANCE_DISPATCH_ENTRIES];
+	size_t num_filters = 0, num_handles = 0;
+	memset(filters, 0, sizeof(filters));
+	if (p_layerInstanceFilters(layer->data, NUM_INSTANCE_DISPATCH_ENTRIES, filters))
+		return SPEC_ERROR;
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++) {
+		if (filters[i].kind == LAYER_FILTER_NONE || !((void **)&layer->dispatch)[i])
+			continue;
+		switch (filters[i].kind) {
+		case LAYER_FILTER_HANDLES:
+			if (!filters[i].num_handles || !filters[i].handles)
+				return SPEC_ERROR;
+			num_handles += filters[i].num_handles;
+			break;
+		case LAYER_FILTER_RANGE:
+			if (!_filter_values[i] || filters[i].min > filters[i].max)
+				return SPEC_ERROR;
+			break;
+		case LAYER_FILTER_SAMPLE:
+			if (!filters[i].period)
+				return SPEC_ERROR;
+			break;
+		default:
+			return SPEC_ERROR;
+		}
+		num_filters++;
+	}
+	if (!num_filters)
+		return SPEC_SUCCESS;
+	size_t size = sizeof(struct filter_table_s) + num_handles * sizeof(void *);
+	struct filter_table_s *table = (struct filter_table_s *)arenaAlloc(arena, size);
+	if (!table)
+		return SPEC_ERROR;
+	table->size = size;
+	const void **handles = table->handles;
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++) {
+		if (filters[i].kind == LAYER_FILTER_NONE || !((void **)&layer->dispatch)[i])
+			continue;
+		struct filter_s *filter = &table->filters[i];
+		filter->kind = filters[i].kind;
+		filter->period = filters[i].period;
+		filter->min = filters[i].min;
+		filter->max = filters[i].max;
+		if (filter->kind == LAYER_FILTER_HANDLES) {
+			memcpy(handles, filters[i].handles, filters[i].num_handles * sizeof(void *));
+			filter->num_handles = filters[i].num_handles;
+			filter->handles = handles;
+			handles += filters[i].num_handles;
+		}
+		((void **)&table->filtered)[i] = ((void **)&layer->dispatch)[i];
+		((void **)&layer->dispatch)[i] = ((void **)&_filter_dispatch)[i];
+	}
+	layer->filters = table;
+	return SPEC_SUCCESS;
+}
+#endif
+
+/**
+ * The chain of a device multiplexing structure goes through the instance
+ * layers of its platform, below the device layers, and ends with the device
+ * terminator instead of the platform's.
+ */
+static inline struct instance_layer_s *
+deviceChainLayer(struct multiplex_s *multiplex, struct instance_layer_s *layer) {
+	return layer == &multiplex->parent->terminator ? &multiplex->terminator : layer;
+}
+
+static void
+freeDeviceChains(struct chain_s **chains) {
+	for (size_t i = 0; chains && chains[i]; i++)
+		freeChain(chains[i]);
+	free(chains);
+}
+
+/**
+ * Publishing a new instance layer chain for a platform publishes new chains
+ * for the devices of the platform that have their own layers. They are
+ * allocated first, with _chain_mutex held, so that the platform chain can
+ * be updated without failing. The returned array is NULL terminated, and NULL
+ * if the platform has no such device.
+ */
+static int
+allocDeviceChains(struct multiplex_s *multiplex, struct chain_s ***chains_ret) {
+	struct arena_s *arena = MULTIPLEX_PLT(multiplex)->arena;
+	size_t num_devices = 0;
+	*chains_ret = NULL;
+	for (struct multiplex_s *device = multiplex->devices; device; device = device->next_device)
+		num_devices++;
+	if (!num_devices)
+		return SPEC_SUCCESS;
+	struct chain_s **chains = (struct chain_s **)calloc(num_devices + 1, sizeof(struct chain_s *));
+	if (!chains)
+		return SPEC_ERROR;
+	for (size_t i = 0; i < num_devices; i++)
+		if (!(chains[i] = (struct chain_s *)arenaAlloc(arena, sizeof(struct chain_s)))) {
+			freeDeviceChains(chains);
+			return SPEC_ERROR;
+		}
+	*chains_ret = chains;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Make the devices of a platform go through the new instance layer chain of
+ * the platform, before it is published, with _chain_mutex held. The device
+ * layers calling into the platform layers of the previous chain are made to
+ * call into their replacements, the way removeInstanceLayer patches the
+ * layers calling into a removed layer, and new device chains are published.
+ * The chains allocated by allocDeviceChains are replaced by the previous
+ * ones, to be freed after a grace period.
+ */
+static void
+updateDeviceChains(struct multiplex_s *multiplex, struct chain_s *chain, struct chain_s **chains) {
+#if !FFI_INSTANCE_LAYERS
+	struct chain_s *old_chain = multiplex->chain;
+#endif
+	size_t i = 0;
+	for (struct multiplex_s *device = multiplex->devices; device; device = device->next_device, i++) {
+		struct chain_s *device_chain = chains[i];
+		struct instance_layer_s *parent_layer = device->parent_layer;
+		struct instance_layer_s *first = deviceChainLayer(device, chain->first_layer);
+		struct instance_layer_s *bottom = NULL, *l;
+		*device_chain = *device->chain;
+		for (l = device_chain->first_layer; l != parent_layer; l = l->next)
+			bottom = l;
+		for (size_t j = 0; j < NUM_DRIVER_DISPATCH_ENTRIES; j++) {
+			device_chain->fanout[j] = chain->fanout[j];
+			for (l = device_chain->first_layer; l != parent_layer; l = l->next)
+				device_chain->fanout[j] |= l->fanout[j];
+		}
+#if FFI_INSTANCE_LAYERS
+		/* when profiling, the shims follow the next pointers instead */
+		for (size_t j = 0; !_profile && j < NUM_INSTANCE_DISPATCH_ENTRIES; j++) {
+			void *old = ((void **)&device->platform_dispatch)[j];
+			void *pfn = ((void **)&first->dispatch)[j];
+			if (old != pfn)
+				patchDeviceLayers(device, j, old, pfn);
+		}
+#else
+		for (size_t j = 0; j < NUM_INSTANCE_DISPATCH_ENTRIES; j++) {
+			struct instance_layer_s *from = deviceChainLayer(device,
+				((struct instance_layer_s **)&old_chain->layer_dispatch)[j]);
+			struct instance_layer_s *to = deviceChainLayer(device,
+				((struct instance_layer_s **)&chain->layer_dispatch)[j]);
+			if (from == to)
+				continue;
+			if (((struct instance_layer_s **)&device_chain->layer_dispatch)[j] == from)
+				((struct instance_layer_s **)&device_chain->layer_dispatch)[j] = to;
+			for (l = device_chain->first_layer; l != parent_layer; l = l->next) {
+				struct instance_layer_s **table = (struct instance_layer_s **)
+					(_profile ? &l->profile_next : &l->layer_dispatch);
+				if (table[j] == from)
+					__atomic_store_n(&table[j], to, __ATOMIC_RELEASE);
+			}
+		}
+#endif
+		if (bottom)
+			__atomic_store_n(&bottom->next, first, __ATOMIC_RELEASE);
+		else
+			device_chain->first_layer = first;
+		device->parent_layer = first;
+		device_chain->generation++;
+		chains[i] = device->chain;
+		__atomic_store_n(&device->chain, device_chain, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Load an instance layer library into a multiplexing structure, inserting it
+ * in front of the instance layer chain. The new chain is fully built before
+ * being published, and the previous one is reclaimed once no API call can be
+ * using it anymore. Non FFI instance layers can have the loader filter the
+ * calls they see, see loadFilters. The bottom layer of a device calls into
+ * the platform chain through the platform_dispatch table of the device, so
+ * that platform layers can be added and removed below it.
+ */
+static int
+loadInstanceLayer(struct multiplex_s *multiplex, const char *path) {
+	struct instance_layer_s *layer = NULL;
+	struct chain_s *chain = NULL;
+	struct chain_s **device_chains = NULL;
+	void *lib = loadLibrary(path);
+	if (!lib)
+		return SPEC_ERROR;
+	pfn_layerInstanceInit_t p_layerInstanceInit =
+		(pfn_layerInstanceInit_t)(intptr_t)dlsym(lib, "layerInstanceInit");
+	if (!p_layerInstanceInit)
 		goto error;
 	pfn_layerInstanceDeinit_t p_layerInstanceDeinit =
 		(pfn_layerInstanceDeinit_t)(intptr_t)dlsym(lib, "layerInstanceDeinit");
 	if (!p_layerInstanceDeinit)
 		goto error;
-	layer = (struct instance_layer_s *)calloc(1, sizeof(struct instance_layer_s));
+	struct arena_s *arena = MULTIPLEX_PLT(multiplex)->arena;
+	layer = (struct instance_layer_s *)arenaAlloc(arena, sizeof(struct instance_layer_s));
+	chain = (struct chain_s *)arenaAlloc(arena, sizeof(struct chain_s));
+	if (!layer || !chain)
+		goto error;
 	layer->library = lib;
+	layer->path = strdup(path);
+	if (!layer->path)
+		goto error;
 	layer->layerInstanceDeinit = p_layerInstanceDeinit;
+	layer->layerInstanceWrapFunc =
+		(pfn_layerInstanceWrapFunc_t)(intptr_t)dlsym(lib, "layerInstanceWrapFunc");
+	pthread_mutex_lock(&_chain_mutex);
+	if (allocDeviceChains(multiplex, &device_chains))
+		goto error_unlock;
+	struct chain_s *old_chain = multiplex->chain;
 	int res;
 	const size_t num_entries = NUM_INSTANCE_DISPATCH_ENTRIES;
 #if FFI_INSTANCE_LAYERS
-	res = p_layerInstanceInit(num_entries, &multiplex->first_layer->dispatch, &layer->dispatch, &layer->data);
+	struct instance_dispatch_s *target =
+		_profile ? &_profile_inst_dispatch :
+		multiplex->parent && old_chain->first_layer == multiplex->parent_layer ? &multiplex->platform_dispatch :
+		&old_chain->first_layer->dispatch;
+	res = p_layerInstanceInit(num_entries, target, &layer->dispatch, &layer->data);
 #else
 	res = p_layerInstanceInit(num_entries, &layer->dispatch, &layer->data);
 #endif
 	if (res)
-		goto error;
+		goto error_unlock;
+#if !FFI_INSTANCE_LAYERS
+	pfn_layerInstanceFilters_t p_layerInstanceFilters =
+		(pfn_layerInstanceFilters_t)(intptr_t)dlsym(lib, "layerInstanceFilters");
+	if (p_layerInstanceFilters && loadFilters(layer, arena, p_layerInstanceFilters)) {
+		p_layerInstanceDeinit(layer->data);
+		goto error_unlock;
+	}
+#endif
+	API_DRIVER_BATCH(CHECK_CHAIN_FANOUT)
+	API_DRIVER_CREATE_BULK(CHECK_BULK_CHAIN_FANOUT)
+	API_DRIVER_BULK(CHECK_BULK_CHAIN_FANOUT)
+	for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++)
+		chain->fanout[i] = old_chain->fanout[i] | layer->fanout[i];
 #if FFI_INSTANCE_LAYERS
 	/**
 	 * FFI instance layer's dispatch tables are completed so that the next
@@ -372,44 +1503,408 @@ loadInstanceLayer(struct multiplex_s *multiplex, const char *path) {
 	 */
 	for (size_t i = 0; i < num_entries; i++)
 		if (!((void **)&(layer->dispatch))[i])
-			((void **)&(layer->dispatch))[i] =
-				((void **)&(multiplex->first_layer->dispatch))[i];
+			((void **)&(layer->dispatch))[i] = ((void **)target)[i];
 #else
 	/**
 	 * Non FFI instance layer need to copy then update the layer_dispatch
 	 * table with the entries they provide.  This allows the layer chain to
 	 * provide the correct context to each layer.
 	 */
-	layer->layer_dispatch = multiplex->layer_dispatch;
+	layer->layer_dispatch = old_chain->layer_dispatch;
+	chain->layer_dispatch = old_chain->layer_dispatch;
 	for (size_t i = 0; i < num_entries; i++)
 		if (((void **)&(layer->dispatch))[i])
-			((struct instance_layer_s **)&(multiplex->layer_dispatch))[i] = layer;
+			((struct instance_layer_s **)&(chain->layer_dispatch))[i] = layer;
+	if (_profile) {
+		layer->profile_next = layer->layer_dispatch;
+		for (size_t i = 0; i < num_entries; i++)
+			((struct instance_layer_s **)&(layer->layer_dispatch))[i] = &_profile_inst_layer;
+	}
 #endif
-	layer->next = multiplex->first_layer;
-	multiplex->first_layer = layer;
+	layer->next = old_chain->first_layer;
+	chain->first_layer = layer;
+	chain->generation = old_chain->generation + 1;
+	updateDeviceChains(multiplex, chain, device_chains);
+	__atomic_store_n(&multiplex->chain, chain, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&_chain_mutex);
+	epochDefer(&freeChain, old_chain);
+	epochSynchronize();
+	freeDeviceChains(device_chains);
 	return SPEC_SUCCESS;
+error_unlock:
+	pthread_mutex_unlock(&_chain_mutex);
+	freeDeviceChains(device_chains);
 error:
-	if (layer)
-		free(layer);
+	if (chain)
+		freeChain(chain);
+	if (layer) {
+		free(layer->path);
+		arenaFree(layer, sizeof(struct instance_layer_s));
+	}
 	dlclose(lib);
 	return SPEC_ERROR;
 }
 
+/**
+ * Remove the outermost instance layer loaded from path from the chain of a
+ * multiplexing structure. As for attachment, a new chain is published, and
+ * the layers calling into the removed layer are made to call its next layer
+ * instead. FFI instance layers call the dispatch table of the next layer they
+ * were initialized with, so the dispatch table of the removed layer is kept
+ * in the removed list, filled with the entries of its next layer, and patched
+ * like the tables of the chain. The layer is deinitialized and unloaded after
+ * a grace period, once no API call can be executing in it, unless it wrapped
+ * extension functions the application may still call. The devices with their
+ * own layers stop going through the layer as well, see updateDeviceChains.
+ */
+static int
+removeInstanceLayer(struct multiplex_s *multiplex, const char *path) {
+	struct instance_layer_s *layer, *prev = NULL;
+	struct chain_s **device_chains;
+	struct chain_s *chain = (struct chain_s *)
+		arenaAlloc(MULTIPLEX_PLT(multiplex)->arena, sizeof(struct chain_s));
+	if (!chain)
+		return SPEC_ERROR;
+	pthread_mutex_lock(&_chain_mutex);
+	struct chain_s *old_chain = multiplex->chain;
+	for (layer = old_chain->first_layer; layer->library; prev = layer, layer = layer->next)
+		if (!strcmp(layer->path, path))
+			break;
+	if (!layer->library || allocDeviceChains(multiplex, &device_chains)) {
+		pthread_mutex_unlock(&_chain_mutex);
+		freeChain(chain);
+		return SPEC_ERROR;
+	}
+	chain->first_layer = prev ? old_chain->first_layer : layer->next;
+	for (struct instance_layer_s *l = chain->first_layer; l->library; l = l->next)
+		for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++)
+			chain->fanout[i] |= l != layer && l->fanout[i];
+	chain->generation = old_chain->generation + 1;
+#if FFI_INSTANCE_LAYERS
+	void *removed[NUM_INSTANCE_DISPATCH_ENTRIES];
+	memcpy(removed, &layer->dispatch, sizeof(removed));
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++) {
+		void *pfn = ((void **)&layer->next->dispatch)[i];
+		if (removed[i] != pfn)
+			patchInstanceLayers(multiplex, i, removed[i], pfn);
+	}
+#else
+	struct instance_layer_s **next = (struct instance_layer_s **)
+		(_profile ? &layer->profile_next : &layer->layer_dispatch);
+	chain->layer_dispatch = old_chain->layer_dispatch;
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++)
+		if (((struct instance_layer_s **)&chain->layer_dispatch)[i] == layer)
+			((struct instance_layer_s **)&chain->layer_dispatch)[i] = next[i];
+	for (struct instance_layer_s *l = old_chain->first_layer; l != layer; l = l->next) {
+		struct instance_layer_s **table = (struct instance_layer_s **)
+			(_profile ? &l->profile_next : &l->layer_dispatch);
+		for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++)
+			if (table[i] == layer)
+				__atomic_store_n(&table[i], next[i], __ATOMIC_RELEASE);
+	}
+#endif
+	updateDeviceChains(multiplex, chain, device_chains);
+	layer->next_removed = multiplex->removed;
+	multiplex->removed = layer;
+	if (prev)
+		__atomic_store_n(&prev->next, layer->next, __ATOMIC_RELEASE);
+	__atomic_store_n(&multiplex->chain, chain, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&_chain_mutex);
+	epochDefer(&freeChain, old_chain);
+	epochSynchronize();
+	freeDeviceChains(device_chains);
+	if (!layer->wrapped) {
+		layer->layerInstanceDeinit(layer->data);
+		dlclose(layer->library);
+		layer->library = NULL;
+	}
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Create the multiplexing structure of a device, sharing the instance layer
+ * chain of its platform: the chain is copied, with the platform terminator
+ * replaced by the device's, whose resolved dispatch table is kept up to date
+ * with the platform's by updateMultiplex. The structure is listed in its
+ * platform's before the device uses it.
+ */
+static struct multiplex_s *
+createDeviceMultiplex(struct multiplex_s *parent) {
+	struct arena_s *arena = MULTIPLEX_PLT(parent)->arena;
+	struct multiplex_s *multiplex = (struct multiplex_s *)
+		arenaAlloc(arena, sizeof(struct multiplex_s));
+	struct chain_s *chain = (struct chain_s *)
+		arenaAlloc(arena, sizeof(struct chain_s));
+	if (!multiplex || !chain) {
+		if (multiplex)
+			arenaFree(multiplex, sizeof(struct multiplex_s));
+		if (chain)
+			freeChain(chain);
+		return NULL;
+	}
+	pthread_mutex_lock(&_chain_mutex);
+	for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++) {
+		((void **)&multiplex->dispatch)[i] =
+			__atomic_load_n(&((void **)&parent->dispatch)[i], __ATOMIC_ACQUIRE);
+		((void **)&multiplex->resolved)[i] =
+			__atomic_load_n(&((void **)&parent->resolved)[i], __ATOMIC_ACQUIRE);
+	}
+	multiplex->terminator = parent->terminator;
+	*chain = *parent->chain;
+	if (chain->first_layer == &parent->terminator)
+		chain->first_layer = &multiplex->terminator;
+#if FFI_INSTANCE_LAYERS
+	multiplex->platform_dispatch = chain->first_layer->dispatch;
+#else
+	multiplex->terminator.data = &multiplex->resolved;
+	for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++)
+		if (((struct instance_layer_s **)&chain->layer_dispatch)[i] == &parent->terminator)
+			((struct instance_layer_s **)&chain->layer_dispatch)[i] = &multiplex->terminator;
+#endif
+	multiplex->platform = parent;
+	multiplex->chain = chain;
+	multiplex->parent = parent;
+	multiplex->parent_layer = chain->first_layer;
+	multiplex->next_device = parent->devices;
+	parent->devices = multiplex;
+	pthread_mutex_unlock(&_chain_mutex);
+	return multiplex;
+}
+
+/**
+ * Deinitialize and unload the instance layers of a device multiplexing
+ * structure, the platform layers of its chain excepted. When profiling, the
+ * profiler references the paths of the layers until profileFini, so the
+ * layers are kept in the removed list of the platform, and their paths freed
+ * by my_fini.
+ */
+static void
+releaseDeviceLayers(struct multiplex_s *multiplex) {
+	struct instance_layer_s *layer = multiplex->chain->first_layer;
+	while (layer != multiplex->parent_layer) {
+		struct instance_layer_s *next_layer = layer->next;
+		layer->layerInstanceDeinit(layer->data);
+		dlclose(layer->library);
+#if !FFI_INSTANCE_LAYERS
+		if (layer->filters)
+			arenaFree(layer->filters, layer->filters->size);
+#endif
+		if (_profile) {
+			layer->library = NULL;
+			pthread_mutex_lock(&_chain_mutex);
+			layer->next_removed = multiplex->parent->removed;
+			multiplex->parent->removed = layer;
+			pthread_mutex_unlock(&_chain_mutex);
+		} else {
+			free(layer->path);
+			arenaFree(layer, sizeof(struct instance_layer_s));
+		}
+		layer = next_layer;
+	}
+}
+
+static void
+freeDeviceMultiplex(void *arg) {
+	struct multiplex_s *multiplex = (struct multiplex_s *)arg;
+	releaseDeviceLayers(multiplex);
+	freeChain(multiplex->chain);
+	arenaFree(multiplex, sizeof(struct multiplex_s));
+}
+
+/**
+ * Unlist the multiplexing structure of a device, which is reclaimed along
+ * with its instance layers once no API call can be using them anymore.
+ */
+static void
+releaseDeviceMultiplex(struct multiplex_s *multiplex) {
+	pthread_mutex_lock(&_chain_mutex);
+	struct multiplex_s **p = &multiplex->parent->devices;
+	while (*p != multiplex)
+		p = &(*p)->next_device;
+	*p = multiplex->next_device;
+	pthread_mutex_unlock(&_chain_mutex);
+	epochDefer(&freeDeviceMultiplex, multiplex);
+}
+
+/**
+ * Extension functions queried on a platform are cached in an open addressing
+ * hash table, so repeated queries don't go back to the driver and the layers.
+ * Entries are never modified once published, and record the generation of the
+ * instance layer chain that wrapped the function: when instance layers are
+ * attached to the platform, the next query wraps the function again, and
+ * replaces the entry. Functions the platform doesn't support are cached as
+ * well. Lookups don't lock: tables and replaced entries are reclaimed after a
+ * grace period.
+ */
+#define EXT_TABLE_MIN_SIZE 16
+
+struct ext_func_s {
+	uint64_t  generation;
+	void     *func;
+	uint32_t  hash;
+	char      name[];
+};
+
+struct ext_table_s {
+	size_t              size;
+	struct ext_func_s  *entries[];
+};
+
+/**
+ * Return the entry for name, or NULL, in which case index_ret is set to the
+ * free slot the entry would be inserted at. Tables are never more than half
+ * full, so the search always ends.
+ */
+static struct ext_func_s *
+findExtFunc(struct ext_table_s *table, uint32_t hash, const char *name, size_t *index_ret) {
+	size_t mask = table->size - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct ext_func_s *entry = __atomic_load_n(&table->entries[i], __ATOMIC_ACQUIRE);
+		if (!entry || (entry->hash == hash && !strcmp(entry->name, name))) {
+			if (index_ret)
+				*index_ret = i;
+			return entry;
+		}
+	}
+}
+
+/**
+ * Insert or replace an entry, growing the table if needed. Called with the
+ * chain mutex held.
+ */
+static int
+insertExtFunc(struct multiplex_s *multiplex, struct ext_func_s *entry) {
+	struct ext_table_s *table = multiplex->ext_table;
+	size_t index;
+	if (!table || (multiplex->num_ext_funcs + 1) * 2 > table->size) {
+		size_t size = table ? table->size * 2 : EXT_TABLE_MIN_SIZE;
+		struct ext_table_s *new_table = (struct ext_table_s *)
+			calloc(1, sizeof(struct ext_table_s) + size * sizeof(struct ext_func_s *));
+		if (!new_table)
+			return SPEC_ERROR;
+		new_table->size = size;
+		for (size_t i = 0; table && i < table->size; i++)
+			if (table->entries[i]) {
+				findExtFunc(new_table, table->entries[i]->hash, table->entries[i]->name, &index);
+				new_table->entries[index] = table->entries[i];
+			}
+		__atomic_store_n(&multiplex->ext_table, new_table, __ATOMIC_RELEASE);
+		if (table)
+			epochDefer(&free, table);
+		table = new_table;
+	}
+	struct ext_func_s *old_entry = findExtFunc(table, entry->hash, entry->name, &index);
+	__atomic_store_n(&table->entries[index], entry, __ATOMIC_RELEASE);
+	if (old_entry)
+		epochDefer(&free, old_entry);
+	else
+		multiplex->num_ext_funcs++;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Give each instance layer of a chain the opportunity to wrap an extension
+ * function, innermost layer first.
+ */
+static void *
+wrapExtFunc(struct instance_layer_s *layer, const char *name, void *func) {
+	if (!layer->library)
+		return func;
+	func = wrapExtFunc(layer->next, name, func);
+	void *wrapper = NULL;
+	if (layer->layerInstanceWrapFunc &&
+	    layer->layerInstanceWrapFunc(layer->data, name, func, &wrapper) == SPEC_SUCCESS &&
+	    wrapper) {
+		layer->wrapped = 1;
+		return wrapper;
+	}
+	return func;
+}
+
+/**
+ * Return the head of the chain of an extension function of a platform: the
+ * driver function wrapped by the instance layers of the platform that support
+ * it.
+ */
+static int
+getExtensionFunc(struct multiplex_s *multiplex, const char *name, void **func_ret) {
+	uint32_t hash = apiHash(0, name);
+	struct ext_func_s *entry = NULL;
+	void *func;
+	epochEnter();
+	struct chain_s *chain = __atomic_load_n(&multiplex->chain, __ATOMIC_ACQUIRE);
+	struct ext_table_s *table = __atomic_load_n(&multiplex->ext_table, __ATOMIC_ACQUIRE);
+	if (table)
+		entry = findExtFunc(table, hash, name, NULL);
+	if (entry && entry->generation == chain->generation) {
+		func = entry->func;
+		epochExit();
+		goto end;
+	}
+	epochExit();
+	size_t len = strlen(name);
+	struct ext_func_s *new_entry = (struct ext_func_s *)
+		malloc(sizeof(struct ext_func_s) + len + 1);
+	if (!new_entry)
+		return SPEC_ERROR;
+	pthread_mutex_lock(&_chain_mutex);
+	chain = multiplex->chain;
+	entry = multiplex->ext_table ?
+		findExtFunc(multiplex->ext_table, hash, name, NULL) : NULL;
+	if (entry && entry->generation == chain->generation) {
+		/* another thread was faster */
+		func = entry->func;
+		free(new_entry);
+	} else {
+		struct plt_s *plt = MULTIPLEX_PLT(multiplex);
+		func = plt->driver->platformGetFuncExt(plt->platform, name);
+		if (func)
+			func = wrapExtFunc(chain->first_layer, name, func);
+		new_entry->generation = chain->generation;
+		new_entry->func = func;
+		new_entry->hash = hash;
+		memcpy(new_entry->name, name, len + 1);
+		if (insertExtFunc(multiplex, new_entry))
+			free(new_entry);
+	}
+	pthread_mutex_unlock(&_chain_mutex);
+	epochSynchronize();
+end:
+	*func_ret = func;
+	return func ? SPEC_SUCCESS : SPEC_UNSUPPORTED;
+}
+
 /**
  * Load drivers and global layers, both lists provided in colon separated list
- * given by environment variables.
+ * given by environment variables. Baked loaders use their baked drivers and
+ * global layers instead, and don't support profiling, as their global layers
+ * are not part of the global layer list.
  */
 static void
 initReal() {
+#if !BAKED_LOADER
+	char *profile = getenv("LAYER_PROFILE");
+	if (profile && *profile && !profileInit(profile))
+		_profile = 1;
+#endif
+	char *lazy = getenv("LAZY_DISPATCH");
+	if (lazy && atoi(lazy))
+		_lazy_resolution = 1;
+	char *validate = getenv("VALIDATE_HANDLES");
+	if (validate && atoi(validate) && !registryInit(&_live_handles))
+		_validate_handles = 1;
+	char *cache = getenv("LOADER_CACHE");
+	if (cache && *cache && !discoveryInit(cache, NUM_DRIVER_DISPATCH_ENTRIES))
+		_discovery = 1;
+#if BAKED_LOADER
+	loadBakedDrivers();
+	loadBakedLayers();
+#else
 	char *drivers = getenv("DRIVERS");
-	if (drivers) {
-		char *next_file = drivers;
-		while (NULL != next_file && *next_file != '\0') {
-			char *cur_file = next_file;
-			next_file = get_next(cur_file);
-			loadDriver(cur_file);
-		}
-	}
+	if (drivers)
+		loadDrivers(drivers);
+	if (_discovery)
+		discoveryFlush();
 	char *layers = getenv("LAYERS");
 	if (layers) {
 		char *next_file = layers;
@@ -419,6 +1914,12 @@ initReal() {
 			loadLayer(cur_file);
 		}
 	}
+#endif
+	if (_profile) {
+		_profile_head.next = _first_layer;
+		_first_layer = &_profile_head;
+		updatePlatforms();
+	}
 }
 
 static void
@@ -432,60 +1933,304 @@ initOnce(void) {
 int
 getPlatforms(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) {
 	initOnce();
-	return _first_layer->dispatch.getPlatforms(num_platforms, platforms, num_platforms_ret);
+	return GLOBAL_CALL(getPlatforms, (num_platforms, platforms, num_platforms_ret));
 }
 
 int
 platformAddLayer(platform_t platform, const char *layer_name) {
-	return _first_layer->dispatch.platformAddLayer(platform, layer_name);
+	return GLOBAL_CALL(platformAddLayer, (platform, layer_name));
+}
+
+int
+platformGetFunc(platform_t platform, const char *name, void **func_ret) {
+	return GLOBAL_CALL(platformGetFunc, (platform, name, func_ret));
+}
+
+int
+platformCreateQueue(platform_t platform, queue_t *queue_ret) {
+	return GLOBAL_CALL(platformCreateQueue, (platform, queue_ret));
+}
+
+int
+deviceCreateQueue(device_t device, queue_t *queue_ret) {
+	return GLOBAL_CALL(deviceCreateQueue, (device, queue_ret));
+}
+
+int
+queueDestroy(queue_t queue) {
+	return GLOBAL_CALL(queueDestroy, (queue));
+}
+
+int
+eventQuery(event_t event, int *complete_ret, int *result_ret) {
+	return GLOBAL_CALL(eventQuery, (event, complete_ret, result_ret));
+}
+
+int
+eventWait(size_t num_events, const event_t *events) {
+	return GLOBAL_CALL(eventWait, (num_events, events));
+}
+
+int
+eventRelease(event_t event) {
+	return GLOBAL_CALL(eventRelease, (event));
+}
+
+int
+layerSetEnabled(const char *layer_name, int enabled) {
+	return GLOBAL_CALL(layerSetEnabled, (layer_name, enabled));
+}
+
+int
+platformRemoveLayer(platform_t platform, const char *layer_name) {
+	return GLOBAL_CALL(platformRemoveLayer, (platform, layer_name));
+}
+
+int
+addDriver(const char *driver_name) {
+	initOnce();
+	return GLOBAL_CALL(addDriver, (driver_name));
+}
+
+int
+deviceAddLayer(device_t device, const char *layer_name) {
+	return GLOBAL_CALL(deviceAddLayer, (device, layer_name));
+}
+
+#define DEFINE_ENQUEUE_ENTRY_POINT(api, target, handle_type, queue, event_ret, params, args, fields, elems, call) \
+int \
+api params { \
+	return GLOBAL_CALL(api, args); \
 }
+API_ENQUEUE(DEFINE_ENQUEUE_ENTRY_POINT)
 
 /**
  * For driver implemented APIs, the global entry point calls into the instance
- * layer chain.
+ * layer chain. FFI instance layers complete their dispatch table with the
+ * entries of the next layer, so the first layer dispatch table contains the
+ * resolved target for APIs no instance layer intercepts. Non FFI instance
+ * layers require the layer context, so when the first layer is the
+ * terminator, the resolved target is called directly.
  */
 
 #if FFI_INSTANCE_LAYERS
-#define NEXT_LAYER(handle, api) (handle->multiplex->first_layer)
-#define NEXT_ENTRY(handle, api) NEXT_LAYER(handle, api)->dispatch.api ## _instance
-#define CALL_FIRST_LAYER(handle, api, ...) NEXT_ENTRY(handle, api)(__VA_ARGS__)
+#define NEXT_LAYER(chain, api) (chain->first_layer)
+#define NEXT_ENTRY(chain, api) NEXT_LAYER(chain, api)->dispatch.api ## _instance
+#if BAKED_LOADER
+#define CALL_CHAIN(chain, handle, api, ...) ( \
+	NEXT_LAYER(chain, api) == &handle->multiplex->terminator ? \
+	BAKED_CHAIN(api)(__VA_ARGS__) : \
+	NEXT_ENTRY(chain, api)(__VA_ARGS__))
 #else
-#define NEXT_LAYER(handle, api) (handle->multiplex->layer_dispatch.api ## _next)
-#define NEXT_ENTRY(handle, api) NEXT_LAYER(handle, api)->dispatch.api ## _instance
-#define CALL_FIRST_LAYER(handle, api, ...) NEXT_ENTRY(handle, api)(NEXT_LAYER(handle, api), __VA_ARGS__)
+#define CALL_CHAIN(chain, handle, api, ...) NEXT_ENTRY(chain, api)(__VA_ARGS__)
+#endif
+#else
+#define NEXT_LAYER(chain, api) (chain->layer_dispatch.api ## _next)
+#define NEXT_ENTRY(chain, api) NEXT_LAYER(chain, api)->dispatch.api ## _instance
+#if BAKED_LOADER
+#define CALL_TERMINATOR(handle, api, ...) BAKED_CHAIN(api)(__VA_ARGS__)
+#else
+#define CALL_TERMINATOR(handle, api, ...) handle->multiplex->resolved.api(__VA_ARGS__)
+#endif
+#define CALL_CHAIN(chain, handle, api, ...) ( \
+	(struct instance_layer_s *)NEXT_LAYER(chain, api) == &handle->multiplex->terminator ? \
+	CALL_TERMINATOR(handle, api, __VA_ARGS__) : \
+	NEXT_ENTRY(chain, api)(NEXT_LAYER(chain, api), __VA_ARGS__))
 #endif
 
-int
-platformCreateDevice(platform_t platform, device_t *device_ret) {
-	if (!platform)
-		return _first_layer->dispatch.platformCreateDevice(platform, device_ret);
-	else
-		return CALL_FIRST_LAYER(platform, platformCreateDevice, platform, device_ret);
+#define CALL_FIRST_LAYER(chain, handle, api, ...) ( \
+	__builtin_expect(_profile, 0) ? api ## _prof_first(chain, __VA_ARGS__) : \
+	CALL_CHAIN(chain, handle, api, __VA_ARGS__))
+
+/**
+ * The instance layer chain is loaded once per call, and the call happens in an
+ * epoch read side critical section so the chain can't be reclaimed while in
+ * use.
+ */
+#define LOAD_CHAIN(handle) __atomic_load_n(&handle->multiplex->chain, __ATOMIC_ACQUIRE)
+
+/**
+ * In handle validation mode, entry points look their handles up in the live
+ * handle registry before loading the chain. APIs releasing their handle
+ * remove it from the registry before the call instead, so that when a handle
+ * is released several times, concurrently or not, only one call goes through,
+ * and a driver reusing the handle can't see it removed after it was created
+ * again.
+ */
+#define DESTROY_ENTRY(api, handle, params, args) [DRIVER_SLOT(api)] = 1,
+static const unsigned char _destroys[NUM_DRIVER_DISPATCH_ENTRIES] = {
+	API_DRIVER_DESTROY(DESTROY_ENTRY)
+};
+
+static inline int
+validateHandle(size_t slot, const void *handle) {
+	if (_destroys[slot])
+		return registryRemove(&_live_handles, handle) ? SPEC_ERROR : SPEC_SUCCESS;
+	return registryContains(&_live_handles, handle) ? SPEC_SUCCESS : SPEC_ERROR;
 }
 
-int
-deviceFunc1(device_t device, int param) {
-	if (!device)
-		return _first_layer->dispatch.deviceFunc1(device, param);
-	else
-		return CALL_FIRST_LAYER(device, deviceFunc1, device, param);
+/**
+ * Handles of bulk calls are all validated, or none: handles released before
+ * an invalid one are restored. Bulk calls failing after validation restore
+ * their handles as well.
+ */
+static void
+restoreHandles(size_t slot, size_t num, const void * const *handles) {
+	while (_destroys[slot] && num--)
+		registryInsert(&_live_handles, handles[num]);
 }
 
-int
-deviceFunc2(device_t device, int param) {
-	if (!device)
-		return _first_layer->dispatch.deviceFunc2(device, param);
-	else
-		return CALL_FIRST_LAYER(device, deviceFunc2, device, param);
+static int
+validateHandles(size_t slot, size_t num, const void * const *handles) {
+	for (size_t i = 0; i < num; i++)
+		if (validateHandle(slot, handles[i])) {
+			restoreHandles(slot, i, handles);
+			return SPEC_ERROR;
+		}
+	return SPEC_SUCCESS;
 }
 
-int
-deviceDestroy(device_t device) {
-	if (!device)
-		return _first_layer->dispatch.deviceDestroy(device);
-	else
-		return CALL_FIRST_LAYER(device, deviceDestroy, device);
+#define CHECK_HANDLE(api, handle) \
+	if (__builtin_expect(_validate_handles, 0) && \
+	    validateHandle(DRIVER_SLOT(api), handle)) { \
+		epochExit(); \
+		return SPEC_ERROR; \
+	}
+
+#define CHECK_HANDLES(single, num, handles) \
+	if (__builtin_expect(_validate_handles, 0) && \
+	    validateHandles(DRIVER_SLOT(single), num, (const void * const *)handles)) { \
+		epochExit(); \
+		return SPEC_ERROR; \
+	}
+
+/**
+ * Loader implemented APIs validate their handle outside of entry points.
+ */
+static int
+handleIsLive(const void *handle) {
+	if (!_validate_handles)
+		return 1;
+	epochEnter();
+	int live = registryContains(&_live_handles, handle);
+	epochExit();
+	return live;
+}
+
+#define DEFINE_ENTRY_POINT(api, handle, params, args) \
+int \
+api params { \
+	if (!handle) \
+		return GLOBAL_CALL(api, args); \
+	epochEnter(); \
+	CHECK_HANDLE(api, handle) \
+	struct chain_s *chain = LOAD_CHAIN(handle); \
+	int res = CALL_FIRST_LAYER(chain, handle, api, EXPAND args); \
+	epochExit(); \
+	return res; \
+}
+API_DRIVER_SINGLE(DEFINE_ENTRY_POINT)
+
+/**
+ * Batches are fanned out to the entry point of the API they batch when a
+ * layer would not see them otherwise, in which case the chain is still only
+ * loaded once.
+ */
+#define DEFINE_BATCH_ENTRY_POINT(api, single, handle, params, args, num, elems, results) \
+int \
+api params { \
+	if (!handle) \
+		return GLOBAL_CALL(api, args); \
+	epochEnter(); \
+	CHECK_HANDLE(api, handle) \
+	struct chain_s *chain = LOAD_CHAIN(handle); \
+	int res; \
+	if (_global_fanout[DRIVER_SLOT(api)] || chain->fanout[DRIVER_SLOT(api)]) { \
+		res = SPEC_SUCCESS; \
+		if (num && (!elems || !results)) \
+			res = SPEC_ERROR; \
+		else \
+			for (size_t i = 0; i < num; i++) { \
+				results[i] = CALL_FIRST_LAYER(chain, handle, single, handle, elems[i]); \
+				if (results[i] != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+					res = results[i]; \
+			} \
+	} else \
+		res = CALL_FIRST_LAYER(chain, handle, api, EXPAND args); \
+	epochExit(); \
+	return res; \
 }
+API_DRIVER_BATCH(DEFINE_BATCH_ENTRY_POINT)
+
+/**
+ * Bulk calls are fanned out the same way. Handles that could not be created
+ * are NULL, and destroyed handles must all belong to the platform the call is
+ * dispatched through. Bulk calls on handles with different instance layer
+ * chains, devices with their own layers, are fanned out, each call going
+ * through the chain of its handle.
+ */
+#define MULTIPLEX_ROOT(m) ((m)->parent ? (m)->parent : (m))
+
+#define DEFINE_CREATE_BULK_ENTRY_POINT(api, single, handle, params, args, num, handles_ret) \
+int \
+api params { \
+	if (!handle) \
+		return GLOBAL_CALL(api, args); \
+	epochEnter(); \
+	CHECK_HANDLE(api, handle) \
+	struct chain_s *chain = LOAD_CHAIN(handle); \
+	int res; \
+	if (_global_fanout[DRIVER_SLOT(api)] || chain->fanout[DRIVER_SLOT(api)]) { \
+		res = SPEC_SUCCESS; \
+		if (num && !handles_ret) \
+			res = SPEC_ERROR; \
+		else \
+			for (size_t i = 0; i < num; i++) { \
+				handles_ret[i] = NULL; \
+				int r = CALL_FIRST_LAYER(chain, handle, single, handle, &handles_ret[i]); \
+				if (r != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+					res = r; \
+			} \
+	} else \
+		res = CALL_FIRST_LAYER(chain, handle, api, EXPAND args); \
+	epochExit(); \
+	return res; \
+}
+API_DRIVER_CREATE_BULK(DEFINE_CREATE_BULK_ENTRY_POINT)
+
+#define DEFINE_BULK_ENTRY_POINT(api, single, handle, params, args, num, handles) \
+int \
+api params { \
+	if (!handle) \
+		return GLOBAL_CALL(api, args); \
+	epochEnter(); \
+	CHECK_HANDLES(single, num, handles) \
+	struct chain_s *chain = LOAD_CHAIN(handle); \
+	int res, mixed = 0; \
+	for (size_t i = 0; i < num; i++) \
+		if (handles[i] && handles[i]->multiplex != handle->multiplex) \
+			mixed = 1; \
+	if (mixed || _global_fanout[DRIVER_SLOT(api)] || chain->fanout[DRIVER_SLOT(api)]) { \
+		res = SPEC_SUCCESS; \
+		for (size_t i = 0; i < num; i++) \
+			if (!handles[i] || MULTIPLEX_ROOT(handles[i]->multiplex) != MULTIPLEX_ROOT(handle->multiplex)) \
+				res = SPEC_ERROR; \
+		if (res != SPEC_SUCCESS && __builtin_expect(_validate_handles, 0)) \
+			restoreHandles(DRIVER_SLOT(single), num, (const void * const *)handles); \
+		if (res == SPEC_SUCCESS) \
+			for (size_t i = 0; i < num; i++) { \
+				struct chain_s *c = handles[i]->multiplex == handle->multiplex ? \
+					chain : LOAD_CHAIN(handles[i]); \
+				int r = CALL_FIRST_LAYER(c, handles[i], single, handles[i]); \
+				if (r != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+					res = r; \
+			} \
+	} else \
+		res = CALL_FIRST_LAYER(chain, handle, api, EXPAND args); \
+	epochExit(); \
+	return res; \
+}
+API_DRIVER_BULK(DEFINE_BULK_ENTRY_POINT)
 
 /**
  * Global layer terminators.
@@ -496,144 +2241,764 @@ deviceDestroy(device_t device) {
  */
 static int
 getPlatforms_disp(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) {
+	int res = SPEC_SUCCESS;
+	epochEnter();
+	struct platform_array_s *array = __atomic_load_n(&_platforms, __ATOMIC_ACQUIRE);
+	size_t count = __atomic_load_n(&array->num_platforms, __ATOMIC_ACQUIRE);
 	if (num_platforms_ret)
-		*num_platforms_ret = _num_platforms;
+		*num_platforms_ret = count;
 	if (num_platforms && platforms) {
-		if (num_platforms < _num_platforms)
-			return SPEC_ERROR;
-		struct plt_s *plt = _first_platform;
-		size_t i = 0;
-		while (plt) {
-			platforms[i] = plt->platform;
-			plt = plt->next;
-			i++;
+		if (num_platforms < count) {
+			res = SPEC_ERROR;
+			goto end;
 		}
-		while (i < num_platforms)
+		memcpy(platforms, array->platforms, count * sizeof(platform_t));
+		for (size_t i = count; i < num_platforms; i++)
 			platforms[i] = NULL;
 	}
-	return SPEC_SUCCESS;
+end:
+	epochExit();
+	return res;
 }
 
 static int
 platformAddLayer_disp(platform_t platform, const char *layer_name) {
+	if (!platform || !handleIsLive(platform))
+		return SPEC_ERROR;
 	return loadInstanceLayer(platform->multiplex, layer_name);
 }
 
+static int
+platformRemoveLayer_disp(platform_t platform, const char *layer_name) {
+	if (!platform || !layer_name || !handleIsLive(platform))
+		return SPEC_ERROR;
+	return removeInstanceLayer(platform->multiplex, layer_name);
+}
+
 /**
- * These are driver implemented and call into the dispatch tables.
+ * The first instance layer attached to a device gives it its own multiplexing
+ * structure, which the device switches to once the layer is attached. Calls
+ * in progress, and the handles created from the device before, keep using
+ * the platform's.
  */
-
 static int
-platformCreateDevice_disp(platform_t platform, device_t *device_ret) {
-	if (!platform)
+deviceAddLayer_disp(device_t device, const char *layer_name) {
+	if (!device || !layer_name || !handleIsLive(device))
 		return SPEC_ERROR;
-	int result = platform->multiplex->dispatch.platformCreateDevice(platform, device_ret);
-	/* Devices inherit from the platfom multiplex structure reference */
-	if (result == SPEC_SUCCESS)
-		(*device_ret)->multiplex = platform->multiplex;
-	return result;
+	int res;
+	pthread_mutex_lock(&_device_mutex);
+	struct multiplex_s *multiplex = device->multiplex;
+	if (multiplex->parent)
+		res = loadInstanceLayer(multiplex, layer_name);
+	else {
+		multiplex = createDeviceMultiplex(multiplex);
+		if (!multiplex)
+			res = SPEC_ERROR;
+		else if ((res = loadInstanceLayer(multiplex, layer_name)))
+			releaseDeviceMultiplex(multiplex);
+		else
+			__atomic_store_n(&device->multiplex, multiplex, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&_device_mutex);
+	return res;
 }
 
+/**
+ * Layers are enabled and disabled by republishing the global layer dispatch
+ * tables and the resolved dispatch tables. Batches the layer requires to be
+ * fanned out are fanned out before the layer is enabled, and until it is
+ * disabled: the grace periods ensure no call can have loaded the previous
+ * fanout flags while seeing the new tables. As grace periods wait for API
+ * calls in progress, layers must not call this from an API call.
+ */
 static int
-deviceFunc1_disp(device_t device, int param) {
-	if (!device)
+layerSetEnabled_disp(const char *layer_name, int enabled) {
+	struct layer_s *layer;
+	unsigned char fanout[NUM_DRIVER_DISPATCH_ENTRIES];
+	if (!layer_name)
 		return SPEC_ERROR;
-	return device->multiplex->dispatch.deviceFunc1(device, param);
+	pthread_mutex_lock(&_layer_mutex);
+	for (layer = _first_layer; layer != &_layer_terminator; layer = layer->next)
+		if (layer->path && !strcmp(layer->path, layer_name))
+			break;
+	if (layer == &_layer_terminator) {
+		pthread_mutex_unlock(&_layer_mutex);
+		return SPEC_ERROR;
+	}
+	if (layer->enabled != !!enabled) {
+		layer->enabled = !!enabled;
+		globalFanout(fanout);
+		for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++)
+			if (fanout[i])
+				__atomic_store_n(&_global_fanout[i], 1, __ATOMIC_RELAXED);
+		epochSynchronize();
+		pthread_mutex_lock(&_chain_mutex);
+		publishLayer(_first_layer);
+		updatePlatforms();
+		pthread_mutex_unlock(&_chain_mutex);
+		epochSynchronize();
+		for (size_t i = 0; i < NUM_DRIVER_DISPATCH_ENTRIES; i++)
+			__atomic_store_n(&_global_fanout[i], fanout[i], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&_layer_mutex);
+	return SPEC_SUCCESS;
 }
 
+/**
+ * Drivers are added one at a time, as loading a driver twice would make it
+ * return the handles of the platforms already published. A driver is already
+ * loaded if it was listed under the same name, or if its library is, as the
+ * same library can be named through different paths. Loading only holds
+ * _driver_mutex, as drivers may take a while to initialize. The resolved
+ * tables of the new platforms are then computed again, and the platforms
+ * published, while holding _layer_mutex, so they can't miss a global layer
+ * toggle. Platforms are published with their multiplexing structure set,
+ * and enumerations never lock, see appendPlatforms.
+ */
 static int
-deviceFunc2_disp(device_t device, int param) {
-	if (!device)
+addDriver_disp(const char *driver_name) {
+	struct driver_s *driver;
+	int res;
+	if (!driver_name)
+		return SPEC_ERROR;
+	pthread_mutex_lock(&_driver_mutex);
+	void *lib = loadLibrary(driver_name);
+	if (!lib) {
+		pthread_mutex_unlock(&_driver_mutex);
 		return SPEC_ERROR;
-	return device->multiplex->dispatch.deviceFunc2(device, param);
+	}
+	for (driver = _first_driver; driver; driver = driver->next)
+		if (!strcmp(driver->path, driver_name) || driver->library == lib) {
+			dlclose(lib);
+			pthread_mutex_unlock(&_driver_mutex);
+			return SPEC_ERROR;
+		}
+	driver = loadDriver(driver_name);
+	dlclose(lib);
+	if (!driver) {
+		pthread_mutex_unlock(&_driver_mutex);
+		return SPEC_ERROR;
+	}
+	pthread_mutex_lock(&_layer_mutex);
+	pthread_mutex_lock(&_chain_mutex);
+	for (size_t i = 0; i < driver->num_platforms; i++)
+		updateMultiplex(driver->platforms[i]->multiplex);
+	pthread_mutex_unlock(&_chain_mutex);
+	pthread_mutex_lock(&_platform_mutex);
+	res = insertDriver(driver);
+	pthread_mutex_unlock(&_platform_mutex);
+	pthread_mutex_unlock(&_layer_mutex);
+	if (res)
+		unloadDriver(driver);
+	else if (_discovery)
+		discoveryFlush();
+	pthread_mutex_unlock(&_driver_mutex);
+	return res;
 }
 
+/**
+ * API names resolve to the loader entry points, other names to extension
+ * functions of the platform.
+ */
+#define LOADER_ENTRY_POINT(api, params, args) .api = &api,
+#define ENTRY_POINT(api, handle, params, args) .api = &api,
+static struct dispatch_s _entry_points = {
+	API_LOADER(LOADER_ENTRY_POINT)
+	API_DRIVER(ENTRY_POINT)
+};
+
 static int
-deviceDestroy_disp(device_t device) {
-	if (!device)
+platformGetFunc_disp(platform_t platform, const char *name, void **func_ret) {
+	if (!platform || !name || !func_ret || !handleIsLive(platform))
 		return SPEC_ERROR;
-	return device->multiplex->dispatch.deviceDestroy(device);
+	const struct api_entry_s *entry = apiLookup(name);
+	if (entry) {
+		*func_ret = ((void **)&_entry_points)[entry->slot];
+		return SPEC_SUCCESS;
+	}
+	return getExtensionFunc(platform->multiplex, name, func_ret);
+}
+
+/**
+ * These are driver implemented and call into the dispatch tables. Baked
+ * drivers are called directly.
+ */
+#if BAKED_LOADER
+#define DRIVER_CALL(multiplex, api, args) \
+	BAKED_DRIVER_CALL(MULTIPLEX_PLT(multiplex)->driver->baked, api, args, (multiplex)->dispatch.api args)
+#else
+#define DRIVER_CALL(multiplex, api, args) (multiplex)->dispatch.api args
+#endif
+
+#define DEFINE_CREATE_DISP(api, handle, params, args, handle_ret) \
+static int \
+api ## _disp params { \
+	if (!handle) \
+		return SPEC_ERROR; \
+	int result = DRIVER_CALL(handle->multiplex, api, args); \
+	/* Created handles inherit from the parent multiplex structure reference */ \
+	if (result == SPEC_SUCCESS) { \
+		(*handle_ret)->multiplex = handle->multiplex; \
+		/* out of memory, the handle can't be used and is lost */ \
+		if (_validate_handles && registryInsert(&_live_handles, *handle_ret)) { \
+			*handle_ret = NULL; \
+			result = SPEC_ERROR; \
+		} \
+	} \
+	return result; \
+}
+API_DRIVER_CREATE(DEFINE_CREATE_DISP)
+
+/**
+ * Destroyed devices release their multiplexing structure, if they have their
+ * own.
+ */
+#define DEFINE_DISP(api, handle, params, args) \
+static int \
+api ## _disp params { \
+	if (!handle) \
+		return SPEC_ERROR; \
+	struct multiplex_s *multiplex = handle->multiplex; \
+	int result = DRIVER_CALL(multiplex, api, args); \
+	if (_destroys[DRIVER_SLOT(api)] && result == SPEC_SUCCESS && multiplex->parent) \
+		releaseDeviceMultiplex(multiplex); \
+	return result; \
 }
+API_DRIVER_CALL(DEFINE_DISP)
+
+#define DEFINE_BATCH_DISP(api, single, handle, params, args, num, elems, results) \
+	DEFINE_DISP(api, handle, params, args)
+API_DRIVER_BATCH(DEFINE_BATCH_DISP)
+
+/**
+ * Handles created in bulk all inherit from the parent multiplex structure
+ * reference, in a single pass. The array is cleared before calling the
+ * driver, so entries it didn't write on failure are NULL and skipped.
+ */
+#define DEFINE_CREATE_BULK_DISP(api, single, handle, params, args, num, handles_ret) \
+static int \
+api ## _disp params { \
+	if (!handle) \
+		return SPEC_ERROR; \
+	if (num && !handles_ret) \
+		return SPEC_ERROR; \
+	for (size_t i = 0; i < num; i++) \
+		handles_ret[i] = NULL; \
+	int result = DRIVER_CALL(handle->multiplex, api, args); \
+	for (size_t i = 0; i < num; i++) \
+		if (handles_ret[i]) { \
+			handles_ret[i]->multiplex = handle->multiplex; \
+			if (_validate_handles && registryInsert(&_live_handles, handles_ret[i])) { \
+				handles_ret[i] = NULL; \
+				result = SPEC_ERROR; \
+			} \
+		} \
+	return result; \
+}
+API_DRIVER_CREATE_BULK(DEFINE_CREATE_BULK_DISP)
+
+/**
+ * Handles of bulk calls must share their multiplexing structure, as drivers
+ * are called once for all of them. Entry points fan bulk calls out otherwise.
+ */
+#define DEFINE_BULK_DISP(api, single, handle, params, args, num, handles) \
+static int \
+api ## _disp params { \
+	if (!num) \
+		return SPEC_SUCCESS; \
+	if (!handle) \
+		return SPEC_ERROR; \
+	struct multiplex_s *multiplex = handle->multiplex; \
+	for (size_t i = 0; i < num; i++) \
+		if (!handles[i] || handles[i]->multiplex != multiplex) \
+			return SPEC_ERROR; \
+	int result = DRIVER_CALL(multiplex, api, args); \
+	if (_destroys[DRIVER_SLOT(single)] && result == SPEC_SUCCESS && multiplex->parent) \
+		releaseDeviceMultiplex(multiplex); \
+	return result; \
+}
+API_DRIVER_BULK(DEFINE_BULK_DISP)
+
+/**
+ * Asynchronous calls. Queues are bound to a platform or a device, and their
+ * worker thread calls the API entry points, so asynchronous calls go through
+ * the global and instance layers. Enqueuing never locks: calls are pushed on
+ * the lock-free work queue (see queue.h). Live queues are listed so that they
+ * can be drained when the loader is unloaded.
+ */
+struct queue_s {
+	void                *handle;
+	enum api_handle_e    handle_type;
+	struct work_queue_s  work_queue;
+	struct queue_s      *prev;
+	struct queue_s      *next;
+};
+
+static struct queue_s  *_first_queue = NULL;
+static pthread_mutex_t  _queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * Unsupported API stubs.
+ * Events are the work items of the enqueued calls, and are followed by the
+ * call arguments in the same allocation. They are referenced by the queue
+ * until the call completes, and by the application until released.
  */
+struct event_s {
+	struct work_s work;
+	int           refs;
+	int           complete;
+	int           result;
+};
+
+/**
+ * Threads waiting for events sleep on a single condition, that is only
+ * signaled when there are waiters, so completing a call doesn't lock in the
+ * common case.
+ */
+static int             _event_waiters = 0;
+static pthread_mutex_t _event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  _event_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+releaseEvent(struct event_s *event) {
+	if (!__atomic_sub_fetch(&event->refs, 1, __ATOMIC_ACQ_REL))
+		free(event);
+}
+
+static void
+completeEvent(struct event_s *event, int result) {
+	event->result = result;
+	__atomic_store_n(&event->complete, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&_event_waiters, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&_event_mutex);
+		pthread_cond_broadcast(&_event_cond);
+		pthread_mutex_unlock(&_event_mutex);
+	}
+	releaseEvent(event);
+}
+
 static int
-platformCreateDevice_unsup(platform_t platform, device_t *device_ret) {
-	(void)platform;
-	(void)device_ret;
-	return SPEC_UNSUPPORTED;
+createQueue(void *handle, enum api_handle_e handle_type, queue_t *queue_ret) {
+	if (!handle || !queue_ret || !handleIsLive(handle))
+		return SPEC_ERROR;
+	struct queue_s *queue = (struct queue_s *)calloc(1, sizeof(struct queue_s));
+	if (!queue)
+		return SPEC_ERROR;
+	queue->handle = handle;
+	queue->handle_type = handle_type;
+	if (workQueueInit(&queue->work_queue)) {
+		free(queue);
+		return SPEC_ERROR;
+	}
+	pthread_mutex_lock(&_queue_mutex);
+	queue->next = _first_queue;
+	if (_first_queue)
+		_first_queue->prev = queue;
+	_first_queue = queue;
+	pthread_mutex_unlock(&_queue_mutex);
+	*queue_ret = queue;
+	return SPEC_SUCCESS;
 }
 
 static int
-deviceFunc1_unsup(device_t device, int param) {
-	(void)device;
-	(void)param;
-	return  SPEC_UNSUPPORTED;
+platformCreateQueue_disp(platform_t platform, queue_t *queue_ret) {
+	return createQueue(platform, API_HANDLE_PLATFORM, queue_ret);
 }
 
 static int
-deviceFunc2_unsup(device_t device, int param) {
-	(void)device;
-	(void)param;
-	return SPEC_UNSUPPORTED;
+deviceCreateQueue_disp(device_t device, queue_t *queue_ret) {
+	return createQueue(device, API_HANDLE_DEVICE, queue_ret);
+}
+
+static int
+queueDestroy_disp(queue_t queue) {
+	if (!queue)
+		return SPEC_ERROR;
+	pthread_mutex_lock(&_queue_mutex);
+	if (queue->prev)
+		queue->prev->next = queue->next;
+	else
+		_first_queue = queue->next;
+	if (queue->next)
+		queue->next->prev = queue->prev;
+	pthread_mutex_unlock(&_queue_mutex);
+	workQueueFini(&queue->work_queue);
+	free(queue);
+	return SPEC_SUCCESS;
+}
+
+static int
+eventQuery_disp(event_t event, int *complete_ret, int *result_ret) {
+	if (!event || !complete_ret || !result_ret)
+		return SPEC_ERROR;
+	*complete_ret = __atomic_load_n(&event->complete, __ATOMIC_ACQUIRE);
+	if (*complete_ret)
+		*result_ret = event->result;
+	return SPEC_SUCCESS;
+}
+
+static int
+eventWait_disp(size_t num_events, const event_t *events) {
+	if (num_events && !events)
+		return SPEC_ERROR;
+	for (size_t i = 0; i < num_events; i++)
+		if (!events[i])
+			return SPEC_ERROR;
+	int res = SPEC_SUCCESS;
+	for (size_t i = 0; i < num_events; i++) {
+		if (!__atomic_load_n(&events[i]->complete, __ATOMIC_ACQUIRE)) {
+			__atomic_add_fetch(&_event_waiters, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_lock(&_event_mutex);
+			while (!__atomic_load_n(&events[i]->complete, __ATOMIC_SEQ_CST))
+				pthread_cond_wait(&_event_cond, &_event_mutex);
+			pthread_mutex_unlock(&_event_mutex);
+			__atomic_sub_fetch(&_event_waiters, 1, __ATOMIC_RELAXED);
+		}
+		if (events[i]->result != SPEC_SUCCESS && res == SPEC_SUCCESS)
+			res = events[i]->result;
+	}
+	return res;
 }
 
 static int
-deviceDestroy_unsup(device_t device) {
-	(void)device;
-	return SPEC_UNSUPPORTED;
+eventRelease_disp(event_t event) {
+	if (!event)
+		return SPEC_ERROR;
+	releaseEvent(event);
+	return SPEC_SUCCESS;
 }
 
 /**
- * Instance layer terminators either directly (for FFI layers) or indirectly
- * (for non-FFI layers). Call into the global layer chain.
+ * Each enqueue API stores the handle of the queue and its arguments after the
+ * event, and the worker thread calls the entry point of the target API with
+ * them.
  */
-static inline int
-platformCreateDevice_term(platform_t platform, device_t *device_ret) {
-	return _first_layer->dispatch.platformCreateDevice(platform, device_ret);
+#define DEFINE_ENQUEUE_DISP(api, target, type, queue, event_ret, params, args, fields, elems, call) \
+struct api ## _args_s { \
+	EXPAND fields \
+}; \
+struct api ## _call_s { \
+	struct event_s          event; \
+	struct api ## _args_s   stored; \
+}; \
+static void \
+api ## _run(struct work_s *work) { \
+	struct api ## _args_s *stored = &((struct api ## _call_s *)work)->stored; \
+	completeEvent((struct event_s *)work, target call); \
+} \
+static int \
+api ## _disp params { \
+	if (event_ret) \
+		*event_ret = NULL; \
+	if (!queue || queue->handle_type != type) \
+		return SPEC_ERROR; \
+	struct api ## _call_s *c = (struct api ## _call_s *)malloc(sizeof(struct api ## _call_s)); \
+	if (!c) \
+		return SPEC_ERROR; \
+	struct api ## _args_s stored = { queue->handle, EXPAND elems }; \
+	c->stored = stored; \
+	c->event.work.callback = &api ## _run; \
+	c->event.refs = event_ret ? 2 : 1; \
+	c->event.complete = 0; \
+	c->event.result = SPEC_SUCCESS; \
+	if (event_ret) \
+		*event_ret = &c->event; \
+	workQueuePush(&queue->work_queue, &c->event.work); \
+	return SPEC_SUCCESS; \
 }
+API_ENQUEUE(DEFINE_ENQUEUE_DISP)
 
-static inline int
-deviceFunc1_term(device_t device, int param) {
-	return _first_layer->dispatch.deviceFunc1(device, param);
+/**
+ * Unsupported API stubs, that ignore their parameters.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#define DEFINE_UNSUP(api, handle, params, args) \
+static int \
+api ## _unsup params { \
+	return SPEC_UNSUPPORTED; \
 }
+API_DRIVER_SINGLE(DEFINE_UNSUP)
+#pragma GCC diagnostic pop
 
-static inline int
-deviceFunc2_term(device_t device, int param) {
-	return _first_layer->dispatch.deviceFunc2(device, param);
+/**
+ * Batch fan out, calling the driver once per element.
+ */
+#define DEFINE_FANOUT(api, single, handle, params, args, num, elems, results) \
+static int \
+api ## _fanout params { \
+	if (num && (!elems || !results)) \
+		return SPEC_ERROR; \
+	int res = SPEC_SUCCESS; \
+	for (size_t i = 0; i < num; i++) { \
+		results[i] = handle->multiplex->dispatch.single(handle, elems[i]); \
+		if (results[i] != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+			res = results[i]; \
+	} \
+	return res; \
 }
+API_DRIVER_BATCH(DEFINE_FANOUT)
 
-static inline int
-deviceDestroy_term(device_t device) {
-	return _first_layer->dispatch.deviceDestroy(device);
+/**
+ * Bulk fan out, calling the driver once per handle. Handles that could not be
+ * created are NULL.
+ */
+#define DEFINE_CREATE_BULK_FANOUT(api, single, handle, params, args, num, handles_ret) \
+static int \
+api ## _fanout params { \
+	if (num && !handles_ret) \
+		return SPEC_ERROR; \
+	int res = SPEC_SUCCESS; \
+	for (size_t i = 0; i < num; i++) { \
+		handles_ret[i] = NULL; \
+		int r = handle->multiplex->dispatch.single(handle, &handles_ret[i]); \
+		if (r != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+			res = r; \
+	} \
+	return res; \
+}
+API_DRIVER_CREATE_BULK(DEFINE_CREATE_BULK_FANOUT)
+
+#define DEFINE_BULK_FANOUT(api, single, handle, params, args, num, handles) \
+static int \
+api ## _fanout params { \
+	int res = SPEC_SUCCESS; \
+	for (size_t i = 0; i < num; i++) { \
+		int r = handle->multiplex->dispatch.single(handles[i]); \
+		if (r != SPEC_SUCCESS && res == SPEC_SUCCESS) \
+			res = r; \
+	} \
+	return res; \
 }
+API_DRIVER_BULK(DEFINE_BULK_FANOUT)
+
+#if BAKED_LOADER
+#define DEFINE_BAKED_LOADER(api, params, args) \
+int \
+baked_loader_ ## api params { \
+	return api ## _disp args; \
+}
+API_LOADER(DEFINE_BAKED_LOADER)
+
+#define DEFINE_BAKED_TERMINATOR(api, handle, params, args) \
+	DEFINE_BAKED_LOADER(api, params, args)
+API_DRIVER(DEFINE_BAKED_TERMINATOR)
+
+#define DEFINE_BAKED_UNSUP(api, handle, params, args) \
+int \
+baked_fallback_ ## api params { \
+	return api ## _unsup args; \
+}
+API_DRIVER_SINGLE(DEFINE_BAKED_UNSUP)
+
+#define DEFINE_BAKED_FANOUT(api, single, handle, params, args, num, elems, results) \
+int \
+baked_fallback_ ## api params { \
+	return api ## _fanout args; \
+}
+API_DRIVER_BATCH(DEFINE_BAKED_FANOUT)
+
+#define DEFINE_BAKED_BULK_FANOUT(api, single, handle, params, args, num, handles) \
+	DEFINE_BAKED_FANOUT(api, single, handle, params, args, num, handles, NULL)
+API_DRIVER_CREATE_BULK(DEFINE_BAKED_BULK_FANOUT)
+API_DRIVER_BULK(DEFINE_BAKED_BULK_FANOUT)
+#endif
 
 /**
- * Non ffi instance layer terminators.
+ * Lazy resolution of driver entry points. The driver is queried for the entry
+ * point at index `index` of the driver dispatch table, and the resolver stub
+ * is replaced by the result (or the unsupported API stub) wherever the loader
+ * copied it: the dispatch table, the resolved dispatch table and, for FFI
+ * instance layers, the instance layer dispatch tables. Concurrent first calls
+ * may query the driver several times, but all patch the same value.
+ */
+static void *
+resolveLazy(struct multiplex_s *multiplex, size_t index, const char *name) {
+	void **slot = &((void **)&multiplex->dispatch)[index];
+	void *stub = ((void **)&_lazy_dispatch)[index];
+	void *pfn = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (pfn != stub)
+		return pfn;
+	struct plt_s *plt = MULTIPLEX_PLT(multiplex);
+	pfn = plt->driver->platformGetFuncExt(plt->platform, name);
+	if (!pfn)
+		pfn = ((void **)&_unsup_dispatch)[index];
+	void *expected = stub;
+	if (!__atomic_compare_exchange_n(slot, &expected, pfn, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return expected;
+	expected = stub;
+	__atomic_compare_exchange_n(&((void **)&multiplex->resolved)[index],
+		&expected, pfn, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+#if FFI_INSTANCE_LAYERS
+	pthread_mutex_lock(&_chain_mutex);
+	patchInstanceLayers(multiplex, index, stub, pfn);
+	expected = stub;
+	__atomic_compare_exchange_n(&((void **)&multiplex->terminator.dispatch)[index],
+		&expected, pfn, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&_chain_mutex);
+#endif
+	return pfn;
+}
+
+#define RESOLVE_LAZY(multiplex, api) \
+	((pfn_ ## api ## _t)(intptr_t)resolveLazy(multiplex, \
+		DRIVER_SLOT(api), #api))
+
+#define DEFINE_LAZY(api, handle, params, args) \
+static int \
+api ## _lazy params { \
+	return RESOLVE_LAZY(handle->multiplex, api) args; \
+}
+API_DRIVER(DEFINE_LAZY)
+
+/**
+ * Non ffi instance layer terminators, call into the resolved dispatch table of
+ * the multiplexing structure they belong to.
  */
 #if !FFI_INSTANCE_LAYERS
-static int platformCreateDevice_inst(struct instance_layer_s *layer, platform_t platform, device_t *device_ret) {
-	(void)layer;
-	return platformCreateDevice_term(platform, device_ret);
+#define RESOLVED_DISPATCH(layer) ((struct driver_dispatch_s *)layer->data)
+
+#define DEFINE_INST(api, handle, params, args) \
+static int api ## _inst(struct instance_layer_s *layer, EXPAND params) { \
+	return RESOLVED_DISPATCH(layer)->api args; \
+}
+API_DRIVER(DEFINE_INST)
+
+/**
+ * Filter shims, called instead of the layer entries of the filtered APIs.
+ * Calls that don't match the filter go to the next layer through the next
+ * layer table of the layer, as if the layer forwarded them, so they are
+ * profiled the same way.
+ */
+static inline int
+filterMatch(struct filter_table_s *table, size_t slot, const void *handle, int value) {
+	const struct filter_s *filter = &table->filters[slot];
+	switch (filter->kind) {
+	case LAYER_FILTER_HANDLES:
+		for (size_t i = 0; i < filter->num_handles; i++)
+			if (filter->handles[i] == handle)
+				return 1;
+		return 0;
+	case LAYER_FILTER_RANGE:
+		return value >= filter->min && value <= filter->max;
+	case LAYER_FILTER_SAMPLE:
+		return !(__atomic_fetch_add(&table->counts[slot], 1, __ATOMIC_RELAXED) % filter->period);
+	default:
+		return 1;
+	}
 }
 
-static int deviceFunc1_inst(struct instance_layer_s *layer, device_t device, int param) {
-	(void)layer;
-	return deviceFunc1_term(device, param);
+#define FILTER_SLOT(api) (offsetof(struct instance_dispatch_s, api ## _instance) / sizeof(void *))
+
+#define DEFINE_FILTER(api, handle, params, args, value, has_value) \
+static int api ## _filter(struct instance_layer_s *layer, EXPAND params) { \
+	struct filter_table_s *table = layer->filters; \
+	if (filterMatch(table, FILTER_SLOT(api), handle, value)) \
+		return table->filtered.api ## _instance((struct instance_layer_proxy_s *)layer, EXPAND args); \
+	struct instance_layer_s *next = (struct instance_layer_s *)layer->layer_dispatch.api ## _next; \
+	return next->dispatch.api ## _instance((struct instance_layer_proxy_s *)next, EXPAND args); \
 }
+API_DRIVER_FILTER(DEFINE_FILTER)
+#endif
+
+/**
+ * Profiling shims. Links that don't intercept an API are skipped, their
+ * dispatch table entry being the shim of the next link. Time spent in the
+ * global layer terminator is attributed to the driver of the handle, or to
+ * the loader for loader APIs.
+ */
+#define PROFILE_SKIP_GLOBAL(layer, api) \
+	while (layer->dispatch.api == &api ## _prof_next) \
+		layer = layer->next;
+
+#define PROFILE_CALL_GLOBAL(layer, api, args, driver_name) \
+	if (layer == &_layer_terminator) \
+		profileEnter(layer, PROFILE_DRIVER, driver_name, #api); \
+	else \
+		profileEnter(layer, PROFILE_GLOBAL, layer->path, #api); \
+	int res = layer->dispatch.api args; \
+	profileExit(); \
+	return res;
 
-static int deviceFunc2_inst(struct instance_layer_s *layer, device_t device, int param) {
-	(void)layer;
-	return deviceFunc2_term(device, param);
+#define DEFINE_PROFILE_GLOBAL(api, params, args, driver_name) \
+static int \
+api ## _prof_head params { \
+	struct layer_s *layer = _profile_head.next; \
+	PROFILE_SKIP_GLOBAL(layer, api) \
+	PROFILE_CALL_GLOBAL(layer, api, args, driver_name) \
+} \
+static int \
+api ## _prof_next params { \
+	struct layer_s *layer = (struct layer_s *)(intptr_t)profileTop(PROFILE_GLOBAL); \
+	if (!layer) \
+		return SPEC_ERROR; \
+	layer = layer->next; \
+	PROFILE_SKIP_GLOBAL(layer, api) \
+	PROFILE_CALL_GLOBAL(layer, api, args, driver_name) \
 }
 
-static int deviceDestroy_inst(struct instance_layer_s *layer, device_t device) {
-	(void)layer;
-	return deviceDestroy_term(device);
+static inline const char *
+profileDriverName(struct multiplex_s *multiplex) {
+	return MULTIPLEX_PLT(multiplex)->driver->path;
 }
+
+#define PROFILE_DRIVER_NAME(handle) \
+	((handle) ? profileDriverName((handle)->multiplex) : "loader")
+
+#define DEFINE_PROFILE_LOADER(api, params, args) \
+	DEFINE_PROFILE_GLOBAL(api, params, args, "loader")
+API_LOADER(DEFINE_PROFILE_LOADER)
+
+#define DEFINE_PROFILE_DRIVER(api, handle, params, args) \
+	DEFINE_PROFILE_GLOBAL(api, params, args, PROFILE_DRIVER_NAME(handle))
+API_DRIVER(DEFINE_PROFILE_DRIVER)
+
+/**
+ * The instance layer terminator is not profiled, as it calls into the
+ * resolved dispatch table, whose entries are the _prof_head shims.
+ */
+#if FFI_INSTANCE_LAYERS
+#define PROFILE_FIRST_INSTANCE(chain, api) (chain->first_layer)
+#define PROFILE_NEXT_INSTANCE(layer, api) (layer->next)
+#define PROFILE_SKIP_INSTANCE(layer, api) \
+	while (layer->library && layer->dispatch.api ## _instance == &api ## _prof_inst) \
+		layer = layer->next;
+#define PROFILE_INSTANCE_CALL(layer, api, args) layer->dispatch.api ## _instance args
+#else
+#define PROFILE_FIRST_INSTANCE(chain, api) \
+	((struct instance_layer_s *)chain->layer_dispatch.api ## _next)
+#define PROFILE_NEXT_INSTANCE(layer, api) \
+	((struct instance_layer_s *)layer->profile_next.api ## _next)
+#define PROFILE_SKIP_INSTANCE(layer, api)
+#define PROFILE_INSTANCE_CALL(layer, api, args) \
+	layer->dispatch.api ## _instance((struct instance_layer_proxy_s *)layer, EXPAND args)
 #endif
 
+#define PROFILE_CALL_INSTANCE(layer, api, args) \
+	PROFILE_SKIP_INSTANCE(layer, api) \
+	if (!layer->library) \
+		return PROFILE_INSTANCE_CALL(layer, api, args); \
+	profileEnter(layer, PROFILE_INSTANCE, layer->path, #api); \
+	int res = PROFILE_INSTANCE_CALL(layer, api, args); \
+	profileExit(); \
+	return res;
+
+#define DEFINE_PROFILE_INSTANCE(api, handle, params, args) \
+static int \
+api ## _prof_first(struct chain_s *chain, EXPAND params) { \
+	struct instance_layer_s *layer = PROFILE_FIRST_INSTANCE(chain, api); \
+	PROFILE_CALL_INSTANCE(layer, api, args) \
+} \
+static int \
+api ## _prof_inst PROFILE_INST_PARAMS(params) { \
+	struct instance_layer_s *layer = (struct instance_layer_s *)(intptr_t)profileTop(PROFILE_INSTANCE); \
+	if (!layer) \
+		return SPEC_ERROR; \
+	layer = PROFILE_NEXT_INSTANCE(layer, api); \
+	PROFILE_CALL_INSTANCE(layer, api, args) \
+}
+API_DRIVER(DEFINE_PROFILE_INSTANCE)
+
 /**
  * Loader cleanup. If called explicitly at program termination, valgrind should
  * report no leak. as is in a destructor, valgrind reports leaks.
@@ -641,33 +3006,71 @@ static int deviceDestroy_inst(struct instance_layer_s *layer, device_t device) {
 __attribute__((destructor))
 void my_fini(void) {
 	printf("Deiniting loader\n");
-	struct plt_s *platform = _first_platform;
-	while(platform) {
-		struct plt_s *next_platform = platform->next;
-		struct instance_layer_s *layer = platform->multiplex.first_layer;
+	while (_first_queue)
+		queueDestroy_disp(_first_queue);
+	if (_profile)
+		profileFini();
+	epochFini();
+	if (_validate_handles)
+		registryFini(&_live_handles);
+	if (_discovery)
+		discoveryFini();
+	for (size_t i = 0; i < _platforms->num_platforms; i++) {
+		struct multiplex_s *multiplex = _platforms->platforms[i]->multiplex;
+		struct plt_s *platform = MULTIPLEX_PLT(multiplex);
+		struct arena_s *arena = platform->arena;
+		for (struct multiplex_s *device = multiplex->devices; device; device = device->next_device)
+			releaseDeviceLayers(device);
+		struct instance_layer_s *layer = platform->multiplex.chain->first_layer;
 		while(layer->library) {
 			struct instance_layer_s *next_layer = layer->next;
 			layer->layerInstanceDeinit(layer->data);
 			dlclose(layer->library);
-			free(layer);
+			free(layer->path);
 			layer = next_layer;
 		}
-		free(platform);
-		platform = next_platform;
+		layer = platform->multiplex.removed;
+		while (layer) {
+			struct instance_layer_s *next_layer = layer->next_removed;
+			if (layer->library) {
+				layer->layerInstanceDeinit(layer->data);
+				dlclose(layer->library);
+			}
+			free(layer->path);
+			layer = next_layer;
+		}
+		struct ext_table_s *table = platform->multiplex.ext_table;
+		for (size_t i = 0; table && i < table->size; i++)
+			free(table->entries[i]);
+		free(table);
+		/* releases the platform, its chain and its instance layers */
+		arenaDestroy(arena);
 	}
+	if (_platforms != &_no_platforms)
+		free(_platforms);
+	if (_first_layer == &_profile_head)
+		_first_layer = _profile_head.next;
 	struct layer_s *layer = _first_layer;
 	while(layer != &_layer_terminator) {
 		struct layer_s *next_layer = layer->next;
 		if (layer->layerDeinit)
 			layer->layerDeinit();
 		dlclose(layer->library);
-		free(layer);
+		free(layer->path);
 		layer = next_layer;
 	}
+	if (_layer_arena)
+		arenaDestroy(_layer_arena);
+#if BAKED_LOADER
+	for (size_t i = NUM_BAKED_LAYERS; i-- > 0;)
+		_baked_layers[i].deinit();
+#endif
 	struct driver_s *driver = _first_driver;
 	while(driver) {
 		struct driver_s *next_driver = driver->next;
-		dlclose(driver->library);
+		if (driver->library)
+			dlclose(driver->library);
+		free(driver->path);
 		free(driver);
 		driver = next_driver;
 	}
@@ -0,0 +1,1154 @@
+#!/usr/bin/env python3
+"""
+Generate the API headers from the API description in spec.api:
+ - spec.h: the public API,
+ - dispatch.h: the loader, global layer and driver dispatch tables,
+ - layer.h: the layer API, including instance layer dispatch tables,
+ - instance_layer.h: the FFI type tables used by FFI instance layers,
+ - layer.hpp: a header only C++ SDK to write layers,
+ - api.h: API lists to be used as X macros, and a perfect hash table for
+   name to dispatch table slot lookups.
+
+Usage: gen_api.py [spec.api [output_directory]]
+"""
+
+import os
+import re
+import sys
+
+BANNER = "/* Generated from spec.api by gen_api.py, do not edit. */\n\n"
+
+KINDS = ("loader", "driver", "create", "destroy", "batch", "create_bulk", "bulk", "enqueue")
+DRIVER_KINDS = ("driver", "create", "destroy", "batch", "create_bulk", "bulk")
+CALL_KINDS = ("driver", "destroy")
+FANOUT_KINDS = ("batch", "create_bulk", "bulk")
+
+
+class Param:
+    def __init__(self, decl):
+        m = re.match(r"^(.*?)\s*(\**)\s*([A-Za-z_]\w*)$", decl.strip())
+        if not m:
+            raise ValueError("invalid parameter: %s" % decl)
+        self.base = m.group(1)
+        self.stars = len(m.group(2))
+        self.name = m.group(3)
+
+    def decl(self):
+        return "%s %s%s" % (self.base, "*" * self.stars, self.name)
+
+
+class Api:
+    def __init__(self, kind, name, params, doc):
+        self.kind = kind
+        self.name = name
+        self.params = params
+        self.doc = doc
+
+    @property
+    def handle(self):
+        if getattr(self, "bulk_handle", False):
+            num, handles = self.params[0].name, self.params[1].name
+            return "(%s && %s ? %s[0] : NULL)" % (num, handles, handles)
+        return self.params[0].name
+
+    def params_decl(self):
+        return ", ".join(p.decl() for p in self.params)
+
+    def args(self):
+        return ", ".join(p.name for p in self.params)
+
+
+class Spec:
+    def __init__(self):
+        self.handles = []
+        self.handles_doc = ""
+        self.apis = []
+
+    @property
+    def driver_apis(self):
+        return [a for a in self.apis if a.kind in DRIVER_KINDS]
+
+    @property
+    def loader_apis(self):
+        return [a for a in self.apis if a.kind not in DRIVER_KINDS]
+
+
+def parse(path):
+    spec = Spec()
+    doc = None
+    comment = None
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.rstrip()
+            if comment is not None:
+                comment.append(line)
+                if line.strip() == "*/":
+                    doc = "\n".join(comment) + "\n"
+                    comment = None
+                continue
+            if not line or line.startswith("#"):
+                continue
+            if line.strip() == "/**":
+                comment = [line]
+                continue
+            words = line.split()
+            if words[0] == "handles":
+                spec.handles += words[1:]
+                spec.handles_doc = doc or ""
+                doc = None
+                continue
+            m = re.match(r"^(\w+)\s+int\s+(\w+)\s*\((.*)\)\s*;$", line)
+            if not m or m.group(1) not in KINDS:
+                sys.exit("%s:%d: invalid declaration" % (path, lineno))
+            params = [Param(p) for p in m.group(3).split(",")]
+            api = Api(m.group(1), m.group(2), params, doc or "")
+            api.bulk_handle = api.kind == "bulk"
+            if api.kind in DRIVER_KINDS and api.kind != "bulk":
+                base = params[0].base
+                if params[0].stars or not base.endswith("_t") or base[:-2] not in spec.handles:
+                    sys.exit("%s:%d: first parameter of %s must be a handle" % (path, lineno, api.name))
+            if api.kind == "create":
+                last = params[-1]
+                if last.stars != 1 or last.base[:-2] not in spec.handles:
+                    sys.exit("%s:%d: last parameter of %s must return a handle" % (path, lineno, api.name))
+            if api.kind == "batch":
+                single = [a for a in spec.apis if a.kind in CALL_KINDS and a.name + "Batch" == api.name]
+                if not single:
+                    sys.exit("%s:%d: %s must batch a previously declared driver API" % (path, lineno, api.name))
+                api.single = single[0]
+                elem = api.single.params[1:]
+                if (len(api.single.params) != 2 or len(params) != 4 or
+                        params[1].base != "size_t" or params[1].stars or
+                        params[2].base != "const " + elem[0].base or params[2].stars != elem[0].stars + 1 or
+                        params[3].base != "int" or params[3].stars != 1):
+                    sys.exit("%s:%d: %s must take a handle, a count, an array of %s parameters and an array of results" %
+                             (path, lineno, api.name, api.single.name))
+            if api.kind == "create_bulk":
+                single = [a for a in spec.apis if a.kind == "create" and a.name + "s" == api.name]
+                if not single:
+                    sys.exit("%s:%d: %s must create several handles with a previously declared create API" %
+                             (path, lineno, api.name))
+                api.single = single[0]
+                first, ret = api.single.params[0], api.single.params[-1]
+                if (len(api.single.params) != 2 or len(params) != 3 or params[0].decl() != first.decl() or
+                        params[1].base != "size_t" or params[1].stars or
+                        params[2].base != ret.base or params[2].stars != 1):
+                    sys.exit("%s:%d: %s must take the handle of %s, a count and an array of handles" %
+                             (path, lineno, api.name, api.single.name))
+            if api.kind == "bulk":
+                elem = params[-1]
+                name = elem.base.replace("const ", "", 1)[:-2]
+                single = [a for a in spec.apis if a.kind in CALL_KINDS and
+                          api.name.replace(name + "s", name, 1) == a.name]
+                if not single:
+                    sys.exit("%s:%d: %s must call a previously declared driver API on several handles" %
+                             (path, lineno, api.name))
+                api.single = single[0]
+                if (len(api.single.params) != 1 or len(params) != 2 or
+                        params[0].base != "size_t" or params[0].stars or
+                        elem.base != "const " + api.single.params[0].base or elem.stars != 1):
+                    sys.exit("%s:%d: %s must take a count and an array of %s handles" %
+                             (path, lineno, api.name, api.single.name))
+            if api.kind == "enqueue":
+                target = [a for a in spec.apis if a.kind in DRIVER_KINDS and a.name + "Enqueue" == api.name]
+                if not target:
+                    sys.exit("%s:%d: %s must enqueue a previously declared driver API" % (path, lineno, api.name))
+                api.target = target[0]
+                first, last = params[0], params[-1]
+                if (len(params) != len(api.target.params) + 1 or
+                        first.base != "queue_t" or first.stars or
+                        last.base != "event_t" or last.stars != 1 or
+                        [p.decl() for p in params[1:-1]] != [p.decl() for p in api.target.params[1:]]):
+                    sys.exit("%s:%d: %s must take a queue, the parameters of %s but its handle, and an event" %
+                             (path, lineno, api.name, api.target.name))
+            spec.apis.append(api)
+            doc = None
+    if not spec.apis:
+        sys.exit("%s: no API declared" % path)
+    return spec
+
+
+def align_fields(fields, indent="\t"):
+    """Align (type, name) pairs, the name starting one column after the
+    longest type."""
+    width = max(len(t) for t, _ in fields) + 1
+    return ["%s%s%s" % (indent, t.ljust(width), n) for t, n in fields]
+
+
+def align_params(params, indent="\t"):
+    """Align parameters, with pointer stars right aligned against the names."""
+    width = max(len(p.base) for p in params) + 1
+    stars = max(p.stars for p in params)
+    return ["%s%s%s%s" % (indent, p.base.ljust(width),
+                          ("*" * p.stars).rjust(stars), p.name) for p in params]
+
+
+def gen_spec_h(spec):
+    out = BANNER
+    out += """/**
+ * A simple toy API that defines a set of platform available,
+ * and APIs to create objects (called device here) and invoke
+ * methods on those objects.
+ */
+
+/**
+ * A set of error codes to be returned by API entry points.
+ */
+#define SPEC_SUCCESS 0 // API call was a success
+#define SPEC_ERROR -1 // API call failed
+#define SPEC_UNSUPPORTED -2 // API call is not supported by the platform
+
+"""
+    out += spec.handles_doc
+    for h in spec.handles:
+        out += "typedef struct %s_s * %s_t;\n" % (h, h)
+    out += "\n"
+    for api in spec.apis:
+        out += api.doc
+        out += "typedef int\n%s_t(%s);\n\n" % (api.name, api.params_decl())
+    out += "#ifndef NO_PROTOTYPES\n"
+    out += "\n".join(align_fields([("extern %s_t" % a.name, a.name + ";") for a in spec.apis], "")) + "\n"
+    out += "#endif\n"
+    return out
+
+
+def gen_dispatch_h(spec):
+    out = BANNER
+    out += """/**
+ * Definition of the dispatch table used by the loader and global layers.
+ * It gathers all the API entry points defined inn spec.h in a structure.
+ */
+
+"""
+    for api in spec.apis:
+        out += "typedef int (*pfn_%s_t)(%s);\n" % (api.name, api.params_decl())
+    out += "\nstruct dispatch_s {\n"
+    out += "\n".join(align_fields([("pfn_%s_t" % a.name, a.name + ";") for a in spec.apis])) + "\n"
+    out += """};
+
+/**
+ * Dispatch tables that gather APIs that drivers implement.
+ * Use by the loader to dispatch driver calls.
+ */
+struct driver_dispatch_s {
+"""
+    out += "\n".join(align_fields([("pfn_%s_t" % a.name, a.name + ";") for a in spec.driver_apis])) + "\n"
+    out += """};
+
+#define NUM_DRIVER_DISPATCH_ENTRIES (sizeof(struct driver_dispatch_s)/sizeof(pfn_%s_t))
+""" % spec.driver_apis[0].name
+    return out
+
+
+def gen_layer_h(spec):
+    apis = spec.driver_apis
+    out = BANNER
+    out += """/**
+ * The API exposed by the layers. Layers that implement the instance layer API
+ * have a different signature if they use the ffi or non-ffi strategy.
+ */
+
+#define NUM_DISPATCH_ENTRIES (sizeof(struct dispatch_s)/sizeof(pfn_layerInit_t))
+
+#ifndef FFI_INSTANCE_LAYERS
+#define FFI_INSTANCE_LAYERS 1
+#endif
+
+/**
+ * Global layer initialization API. The number of entries into the next
+ * dispatch table to call into is provided in num_entries, while the tbale
+ * itself is pointed to by target_dispatch. The layer's own dispatch table is
+ * to be copied into layer_dispatch. A layer should not write more entries than
+ * num_entries, and must write NULL for unsupported APIs.
+ */
+typedef int layerInit_t(
+	size_t              num_entries,
+	struct dispatch_s  *target_dispatch,
+	struct dispatch_s  *layer_dispatch);
+
+typedef layerInit_t *pfn_layerInit_t;
+
+/**
+ * Optional deinitialization API for global layers.
+ */
+typedef int layerDeinit_t();
+
+typedef layerDeinit_t *pfn_layerDeinit_t;
+
+/**
+ * Dispatch table for instance layer.
+ * Contains driver implemented API entry points.
+ */
+struct instance_dispatch_s;
+
+#if FFI_INSTANCE_LAYERS
+
+"""
+    out += "\n".join(align_fields([("typedef pfn_%s_t" % a.name, "pfn_%s_instance_t;" % a.name) for a in apis], "")) + "\n"
+    instance_dispatch = "struct instance_dispatch_s {\n" + "\n".join(
+        align_fields([("pfn_%s_instance_t" % a.name, "%s_instance;" % a.name) for a in apis])) + "\n};\n"
+    out += "\n" + instance_dispatch
+    out += """
+/**
+ * Instance Layer initialization for FFI instance layers.  Similar to layerInit
+ * but the layer also return a pointer to its internal data for this instance
+ * in layer_data_ret.
+ */
+typedef int layerInstanceInit_t(
+	size_t                       num_entries,
+	struct instance_dispatch_s  *target_dispatch,
+	struct instance_dispatch_s  *layer_instance_dispatch,
+	void                       **layer_data_ret);
+
+#else //!FFI_INSTANCE_LAYERS
+
+/**
+ * Non FFI layers must realize the closure through other means.  Here we are
+ * providing the layer data pointer as the first arguments of the API calls,
+ * while still providing a full dispatch table to call into.
+ */
+struct instance_dispatch_s;
+struct instance_layer_proxy_s;
+
+/**
+ * A table indication the next layer intercepting a given API entry point.
+ */
+struct layer_dispatch_s {
+"""
+    out += "\n".join(align_fields([("struct instance_layer_proxy_s", "*%s_next;" % a.name) for a in apis])) + "\n"
+    out += """};
+
+/**
+ * The layer API wrapper type, with the layer as the first parameter.
+ * The loader and layer must use compatible representations.
+ */
+"""
+    for api in apis:
+        params = [Param("struct instance_layer_proxy_s *layer")] + api.params
+        out += "typedef int %s_instance_t(\n" % api.name
+        out += ",\n".join(align_params(params)) + ");\n"
+        out += "typedef %s_instance_t *pfn_%s_instance_t;\n\n" % (api.name, api.name)
+    out += """/**
+ * Functions that are not dispatchable through objects do not need to be in
+ * instance layers.
+ */
+"""
+    out += instance_dispatch
+    out += """
+/**
+ * This structure must map to its equivalent in the loader.
+ */
+struct instance_layer_proxy_s {
+	struct instance_dispatch_s     dispatch;
+	struct layer_dispatch_s        layer_dispatch;
+	void                          *data;
+};
+
+/**
+ * Initialization if a non FFI instance layer. Here, the loader is responsible
+ * for maintaining the call chain through the instance layers, so the target
+ * dispatch is not required. Similarly to previous initialization functions, no
+ * more than num_entries must be written in layer_instance_dispatch.
+ */
+typedef int layerInstanceInit_t(
+	size_t                       num_entries,
+	struct instance_dispatch_s  *layer_instance_dispatch,
+	void                       **layer_data_ret);
+
+/**
+ * Interception filters, that the loader evaluates before calling into a non
+ * FFI instance layer. Calls that don't match the filter of an API go straight
+ * to the next layer, as if the layer forwarded them. Filters select calls:
+ *   LAYER_FILTER_HANDLES  made on one of the num_handles handles,
+ *   LAYER_FILTER_RANGE    whose first int parameter after the handle is
+ *                         between min and max, inclusive. Only valid for APIs
+ *                         that have such a parameter,
+ *   LAYER_FILTER_SAMPLE   one in every period calls made through the layer.
+ * The loader copies the filters, handle sets included.
+ * Global layers and FFI instance layers can't declare filters: they call the
+ * next link directly, through a dispatch table of plain entry points, so the
+ * loader has no link between them to evaluate a filter at.
+ */
+enum layer_filter_kind_e {
+	LAYER_FILTER_NONE,
+	LAYER_FILTER_HANDLES,
+	LAYER_FILTER_RANGE,
+	LAYER_FILTER_SAMPLE
+};
+
+struct layer_filter_s {
+	enum layer_filter_kind_e  kind;
+	size_t                    num_handles;
+	const void * const       *handles;
+	int                       min;
+	int                       max;
+	unsigned int              period;
+};
+
+/**
+ * Optional filter query for non FFI instance layers, called once after
+ * layerInstanceInit. filters holds num_entries filters, in instance dispatch
+ * table order, initialized to LAYER_FILTER_NONE. A layer should not write
+ * more entries than num_entries. Filters of APIs the layer doesn't intercept
+ * are ignored, and an invalid filter fails the layer attachment.
+ */
+typedef int layerInstanceFilters_t(
+	void                   *layer_data,
+	size_t                  num_entries,
+	struct layer_filter_s  *filters);
+
+typedef layerInstanceFilters_t *pfn_layerInstanceFilters_t;
+
+#endif //FFI_INSTANCE_LAYERS
+
+#define NUM_INSTANCE_DISPATCH_ENTRIES (sizeof(struct instance_dispatch_s)/sizeof(pfn_layerInit_t))
+
+typedef layerInstanceInit_t *pfn_layerInstanceInit_t;
+
+/**
+ * Deinitialization function for instance layers, allowing the layer to free its
+ * data for a particular instance.
+ */
+typedef int layerInstanceDeinit_t(
+	void *layer_data);
+
+typedef layerInstanceDeinit_t *pfn_layerInstanceDeinit_t;
+
+/**
+ * Optional extension function wrapping for instance layers. When an
+ * application queries an extension function of a platform through
+ * platformGetFunc, the instance layers of the platform that export this
+ * function can wrap it, innermost layer first. target is the next function in
+ * the chain, and the layer returns its wrapper in wrapper_ret, or NULL if it
+ * doesn't wrap the function. A layer can be asked to wrap the same extension
+ * function several times, if layers are attached after the function was first
+ * queried, and wrappers must remain valid until the layer instance is
+ * deinitialized.
+ */
+typedef int layerInstanceWrapFunc_t(
+	void        *layer_data,
+	const char  *name,
+	void        *target,
+	void       **wrapper_ret);
+
+typedef layerInstanceWrapFunc_t *pfn_layerInstanceWrapFunc_t;
+"""
+    return out
+
+
+FFI_TYPES = {
+    "int": "&ffi_type_sint",
+    "unsigned int": "&ffi_type_uint",
+    "size_t": "&ffi_type_size_t",
+}
+
+
+def ffi_type(spec, param):
+    if param.stars or param.base[:-2] in spec.handles:
+        return "&ffi_type_pointer"
+    if param.base not in FFI_TYPES:
+        sys.exit("no FFI type for parameter type %s" % param.base)
+    return FFI_TYPES[param.base]
+
+
+def gen_instance_layer_h(spec):
+    apis = spec.driver_apis
+    out = BANNER
+    out += """#if FFI_INSTANCE_LAYERS
+#include <ffi.h>
+"""
+    if any(p.base == "size_t" and not p.stars for a in apis for p in a.params):
+        out += """#include <stdint.h>
+
+#if SIZE_MAX == UINT64_MAX
+#define ffi_type_size_t ffi_type_uint64
+#else
+#define ffi_type_size_t ffi_type_uint32
+#endif
+"""
+    out += "\nenum _exp_layer_func_nargs {\n"
+    out += "\n".join(align_fields([("%s_ffi_nargs" % a.name, "= %d," % len(a.params)) for a in apis])) + "\n"
+    out += "};\n"
+    for api in apis:
+        args = [Param("%s %s*p_%s" % (p.base, "*" * p.stars, p.name)) for p in api.params]
+        out += "\nstruct %s_ffi_args {\n" % api.name
+        out += "\n".join(p + ";" for p in align_params(args)) + "\n};\n"
+        out += "static __attribute__((unused))\n"
+        out += "ffi_type *%s_ffi_types[%s_ffi_nargs] = {\n" % (api.name, api.name)
+        out += ",\n".join("\t" + ffi_type(spec, p) for p in api.params) + "\n};\n"
+        out += "static __attribute__((unused))\n"
+        out += "ffi_type *%s_ffi_ret = &ffi_type_sint;\n" % api.name
+        out += "typedef void %s_ffi_t(\n" % api.name
+        params = [Param("ffi_cif *cif"), Param("int *ffi_ret"),
+                  Param("struct %s_ffi_args *args" % api.name), Param("void *data")]
+        out += ",\n".join(align_params(params)) + ");\n"
+    out += "\n#endif //FFI_INSTANCE_LAYERS\n"
+    return out
+
+
+def gen_layer_hpp(spec):
+    apis = spec.apis
+    instance_apis = spec.driver_apis
+    if len(apis) > 64:
+        sys.exit("interception masks are limited to 64 APIs")
+    out = BANNER
+    out += """/**
+ * Header only C++ SDK to write the layers of layer.h as classes. A layer class
+ * derives from exp_layer::global_layer<layer_class> or
+ * exp_layer::instance_layer<layer_class>, and intercepts an API by defining a
+ * public member function named after it, taking the next link of the chain
+ * followed by the parameters of the API:
+ *
+ *   struct my_layer : exp_layer::instance_layer<my_layer> {
+ *   	int deviceFunc1(next_t next, device_t device, int param) {
+ *   		return next.deviceFunc1(device, param);
+ *   	}
+ *   };
+ *   EXP_INSTANCE_LAYER(my_layer)
+ *
+ * EXP_GLOBAL_LAYER and EXP_INSTANCE_LAYER define the layer API of the library,
+ * and must be used in a single translation unit. The dispatch table of the
+ * layer is built at compile time from the member functions the class defines,
+ * the entries of the other APIs being NULL so that the loader bypasses the
+ * layer for them. intercept_mask() is the mask of the intercepted APIs, by
+ * dispatch table slot (see exp_layer::slot and exp_layer::instance_slot).
+ *
+ * A global layer is a single object, constructed by layerInit and destroyed
+ * by layerDeinit. Instance layers are an object per instance, constructed by
+ * layerInstanceInit and destroyed by layerInstanceDeinit. Layer classes must
+ * be default constructible, without throwing. FFI_INSTANCE_LAYERS selects the
+ * flavor of instance layers, as for C layers.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+extern "C" {
+#include "spec.h"
+#include "dispatch.h"
+#include "layer.h"
+#include "instance_layer.h"
+}
+
+namespace exp_layer {
+
+/**
+ * Dispatch table slots of the APIs, in struct dispatch_s and struct
+ * instance_dispatch_s.
+ */
+namespace slot {
+enum dispatch_slot_e {
+"""
+    out += ",\n".join("\t%s" % a.name for a in apis) + "\n};\n}\n\n"
+    out += "namespace instance_slot {\nenum instance_dispatch_slot_e {\n"
+    out += ",\n".join("\t%s" % a.name for a in instance_apis) + "\n};\n}\n"
+    out += """
+constexpr uint64_t
+api_mask(unsigned int api_slot) {
+	return UINT64_C(1) << api_slot;
+}
+
+/**
+ * Next link of a global layer chain.
+ */
+struct global_next_s {
+	struct dispatch_s *dispatch;
+"""
+    for api in apis:
+        out += "\tint %s(%s) const {\n\t\treturn dispatch->%s(%s);\n\t}\n" % (
+            api.name, api.params_decl(), api.name, api.args())
+    out += """};
+
+/**
+ * Next link of an instance layer chain.
+ */
+#if FFI_INSTANCE_LAYERS
+struct instance_next_s {
+	struct instance_dispatch_s *dispatch;
+"""
+    for api in instance_apis:
+        out += "\tint %s(%s) const {\n\t\treturn dispatch->%s_instance(%s);\n\t}\n" % (
+            api.name, api.params_decl(), api.name, api.args())
+    out += """};
+#else //!FFI_INSTANCE_LAYERS
+struct instance_next_s {
+	struct instance_layer_proxy_s *layer;
+"""
+    for api in instance_apis:
+        out += "\tint %s(%s) const {\n" % (api.name, api.params_decl())
+        out += "\t\tstruct instance_layer_proxy_s *next = layer->layer_dispatch.%s_next;\n" % api.name
+        out += "\t\treturn next->dispatch.%s_instance(next, %s);\n\t}\n" % (api.name, api.args())
+    out += """};
+#endif //!FFI_INSTANCE_LAYERS
+
+template <class L> class global_layer;
+template <class L> class instance_layer;
+
+namespace detail {
+
+template <class T>
+struct voider {
+	typedef void type;
+};
+
+/**
+ * has_<api><L>::value is true if the layer class L intercepts api.
+ */
+"""
+    for api in apis:
+        out += """template <class L, class = void>
+struct has_%(api)s : std::false_type {};
+template <class L>
+struct has_%(api)s<L, typename voider<decltype(&L::%(api)s)>::type> : std::true_type {};
+""" % {"api": api.name}
+    out += """
+constexpr size_t
+mask_entries(uint64_t mask) {
+	return mask ? 1 + mask_entries(mask >> 1) : 0;
+}
+
+/**
+ * Global layer objects are constructed in place by layerInit.
+ */
+template <class L>
+struct global_state_s {
+	alignas(L) static unsigned char storage[sizeof(L)];
+	static struct dispatch_s *target_dispatch;
+};
+
+template <class L>
+alignas(L) unsigned char global_state_s<L>::storage[sizeof(L)];
+template <class L>
+struct dispatch_s *global_state_s<L>::target_dispatch = NULL;
+
+/**
+ * <api>_global<L>::entry() is the dispatch table entry of api for the global
+ * layer class L, calling the member function of the layer object if it
+ * intercepts api and NULL otherwise.
+ */
+"""
+    for api in apis:
+        out += """template <class L, bool = has_%(api)s<L>::value>
+struct %(api)s_global {
+	static constexpr pfn_%(api)s_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct %(api)s_global<L, true> {
+	static int wrap(%(params)s) {
+		return global_layer<L>::layer().%(api)s(global_next_s{global_state_s<L>::target_dispatch}, %(args)s);
+	}
+	static constexpr pfn_%(api)s_t entry() {
+		return &wrap;
+	}
+};
+""" % {"api": api.name, "params": api.params_decl(), "args": api.args()}
+    out += """
+#if FFI_INSTANCE_LAYERS
+
+/**
+ * FFI instance layer objects are allocated together with the closures of
+ * their entries, whose context is this structure.
+ */
+template <class L>
+struct instance_data_s {
+	L                           layer;
+	struct instance_dispatch_s *target_dispatch;
+	ffi_closure                *closures[NUM_INSTANCE_DISPATCH_ENTRIES];
+	ffi_cif                     cifs[NUM_INSTANCE_DISPATCH_ENTRIES];
+};
+
+/**
+ * Create the closure of an entry, see wrap_call in instance_layer.c.
+ */
+template <class L>
+static inline int
+closure(
+		instance_data_s<L>  *data,
+		size_t               api_slot,
+		void                *pfun_ffi,
+		unsigned int         nargs,
+		ffi_type            *rtype,
+		ffi_type           **atypes,
+		void               **pfun_ret) {
+	void *code;
+	data->closures[api_slot] = static_cast<ffi_closure *>(ffi_closure_alloc(sizeof(ffi_closure), &code));
+	if (!data->closures[api_slot])
+		return SPEC_ERROR;
+	if (FFI_OK != ffi_prep_cif(&data->cifs[api_slot], FFI_DEFAULT_ABI, nargs, rtype, atypes) ||
+	    FFI_OK != ffi_prep_closure_loc(data->closures[api_slot], &data->cifs[api_slot],
+			reinterpret_cast<void (*)(ffi_cif *, void *, void **, void *)>(pfun_ffi),
+			data, code))
+		return SPEC_ERROR;
+	*pfun_ret = code;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * <api>_instance<L>::attach() creates the closure of api for the instance
+ * layer class L if it intercepts api.
+ */
+"""
+    for api in instance_apis:
+        out += """template <class L, bool = has_%(api)s<L>::value>
+struct %(api)s_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct %(api)s_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct %(api)s_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.%(api)s(instance_next_s{instance->target_dispatch}, %(ffi_args)s);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::%(api)s, reinterpret_cast<void *>(&wrap),
+			%(api)s_ffi_nargs, %(api)s_ffi_ret, %(api)s_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->%(api)s_instance));
+	}
+};
+""" % {"api": api.name, "ffi_args": ", ".join("*args->p_%s" % p.name for p in api.params)}
+    out += """
+#else //!FFI_INSTANCE_LAYERS
+
+/**
+ * <api>_instance<L>::entry() is the instance dispatch table entry of api for
+ * the instance layer class L, calling the member function of the layer
+ * object of the instance if it intercepts api and NULL otherwise.
+ */
+"""
+    for api in instance_apis:
+        out += """template <class L, bool = has_%(api)s<L>::value>
+struct %(api)s_instance {
+	static constexpr pfn_%(api)s_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct %(api)s_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, %(params)s) {
+		return static_cast<L *>(layer->data)->%(api)s(instance_next_s{layer}, %(args)s);
+	}
+	static constexpr pfn_%(api)s_instance_t entry() {
+		return &wrap;
+	}
+};
+""" % {"api": api.name, "params": api.params_decl(), "args": api.args()}
+    out += """
+#endif //!FFI_INSTANCE_LAYERS
+
+} // namespace detail
+
+/**
+ * Base of global layer classes.
+ */
+template <class L>
+class global_layer {
+public:
+	typedef global_next_s next_t;
+
+	static constexpr uint64_t intercept_mask() {
+		return
+"""
+    out += " |\n".join("\t\t\t(detail::has_%s<L>::value ? api_mask(slot::%s) : 0)" % (a.name, a.name)
+                       for a in apis) + ";\n"
+    out += """	}
+
+	static L &layer() {
+		return *reinterpret_cast<L *>(detail::global_state_s<L>::storage);
+	}
+
+	/**
+	 * The target dispatch table must hold the intercepted APIs, and entries
+	 * past the ones of the layer are left untouched.
+	 */
+	static int init(
+			size_t              num_entries,
+			struct dispatch_s  *target_dispatch,
+			struct dispatch_s  *layer_dispatch) {
+		static_assert(std::is_base_of<global_layer<L>, L>::value, "layer classes must derive from global_layer");
+		static const struct dispatch_s dispatch = {
+"""
+    out += ",\n".join("\t\t\tdetail::%s_global<L>::entry()" % a.name for a in apis) + "\n\t\t};\n"
+    out += """		if (!target_dispatch || !layer_dispatch)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		if (num_entries > NUM_DISPATCH_ENTRIES)
+			num_entries = NUM_DISPATCH_ENTRIES;
+		detail::global_state_s<L>::target_dispatch = target_dispatch;
+		new (detail::global_state_s<L>::storage) L();
+		memcpy(layer_dispatch, &dispatch, num_entries * sizeof(pfn_layerInit_t));
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit() {
+		layer().~L();
+		return SPEC_SUCCESS;
+	}
+};
+
+/**
+ * Base of instance layer classes.
+ */
+template <class L>
+class instance_layer {
+public:
+	typedef instance_next_s next_t;
+
+	static constexpr uint64_t intercept_mask() {
+		return
+"""
+    out += " |\n".join("\t\t\t(detail::has_%s<L>::value ? api_mask(instance_slot::%s) : 0)" % (a.name, a.name)
+                       for a in instance_apis) + ";\n"
+    out += """	}
+
+#if FFI_INSTANCE_LAYERS
+	static int init(
+			size_t                       num_entries,
+			struct instance_dispatch_s  *target_dispatch,
+			struct instance_dispatch_s  *layer_instance_dispatch,
+			void                       **layer_data_ret) {
+		static_assert(std::is_base_of<instance_layer<L>, L>::value, "layer classes must derive from instance_layer");
+		if (!target_dispatch || !layer_instance_dispatch || !layer_data_ret)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		detail::instance_data_s<L> *data = new (std::nothrow) detail::instance_data_s<L>();
+		if (!data)
+			return SPEC_ERROR;
+		data->target_dispatch = target_dispatch;
+		if (
+"""
+    out += " ||\n".join("\t\t    detail::%s_instance<L>::attach(data, layer_instance_dispatch)" % a.name
+                        for a in instance_apis) + ") {\n"
+    out += """			deinit(data);
+			return SPEC_ERROR;
+		}
+		*layer_data_ret = data;
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit(void *layer_data) {
+		detail::instance_data_s<L> *data = static_cast<detail::instance_data_s<L> *>(layer_data);
+		for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++)
+			if (data->closures[i])
+				ffi_closure_free(data->closures[i]);
+		delete data;
+		return SPEC_SUCCESS;
+	}
+#else //!FFI_INSTANCE_LAYERS
+	static int init(
+			size_t                       num_entries,
+			struct instance_dispatch_s  *layer_instance_dispatch,
+			void                       **layer_data_ret) {
+		static_assert(std::is_base_of<instance_layer<L>, L>::value, "layer classes must derive from instance_layer");
+		static const struct instance_dispatch_s dispatch = {
+"""
+    out += ",\n".join("\t\t\tdetail::%s_instance<L>::entry()" % a.name for a in instance_apis) + "\n\t\t};\n"
+    out += """		if (!layer_instance_dispatch || !layer_data_ret)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		if (num_entries > NUM_INSTANCE_DISPATCH_ENTRIES)
+			num_entries = NUM_INSTANCE_DISPATCH_ENTRIES;
+		L *layer = new (std::nothrow) L();
+		if (!layer)
+			return SPEC_ERROR;
+		memcpy(layer_instance_dispatch, &dispatch, num_entries * sizeof(pfn_layerInit_t));
+		*layer_data_ret = layer;
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit(void *layer_data) {
+		delete static_cast<L *>(layer_data);
+		return SPEC_SUCCESS;
+	}
+#endif //!FFI_INSTANCE_LAYERS
+};
+
+} // namespace exp_layer
+
+/**
+ * Layer API of a library implementing the global layer class layer_class.
+ */
+#define EXP_GLOBAL_LAYER(layer_class) \\
+extern "C" int layerInit( \\
+		size_t              num_entries, \\
+		struct dispatch_s  *target_dispatch, \\
+		struct dispatch_s  *layer_dispatch) { \\
+	return exp_layer::global_layer<layer_class>::init(num_entries, target_dispatch, layer_dispatch); \\
+} \\
+extern "C" int layerDeinit() { \\
+	return exp_layer::global_layer<layer_class>::deinit(); \\
+}
+
+/**
+ * Layer API of a library implementing the instance layer class layer_class.
+ */
+#if FFI_INSTANCE_LAYERS
+#define EXP_INSTANCE_LAYER(layer_class) \\
+extern "C" int layerInstanceInit( \\
+		size_t                       num_entries, \\
+		struct instance_dispatch_s  *target_dispatch, \\
+		struct instance_dispatch_s  *layer_instance_dispatch, \\
+		void                       **layer_data_ret) { \\
+	return exp_layer::instance_layer<layer_class>::init( \\
+		num_entries, target_dispatch, layer_instance_dispatch, layer_data_ret); \\
+} \\
+extern "C" int layerInstanceDeinit(void *layer_data) { \\
+	return exp_layer::instance_layer<layer_class>::deinit(layer_data); \\
+}
+#else //!FFI_INSTANCE_LAYERS
+#define EXP_INSTANCE_LAYER(layer_class) \\
+extern "C" int layerInstanceInit( \\
+		size_t                       num_entries, \\
+		struct instance_dispatch_s  *layer_instance_dispatch, \\
+		void                       **layer_data_ret) { \\
+	return exp_layer::instance_layer<layer_class>::init( \\
+		num_entries, layer_instance_dispatch, layer_data_ret); \\
+} \\
+extern "C" int layerInstanceDeinit(void *layer_data) { \\
+	return exp_layer::instance_layer<layer_class>::deinit(layer_data); \\
+}
+#endif //!FFI_INSTANCE_LAYERS
+"""
+    return out
+
+
+def fnv1a(seed, name):
+    h = (2166136261 ^ seed) & 0xffffffff
+    for c in name.encode():
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    # final avalanche, so that different seeds give independent hashes
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+
+def perfect_hash(names):
+    """Hash and displace: names are distributed in buckets by a first hash,
+    then for each bucket, largest first, a seed is searched so that the
+    second hash places all the names of the bucket in free slots."""
+    num_buckets = max(1, (len(names) + 3) // 4)
+    size = max(1, len(names) + len(names) // 4)
+    buckets = [[] for _ in range(num_buckets)]
+    for n in names:
+        buckets[fnv1a(0, n) % num_buckets].append(n)
+    seeds = [0] * num_buckets
+    slots = [None] * size
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        for seed in range(1, 1 << 24):
+            taken = [fnv1a(seed, n) % size for n in buckets[b]]
+            if len(set(taken)) == len(taken) and all(slots[t] is None for t in taken):
+                break
+        else:
+            sys.exit("could not build the API name perfect hash")
+        seeds[b] = seed
+        for n, t in zip(buckets[b], taken):
+            slots[t] = n
+    return seeds, slots
+
+
+def x_entry(api):
+    entry = "%s, " % api.name
+    if api.kind != "loader":
+        entry += "%s, " % api.handle
+    entry += "(%s), (%s)" % (api.params_decl(), api.args())
+    if api.kind == "create":
+        entry += ", %s" % api.params[-1].name
+    if api.kind == "batch":
+        entry = "%s, %s, %s" % (api.name, api.single.name, entry[len(api.name) + 2:])
+        entry += ", %s" % ", ".join(p.name for p in api.params[1:])
+    if api.kind in ("create_bulk", "bulk"):
+        entry = "%s, %s, %s" % (api.name, api.single.name, entry[len(api.name) + 2:])
+        entry += ", %s" % ", ".join(p.name for p in api.params[-2:])
+    if api.kind == "enqueue":
+        target = api.target
+        entry = "%s, %s, API_HANDLE_%s, %s, %s, (%s), (%s), (%s), (%s), (%s)" % (
+            api.name, target.name, target.params[0].base[:-2].upper(),
+            api.params[0].name, api.params[-1].name, api.params_decl(), api.args(),
+            " ".join(p.decl() + ";" for p in target.params),
+            ", ".join(p.name for p in api.params[1:-1]),
+            ", ".join("stored->" + p.name for p in target.params))
+    return "\tX(%s)" % entry
+
+
+def as_driver(api):
+    """The API as a plain driver API, for lists that ignore the kind."""
+    if api.kind == "driver":
+        return api
+    driver = Api("driver", api.name, api.params, api.doc)
+    driver.bulk_handle = api.bulk_handle
+    return driver
+
+
+def x_list(name, apis):
+    if not apis:
+        return "#define %s(X)\n" % name
+    return "#define %s(X) \\\n" % name + " \\\n".join(x_entry(a) for a in apis) + "\n"
+
+
+def x_list_filter(name, apis):
+    entries = []
+    for api in apis:
+        value = next((p.name for p in api.params[1:] if p.base == "int" and not p.stars), None)
+        entries.append(x_entry(api)[:-1] + (", %s, 1)" % value if value else ", 0, 0)"))
+    return "#define %s(X) \\\n" % name + " \\\n".join(entries) + "\n"
+
+
+def gen_api_h(spec):
+    out = BANNER
+    out += """#include <stdint.h>
+#include <string.h>
+
+/**
+ * Types of the handles, for loader objects bound to a handle.
+ */
+enum api_handle_e {
+"""
+    out += ",\n".join("\tAPI_HANDLE_%s" % h.upper() for h in spec.handles) + "\n};\n"
+    out += """
+/**
+ * Lists of the APIs defined in spec.h, to be used as X macros, in dispatch
+ * table order. params is the parenthesized parameter list of the API, and args
+ * the parenthesized argument list to forward a call. Driver APIs also provide
+ * the name of their handle parameter, APIs creating handles the name of their
+ * handle returning parameter, and batch APIs the name of the API they batch
+ * and of their count, parameters array and results array parameters. Bulk
+ * APIs, that create or are called on arrays of handles, provide the name of
+ * the API called on each handle and of their count and handles array
+ * parameters. APIs called on an array of handles are dispatched through the
+ * first one, the handle of the API being an expression giving it.
+ */
+
+/* X(api, params, args), loader implemented APIs, including enqueue APIs */
+"""
+    out += x_list("API_LOADER", [a if a.kind == "loader" else Api("loader", a.name, a.params, a.doc)
+                                 for a in spec.loader_apis])
+    out += "\n/* X(api, handle, params, args), all driver implemented APIs */\n"
+    out += x_list("API_DRIVER", [as_driver(a) for a in spec.driver_apis])
+    out += "\n/* X(api, handle, params, args), driver implemented APIs that are not fanned out */\n"
+    out += x_list("API_DRIVER_SINGLE", [as_driver(a) for a in spec.driver_apis if a.kind not in FANOUT_KINDS])
+    out += "\n/* X(api, handle, params, args) */\n"
+    out += x_list("API_DRIVER_CALL", [as_driver(a) for a in spec.apis if a.kind in CALL_KINDS])
+    out += "\n/* X(api, handle, params, args, value, has_value), all driver implemented\n * APIs, value being their first int parameter after the handle if has_value */\n"
+    out += x_list_filter("API_DRIVER_FILTER", [as_driver(a) for a in spec.driver_apis])
+    out += "\n/* X(api, handle, params, args), driver APIs releasing their handle */\n"
+    out += x_list("API_DRIVER_DESTROY", [a for a in spec.apis if a.kind == "destroy"])
+    out += "\n/* X(api, handle, params, args, handle_ret) */\n"
+    out += x_list("API_DRIVER_CREATE", [a for a in spec.apis if a.kind == "create"])
+    out += "\n/* X(api, single, handle, params, args, num, elems, results) */\n"
+    out += x_list("API_DRIVER_BATCH", [a for a in spec.apis if a.kind == "batch"])
+    out += "\n/* X(api, single, handle, params, args, num, handles_ret) */\n"
+    out += x_list("API_DRIVER_CREATE_BULK", [a for a in spec.apis if a.kind == "create_bulk"])
+    out += "\n/* X(api, single, handle, params, args, num, handles) */\n"
+    out += x_list("API_DRIVER_BULK", [a for a in spec.apis if a.kind == "bulk"])
+    out += """
+/**
+ * X(api, target, handle_type, queue, event_ret, params, args, fields, elems,
+ *   call)
+ * Enqueue APIs, target being the API they enqueue, and handle_type the type of
+ * its handle. queue and event_ret are the names of the queue and event
+ * parameters, fields the parameters of target as structure fields, elems the
+ * arguments to store after the handle, and call the arguments to call target
+ * with from a pointer to the stored fields named stored.
+ */
+"""
+    out += x_list("API_ENQUEUE", [a for a in spec.apis if a.kind == "enqueue"])
+
+    names = [a.name for a in spec.apis]
+    driver_names = [a.name for a in spec.driver_apis]
+    seeds, slots = perfect_hash(names)
+    out += """
+#define NUM_APIS %d
+
+/**
+ * Name lookup, in constant time irrespective of the number of APIs. The table
+ * is a perfect hash (hash and displace): the name is hashed once to find its
+ * bucket, and a second time with the seed of the bucket to find its entry,
+ * which gives the slot of the API in struct dispatch_s and in struct
+ * driver_dispatch_s (-1 for loader APIs).
+ */
+struct api_entry_s {
+	const char *name;
+	int         slot;
+	int         driver_slot;
+};
+
+#define API_HASH_BUCKETS %d
+#define API_HASH_SIZE %d
+
+static const uint32_t _api_hash_seeds[API_HASH_BUCKETS] __attribute__((unused)) = {
+""" % (len(names), len(seeds), len(slots))
+    out += ",\n".join("\t0x%08x" % s for s in seeds) + "\n};\n\n"
+    out += "static const struct api_entry_s _api_hash_entries[API_HASH_SIZE] __attribute__((unused)) = {\n"
+    entries = []
+    for n in slots:
+        if n is None:
+            entries.append("\t{ NULL, -1, -1 }")
+        else:
+            entries.append('\t{ "%s", %d, %d }' % (n, names.index(n),
+                           driver_names.index(n) if n in driver_names else -1))
+    out += ",\n".join(entries) + "\n};\n"
+    out += """
+static inline uint32_t
+apiHash(uint32_t seed, const char *name) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (; *name; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/**
+ * Return the entry of the API named name, or NULL if there is no such API.
+ */
+static inline const struct api_entry_s *
+apiLookup(const char *name) {
+	uint32_t seed = _api_hash_seeds[apiHash(0, name) % API_HASH_BUCKETS];
+	const struct api_entry_s *entry = &_api_hash_entries[apiHash(seed, name) % API_HASH_SIZE];
+	if (entry->name && !strcmp(entry->name, name))
+		return entry;
+	return NULL;
+}
+"""
+    return out
+
+
+def main():
+    src = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(os.path.abspath(__file__)), "spec.api")
+    dst = sys.argv[2] if len(sys.argv) > 2 else os.path.dirname(os.path.abspath(src))
+    spec = parse(src)
+    outputs = {
+        "spec.h": gen_spec_h,
+        "dispatch.h": gen_dispatch_h,
+        "layer.h": gen_layer_h,
+        "instance_layer.h": gen_instance_layer_h,
+        "layer.hpp": gen_layer_hpp,
+        "api.h": gen_api_h,
+    }
+    for name, gen in outputs.items():
+        with open(os.path.join(dst, name), "w") as f:
+            f.write(gen(spec))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,377 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "spec.h"
+#include "dispatch.h"
+#include "layer.h"
+#include "api.h"
+
+/**
+ * This file contains a global layer measuring the latency of every API call
+ * going through it. Latencies are recorded in per thread histograms, so the
+ * hot path only writes to memory owned by the calling thread. When the layer
+ * is deinitialized, the histograms of all the threads are merged, and the
+ * p50/p99/p999 latencies of each API are printed, per platform.
+ *
+ * Histograms use log buckets, as HDR histograms do: values are bucketed by
+ * their power of two, each power of two being split in
+ * HISTOGRAM_SUB_BUCKETS linear sub buckets, which bounds the relative error of
+ * the reported values to 1/HISTOGRAM_SUB_BUCKETS for any value.
+ *
+ * The platform of a call is identified by the multiplexing structure of its
+ * platform. The loader sets the first word of handles to their multiplexing
+ * structure (see driver-spec.h), which devices with their own instance layers
+ * don't share with their platform, and the first word of a multiplexing
+ * structure to the one of the platform. Platforms are numbered in the order
+ * getPlatforms returns them. Loader APIs, that are not called on driver
+ * handles, are not attributed to a platform.
+ */
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NUM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Maximum number of platforms a thread records separately. Slot 0 gathers
+ * loader APIs, and calls on platforms past the limit.
+ */
+#define HISTOGRAM_MAX_PLATFORMS 16
+
+#define API_SLOT(api) (offsetof(struct dispatch_s, api) / sizeof(pfn_layerInit_t))
+
+struct histogram_s {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_NUM_BUCKETS];
+};
+
+/**
+ * Histograms of a thread, allocated on first use. Records are never freed
+ * while the layer is loaded, and are reused by new threads once their thread
+ * exits, so the latencies of exited threads are still reported.
+ */
+struct histogram_thread_s;
+struct histogram_thread_s {
+	struct histogram_thread_s *next;
+	int                        in_use;
+	size_t                     num_keys;
+	const void                *keys[HISTOGRAM_MAX_PLATFORMS];
+	struct histogram_s        *histograms[NUM_APIS][HISTOGRAM_MAX_PLATFORMS];
+};
+
+/**
+ * Global variable pointing to the next layer dispatch table (or loader
+ * terminator).
+ */
+static struct dispatch_s *_target_dispatch = NULL;
+
+static __thread struct histogram_thread_s *_histogram_thread = NULL;
+static struct histogram_thread_s *_histogram_threads = NULL;
+static pthread_key_t              _histogram_key;
+
+/**
+ * Keys of the platforms returned by getPlatforms, in order.
+ */
+static const void     *_platform_keys[HISTOGRAM_MAX_PLATFORMS];
+static size_t          _num_platform_keys = 0;
+static pthread_mutex_t _platform_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t
+histogramNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline const void *
+histogramKey(const void *handle) {
+	const void * const *multiplex = handle ? *(const void * const * const *)handle : NULL;
+	return multiplex ? *multiplex : NULL;
+}
+
+static inline size_t
+histogramBucket(uint64_t value) {
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+	int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+	return (size_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * Highest value recorded in a bucket.
+ */
+static uint64_t
+histogramBucketValue(size_t bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+	int shift = (int)(bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+	uint64_t low = (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+	return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void
+histogramThreadExit(void *arg) {
+	struct histogram_thread_s *thread = (struct histogram_thread_s *)arg;
+	__atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static struct histogram_thread_s *
+histogramThreadRegister(void) {
+	struct histogram_thread_s *thread;
+	for (thread = __atomic_load_n(&_histogram_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&thread->in_use, &unused, 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			goto found;
+	}
+	thread = (struct histogram_thread_s *)calloc(1, sizeof(struct histogram_thread_s));
+	if (!thread)
+		return NULL;
+	thread->in_use = 1;
+	thread->num_keys = 1;
+	thread->next = __atomic_load_n(&_histogram_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_histogram_threads, &thread->next, thread, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+found:
+	pthread_setspecific(_histogram_key, thread);
+	_histogram_thread = thread;
+	return thread;
+}
+
+static void
+histogramRecord(size_t api, const void *key, uint64_t latency) {
+	struct histogram_thread_s *thread = _histogram_thread;
+	if (__builtin_expect(!thread, 0) && !(thread = histogramThreadRegister()))
+		return;
+	size_t slot = 0;
+	if (key) {
+		for (slot = 1; slot < thread->num_keys && thread->keys[slot] != key; slot++)
+			;
+		if (slot == thread->num_keys) {
+			if (slot < HISTOGRAM_MAX_PLATFORMS) {
+				thread->keys[slot] = key;
+				thread->num_keys++;
+			} else
+				slot = 0;
+		}
+	}
+	struct histogram_s *histogram = thread->histograms[api][slot];
+	if (__builtin_expect(!histogram, 0)) {
+		histogram = (struct histogram_s *)calloc(1, sizeof(struct histogram_s));
+		if (!histogram)
+			return;
+		thread->histograms[api][slot] = histogram;
+	}
+	histogram->count++;
+	histogram->sum += latency;
+	if (latency > histogram->max)
+		histogram->max = latency;
+	histogram->buckets[histogramBucket(latency)]++;
+}
+
+/**
+ * API wrappers of the layer, timing the rest of the call chain.
+ */
+#define HISTOGRAM_WRAP(api, key, params, args) \
+static int \
+api ## _wrap params { \
+	const void *_key = (key); \
+	uint64_t _start = histogramNow(); \
+	int res = _target_dispatch->api args; \
+	histogramRecord(API_SLOT(api), _key, histogramNow() - _start); \
+	return res; \
+}
+
+#define HISTOGRAM_WRAP_LOADER(api, params, args) \
+	HISTOGRAM_WRAP(api, NULL, params, args)
+#define HISTOGRAM_WRAP_DRIVER(api, handle, params, args) \
+	HISTOGRAM_WRAP(api, histogramKey(handle), params, args)
+
+API_LOADER(HISTOGRAM_WRAP_LOADER)
+API_DRIVER(HISTOGRAM_WRAP_DRIVER)
+
+#undef HISTOGRAM_WRAP_DRIVER
+#undef HISTOGRAM_WRAP_LOADER
+#undef HISTOGRAM_WRAP
+
+/**
+ * getPlatforms is also intercepted to number the platforms, outside of the
+ * timed call.
+ */
+static int
+getPlatforms_number(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) {
+	int res = getPlatforms_wrap(num_platforms, platforms, num_platforms_ret);
+	if (res != SPEC_SUCCESS || !platforms)
+		return res;
+	pthread_mutex_lock(&_platform_mutex);
+	for (size_t i = 0; i < num_platforms && platforms[i]; i++) {
+		const void *key = histogramKey(platforms[i]);
+		size_t j;
+		for (j = 0; j < _num_platform_keys && _platform_keys[j] != key; j++)
+			;
+		if (j == _num_platform_keys && j < HISTOGRAM_MAX_PLATFORMS)
+			_platform_keys[_num_platform_keys++] = key;
+	}
+	pthread_mutex_unlock(&_platform_mutex);
+	return res;
+}
+
+/**
+ * Dispatch table of the layer, intercepting every API.
+ */
+#define HISTOGRAM_ENTRY_LOADER(api, params, args) \
+	.api = &api ## _wrap,
+#define HISTOGRAM_ENTRY_DRIVER(api, handle, params, args) \
+	.api = &api ## _wrap,
+
+static struct dispatch_s _dispatch = {
+	API_LOADER(HISTOGRAM_ENTRY_LOADER)
+	API_DRIVER(HISTOGRAM_ENTRY_DRIVER)
+};
+
+#undef HISTOGRAM_ENTRY_DRIVER
+#undef HISTOGRAM_ENTRY_LOADER
+
+static const char *_api_names[NUM_APIS] = {
+#define HISTOGRAM_NAME_LOADER(api, params, args) \
+	[API_SLOT(api)] = #api,
+#define HISTOGRAM_NAME_DRIVER(api, handle, params, args) \
+	[API_SLOT(api)] = #api,
+	API_LOADER(HISTOGRAM_NAME_LOADER)
+	API_DRIVER(HISTOGRAM_NAME_DRIVER)
+#undef HISTOGRAM_NAME_DRIVER
+#undef HISTOGRAM_NAME_LOADER
+};
+
+int layerInit(
+		size_t              num_entries,
+		struct dispatch_s  *target_dispatch,
+		struct dispatch_s  *layer_dispatch) {
+	if (num_entries < NUM_DISPATCH_ENTRIES)
+		return SPEC_ERROR;
+	if (!target_dispatch || !layer_dispatch)
+		return SPEC_ERROR;
+	if (pthread_key_create(&_histogram_key, &histogramThreadExit))
+		return SPEC_ERROR;
+	_target_dispatch = target_dispatch;
+	*layer_dispatch = _dispatch;
+	layer_dispatch->getPlatforms = &getPlatforms_number;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * Return the value under which fraction of the recorded values are.
+ */
+static uint64_t
+histogramPercentile(const struct histogram_s *histogram, double fraction) {
+	uint64_t target = (uint64_t)(fraction * histogram->count);
+	uint64_t count = 0;
+	if (target < fraction * histogram->count || target < 1)
+		target++;
+	for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+		count += histogram->buckets[i];
+		if (count >= target) {
+			uint64_t value = histogramBucketValue(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+static void
+histogramMerge(struct histogram_s *dst, const struct histogram_s *src) {
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+static void
+histogramPrint(const char *api, const char *platform, const struct histogram_s *histogram) {
+	printf("HISTOGRAM LAYER: %-28s %-12s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+		api, platform, (unsigned long long)histogram->count,
+		(unsigned long long)(histogram->sum / histogram->count),
+		(unsigned long long)histogramPercentile(histogram, 0.5),
+		(unsigned long long)histogramPercentile(histogram, 0.99),
+		(unsigned long long)histogramPercentile(histogram, 0.999),
+		(unsigned long long)histogram->max);
+}
+
+/**
+ * Merge the histograms of every thread, per API and platform, and print them.
+ * Every platform key seen by a thread is reported, numbered if getPlatforms
+ * returned it.
+ */
+int layerDeinit() {
+	struct histogram_s *merged = (struct histogram_s *)malloc(sizeof(struct histogram_s));
+	struct histogram_s *total = (struct histogram_s *)malloc(sizeof(struct histogram_s));
+	const void *keys[HISTOGRAM_MAX_PLATFORMS + 1];
+	size_t num_keys = 0;
+	int res = SPEC_SUCCESS;
+	if (!merged || !total) {
+		res = SPEC_ERROR;
+		goto end;
+	}
+	keys[num_keys++] = NULL;
+	for (size_t i = 0; i < _num_platform_keys; i++)
+		keys[num_keys++] = _platform_keys[i];
+	printf("HISTOGRAM LAYER: %-28s %-12s %10s %10s %10s %10s %10s %10s\n",
+		"API", "platform", "calls", "mean (ns)", "p50 (ns)", "p99 (ns)", "p999 (ns)", "max (ns)");
+	for (size_t api = 0; api < NUM_APIS; api++) {
+		size_t num_printed = 0;
+		memset(total, 0, sizeof(*total));
+		/* threads may have seen platforms that getPlatforms didn't return */
+		for (struct histogram_thread_s *thread = _histogram_threads; thread; thread = thread->next)
+			for (size_t slot = 1; slot < thread->num_keys; slot++) {
+				size_t k;
+				for (k = 0; k < num_keys && keys[k] != thread->keys[slot]; k++)
+					;
+				if (k == num_keys && num_keys <= HISTOGRAM_MAX_PLATFORMS)
+					keys[num_keys++] = thread->keys[slot];
+			}
+		for (size_t k = 0; k < num_keys; k++) {
+			memset(merged, 0, sizeof(*merged));
+			for (struct histogram_thread_s *thread = _histogram_threads; thread; thread = thread->next)
+				for (size_t slot = 0; slot < thread->num_keys; slot++)
+					if ((slot ? thread->keys[slot] : NULL) == keys[k] && thread->histograms[api][slot])
+						histogramMerge(merged, thread->histograms[api][slot]);
+			if (!merged->count)
+				continue;
+			char platform[32];
+			if (!k)
+				snprintf(platform, sizeof(platform), "-");
+			else if (k <= _num_platform_keys)
+				snprintf(platform, sizeof(platform), "%zu", k - 1);
+			else
+				snprintf(platform, sizeof(platform), "%p", keys[k]);
+			histogramPrint(_api_names[api], platform, merged);
+			histogramMerge(total, merged);
+			num_printed++;
+		}
+		if (num_printed > 1)
+			histogramPrint(_api_names[api], "all", total);
+	}
+end:
+	free(merged);
+	free(total);
+	pthread_key_delete(_histogram_key);
+	struct histogram_thread_s *thread = _histogram_threads;
+	while (thread) {
+		struct histogram_thread_s *next = thread->next;
+		for (size_t api = 0; api < NUM_APIS; api++)
+			for (size_t slot = 0; slot < HISTOGRAM_MAX_PLATFORMS; slot++)
+				free(thread->histograms[api][slot]);
+		free(thread);
+		thread = next;
+	}
+	_histogram_threads = NULL;
+	_histogram_thread = NULL;
+	return res;
+}
@@ -2,34 +2,90 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "spec.h"
 #include "dispatch.h"
 #include "layer.h"
 #include "instance_layer.h"
+#include "trace.h"
+#include "spec_ext.h"
+#include "api.h"
 
 /**
  * This file contains an implementation of the instance layer API defined in
  * layer.h.  Several different layers can be created through the use of the
  * LAYER_NUMBER macro definition.  The layer will only intercept deviceFunc1
- * when LAYER_NUMBER == 1, showcasing the use of partial layering. Also none of
- * them intercept platformAddLayer as it is provided by the loader and not the
+ * and deviceFunc1Batch when LAYER_NUMBER == 1, showcasing the use of partial
+ * layering. Also none of them intercept platformAddLayer as it is provided by the loader and not the
  * drivers. Depending on the FFI_INSTANCE_LAYERS macro definition the FFI or
  * regular flavor of the
- * layer will be built.
+ * layer will be built. The FFI flavor also wraps the deviceExtFunc extension
+ * function (see spec_ext.h) when the application queries it.
  * The instance_layer.h file contains definitions for FFI layers that would be
  * shared between layers written in FFI. Several other helper functions written
  * here could also be included in this file.
+ * When LAYER_FILTER is defined, the layer only handles the deviceFunc2 calls
+ * whose param is between 10 and 19: the non FFI flavor asks the loader to
+ * only call it for those, and the FFI flavor, that the loader can't filter,
+ * forwards the other calls itself.
+ * The layer counts the calls it sees for each API, that the tests query
+ * through layerCallCount to check which calls reach it.
  */
 
 #ifndef LAYER_NUMBER
 #define LAYER_NUMBER 1
 #endif
 
+#define LAYER_FILTER_MIN 10
+#define LAYER_FILTER_MAX 19
+
+/**
+ * See layer.c, LAYER_VERBOSE=0 builds a silent layer for benchmarking, and
+ * LAYER_TRACE records the logs in binary form.
+ */
+#ifndef LAYER_VERBOSE
+#define LAYER_VERBOSE 1
+#endif
+
 #define LAYER_LOG(format, ...) \
 do  { \
-	printf("INSTANCE LAYER %d: " format "\n", LAYER_NUMBER, __VA_ARGS__); \
+	if (LAYER_VERBOSE) { \
+		static uint32_t _format_id = 0; \
+		if (_trace_enabled) \
+			traceLog(&_format_id, "INSTANCE LAYER %d: " format, LAYER_NUMBER, __VA_ARGS__); \
+		else \
+			printf("INSTANCE LAYER %d: " format "\n", LAYER_NUMBER, __VA_ARGS__); \
+	} \
+} while (0)
+
+/**
+ * Silent layers don't count calls, unless built with LAYER_COUNT=1, so that
+ * benchmarks don't measure the counters.
+ */
+#ifndef LAYER_COUNT
+#define LAYER_COUNT LAYER_VERBOSE
+#endif
+
+static size_t _call_counts[NUM_INSTANCE_DISPATCH_ENTRIES];
+
+#define LAYER_COUNT_CALL(api) \
+do { \
+	if (LAYER_COUNT) \
+		__atomic_add_fetch(&_call_counts[offsetof(struct instance_dispatch_s, api ## _instance) / sizeof(void *)], \
+			1, __ATOMIC_RELAXED); \
 } while (0)
 
+/**
+ * Returns the number of calls to the named API that went through the layer,
+ * on all the platforms and devices it is attached to.
+ */
+size_t layerCallCount(const char *api_name) {
+	const struct api_entry_s *entry = apiLookup(api_name);
+	if (!entry || entry->driver_slot < 0)
+		return 0;
+	return __atomic_load_n(&_call_counts[entry->driver_slot], __ATOMIC_RELAXED);
+}
+
 #if FFI_INSTANCE_LAYERS
 
 /**
@@ -42,12 +98,26 @@ struct ffi_wrap_data {
 	ffi_cif      cif;
 };
 
+/**
+ * Extension functions wrappers are created on demand, possibly several times
+ * for the same extension, so they are kept in a list.
+ */
+struct ffi_ext_wrap_data {
+	struct ffi_wrap_data      wrap;
+	void                     *target;
+	struct ffi_ext_wrap_data *next;
+};
+
 struct ffi_layer_data {
 	struct instance_dispatch_s *target_dispatch;
 	struct ffi_wrap_data        platformCreateDevice;
 	struct ffi_wrap_data        deviceFunc1;
 	struct ffi_wrap_data        deviceFunc2;
 	struct ffi_wrap_data        deviceDestroy;
+	struct ffi_wrap_data        platformCreateDevices;
+	struct ffi_wrap_data        devicesDestroy;
+	struct ffi_wrap_data        deviceFunc1Batch;
+	struct ffi_ext_wrap_data   *ext_wraps;
 };
 
 typedef struct ffi_layer_data instance_layer_t;
@@ -84,6 +154,7 @@ platformCreateDevice_instance(
 		device_t         *device_ret) {
 	LAYER_LOG("entering platformCreateDevice(platform = %p, device_ret = %p)",
 		(void *)platform, (void *)device_ret);
+	LAYER_COUNT_CALL(platformCreateDevice);
 	int res = CALL_NEXT_LAYER(layer, platformCreateDevice, platform, device_ret);
 	LAYER_LOG("leaving platformCreateDevice, result = %d, device_ret_val = %p",
 		res, device_ret ? (void *)*device_ret : NULL);
@@ -97,10 +168,26 @@ deviceFunc1_instance(
 		device_t          device,
 		int               param) {
 	LAYER_LOG("entering deviceFunc1(device = %p, param %d)", (void *)device, param);
+	LAYER_COUNT_CALL(deviceFunc1);
 	int res = CALL_NEXT_LAYER(layer, deviceFunc1, device, param);
 	LAYER_LOG("eaving deviceFunc1, result = %d", res);
 	return res;
 }
+
+static inline int
+deviceFunc1Batch_instance(
+		instance_layer_t *layer,
+		device_t          device,
+		size_t            num_params,
+		const int        *params,
+		int              *results) {
+	LAYER_LOG("entering deviceFunc1Batch(device = %p, num_params = %zu, params = %p, results = %p)",
+		(void *)device, num_params, (void *)params, (void *)results);
+	LAYER_COUNT_CALL(deviceFunc1Batch);
+	int res = CALL_NEXT_LAYER(layer, deviceFunc1Batch, device, num_params, params, results);
+	LAYER_LOG("leaving deviceFunc1Batch, result = %d", res);
+	return res;
+}
 #endif
 
 static inline int
@@ -108,7 +195,12 @@ deviceFunc2_instance(
 		instance_layer_t *layer,
 		device_t          device,
 		int               param) {
+#if defined(LAYER_FILTER) && FFI_INSTANCE_LAYERS
+	if (param < LAYER_FILTER_MIN || param > LAYER_FILTER_MAX)
+		return CALL_NEXT_LAYER(layer, deviceFunc2, device, param);
+#endif
 	LAYER_LOG("entering deviceFunc2(device = %p, param %d)", (void *)device, param);
+	LAYER_COUNT_CALL(deviceFunc2);
 	int res = CALL_NEXT_LAYER(layer, deviceFunc2, device, param);
 	LAYER_LOG("leaving deviceFunc2, result = %d", res);
 	return res;
@@ -119,11 +211,39 @@ deviceDestroy_instance(
 		instance_layer_t *layer,
 		device_t          device) {
 	LAYER_LOG("entering deviceDestroy(device = %p)", (void *)device);
+	LAYER_COUNT_CALL(deviceDestroy);
 	int res = CALL_NEXT_LAYER(layer, deviceDestroy, device);
 	LAYER_LOG("leaving deviceDestroy, result = %d", res);
 	return res;
 }
 
+static inline int
+platformCreateDevices_instance(
+		instance_layer_t *layer,
+		platform_t        platform,
+		size_t            num_devices,
+		device_t         *devices) {
+	LAYER_LOG("entering platformCreateDevices(platform = %p, num_devices = %zu, devices = %p)",
+		(void *)platform, num_devices, (void *)devices);
+	LAYER_COUNT_CALL(platformCreateDevices);
+	int res = CALL_NEXT_LAYER(layer, platformCreateDevices, platform, num_devices, devices);
+	LAYER_LOG("leaving platformCreateDevices, result = %d", res);
+	return res;
+}
+
+static inline int
+devicesDestroy_instance(
+		instance_layer_t *layer,
+		size_t            num_devices,
+		const device_t   *devices) {
+	LAYER_LOG("entering devicesDestroy(num_devices = %zu, devices = %p)",
+		num_devices, (void *)devices);
+	LAYER_COUNT_CALL(devicesDestroy);
+	int res = CALL_NEXT_LAYER(layer, devicesDestroy, num_devices, devices);
+	LAYER_LOG("leaving devicesDestroy, result = %d", res);
+	return res;
+}
+
 #if FFI_INSTANCE_LAYERS
 
 /**
@@ -147,11 +267,20 @@ DECLARE_WRAPPER(deviceFunc2);
 static deviceFunc2_ffi_t deviceFunc2_ffi;
 DECLARE_WRAPPER(deviceDestroy);
 static deviceDestroy_ffi_t deviceDestroy_ffi;
+DECLARE_WRAPPER(platformCreateDevices);
+static platformCreateDevices_ffi_t platformCreateDevices_ffi;
+DECLARE_WRAPPER(devicesDestroy);
+static devicesDestroy_ffi_t devicesDestroy_ffi;
+#if LAYER_NUMBER == 1
+DECLARE_WRAPPER(deviceFunc1Batch);
+static deviceFunc1Batch_ffi_t deviceFunc1Batch_ffi;
+#endif
 
 /**
  * This function realizes the ffi closures with the given argument types and
- * return value type, plus a function to call (`pfun_ffi`) and the layer
- * instance context `layer_data`. The layer entry point is returned in `pfun_ret`.
+ * return value type, plus a function to call (`pfun_ffi`) and the context
+ * `data`, usually the layer instance data. The layer entry point is returned
+ * in `pfun_ret`.
  * For more details refer to the ffi documentation:
  * http://www.chiark.greenend.org.uk/doc/libffi-dev/html/The-Closure-API.html
  * http://www.chiark.greenend.org.uk/doc/libffi-dev/html/Closure-Example.html
@@ -164,7 +293,7 @@ static deviceDestroy_ffi_t deviceDestroy_ffi;
  */
 static inline int
 wrap_call(
-		struct ffi_layer_data  *layer_data,
+		void                   *data,
 		void                   *pfun_ffi,
 		unsigned int            nargs,
 		ffi_type               *rtype,
@@ -183,7 +312,7 @@ wrap_call(
 	status = ffi_prep_closure_loc(
 		wrap_data->closure, &wrap_data->cif,
 		(void (*)(ffi_cif *, void *, void **, void *))(intptr_t)pfun_ffi,
-		(void *)layer_data, code);
+		data, code);
 	if (FFI_OK != status)
 		goto error_closure;
 	*pfun_ret = code;
@@ -215,6 +344,11 @@ WRAPPER(deviceFunc1)
 #endif
 WRAPPER(deviceFunc2)
 WRAPPER(deviceDestroy)
+WRAPPER(platformCreateDevices)
+WRAPPER(devicesDestroy)
+#if LAYER_NUMBER == 1
+WRAPPER(deviceFunc1Batch)
+#endif
 
 #define WRAP(api) do { \
 	int res = WRAPPER_NAME(api)( \
@@ -242,6 +376,17 @@ cleanup_closures(struct ffi_layer_data *layer_data) {
 #endif
 	UNWRAP(deviceFunc2);
 	UNWRAP(deviceDestroy);
+	UNWRAP(platformCreateDevices);
+	UNWRAP(devicesDestroy);
+#if LAYER_NUMBER == 1
+	UNWRAP(deviceFunc1Batch);
+#endif
+	while (layer_data->ext_wraps) {
+		struct ffi_ext_wrap_data *next = layer_data->ext_wraps->next;
+		ffi_closure_free(layer_data->ext_wraps->wrap.closure);
+		free(layer_data->ext_wraps);
+		layer_data->ext_wraps = next;
+	}
 }
 
 /**
@@ -272,6 +417,11 @@ int layerInstanceInit(
 #endif
 	WRAP(deviceFunc2);
 	WRAP(deviceDestroy);
+	WRAP(platformCreateDevices);
+	WRAP(devicesDestroy);
+#if LAYER_NUMBER == 1
+	WRAP(deviceFunc1Batch);
+#endif
 	layer_data->target_dispatch = target_dispatch;
 	*layer_data_ret = (void *)layer_data;
 	return SPEC_SUCCESS;
@@ -292,6 +442,68 @@ int layerInstanceDeinit(
 	return SPEC_SUCCESS;
 }
 
+/**
+ * Extension function wrapper, the FFI closure context is the wrapper data,
+ * that contains the next function in the chain.
+ */
+struct deviceExtFunc_ffi_args {
+	device_t *p_device;
+	int      *p_param;
+};
+static ffi_type *deviceExtFunc_ffi_types[2] = {
+	&ffi_type_pointer,
+	&ffi_type_sint
+};
+
+static void
+deviceExtFunc_ffi(
+		ffi_cif                       *cif,
+		int                           *ffi_ret,
+		struct deviceExtFunc_ffi_args *args,
+		void                          *data) {
+	(void)cif;
+	struct ffi_ext_wrap_data *wrap_data = (struct ffi_ext_wrap_data *)data;
+	device_t device = *args->p_device;
+	int      param  = *args->p_param;
+	LAYER_LOG("entering deviceExtFunc(device = %p, param %d)", (void *)device, param);
+	int res = ((pfn_deviceExtFunc_t)(intptr_t)wrap_data->target)(device, param);
+	LAYER_LOG("leaving deviceExtFunc, result = %d", res);
+	*ffi_ret = res;
+}
+
+/**
+ * As closures are created at runtime, FFI layers can wrap extension
+ * functions for every platform they are attached to.
+ */
+int layerInstanceWrapFunc(
+		void        *layer_data,
+		const char  *name,
+		void        *target,
+		void       **wrapper_ret) {
+	LAYER_LOG("entering layerInstanceWrapFunc(layer_data = %p, name = %s, target = %p, wrapper_ret = %p)",
+		layer_data, name, target, (void *)wrapper_ret);
+	if (!layer_data || !name || !target || !wrapper_ret)
+		return SPEC_ERROR;
+	*wrapper_ret = NULL;
+	if (strcmp(name, DEVICE_EXT_FUNC_NAME))
+		return SPEC_SUCCESS;
+	struct ffi_layer_data *data = (struct ffi_layer_data *)layer_data;
+	struct ffi_ext_wrap_data *wrap_data =
+		(struct ffi_ext_wrap_data *)calloc(1, sizeof(struct ffi_ext_wrap_data));
+	if (!wrap_data)
+		return SPEC_ERROR;
+	wrap_data->target = target;
+	if (wrap_call(wrap_data, (void *)(intptr_t)deviceExtFunc_ffi,
+			2, &ffi_type_sint, deviceExtFunc_ffi_types,
+			&wrap_data->wrap, wrapper_ret)) {
+		free(wrap_data);
+		return SPEC_ERROR;
+	}
+	wrap_data->next = data->ext_wraps;
+	data->ext_wraps = wrap_data;
+	return SPEC_SUCCESS;
+}
+
 /**
  * FFI specific wrappers. Could be provided in instance_layer.h.
  */
@@ -348,6 +560,50 @@ deviceDestroy_ffi(
 	*ffi_ret = deviceDestroy_instance(layer_data, device);
 }
 
+static void
+platformCreateDevices_ffi(
+		ffi_cif                               *cif,
+		int                                   *ffi_ret,
+		struct platformCreateDevices_ffi_args *args,
+		void                                  *data) {
+	(void)cif;
+	instance_layer_t *layer_data = (instance_layer_t *)data;
+	platform_t  platform    = *args->p_platform;
+	size_t      num_devices = *args->p_num_devices;
+	device_t   *devices     = *args->p_devices;
+	*ffi_ret = platformCreateDevices_instance(layer_data, platform, num_devices, devices);
+}
+
+static void
+devicesDestroy_ffi(
+		ffi_cif                        *cif,
+		int                            *ffi_ret,
+		struct devicesDestroy_ffi_args *args,
+		void                           *data) {
+	(void)cif;
+	instance_layer_t *layer_data = (instance_layer_t *)data;
+	size_t          num_devices = *args->p_num_devices;
+	const device_t *devices     = *args->p_devices;
+	*ffi_ret = devicesDestroy_instance(layer_data, num_devices, devices);
+}
+
+#if LAYER_NUMBER == 1
+static void
+deviceFunc1Batch_ffi(
+		ffi_cif                          *cif,
+		int                              *ffi_ret,
+		struct deviceFunc1Batch_ffi_args *args,
+		void                             *data) {
+	(void)cif;
+	instance_layer_t *layer_data = (instance_layer_t *)data;
+	device_t   device     = *args->p_device;
+	size_t     num_params = *args->p_num_params;
+	const int *params     = *args->p_params;
+	int       *results    = *args->p_results;
+	*ffi_ret = deviceFunc1Batch_instance(layer_data, device, num_params, params, results);
+}
+#endif
+
 #else //!FFI_INSTANCE_LAYERS
 
 /** Instance layer without FFI are more straightforward, the loader/layer chain
@@ -362,7 +618,15 @@ static struct instance_dispatch_s _dispatch = {
 	NULL,
 #endif
 	&deviceFunc2_instance,
-	&deviceDestroy_instance
+	&deviceDestroy_instance,
+#if LAYER_NUMBER == 1
+	&deviceFunc1Batch_instance,
+#else
+	NULL,
+#endif
+	NULL, // deviceFunc2Batch
+	&platformCreateDevices_instance,
+	&devicesDestroy_instance
 };
 
 /**
@@ -393,4 +657,21 @@ int layerInstanceDeinit(
 	return SPEC_SUCCESS;
 }
 
+#ifdef LAYER_FILTER
+int layerInstanceFilters(
+		void                  *layer_data,
+		size_t                 num_entries,
+		struct layer_filter_s *filters) {
+	LAYER_LOG("entering layerInstanceFilters(layer_data = %p, num_entries = %zu, filters = %p)",
+		layer_data, num_entries, (void *)filters);
+	size_t slot = offsetof(struct instance_dispatch_s, deviceFunc2_instance) / sizeof(void *);
+	if (num_entries <= slot)
+		return SPEC_ERROR;
+	filters[slot].kind = LAYER_FILTER_RANGE;
+	filters[slot].min = LAYER_FILTER_MIN;
+	filters[slot].max = LAYER_FILTER_MAX;
+	return SPEC_SUCCESS;
+}
+#endif
+
 #endif //FFI_INSTANCE_LAYERS
@@ -1,11 +1,24 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
 #if FFI_INSTANCE_LAYERS
 #include <ffi.h>
+#include <stdint.h>
+
+#if SIZE_MAX == UINT64_MAX
+#define ffi_type_size_t ffi_type_uint64
+#else
+#define ffi_type_size_t ffi_type_uint32
+#endif
 
 enum _exp_layer_func_nargs {
-	platformCreateDevice_ffi_nargs = 2,
-	deviceFunc1_ffi_nargs          = 2,
-	deviceFunc2_ffi_nargs          = 2,
-	deviceDestroy_ffi_nargs        = 1,
+	platformCreateDevice_ffi_nargs  = 2,
+	deviceFunc1_ffi_nargs           = 2,
+	deviceFunc2_ffi_nargs           = 2,
+	deviceDestroy_ffi_nargs         = 1,
+	deviceFunc1Batch_ffi_nargs      = 4,
+	deviceFunc2Batch_ffi_nargs      = 4,
+	platformCreateDevices_ffi_nargs = 3,
+	devicesDestroy_ffi_nargs        = 2,
 };
 
 struct platformCreateDevice_ffi_args {
@@ -74,4 +87,82 @@ typedef void deviceDestroy_ffi_t(
 	struct deviceDestroy_ffi_args *args,
 	void                          *data);
 
+struct deviceFunc1Batch_ffi_args {
+	device_t   *p_device;
+	size_t     *p_num_params;
+	const int **p_params;
+	int       **p_results;
+};
+static __attribute__((unused))
+ffi_type *deviceFunc1Batch_ffi_types[deviceFunc1Batch_ffi_nargs] = {
+	&ffi_type_pointer,
+	&ffi_type_size_t,
+	&ffi_type_pointer,
+	&ffi_type_pointer
+};
+static __attribute__((unused))
+ffi_type *deviceFunc1Batch_ffi_ret = &ffi_type_sint;
+typedef void deviceFunc1Batch_ffi_t(
+	ffi_cif                          *cif,
+	int                              *ffi_ret,
+	struct deviceFunc1Batch_ffi_args *args,
+	void                             *data);
+
+struct deviceFunc2Batch_ffi_args {
+	device_t   *p_device;
+	size_t     *p_num_params;
+	const int **p_params;
+	int       **p_results;
+};
+static __attribute__((unused))
+ffi_type *deviceFunc2Batch_ffi_types[deviceFunc2Batch_ffi_nargs] = {
+	&ffi_type_pointer,
+	&ffi_type_size_t,
+	&ffi_type_pointer,
+	&ffi_type_pointer
+};
+static __attribute__((unused))
+ffi_type *deviceFunc2Batch_ffi_ret = &ffi_type_sint;
+typedef void deviceFunc2Batch_ffi_t(
+	ffi_cif                          *cif,
+	int                              *ffi_ret,
+	struct deviceFunc2Batch_ffi_args *args,
+	void                             *data);
+
+struct platformCreateDevices_ffi_args {
+	platform_t  *p_platform;
+	size_t      *p_num_devices;
+	device_t   **p_devices;
+};
+static __attribute__((unused))
+ffi_type *platformCreateDevices_ffi_types[platformCreateDevices_ffi_nargs] = {
+	&ffi_type_pointer,
+	&ffi_type_size_t,
+	&ffi_type_pointer
+};
+static __attribute__((unused))
+ffi_type *platformCreateDevices_ffi_ret = &ffi_type_sint;
+typedef void platformCreateDevices_ffi_t(
+	ffi_cif                               *cif,
+	int                                   *ffi_ret,
+	struct platformCreateDevices_ffi_args *args,
+	void                                  *data);
+
+struct devicesDestroy_ffi_args {
+	size_t          *p_num_devices;
+	const device_t **p_devices;
+};
+static __attribute__((unused))
+ffi_type *devicesDestroy_ffi_types[devicesDestroy_ffi_nargs] = {
+	&ffi_type_size_t,
+	&ffi_type_pointer
+};
+static __attribute__((unused))
+ffi_type *devicesDestroy_ffi_ret = &ffi_type_sint;
+typedef void devicesDestroy_ffi_t(
+	ffi_cif                        *cif,
+	int                            *ffi_ret,
+	struct devicesDestroy_ffi_args *args,
+	void                           *data);
+
 #endif //FFI_INSTANCE_LAYERS
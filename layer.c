@@ -2,37 +2,95 @@
 #include "spec.h"
 #include "dispatch.h"
 #include "layer.h"
+#include "trace.h"
+#include "api.h"
 #include <stdio.h>
 
 /**
  * This file contains an implementation of the global layer API defined in
  * layer.h.  Several different layers can be created through the use of the
  * LAYER_NUMBER macro definition.  The layer will only intercept deviceFunc1
- * when LAYER_NUMBER == 1, showcasing the use of partial layering. Also none of
- * them intercept platformAddLayer (not a limitation, they could). Only when
- * LAYER_NUMBER == 1 is the layer implementing layerDeinit, showcasing its
- * optionality.
+ * and its batched version deviceFunc1Batch when LAYER_NUMBER == 1, showcasing
+ * the use of partial layering. Also none of them intercept platformAddLayer
+ * (not a limitation, they could). Only when LAYER_NUMBER == 1 is the layer
+ * implementing layerDeinit, showcasing its optionality. Layers also count the
+ * calls they see, that tests read through layerCallCount.
  */
 
 #ifndef LAYER_NUMBER
 #define LAYER_NUMBER 1
 #endif
 
+/**
+ * Layers log every call by default. Building with LAYER_VERBOSE=0 produces a
+ * silent pass-through layer, used when benchmarking the loader. When
+ * LAYER_TRACE is set, logs are recorded in binary form instead of printed, see
+ * trace.h.
+ */
+#ifndef LAYER_VERBOSE
+#define LAYER_VERBOSE 1
+#endif
+
 #define LAYER_LOG(format, ...) \
 do  { \
-	printf("LAYER %d: " format "\n", LAYER_NUMBER, __VA_ARGS__); \
+	if (LAYER_VERBOSE) { \
+		static uint32_t _format_id = 0; \
+		if (_trace_enabled) \
+			traceLog(&_format_id, "LAYER %d: " format, LAYER_NUMBER, __VA_ARGS__); \
+		else \
+			printf("LAYER %d: " format "\n", LAYER_NUMBER, __VA_ARGS__); \
+	} \
 } while (0)
 
 #define LAYER_LOG_NO_ARGS(format) \
 do  { \
-	printf("LAYER %d: " format "\n", LAYER_NUMBER); \
+	if (LAYER_VERBOSE) { \
+		static uint32_t _format_id = 0; \
+		if (_trace_enabled) \
+			traceLog(&_format_id, "LAYER %d: " format, LAYER_NUMBER); \
+		else \
+			printf("LAYER %d: " format "\n", LAYER_NUMBER); \
+	} \
+} while (0)
+
+/**
+ * Silent layers don't count calls, unless built with LAYER_COUNT=1, so that
+ * benchmarks don't measure the counters.
+ */
+#ifndef LAYER_COUNT
+#define LAYER_COUNT LAYER_VERBOSE
+#endif
+
+static size_t _call_counts[NUM_DISPATCH_ENTRIES];
+
+#define LAYER_COUNT_CALL(api) \
+do { \
+	if (LAYER_COUNT) \
+		__atomic_add_fetch(&_call_counts[offsetof(struct dispatch_s, api) / sizeof(void *)], \
+			1, __ATOMIC_RELAXED); \
 } while (0)
 
+/**
+ * Returns the number of calls to the named API that went through the layer,
+ * while it was enabled.
+ */
+size_t layerCallCount(const char *api_name) {
+	const struct api_entry_s *entry = apiLookup(api_name);
+	if (!entry || entry->slot < 0)
+		return 0;
+	return __atomic_load_n(&_call_counts[entry->slot], __ATOMIC_RELAXED);
+}
+
 /**
  * Global variable pointing to the next layer dispatch table (or loader
- * terminator).
+ * terminator). Baked loaders (see bake.py) define LAYER_TARGET to the constant
+ * dispatch table of the next link instead, so that calls are direct.
  */
+#ifdef LAYER_TARGET
+#define _target_dispatch LAYER_TARGET
+#else
 static struct dispatch_s *_target_dispatch = NULL;
+#endif
 
 /**
  * API wrappers of the layer. Teir signatures should be identical to the API calls thay intercept.
@@ -41,6 +99,7 @@ static int
 getPlatforms_wrap(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) {
 	LAYER_LOG("entering getPlatforms(num_platforms = %zu, platforms = %p, num_platforms_ret = %p)",
 		num_platforms, (void *)platforms, (void *)num_platforms_ret);
+	LAYER_COUNT_CALL(getPlatforms);
 	int res = _target_dispatch->getPlatforms(num_platforms, platforms, num_platforms_ret);
 	LAYER_LOG("leaving getPlatforms, result = %d", res);
 	return res;
@@ -50,6 +109,7 @@ static int
 platformCreateDevice_wrap(platform_t platform, device_t *device_ret) {
 	LAYER_LOG("entering platformCreateDevice(platform = %p, device_ret = %p)",
 		(void *)platform, (void *)device_ret);
+	LAYER_COUNT_CALL(platformCreateDevice);
 	int res = _target_dispatch->platformCreateDevice(platform, device_ret);
 	LAYER_LOG("leaving platformCreateDevice, result = %d, device_ret_val = %p",
 		res, device_ret ? (void *)*device_ret : NULL);
@@ -60,15 +120,29 @@ platformCreateDevice_wrap(platform_t platform, device_t *device_ret) {
 static int
 deviceFunc1_wrap(device_t device, int param) {
 	LAYER_LOG("entering deviceFunc1(device = %p, param %d)", (void *)device, param);
+	LAYER_COUNT_CALL(deviceFunc1);
 	int res = _target_dispatch->deviceFunc1(device, param);
 	LAYER_LOG("leaving deviceFunc1, result = %d", res);
 	return res;
 }
+
+static int
+deviceFunc1Batch_wrap(device_t device, size_t num_params, const int *params, int *results) {
+	LAYER_LOG("entering deviceFunc1Batch(device = %p, num_params = %zu, params = %p, results = %p)",
+		(void *)device, num_params, (void *)params, (void *)results);
+	for (size_t i = 0; params && i < num_params; i++)
+		LAYER_LOG("  deviceFunc1Batch param[%zu] %d", i, params[i]);
+	LAYER_COUNT_CALL(deviceFunc1Batch);
+	int res = _target_dispatch->deviceFunc1Batch(device, num_params, params, results);
+	LAYER_LOG("leaving deviceFunc1Batch, result = %d", res);
+	return res;
+}
 #endif
 
 static int
 deviceFunc2_wrap(device_t device, int param) {
 	LAYER_LOG("entering deviceFunc2(device = %p, param %d)", (void *)device, param);
+	LAYER_COUNT_CALL(deviceFunc2);
 	int res = _target_dispatch->deviceFunc2(device, param);
 	LAYER_LOG("leaving deviceFunc2, result = %d", res);
 	return res;
@@ -77,26 +151,48 @@ deviceFunc2_wrap(device_t device, int param) {
 static int
 deviceDestroy_wrap(device_t device) {
 	LAYER_LOG("entering deviceDestroy(device = %p)", (void *)device);
+	LAYER_COUNT_CALL(deviceDestroy);
 	int res = _target_dispatch->deviceDestroy(device);
 	LAYER_LOG("leaving deviceDestroy, result = %d", res);
 	return res;
 }
 
+static int
+platformCreateDevices_wrap(platform_t platform, size_t num_devices, device_t *devices) {
+	LAYER_LOG("entering platformCreateDevices(platform = %p, num_devices = %zu, devices = %p)",
+		(void *)platform, num_devices, (void *)devices);
+	LAYER_COUNT_CALL(platformCreateDevices);
+	int res = _target_dispatch->platformCreateDevices(platform, num_devices, devices);
+	LAYER_LOG("leaving platformCreateDevices, result = %d", res);
+	return res;
+}
+
+static int
+devicesDestroy_wrap(size_t num_devices, const device_t *devices) {
+	LAYER_LOG("entering devicesDestroy(num_devices = %zu, devices = %p)",
+		num_devices, (void *)devices);
+	LAYER_COUNT_CALL(devicesDestroy);
+	int res = _target_dispatch->devicesDestroy(num_devices, devices);
+	LAYER_LOG("leaving devicesDestroy, result = %d", res);
+	return res;
+}
+
 /**
  * Dispatch table of the layer, can be incomplete, or shorter than the loader
  * dispatch tables, enabling older layer to be used on newer loaders.
+ * Unsupported APIs are NULL.
  */
 static struct dispatch_s _dispatch = {
-	&getPlatforms_wrap,
-	NULL, // platformAddLayer
-	&platformCreateDevice_wrap,
+	.getPlatforms          = &getPlatforms_wrap,
+	.platformCreateDevice  = &platformCreateDevice_wrap,
 #if LAYER_NUMBER == 1
-	&deviceFunc1_wrap,
-#else
-	NULL,
+	.deviceFunc1           = &deviceFunc1_wrap,
+	.deviceFunc1Batch      = &deviceFunc1Batch_wrap,
 #endif
-	&deviceFunc2_wrap,
-	&deviceDestroy_wrap
+	.deviceFunc2           = &deviceFunc2_wrap,
+	.deviceDestroy         = &deviceDestroy_wrap,
+	.platformCreateDevices = &platformCreateDevices_wrap,
+	.devicesDestroy        = &devicesDestroy_wrap
 };
 
 /**
@@ -120,7 +216,9 @@ int layerInit(
 		return SPEC_ERROR;
 	if (!target_dispatch || !layer_dispatch)
 		return SPEC_ERROR;
+#ifndef LAYER_TARGET
 	_target_dispatch = target_dispatch;
+#endif
 	*layer_dispatch = _dispatch;
 	return SPEC_SUCCESS;
 }
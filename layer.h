@@ -1,3 +1,5 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
 /**
  * The API exposed by the layers. Layers that implement the instance layer API
  * have a different signature if they use the ffi or non-ffi strategy.
@@ -38,16 +40,24 @@ struct instance_dispatch_s;
 
 #if FFI_INSTANCE_LAYERS
 
-typedef pfn_platformCreateDevice_t pfn_platformCreateDevice_instance_t;
-typedef pfn_deviceFunc1_t          pfn_deviceFunc1_instance_t;
-typedef pfn_deviceFunc2_t          pfn_deviceFunc2_instance_t;
-typedef pfn_deviceDestroy_t        pfn_deviceDestroy_instance_t;
+typedef pfn_platformCreateDevice_t  pfn_platformCreateDevice_instance_t;
+typedef pfn_deviceFunc1_t           pfn_deviceFunc1_instance_t;
+typedef pfn_deviceFunc2_t           pfn_deviceFunc2_instance_t;
+typedef pfn_deviceDestroy_t         pfn_deviceDestroy_instance_t;
+typedef pfn_deviceFunc1Batch_t      pfn_deviceFunc1Batch_instance_t;
+typedef pfn_deviceFunc2Batch_t      pfn_deviceFunc2Batch_instance_t;
+typedef pfn_platformCreateDevices_t pfn_platformCreateDevices_instance_t;
+typedef pfn_devicesDestroy_t        pfn_devicesDestroy_instance_t;
 
 struct instance_dispatch_s {
-	pfn_platformCreateDevice_instance_t platformCreateDevice_instance;
-	pfn_deviceFunc1_instance_t          deviceFunc1_instance;
-	pfn_deviceFunc2_instance_t          deviceFunc2_instance;
-	pfn_deviceDestroy_instance_t        deviceDestroy_instance;
+	pfn_platformCreateDevice_instance_t  platformCreateDevice_instance;
+	pfn_deviceFunc1_instance_t           deviceFunc1_instance;
+	pfn_deviceFunc2_instance_t           deviceFunc2_instance;
+	pfn_deviceDestroy_instance_t         deviceDestroy_instance;
+	pfn_deviceFunc1Batch_instance_t      deviceFunc1Batch_instance;
+	pfn_deviceFunc2Batch_instance_t      deviceFunc2Batch_instance;
+	pfn_platformCreateDevices_instance_t platformCreateDevices_instance;
+	pfn_devicesDestroy_instance_t        devicesDestroy_instance;
 };
 
 /**
@@ -79,6 +89,10 @@ struct layer_dispatch_s {
 	struct instance_layer_proxy_s *deviceFunc1_next;
 	struct instance_layer_proxy_s *deviceFunc2_next;
 	struct instance_layer_proxy_s *deviceDestroy_next;
+	struct instance_layer_proxy_s *deviceFunc1Batch_next;
+	struct instance_layer_proxy_s *deviceFunc2Batch_next;
+	struct instance_layer_proxy_s *platformCreateDevices_next;
+	struct instance_layer_proxy_s *devicesDestroy_next;
 };
 
 /**
@@ -108,15 +122,48 @@ typedef int deviceDestroy_instance_t(
 	device_t                       device);
 typedef deviceDestroy_instance_t *pfn_deviceDestroy_instance_t;
 
+typedef int deviceFunc1Batch_instance_t(
+	struct instance_layer_proxy_s *layer,
+	device_t                       device,
+	size_t                         num_params,
+	const int                     *params,
+	int                           *results);
+typedef deviceFunc1Batch_instance_t *pfn_deviceFunc1Batch_instance_t;
+
+typedef int deviceFunc2Batch_instance_t(
+	struct instance_layer_proxy_s *layer,
+	device_t                       device,
+	size_t                         num_params,
+	const int                     *params,
+	int                           *results);
+typedef deviceFunc2Batch_instance_t *pfn_deviceFunc2Batch_instance_t;
+
+typedef int platformCreateDevices_instance_t(
+	struct instance_layer_proxy_s *layer,
+	platform_t                     platform,
+	size_t                         num_devices,
+	device_t                      *devices);
+typedef platformCreateDevices_instance_t *pfn_platformCreateDevices_instance_t;
+
+typedef int devicesDestroy_instance_t(
+	struct instance_layer_proxy_s *layer,
+	size_t                         num_devices,
+	const device_t                *devices);
+typedef devicesDestroy_instance_t *pfn_devicesDestroy_instance_t;
+
 /**
  * Functions that are not dispatchable through objects do not need to be in
  * instance layers.
  */
 struct instance_dispatch_s {
-	pfn_platformCreateDevice_instance_t platformCreateDevice_instance;
-	pfn_deviceFunc1_instance_t          deviceFunc1_instance;
-	pfn_deviceFunc2_instance_t          deviceFunc2_instance;
-	pfn_deviceDestroy_instance_t        deviceDestroy_instance;
+	pfn_platformCreateDevice_instance_t  platformCreateDevice_instance;
+	pfn_deviceFunc1_instance_t           deviceFunc1_instance;
+	pfn_deviceFunc2_instance_t           deviceFunc2_instance;
+	pfn_deviceDestroy_instance_t         deviceDestroy_instance;
+	pfn_deviceFunc1Batch_instance_t      deviceFunc1Batch_instance;
+	pfn_deviceFunc2Batch_instance_t      deviceFunc2Batch_instance;
+	pfn_platformCreateDevices_instance_t platformCreateDevices_instance;
+	pfn_devicesDestroy_instance_t        devicesDestroy_instance;
 };
 
 /**
@@ -139,6 +186,50 @@ typedef int layerInstanceInit_t(
 	struct instance_dispatch_s  *layer_instance_dispatch,
 	void                       **layer_data_ret);
 
+/**
+ * Interception filters, that the loader evaluates before calling into a non
+ * FFI instance layer. Calls that don't match the filter of an API go straight
+ * to the next layer, as if the layer forwarded them. Filters select calls:
+ *   LAYER_FILTER_HANDLES  made on one of the num_handles handles,
+ *   LAYER_FILTER_RANGE    whose first int parameter after the handle is
+ *                         between min and max, inclusive. Only valid for APIs
+ *                         that have such a parameter,
+ *   LAYER_FILTER_SAMPLE   one in every period calls made through the layer.
+ * The loader copies the filters, handle sets included.
+ * Global layers and FFI instance layers can't declare filters: they call the
+ * next link directly, through a dispatch table of plain entry points, so the
+ * loader has no link between them to evaluate a filter at.
+ */
+enum layer_filter_kind_e {
+	LAYER_FILTER_NONE,
+	LAYER_FILTER_HANDLES,
+	LAYER_FILTER_RANGE,
+	LAYER_FILTER_SAMPLE
+};
+
+struct layer_filter_s {
+	enum layer_filter_kind_e  kind;
+	size_t                    num_handles;
+	const void * const       *handles;
+	int                       min;
+	int                       max;
+	unsigned int              period;
+};
+
+/**
+ * Optional filter query for non FFI instance layers, called once after
+ * layerInstanceInit. filters holds num_entries filters, in instance dispatch
+ * table order, initialized to LAYER_FILTER_NONE. A layer should not write
+ * more entries than num_entries. Filters of APIs the layer doesn't intercept
+ * are ignored, and an invalid filter fails the layer attachment.
+ */
+typedef int layerInstanceFilters_t(
+	void                   *layer_data,
+	size_t                  num_entries,
+	struct layer_filter_s  *filters);
+
+typedef layerInstanceFilters_t *pfn_layerInstanceFilters_t;
+
 #endif //FFI_INSTANCE_LAYERS
 
 #define NUM_INSTANCE_DISPATCH_ENTRIES (sizeof(struct instance_dispatch_s)/sizeof(pfn_layerInit_t))
@@ -153,3 +244,22 @@ typedef int layerInstanceDeinit_t(
 	void *layer_data);
 
 typedef layerInstanceDeinit_t *pfn_layerInstanceDeinit_t;
+
+/**
+ * Optional extension function wrapping for instance layers. When an
+ * application queries an extension function of a platform through
+ * platformGetFunc, the instance layers of the platform that export this
+ * function can wrap it, innermost layer first. target is the next function in
+ * the chain, and the layer returns its wrapper in wrapper_ret, or NULL if it
+ * doesn't wrap the function. A layer can be asked to wrap the same extension
+ * function several times, if layers are attached after the function was first
+ * queried, and wrappers must remain valid until the layer instance is
+ * deinitialized.
+ */
+typedef int layerInstanceWrapFunc_t(
+	void        *layer_data,
+	const char  *name,
+	void        *target,
+	void       **wrapper_ret);
+
+typedef layerInstanceWrapFunc_t *pfn_layerInstanceWrapFunc_t;
@@ -0,0 +1,1369 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
+/**
+ * Header only C++ SDK to write the layers of layer.h as classes. A layer class
+ * derives from exp_layer::global_layer<layer_class> or
+ * exp_layer::instance_layer<layer_class>, and intercepts an API by defining a
+ * public member function named after it, taking the next link of the chain
+ * followed by the parameters of the API:
+ *
+ *   struct my_layer : exp_layer::instance_layer<my_layer> {
+ *   	int deviceFunc1(next_t next, device_t device, int param) {
+ *   		return next.deviceFunc1(device, param);
+ *   	}
+ *   };
+ *   EXP_INSTANCE_LAYER(my_layer)
+ *
+ * EXP_GLOBAL_LAYER and EXP_INSTANCE_LAYER define the layer API of the library,
+ * and must be used in a single translation unit. The dispatch table of the
+ * layer is built at compile time from the member functions the class defines,
+ * the entries of the other APIs being NULL so that the loader bypasses the
+ * layer for them. intercept_mask() is the mask of the intercepted APIs, by
+ * dispatch table slot (see exp_layer::slot and exp_layer::instance_slot).
+ *
+ * A global layer is a single object, constructed by layerInit and destroyed
+ * by layerDeinit. Instance layers are an object per instance, constructed by
+ * layerInstanceInit and destroyed by layerInstanceDeinit. Layer classes must
+ * be default constructible, without throwing. FFI_INSTANCE_LAYERS selects the
+ * flavor of instance layers, as for C layers.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+extern "C" {
+#include "spec.h"
+#include "dispatch.h"
+#include "layer.h"
+#include "instance_layer.h"
+}
+
+namespace exp_layer {
+
+/**
+ * Dispatch table slots of the APIs, in struct dispatch_s and struct
+ * instance_dispatch_s.
+ */
+namespace slot {
+enum dispatch_slot_e {
+	getPlatforms,
+	platformAddLayer,
+	platformCreateDevice,
+	deviceFunc1,
+	deviceFunc2,
+	deviceDestroy,
+	platformGetFunc,
+	deviceFunc1Batch,
+	deviceFunc2Batch,
+	platformCreateQueue,
+	deviceCreateQueue,
+	queueDestroy,
+	eventQuery,
+	eventWait,
+	eventRelease,
+	platformCreateDeviceEnqueue,
+	deviceFunc1Enqueue,
+	deviceFunc2Enqueue,
+	deviceDestroyEnqueue,
+	deviceFunc1BatchEnqueue,
+	deviceFunc2BatchEnqueue,
+	platformCreateDevices,
+	devicesDestroy,
+	layerSetEnabled,
+	platformRemoveLayer,
+	addDriver,
+	deviceAddLayer
+};
+}
+
+namespace instance_slot {
+enum instance_dispatch_slot_e {
+	platformCreateDevice,
+	deviceFunc1,
+	deviceFunc2,
+	deviceDestroy,
+	deviceFunc1Batch,
+	deviceFunc2Batch,
+	platformCreateDevices,
+	devicesDestroy
+};
+}
+
+constexpr uint64_t
+api_mask(unsigned int api_slot) {
+	return UINT64_C(1) << api_slot;
+}
+
+/**
+ * Next link of a global layer chain.
+ */
+struct global_next_s {
+	struct dispatch_s *dispatch;
+	int getPlatforms(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) const {
+		return dispatch->getPlatforms(num_platforms, platforms, num_platforms_ret);
+	}
+	int platformAddLayer(platform_t platform, const char *layer_name) const {
+		return dispatch->platformAddLayer(platform, layer_name);
+	}
+	int platformCreateDevice(platform_t platform, device_t *device_ret) const {
+		return dispatch->platformCreateDevice(platform, device_ret);
+	}
+	int deviceFunc1(device_t device, int param) const {
+		return dispatch->deviceFunc1(device, param);
+	}
+	int deviceFunc2(device_t device, int param) const {
+		return dispatch->deviceFunc2(device, param);
+	}
+	int deviceDestroy(device_t device) const {
+		return dispatch->deviceDestroy(device);
+	}
+	int platformGetFunc(platform_t platform, const char *name, void **func_ret) const {
+		return dispatch->platformGetFunc(platform, name, func_ret);
+	}
+	int deviceFunc1Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		return dispatch->deviceFunc1Batch(device, num_params, params, results);
+	}
+	int deviceFunc2Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		return dispatch->deviceFunc2Batch(device, num_params, params, results);
+	}
+	int platformCreateQueue(platform_t platform, queue_t *queue_ret) const {
+		return dispatch->platformCreateQueue(platform, queue_ret);
+	}
+	int deviceCreateQueue(device_t device, queue_t *queue_ret) const {
+		return dispatch->deviceCreateQueue(device, queue_ret);
+	}
+	int queueDestroy(queue_t queue) const {
+		return dispatch->queueDestroy(queue);
+	}
+	int eventQuery(event_t event, int *complete_ret, int *result_ret) const {
+		return dispatch->eventQuery(event, complete_ret, result_ret);
+	}
+	int eventWait(size_t num_events, const event_t *events) const {
+		return dispatch->eventWait(num_events, events);
+	}
+	int eventRelease(event_t event) const {
+		return dispatch->eventRelease(event);
+	}
+	int platformCreateDeviceEnqueue(queue_t queue, device_t *device_ret, event_t *event_ret) const {
+		return dispatch->platformCreateDeviceEnqueue(queue, device_ret, event_ret);
+	}
+	int deviceFunc1Enqueue(queue_t queue, int param, event_t *event_ret) const {
+		return dispatch->deviceFunc1Enqueue(queue, param, event_ret);
+	}
+	int deviceFunc2Enqueue(queue_t queue, int param, event_t *event_ret) const {
+		return dispatch->deviceFunc2Enqueue(queue, param, event_ret);
+	}
+	int deviceDestroyEnqueue(queue_t queue, event_t *event_ret) const {
+		return dispatch->deviceDestroyEnqueue(queue, event_ret);
+	}
+	int deviceFunc1BatchEnqueue(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret) const {
+		return dispatch->deviceFunc1BatchEnqueue(queue, num_params, params, results, event_ret);
+	}
+	int deviceFunc2BatchEnqueue(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret) const {
+		return dispatch->deviceFunc2BatchEnqueue(queue, num_params, params, results, event_ret);
+	}
+	int platformCreateDevices(platform_t platform, size_t num_devices, device_t *devices) const {
+		return dispatch->platformCreateDevices(platform, num_devices, devices);
+	}
+	int devicesDestroy(size_t num_devices, const device_t *devices) const {
+		return dispatch->devicesDestroy(num_devices, devices);
+	}
+	int layerSetEnabled(const char *layer_name, int enabled) const {
+		return dispatch->layerSetEnabled(layer_name, enabled);
+	}
+	int platformRemoveLayer(platform_t platform, const char *layer_name) const {
+		return dispatch->platformRemoveLayer(platform, layer_name);
+	}
+	int addDriver(const char *driver_name) const {
+		return dispatch->addDriver(driver_name);
+	}
+	int deviceAddLayer(device_t device, const char *layer_name) const {
+		return dispatch->deviceAddLayer(device, layer_name);
+	}
+};
+
+/**
+ * Next link of an instance layer chain.
+ */
+#if FFI_INSTANCE_LAYERS
+struct instance_next_s {
+	struct instance_dispatch_s *dispatch;
+	int platformCreateDevice(platform_t platform, device_t *device_ret) const {
+		return dispatch->platformCreateDevice_instance(platform, device_ret);
+	}
+	int deviceFunc1(device_t device, int param) const {
+		return dispatch->deviceFunc1_instance(device, param);
+	}
+	int deviceFunc2(device_t device, int param) const {
+		return dispatch->deviceFunc2_instance(device, param);
+	}
+	int deviceDestroy(device_t device) const {
+		return dispatch->deviceDestroy_instance(device);
+	}
+	int deviceFunc1Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		return dispatch->deviceFunc1Batch_instance(device, num_params, params, results);
+	}
+	int deviceFunc2Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		return dispatch->deviceFunc2Batch_instance(device, num_params, params, results);
+	}
+	int platformCreateDevices(platform_t platform, size_t num_devices, device_t *devices) const {
+		return dispatch->platformCreateDevices_instance(platform, num_devices, devices);
+	}
+	int devicesDestroy(size_t num_devices, const device_t *devices) const {
+		return dispatch->devicesDestroy_instance(num_devices, devices);
+	}
+};
+#else //!FFI_INSTANCE_LAYERS
+struct instance_next_s {
+	struct instance_layer_proxy_s *layer;
+	int platformCreateDevice(platform_t platform, device_t *device_ret) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.platformCreateDevice_next;
+		return next->dispatch.platformCreateDevice_instance(next, platform, device_ret);
+	}
+	int deviceFunc1(device_t device, int param) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.deviceFunc1_next;
+		return next->dispatch.deviceFunc1_instance(next, device, param);
+	}
+	int deviceFunc2(device_t device, int param) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.deviceFunc2_next;
+		return next->dispatch.deviceFunc2_instance(next, device, param);
+	}
+	int deviceDestroy(device_t device) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.deviceDestroy_next;
+		return next->dispatch.deviceDestroy_instance(next, device);
+	}
+	int deviceFunc1Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.deviceFunc1Batch_next;
+		return next->dispatch.deviceFunc1Batch_instance(next, device, num_params, params, results);
+	}
+	int deviceFunc2Batch(device_t device, size_t num_params, const int *params, int *results) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.deviceFunc2Batch_next;
+		return next->dispatch.deviceFunc2Batch_instance(next, device, num_params, params, results);
+	}
+	int platformCreateDevices(platform_t platform, size_t num_devices, device_t *devices) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.platformCreateDevices_next;
+		return next->dispatch.platformCreateDevices_instance(next, platform, num_devices, devices);
+	}
+	int devicesDestroy(size_t num_devices, const device_t *devices) const {
+		struct instance_layer_proxy_s *next = layer->layer_dispatch.devicesDestroy_next;
+		return next->dispatch.devicesDestroy_instance(next, num_devices, devices);
+	}
+};
+#endif //!FFI_INSTANCE_LAYERS
+
+template <class L> class global_layer;
+template <class L> class instance_layer;
+
+namespace detail {
+
+template <class T>
+struct voider {
+	typedef void type;
+};
+
+/**
+ * has_<api><L>::value is true if the layer class L intercepts api.
+ */
+template <class L, class = void>
+struct has_getPlatforms : std::false_type {};
+template <class L>
+struct has_getPlatforms<L, typename voider<decltype(&L::getPlatforms)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformAddLayer : std::false_type {};
+template <class L>
+struct has_platformAddLayer<L, typename voider<decltype(&L::platformAddLayer)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformCreateDevice : std::false_type {};
+template <class L>
+struct has_platformCreateDevice<L, typename voider<decltype(&L::platformCreateDevice)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc1 : std::false_type {};
+template <class L>
+struct has_deviceFunc1<L, typename voider<decltype(&L::deviceFunc1)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc2 : std::false_type {};
+template <class L>
+struct has_deviceFunc2<L, typename voider<decltype(&L::deviceFunc2)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceDestroy : std::false_type {};
+template <class L>
+struct has_deviceDestroy<L, typename voider<decltype(&L::deviceDestroy)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformGetFunc : std::false_type {};
+template <class L>
+struct has_platformGetFunc<L, typename voider<decltype(&L::platformGetFunc)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc1Batch : std::false_type {};
+template <class L>
+struct has_deviceFunc1Batch<L, typename voider<decltype(&L::deviceFunc1Batch)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc2Batch : std::false_type {};
+template <class L>
+struct has_deviceFunc2Batch<L, typename voider<decltype(&L::deviceFunc2Batch)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformCreateQueue : std::false_type {};
+template <class L>
+struct has_platformCreateQueue<L, typename voider<decltype(&L::platformCreateQueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceCreateQueue : std::false_type {};
+template <class L>
+struct has_deviceCreateQueue<L, typename voider<decltype(&L::deviceCreateQueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_queueDestroy : std::false_type {};
+template <class L>
+struct has_queueDestroy<L, typename voider<decltype(&L::queueDestroy)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_eventQuery : std::false_type {};
+template <class L>
+struct has_eventQuery<L, typename voider<decltype(&L::eventQuery)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_eventWait : std::false_type {};
+template <class L>
+struct has_eventWait<L, typename voider<decltype(&L::eventWait)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_eventRelease : std::false_type {};
+template <class L>
+struct has_eventRelease<L, typename voider<decltype(&L::eventRelease)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformCreateDeviceEnqueue : std::false_type {};
+template <class L>
+struct has_platformCreateDeviceEnqueue<L, typename voider<decltype(&L::platformCreateDeviceEnqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc1Enqueue : std::false_type {};
+template <class L>
+struct has_deviceFunc1Enqueue<L, typename voider<decltype(&L::deviceFunc1Enqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc2Enqueue : std::false_type {};
+template <class L>
+struct has_deviceFunc2Enqueue<L, typename voider<decltype(&L::deviceFunc2Enqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceDestroyEnqueue : std::false_type {};
+template <class L>
+struct has_deviceDestroyEnqueue<L, typename voider<decltype(&L::deviceDestroyEnqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc1BatchEnqueue : std::false_type {};
+template <class L>
+struct has_deviceFunc1BatchEnqueue<L, typename voider<decltype(&L::deviceFunc1BatchEnqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceFunc2BatchEnqueue : std::false_type {};
+template <class L>
+struct has_deviceFunc2BatchEnqueue<L, typename voider<decltype(&L::deviceFunc2BatchEnqueue)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformCreateDevices : std::false_type {};
+template <class L>
+struct has_platformCreateDevices<L, typename voider<decltype(&L::platformCreateDevices)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_devicesDestroy : std::false_type {};
+template <class L>
+struct has_devicesDestroy<L, typename voider<decltype(&L::devicesDestroy)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_layerSetEnabled : std::false_type {};
+template <class L>
+struct has_layerSetEnabled<L, typename voider<decltype(&L::layerSetEnabled)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_platformRemoveLayer : std::false_type {};
+template <class L>
+struct has_platformRemoveLayer<L, typename voider<decltype(&L::platformRemoveLayer)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_addDriver : std::false_type {};
+template <class L>
+struct has_addDriver<L, typename voider<decltype(&L::addDriver)>::type> : std::true_type {};
+template <class L, class = void>
+struct has_deviceAddLayer : std::false_type {};
+template <class L>
+struct has_deviceAddLayer<L, typename voider<decltype(&L::deviceAddLayer)>::type> : std::true_type {};
+
+constexpr size_t
+mask_entries(uint64_t mask) {
+	return mask ? 1 + mask_entries(mask >> 1) : 0;
+}
+
+/**
+ * Global layer objects are constructed in place by layerInit.
+ */
+template <class L>
+struct global_state_s {
+	alignas(L) static unsigned char storage[sizeof(L)];
+	static struct dispatch_s *target_dispatch;
+};
+
+template <class L>
+alignas(L) unsigned char global_state_s<L>::storage[sizeof(L)];
+template <class L>
+struct dispatch_s *global_state_s<L>::target_dispatch = NULL;
+
+/**
+ * <api>_global<L>::entry() is the dispatch table entry of api for the global
+ * layer class L, calling the member function of the layer object if it
+ * intercepts api and NULL otherwise.
+ */
+template <class L, bool = has_getPlatforms<L>::value>
+struct getPlatforms_global {
+	static constexpr pfn_getPlatforms_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct getPlatforms_global<L, true> {
+	static int wrap(size_t num_platforms, platform_t *platforms, size_t *num_platforms_ret) {
+		return global_layer<L>::layer().getPlatforms(global_next_s{global_state_s<L>::target_dispatch}, num_platforms, platforms, num_platforms_ret);
+	}
+	static constexpr pfn_getPlatforms_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformAddLayer<L>::value>
+struct platformAddLayer_global {
+	static constexpr pfn_platformAddLayer_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformAddLayer_global<L, true> {
+	static int wrap(platform_t platform, const char *layer_name) {
+		return global_layer<L>::layer().platformAddLayer(global_next_s{global_state_s<L>::target_dispatch}, platform, layer_name);
+	}
+	static constexpr pfn_platformAddLayer_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformCreateDevice<L>::value>
+struct platformCreateDevice_global {
+	static constexpr pfn_platformCreateDevice_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateDevice_global<L, true> {
+	static int wrap(platform_t platform, device_t *device_ret) {
+		return global_layer<L>::layer().platformCreateDevice(global_next_s{global_state_s<L>::target_dispatch}, platform, device_ret);
+	}
+	static constexpr pfn_platformCreateDevice_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1<L>::value>
+struct deviceFunc1_global {
+	static constexpr pfn_deviceFunc1_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1_global<L, true> {
+	static int wrap(device_t device, int param) {
+		return global_layer<L>::layer().deviceFunc1(global_next_s{global_state_s<L>::target_dispatch}, device, param);
+	}
+	static constexpr pfn_deviceFunc1_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2<L>::value>
+struct deviceFunc2_global {
+	static constexpr pfn_deviceFunc2_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2_global<L, true> {
+	static int wrap(device_t device, int param) {
+		return global_layer<L>::layer().deviceFunc2(global_next_s{global_state_s<L>::target_dispatch}, device, param);
+	}
+	static constexpr pfn_deviceFunc2_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceDestroy<L>::value>
+struct deviceDestroy_global {
+	static constexpr pfn_deviceDestroy_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceDestroy_global<L, true> {
+	static int wrap(device_t device) {
+		return global_layer<L>::layer().deviceDestroy(global_next_s{global_state_s<L>::target_dispatch}, device);
+	}
+	static constexpr pfn_deviceDestroy_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformGetFunc<L>::value>
+struct platformGetFunc_global {
+	static constexpr pfn_platformGetFunc_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformGetFunc_global<L, true> {
+	static int wrap(platform_t platform, const char *name, void **func_ret) {
+		return global_layer<L>::layer().platformGetFunc(global_next_s{global_state_s<L>::target_dispatch}, platform, name, func_ret);
+	}
+	static constexpr pfn_platformGetFunc_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1Batch<L>::value>
+struct deviceFunc1Batch_global {
+	static constexpr pfn_deviceFunc1Batch_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1Batch_global<L, true> {
+	static int wrap(device_t device, size_t num_params, const int *params, int *results) {
+		return global_layer<L>::layer().deviceFunc1Batch(global_next_s{global_state_s<L>::target_dispatch}, device, num_params, params, results);
+	}
+	static constexpr pfn_deviceFunc1Batch_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2Batch<L>::value>
+struct deviceFunc2Batch_global {
+	static constexpr pfn_deviceFunc2Batch_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2Batch_global<L, true> {
+	static int wrap(device_t device, size_t num_params, const int *params, int *results) {
+		return global_layer<L>::layer().deviceFunc2Batch(global_next_s{global_state_s<L>::target_dispatch}, device, num_params, params, results);
+	}
+	static constexpr pfn_deviceFunc2Batch_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformCreateQueue<L>::value>
+struct platformCreateQueue_global {
+	static constexpr pfn_platformCreateQueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateQueue_global<L, true> {
+	static int wrap(platform_t platform, queue_t *queue_ret) {
+		return global_layer<L>::layer().platformCreateQueue(global_next_s{global_state_s<L>::target_dispatch}, platform, queue_ret);
+	}
+	static constexpr pfn_platformCreateQueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceCreateQueue<L>::value>
+struct deviceCreateQueue_global {
+	static constexpr pfn_deviceCreateQueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceCreateQueue_global<L, true> {
+	static int wrap(device_t device, queue_t *queue_ret) {
+		return global_layer<L>::layer().deviceCreateQueue(global_next_s{global_state_s<L>::target_dispatch}, device, queue_ret);
+	}
+	static constexpr pfn_deviceCreateQueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_queueDestroy<L>::value>
+struct queueDestroy_global {
+	static constexpr pfn_queueDestroy_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct queueDestroy_global<L, true> {
+	static int wrap(queue_t queue) {
+		return global_layer<L>::layer().queueDestroy(global_next_s{global_state_s<L>::target_dispatch}, queue);
+	}
+	static constexpr pfn_queueDestroy_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_eventQuery<L>::value>
+struct eventQuery_global {
+	static constexpr pfn_eventQuery_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct eventQuery_global<L, true> {
+	static int wrap(event_t event, int *complete_ret, int *result_ret) {
+		return global_layer<L>::layer().eventQuery(global_next_s{global_state_s<L>::target_dispatch}, event, complete_ret, result_ret);
+	}
+	static constexpr pfn_eventQuery_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_eventWait<L>::value>
+struct eventWait_global {
+	static constexpr pfn_eventWait_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct eventWait_global<L, true> {
+	static int wrap(size_t num_events, const event_t *events) {
+		return global_layer<L>::layer().eventWait(global_next_s{global_state_s<L>::target_dispatch}, num_events, events);
+	}
+	static constexpr pfn_eventWait_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_eventRelease<L>::value>
+struct eventRelease_global {
+	static constexpr pfn_eventRelease_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct eventRelease_global<L, true> {
+	static int wrap(event_t event) {
+		return global_layer<L>::layer().eventRelease(global_next_s{global_state_s<L>::target_dispatch}, event);
+	}
+	static constexpr pfn_eventRelease_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformCreateDeviceEnqueue<L>::value>
+struct platformCreateDeviceEnqueue_global {
+	static constexpr pfn_platformCreateDeviceEnqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateDeviceEnqueue_global<L, true> {
+	static int wrap(queue_t queue, device_t *device_ret, event_t *event_ret) {
+		return global_layer<L>::layer().platformCreateDeviceEnqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, device_ret, event_ret);
+	}
+	static constexpr pfn_platformCreateDeviceEnqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1Enqueue<L>::value>
+struct deviceFunc1Enqueue_global {
+	static constexpr pfn_deviceFunc1Enqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1Enqueue_global<L, true> {
+	static int wrap(queue_t queue, int param, event_t *event_ret) {
+		return global_layer<L>::layer().deviceFunc1Enqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, param, event_ret);
+	}
+	static constexpr pfn_deviceFunc1Enqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2Enqueue<L>::value>
+struct deviceFunc2Enqueue_global {
+	static constexpr pfn_deviceFunc2Enqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2Enqueue_global<L, true> {
+	static int wrap(queue_t queue, int param, event_t *event_ret) {
+		return global_layer<L>::layer().deviceFunc2Enqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, param, event_ret);
+	}
+	static constexpr pfn_deviceFunc2Enqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceDestroyEnqueue<L>::value>
+struct deviceDestroyEnqueue_global {
+	static constexpr pfn_deviceDestroyEnqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceDestroyEnqueue_global<L, true> {
+	static int wrap(queue_t queue, event_t *event_ret) {
+		return global_layer<L>::layer().deviceDestroyEnqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, event_ret);
+	}
+	static constexpr pfn_deviceDestroyEnqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1BatchEnqueue<L>::value>
+struct deviceFunc1BatchEnqueue_global {
+	static constexpr pfn_deviceFunc1BatchEnqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1BatchEnqueue_global<L, true> {
+	static int wrap(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret) {
+		return global_layer<L>::layer().deviceFunc1BatchEnqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, num_params, params, results, event_ret);
+	}
+	static constexpr pfn_deviceFunc1BatchEnqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2BatchEnqueue<L>::value>
+struct deviceFunc2BatchEnqueue_global {
+	static constexpr pfn_deviceFunc2BatchEnqueue_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2BatchEnqueue_global<L, true> {
+	static int wrap(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret) {
+		return global_layer<L>::layer().deviceFunc2BatchEnqueue(global_next_s{global_state_s<L>::target_dispatch}, queue, num_params, params, results, event_ret);
+	}
+	static constexpr pfn_deviceFunc2BatchEnqueue_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformCreateDevices<L>::value>
+struct platformCreateDevices_global {
+	static constexpr pfn_platformCreateDevices_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateDevices_global<L, true> {
+	static int wrap(platform_t platform, size_t num_devices, device_t *devices) {
+		return global_layer<L>::layer().platformCreateDevices(global_next_s{global_state_s<L>::target_dispatch}, platform, num_devices, devices);
+	}
+	static constexpr pfn_platformCreateDevices_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_devicesDestroy<L>::value>
+struct devicesDestroy_global {
+	static constexpr pfn_devicesDestroy_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct devicesDestroy_global<L, true> {
+	static int wrap(size_t num_devices, const device_t *devices) {
+		return global_layer<L>::layer().devicesDestroy(global_next_s{global_state_s<L>::target_dispatch}, num_devices, devices);
+	}
+	static constexpr pfn_devicesDestroy_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_layerSetEnabled<L>::value>
+struct layerSetEnabled_global {
+	static constexpr pfn_layerSetEnabled_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct layerSetEnabled_global<L, true> {
+	static int wrap(const char *layer_name, int enabled) {
+		return global_layer<L>::layer().layerSetEnabled(global_next_s{global_state_s<L>::target_dispatch}, layer_name, enabled);
+	}
+	static constexpr pfn_layerSetEnabled_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformRemoveLayer<L>::value>
+struct platformRemoveLayer_global {
+	static constexpr pfn_platformRemoveLayer_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformRemoveLayer_global<L, true> {
+	static int wrap(platform_t platform, const char *layer_name) {
+		return global_layer<L>::layer().platformRemoveLayer(global_next_s{global_state_s<L>::target_dispatch}, platform, layer_name);
+	}
+	static constexpr pfn_platformRemoveLayer_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_addDriver<L>::value>
+struct addDriver_global {
+	static constexpr pfn_addDriver_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct addDriver_global<L, true> {
+	static int wrap(const char *driver_name) {
+		return global_layer<L>::layer().addDriver(global_next_s{global_state_s<L>::target_dispatch}, driver_name);
+	}
+	static constexpr pfn_addDriver_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceAddLayer<L>::value>
+struct deviceAddLayer_global {
+	static constexpr pfn_deviceAddLayer_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceAddLayer_global<L, true> {
+	static int wrap(device_t device, const char *layer_name) {
+		return global_layer<L>::layer().deviceAddLayer(global_next_s{global_state_s<L>::target_dispatch}, device, layer_name);
+	}
+	static constexpr pfn_deviceAddLayer_t entry() {
+		return &wrap;
+	}
+};
+
+#if FFI_INSTANCE_LAYERS
+
+/**
+ * FFI instance layer objects are allocated together with the closures of
+ * their entries, whose context is this structure.
+ */
+template <class L>
+struct instance_data_s {
+	L                           layer;
+	struct instance_dispatch_s *target_dispatch;
+	ffi_closure                *closures[NUM_INSTANCE_DISPATCH_ENTRIES];
+	ffi_cif                     cifs[NUM_INSTANCE_DISPATCH_ENTRIES];
+};
+
+/**
+ * Create the closure of an entry, see wrap_call in instance_layer.c.
+ */
+template <class L>
+static inline int
+closure(
+		instance_data_s<L>  *data,
+		size_t               api_slot,
+		void                *pfun_ffi,
+		unsigned int         nargs,
+		ffi_type            *rtype,
+		ffi_type           **atypes,
+		void               **pfun_ret) {
+	void *code;
+	data->closures[api_slot] = static_cast<ffi_closure *>(ffi_closure_alloc(sizeof(ffi_closure), &code));
+	if (!data->closures[api_slot])
+		return SPEC_ERROR;
+	if (FFI_OK != ffi_prep_cif(&data->cifs[api_slot], FFI_DEFAULT_ABI, nargs, rtype, atypes) ||
+	    FFI_OK != ffi_prep_closure_loc(data->closures[api_slot], &data->cifs[api_slot],
+			reinterpret_cast<void (*)(ffi_cif *, void *, void **, void *)>(pfun_ffi),
+			data, code))
+		return SPEC_ERROR;
+	*pfun_ret = code;
+	return SPEC_SUCCESS;
+}
+
+/**
+ * <api>_instance<L>::attach() creates the closure of api for the instance
+ * layer class L if it intercepts api.
+ */
+template <class L, bool = has_platformCreateDevice<L>::value>
+struct platformCreateDevice_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct platformCreateDevice_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct platformCreateDevice_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.platformCreateDevice(instance_next_s{instance->target_dispatch}, *args->p_platform, *args->p_device_ret);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::platformCreateDevice, reinterpret_cast<void *>(&wrap),
+			platformCreateDevice_ffi_nargs, platformCreateDevice_ffi_ret, platformCreateDevice_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->platformCreateDevice_instance));
+	}
+};
+template <class L, bool = has_deviceFunc1<L>::value>
+struct deviceFunc1_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct deviceFunc1_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct deviceFunc1_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.deviceFunc1(instance_next_s{instance->target_dispatch}, *args->p_device, *args->p_param);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::deviceFunc1, reinterpret_cast<void *>(&wrap),
+			deviceFunc1_ffi_nargs, deviceFunc1_ffi_ret, deviceFunc1_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->deviceFunc1_instance));
+	}
+};
+template <class L, bool = has_deviceFunc2<L>::value>
+struct deviceFunc2_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct deviceFunc2_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct deviceFunc2_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.deviceFunc2(instance_next_s{instance->target_dispatch}, *args->p_device, *args->p_param);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::deviceFunc2, reinterpret_cast<void *>(&wrap),
+			deviceFunc2_ffi_nargs, deviceFunc2_ffi_ret, deviceFunc2_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->deviceFunc2_instance));
+	}
+};
+template <class L, bool = has_deviceDestroy<L>::value>
+struct deviceDestroy_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct deviceDestroy_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct deviceDestroy_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.deviceDestroy(instance_next_s{instance->target_dispatch}, *args->p_device);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::deviceDestroy, reinterpret_cast<void *>(&wrap),
+			deviceDestroy_ffi_nargs, deviceDestroy_ffi_ret, deviceDestroy_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->deviceDestroy_instance));
+	}
+};
+template <class L, bool = has_deviceFunc1Batch<L>::value>
+struct deviceFunc1Batch_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct deviceFunc1Batch_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct deviceFunc1Batch_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.deviceFunc1Batch(instance_next_s{instance->target_dispatch}, *args->p_device, *args->p_num_params, *args->p_params, *args->p_results);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::deviceFunc1Batch, reinterpret_cast<void *>(&wrap),
+			deviceFunc1Batch_ffi_nargs, deviceFunc1Batch_ffi_ret, deviceFunc1Batch_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->deviceFunc1Batch_instance));
+	}
+};
+template <class L, bool = has_deviceFunc2Batch<L>::value>
+struct deviceFunc2Batch_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct deviceFunc2Batch_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct deviceFunc2Batch_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.deviceFunc2Batch(instance_next_s{instance->target_dispatch}, *args->p_device, *args->p_num_params, *args->p_params, *args->p_results);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::deviceFunc2Batch, reinterpret_cast<void *>(&wrap),
+			deviceFunc2Batch_ffi_nargs, deviceFunc2Batch_ffi_ret, deviceFunc2Batch_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->deviceFunc2Batch_instance));
+	}
+};
+template <class L, bool = has_platformCreateDevices<L>::value>
+struct platformCreateDevices_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct platformCreateDevices_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct platformCreateDevices_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.platformCreateDevices(instance_next_s{instance->target_dispatch}, *args->p_platform, *args->p_num_devices, *args->p_devices);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::platformCreateDevices, reinterpret_cast<void *>(&wrap),
+			platformCreateDevices_ffi_nargs, platformCreateDevices_ffi_ret, platformCreateDevices_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->platformCreateDevices_instance));
+	}
+};
+template <class L, bool = has_devicesDestroy<L>::value>
+struct devicesDestroy_instance {
+	static int attach(instance_data_s<L> *, struct instance_dispatch_s *) {
+		return SPEC_SUCCESS;
+	}
+};
+template <class L>
+struct devicesDestroy_instance<L, true> {
+	static void wrap(ffi_cif *, int *ffi_ret, struct devicesDestroy_ffi_args *args, void *data) {
+		instance_data_s<L> *instance = static_cast<instance_data_s<L> *>(data);
+		*ffi_ret = instance->layer.devicesDestroy(instance_next_s{instance->target_dispatch}, *args->p_num_devices, *args->p_devices);
+	}
+	static int attach(instance_data_s<L> *data, struct instance_dispatch_s *layer_instance_dispatch) {
+		return closure(data, instance_slot::devicesDestroy, reinterpret_cast<void *>(&wrap),
+			devicesDestroy_ffi_nargs, devicesDestroy_ffi_ret, devicesDestroy_ffi_types,
+			reinterpret_cast<void **>(&layer_instance_dispatch->devicesDestroy_instance));
+	}
+};
+
+#else //!FFI_INSTANCE_LAYERS
+
+/**
+ * <api>_instance<L>::entry() is the instance dispatch table entry of api for
+ * the instance layer class L, calling the member function of the layer
+ * object of the instance if it intercepts api and NULL otherwise.
+ */
+template <class L, bool = has_platformCreateDevice<L>::value>
+struct platformCreateDevice_instance {
+	static constexpr pfn_platformCreateDevice_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateDevice_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, platform_t platform, device_t *device_ret) {
+		return static_cast<L *>(layer->data)->platformCreateDevice(instance_next_s{layer}, platform, device_ret);
+	}
+	static constexpr pfn_platformCreateDevice_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1<L>::value>
+struct deviceFunc1_instance {
+	static constexpr pfn_deviceFunc1_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, device_t device, int param) {
+		return static_cast<L *>(layer->data)->deviceFunc1(instance_next_s{layer}, device, param);
+	}
+	static constexpr pfn_deviceFunc1_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2<L>::value>
+struct deviceFunc2_instance {
+	static constexpr pfn_deviceFunc2_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, device_t device, int param) {
+		return static_cast<L *>(layer->data)->deviceFunc2(instance_next_s{layer}, device, param);
+	}
+	static constexpr pfn_deviceFunc2_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceDestroy<L>::value>
+struct deviceDestroy_instance {
+	static constexpr pfn_deviceDestroy_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceDestroy_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, device_t device) {
+		return static_cast<L *>(layer->data)->deviceDestroy(instance_next_s{layer}, device);
+	}
+	static constexpr pfn_deviceDestroy_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc1Batch<L>::value>
+struct deviceFunc1Batch_instance {
+	static constexpr pfn_deviceFunc1Batch_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc1Batch_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, device_t device, size_t num_params, const int *params, int *results) {
+		return static_cast<L *>(layer->data)->deviceFunc1Batch(instance_next_s{layer}, device, num_params, params, results);
+	}
+	static constexpr pfn_deviceFunc1Batch_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_deviceFunc2Batch<L>::value>
+struct deviceFunc2Batch_instance {
+	static constexpr pfn_deviceFunc2Batch_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct deviceFunc2Batch_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, device_t device, size_t num_params, const int *params, int *results) {
+		return static_cast<L *>(layer->data)->deviceFunc2Batch(instance_next_s{layer}, device, num_params, params, results);
+	}
+	static constexpr pfn_deviceFunc2Batch_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_platformCreateDevices<L>::value>
+struct platformCreateDevices_instance {
+	static constexpr pfn_platformCreateDevices_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct platformCreateDevices_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, platform_t platform, size_t num_devices, device_t *devices) {
+		return static_cast<L *>(layer->data)->platformCreateDevices(instance_next_s{layer}, platform, num_devices, devices);
+	}
+	static constexpr pfn_platformCreateDevices_instance_t entry() {
+		return &wrap;
+	}
+};
+template <class L, bool = has_devicesDestroy<L>::value>
+struct devicesDestroy_instance {
+	static constexpr pfn_devicesDestroy_instance_t entry() {
+		return NULL;
+	}
+};
+template <class L>
+struct devicesDestroy_instance<L, true> {
+	static int wrap(struct instance_layer_proxy_s *layer, size_t num_devices, const device_t *devices) {
+		return static_cast<L *>(layer->data)->devicesDestroy(instance_next_s{layer}, num_devices, devices);
+	}
+	static constexpr pfn_devicesDestroy_instance_t entry() {
+		return &wrap;
+	}
+};
+
+#endif //!FFI_INSTANCE_LAYERS
+
+} // namespace detail
+
+/**
+ * Base of global layer classes.
+ */
+template <class L>
+class global_layer {
+public:
+	typedef global_next_s next_t;
+
+	static constexpr uint64_t intercept_mask() {
+		return
+			(detail::has_getPlatforms<L>::value ? api_mask(slot::getPlatforms) : 0) |
+			(detail::has_platformAddLayer<L>::value ? api_mask(slot::platformAddLayer) : 0) |
+			(detail::has_platformCreateDevice<L>::value ? api_mask(slot::platformCreateDevice) : 0) |
+			(detail::has_deviceFunc1<L>::value ? api_mask(slot::deviceFunc1) : 0) |
+			(detail::has_deviceFunc2<L>::value ? api_mask(slot::deviceFunc2) : 0) |
+			(detail::has_deviceDestroy<L>::value ? api_mask(slot::deviceDestroy) : 0) |
+			(detail::has_platformGetFunc<L>::value ? api_mask(slot::platformGetFunc) : 0) |
+			(detail::has_deviceFunc1Batch<L>::value ? api_mask(slot::deviceFunc1Batch) : 0) |
+			(detail::has_deviceFunc2Batch<L>::value ? api_mask(slot::deviceFunc2Batch) : 0) |
+			(detail::has_platformCreateQueue<L>::value ? api_mask(slot::platformCreateQueue) : 0) |
+			(detail::has_deviceCreateQueue<L>::value ? api_mask(slot::deviceCreateQueue) : 0) |
+			(detail::has_queueDestroy<L>::value ? api_mask(slot::queueDestroy) : 0) |
+			(detail::has_eventQuery<L>::value ? api_mask(slot::eventQuery) : 0) |
+			(detail::has_eventWait<L>::value ? api_mask(slot::eventWait) : 0) |
+			(detail::has_eventRelease<L>::value ? api_mask(slot::eventRelease) : 0) |
+			(detail::has_platformCreateDeviceEnqueue<L>::value ? api_mask(slot::platformCreateDeviceEnqueue) : 0) |
+			(detail::has_deviceFunc1Enqueue<L>::value ? api_mask(slot::deviceFunc1Enqueue) : 0) |
+			(detail::has_deviceFunc2Enqueue<L>::value ? api_mask(slot::deviceFunc2Enqueue) : 0) |
+			(detail::has_deviceDestroyEnqueue<L>::value ? api_mask(slot::deviceDestroyEnqueue) : 0) |
+			(detail::has_deviceFunc1BatchEnqueue<L>::value ? api_mask(slot::deviceFunc1BatchEnqueue) : 0) |
+			(detail::has_deviceFunc2BatchEnqueue<L>::value ? api_mask(slot::deviceFunc2BatchEnqueue) : 0) |
+			(detail::has_platformCreateDevices<L>::value ? api_mask(slot::platformCreateDevices) : 0) |
+			(detail::has_devicesDestroy<L>::value ? api_mask(slot::devicesDestroy) : 0) |
+			(detail::has_layerSetEnabled<L>::value ? api_mask(slot::layerSetEnabled) : 0) |
+			(detail::has_platformRemoveLayer<L>::value ? api_mask(slot::platformRemoveLayer) : 0) |
+			(detail::has_addDriver<L>::value ? api_mask(slot::addDriver) : 0) |
+			(detail::has_deviceAddLayer<L>::value ? api_mask(slot::deviceAddLayer) : 0);
+	}
+
+	static L &layer() {
+		return *reinterpret_cast<L *>(detail::global_state_s<L>::storage);
+	}
+
+	/**
+	 * The target dispatch table must hold the intercepted APIs, and entries
+	 * past the ones of the layer are left untouched.
+	 */
+	static int init(
+			size_t              num_entries,
+			struct dispatch_s  *target_dispatch,
+			struct dispatch_s  *layer_dispatch) {
+		static_assert(std::is_base_of<global_layer<L>, L>::value, "layer classes must derive from global_layer");
+		static const struct dispatch_s dispatch = {
+			detail::getPlatforms_global<L>::entry(),
+			detail::platformAddLayer_global<L>::entry(),
+			detail::platformCreateDevice_global<L>::entry(),
+			detail::deviceFunc1_global<L>::entry(),
+			detail::deviceFunc2_global<L>::entry(),
+			detail::deviceDestroy_global<L>::entry(),
+			detail::platformGetFunc_global<L>::entry(),
+			detail::deviceFunc1Batch_global<L>::entry(),
+			detail::deviceFunc2Batch_global<L>::entry(),
+			detail::platformCreateQueue_global<L>::entry(),
+			detail::deviceCreateQueue_global<L>::entry(),
+			detail::queueDestroy_global<L>::entry(),
+			detail::eventQuery_global<L>::entry(),
+			detail::eventWait_global<L>::entry(),
+			detail::eventRelease_global<L>::entry(),
+			detail::platformCreateDeviceEnqueue_global<L>::entry(),
+			detail::deviceFunc1Enqueue_global<L>::entry(),
+			detail::deviceFunc2Enqueue_global<L>::entry(),
+			detail::deviceDestroyEnqueue_global<L>::entry(),
+			detail::deviceFunc1BatchEnqueue_global<L>::entry(),
+			detail::deviceFunc2BatchEnqueue_global<L>::entry(),
+			detail::platformCreateDevices_global<L>::entry(),
+			detail::devicesDestroy_global<L>::entry(),
+			detail::layerSetEnabled_global<L>::entry(),
+			detail::platformRemoveLayer_global<L>::entry(),
+			detail::addDriver_global<L>::entry(),
+			detail::deviceAddLayer_global<L>::entry()
+		};
+		if (!target_dispatch || !layer_dispatch)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		if (num_entries > NUM_DISPATCH_ENTRIES)
+			num_entries = NUM_DISPATCH_ENTRIES;
+		detail::global_state_s<L>::target_dispatch = target_dispatch;
+		new (detail::global_state_s<L>::storage) L();
+		memcpy(layer_dispatch, &dispatch, num_entries * sizeof(pfn_layerInit_t));
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit() {
+		layer().~L();
+		return SPEC_SUCCESS;
+	}
+};
+
+/**
+ * Base of instance layer classes.
+ */
+template <class L>
+class instance_layer {
+public:
+	typedef instance_next_s next_t;
+
+	static constexpr uint64_t intercept_mask() {
+		return
+			(detail::has_platformCreateDevice<L>::value ? api_mask(instance_slot::platformCreateDevice) : 0) |
+			(detail::has_deviceFunc1<L>::value ? api_mask(instance_slot::deviceFunc1) : 0) |
+			(detail::has_deviceFunc2<L>::value ? api_mask(instance_slot::deviceFunc2) : 0) |
+			(detail::has_deviceDestroy<L>::value ? api_mask(instance_slot::deviceDestroy) : 0) |
+			(detail::has_deviceFunc1Batch<L>::value ? api_mask(instance_slot::deviceFunc1Batch) : 0) |
+			(detail::has_deviceFunc2Batch<L>::value ? api_mask(instance_slot::deviceFunc2Batch) : 0) |
+			(detail::has_platformCreateDevices<L>::value ? api_mask(instance_slot::platformCreateDevices) : 0) |
+			(detail::has_devicesDestroy<L>::value ? api_mask(instance_slot::devicesDestroy) : 0);
+	}
+
+#if FFI_INSTANCE_LAYERS
+	static int init(
+			size_t                       num_entries,
+			struct instance_dispatch_s  *target_dispatch,
+			struct instance_dispatch_s  *layer_instance_dispatch,
+			void                       **layer_data_ret) {
+		static_assert(std::is_base_of<instance_layer<L>, L>::value, "layer classes must derive from instance_layer");
+		if (!target_dispatch || !layer_instance_dispatch || !layer_data_ret)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		detail::instance_data_s<L> *data = new (std::nothrow) detail::instance_data_s<L>();
+		if (!data)
+			return SPEC_ERROR;
+		data->target_dispatch = target_dispatch;
+		if (
+		    detail::platformCreateDevice_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::deviceFunc1_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::deviceFunc2_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::deviceDestroy_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::deviceFunc1Batch_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::deviceFunc2Batch_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::platformCreateDevices_instance<L>::attach(data, layer_instance_dispatch) ||
+		    detail::devicesDestroy_instance<L>::attach(data, layer_instance_dispatch)) {
+			deinit(data);
+			return SPEC_ERROR;
+		}
+		*layer_data_ret = data;
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit(void *layer_data) {
+		detail::instance_data_s<L> *data = static_cast<detail::instance_data_s<L> *>(layer_data);
+		for (size_t i = 0; i < NUM_INSTANCE_DISPATCH_ENTRIES; i++)
+			if (data->closures[i])
+				ffi_closure_free(data->closures[i]);
+		delete data;
+		return SPEC_SUCCESS;
+	}
+#else //!FFI_INSTANCE_LAYERS
+	static int init(
+			size_t                       num_entries,
+			struct instance_dispatch_s  *layer_instance_dispatch,
+			void                       **layer_data_ret) {
+		static_assert(std::is_base_of<instance_layer<L>, L>::value, "layer classes must derive from instance_layer");
+		static const struct instance_dispatch_s dispatch = {
+			detail::platformCreateDevice_instance<L>::entry(),
+			detail::deviceFunc1_instance<L>::entry(),
+			detail::deviceFunc2_instance<L>::entry(),
+			detail::deviceDestroy_instance<L>::entry(),
+			detail::deviceFunc1Batch_instance<L>::entry(),
+			detail::deviceFunc2Batch_instance<L>::entry(),
+			detail::platformCreateDevices_instance<L>::entry(),
+			detail::devicesDestroy_instance<L>::entry()
+		};
+		if (!layer_instance_dispatch || !layer_data_ret)
+			return SPEC_ERROR;
+		if (num_entries < detail::mask_entries(intercept_mask()))
+			return SPEC_ERROR;
+		if (num_entries > NUM_INSTANCE_DISPATCH_ENTRIES)
+			num_entries = NUM_INSTANCE_DISPATCH_ENTRIES;
+		L *layer = new (std::nothrow) L();
+		if (!layer)
+			return SPEC_ERROR;
+		memcpy(layer_instance_dispatch, &dispatch, num_entries * sizeof(pfn_layerInit_t));
+		*layer_data_ret = layer;
+		return SPEC_SUCCESS;
+	}
+
+	static int deinit(void *layer_data) {
+		delete static_cast<L *>(layer_data);
+		return SPEC_SUCCESS;
+	}
+#endif //!FFI_INSTANCE_LAYERS
+};
+
+} // namespace exp_layer
+
+/**
+ * Layer API of a library implementing the global layer class layer_class.
+ */
+#define EXP_GLOBAL_LAYER(layer_class) \
+extern "C" int layerInit( \
+		size_t              num_entries, \
+		struct dispatch_s  *target_dispatch, \
+		struct dispatch_s  *layer_dispatch) { \
+	return exp_layer::global_layer<layer_class>::init(num_entries, target_dispatch, layer_dispatch); \
+} \
+extern "C" int layerDeinit() { \
+	return exp_layer::global_layer<layer_class>::deinit(); \
+}
+
+/**
+ * Layer API of a library implementing the instance layer class layer_class.
+ */
+#if FFI_INSTANCE_LAYERS
+#define EXP_INSTANCE_LAYER(layer_class) \
+extern "C" int layerInstanceInit( \
+		size_t                       num_entries, \
+		struct instance_dispatch_s  *target_dispatch, \
+		struct instance_dispatch_s  *layer_instance_dispatch, \
+		void                       **layer_data_ret) { \
+	return exp_layer::instance_layer<layer_class>::init( \
+		num_entries, target_dispatch, layer_instance_dispatch, layer_data_ret); \
+} \
+extern "C" int layerInstanceDeinit(void *layer_data) { \
+	return exp_layer::instance_layer<layer_class>::deinit(layer_data); \
+}
+#else //!FFI_INSTANCE_LAYERS
+#define EXP_INSTANCE_LAYER(layer_class) \
+extern "C" int layerInstanceInit( \
+		size_t                       num_entries, \
+		struct instance_dispatch_s  *layer_instance_dispatch, \
+		void                       **layer_data_ret) { \
+	return exp_layer::instance_layer<layer_class>::init( \
+		num_entries, layer_instance_dispatch, layer_data_ret); \
+} \
+extern "C" int layerInstanceDeinit(void *layer_data) { \
+	return exp_layer::instance_layer<layer_class>::deinit(layer_data); \
+}
+#endif //!FFI_INSTANCE_LAYERS
@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "profile.h"
+
+/**
+ * Implementation of the link profiling of profile.h.
+ */
+
+#define PROFILE_MIN_FRAMES 16
+#define PROFILE_MIN_EVENTS 1024
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+struct profile_frame_s {
+	const void          *link;
+	enum profile_link_e  kind;
+	const char          *name;
+	const char          *api;
+	uint64_t             start;
+	uint64_t             children;
+};
+
+struct profile_event_s {
+	const char *name;
+	const char *api;
+	uint64_t    start;
+	uint64_t    duration;
+	uint64_t    self;
+};
+
+/**
+ * Per thread frame stack and completed frames. Records are never freed while
+ * the loader is loaded, and are reused by new threads once their thread
+ * exits, like epoch reader records. Events beyond PROFILE_MAX_EVENTS per
+ * thread are dropped.
+ */
+struct profile_thread_s;
+struct profile_thread_s {
+	struct profile_thread_s *next;
+	int                      in_use;
+	uint32_t                 id;
+	size_t                   depth;
+	size_t                   max_depth;
+	struct profile_frame_s  *frames;
+	size_t                   num_events;
+	size_t                   max_events;
+	struct profile_event_s  *events;
+	uint64_t                 dropped;
+};
+
+static __thread struct profile_thread_s *_profile_thread = NULL;
+static struct profile_thread_s *_profile_threads = NULL;
+static uint32_t                 _profile_num_threads = 0;
+static pthread_key_t            _profile_key;
+static FILE                    *_profile_file = NULL;
+static uint64_t                 _profile_start;
+
+static inline uint64_t
+profileNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void
+profileThreadExit(void *arg) {
+	struct profile_thread_s *thread = (struct profile_thread_s *)arg;
+	__atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static struct profile_thread_s *
+profileThreadRegister(void) {
+	struct profile_thread_s *thread;
+	for (thread = __atomic_load_n(&_profile_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&thread->in_use, &unused, 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			goto found;
+	}
+	thread = (struct profile_thread_s *)calloc(1, sizeof(struct profile_thread_s));
+	if (!thread)
+		return NULL;
+	thread->in_use = 1;
+	thread->id = __atomic_fetch_add(&_profile_num_threads, 1, __ATOMIC_RELAXED);
+	thread->next = __atomic_load_n(&_profile_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_profile_threads, &thread->next, thread, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+found:
+	pthread_setspecific(_profile_key, thread);
+	_profile_thread = thread;
+	return thread;
+}
+
+int
+profileInit(const char *path) {
+	_profile_file = fopen(path, "w");
+	if (!_profile_file)
+		return -1;
+	if (pthread_key_create(&_profile_key, &profileThreadExit)) {
+		fclose(_profile_file);
+		_profile_file = NULL;
+		return -1;
+	}
+	_profile_start = profileNow();
+	return 0;
+}
+
+/**
+ * Frames that can't be recorded for lack of memory are still pushed, without
+ * a link, so that the stack stays balanced.
+ */
+void
+profileEnter(const void *link, enum profile_link_e kind, const char *name, const char *api) {
+	struct profile_thread_s *thread = _profile_thread;
+	if (__builtin_expect(!thread, 0) && !(thread = profileThreadRegister()))
+		return;
+	if (thread->depth == thread->max_depth) {
+		size_t max_depth = thread->max_depth ? thread->max_depth * 2 : PROFILE_MIN_FRAMES;
+		struct profile_frame_s *frames = (struct profile_frame_s *)
+			realloc(thread->frames, max_depth * sizeof(struct profile_frame_s));
+		if (!frames) {
+			thread->depth++;
+			return;
+		}
+		thread->frames = frames;
+		thread->max_depth = max_depth;
+	}
+	struct profile_frame_s *frame = &thread->frames[thread->depth++];
+	frame->link = link;
+	frame->kind = kind;
+	frame->name = name;
+	frame->api = api;
+	frame->children = 0;
+	frame->start = profileNow();
+}
+
+void
+profileExit(void) {
+	uint64_t end = profileNow();
+	struct profile_thread_s *thread = _profile_thread;
+	if (!thread || !thread->depth)
+		return;
+	if (--thread->depth >= thread->max_depth)
+		return;
+	struct profile_frame_s *frame = &thread->frames[thread->depth];
+	uint64_t duration = end - frame->start;
+	if (thread->depth)
+		thread->frames[thread->depth - 1].children += duration;
+	if (thread->num_events == thread->max_events) {
+		size_t max_events = thread->max_events ? thread->max_events * 2 : PROFILE_MIN_EVENTS;
+		struct profile_event_s *events = max_events > PROFILE_MAX_EVENTS ? NULL :
+			(struct profile_event_s *)realloc(thread->events, max_events * sizeof(struct profile_event_s));
+		if (!events) {
+			thread->dropped++;
+			return;
+		}
+		thread->events = events;
+		thread->max_events = max_events;
+	}
+	struct profile_event_s *event = &thread->events[thread->num_events++];
+	event->name = frame->name;
+	event->api = frame->api;
+	event->start = frame->start;
+	event->duration = duration;
+	event->self = duration > frame->children ? duration - frame->children : 0;
+}
+
+const void *
+profileTop(enum profile_link_e kind) {
+	struct profile_thread_s *thread = _profile_thread;
+	if (!thread || !thread->depth || thread->depth > thread->max_depth)
+		return NULL;
+	struct profile_frame_s *frame = &thread->frames[thread->depth - 1];
+	return frame->kind == kind ? frame->link : NULL;
+}
+
+static void
+profileWriteString(const char *string) {
+	fputc('"', _profile_file);
+	for (; *string; string++) {
+		if (*string == '"' || *string == '\\')
+			fprintf(_profile_file, "\\%c", *string);
+		else if ((unsigned char)*string < 0x20)
+			fprintf(_profile_file, "\\u%04x", (unsigned char)*string);
+		else
+			fputc(*string, _profile_file);
+	}
+	fputc('"', _profile_file);
+}
+
+struct profile_total_s {
+	const char *name;
+	uint64_t    calls;
+	uint64_t    self;
+};
+
+void
+profileFini(void) {
+	struct profile_total_s *totals = NULL;
+	size_t num_totals = 0;
+	long pid = (long)getpid();
+	int first = 1;
+	if (!_profile_file)
+		return;
+	fprintf(_profile_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (struct profile_thread_s *thread = _profile_threads; thread; thread = thread->next) {
+		fprintf(_profile_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%u,"
+			"\"args\":{\"name\":\"thread %u\"}}", first ? "" : ",", pid, thread->id, thread->id);
+		first = 0;
+		if (thread->dropped)
+			fprintf(stderr, "Profile: %llu frames dropped by thread %u\n",
+				(unsigned long long)thread->dropped, thread->id);
+		for (size_t i = 0; i < thread->num_events; i++) {
+			const struct profile_event_s *event = &thread->events[i];
+			uint64_t start = event->start - _profile_start;
+			fprintf(_profile_file, ",\n{\"name\":");
+			profileWriteString(event->name);
+			fprintf(_profile_file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,"
+				"\"pid\":%ld,\"tid\":%u,\"args\":{\"api\":\"%s\",\"self_ns\":%llu}}",
+				event->api,
+				(unsigned long long)(start / 1000), (unsigned long long)(start % 1000),
+				(unsigned long long)(event->duration / 1000), (unsigned long long)(event->duration % 1000),
+				pid, thread->id, event->api, (unsigned long long)event->self);
+			size_t j;
+			for (j = 0; j < num_totals && strcmp(totals[j].name, event->name); j++)
+				;
+			if (j == num_totals) {
+				struct profile_total_s *t = (struct profile_total_s *)
+					realloc(totals, (num_totals + 1) * sizeof(struct profile_total_s));
+				if (!t)
+					continue;
+				totals = t;
+				totals[num_totals].name = event->name;
+				totals[num_totals].calls = 0;
+				totals[num_totals].self = 0;
+				num_totals++;
+			}
+			totals[j].calls++;
+			totals[j].self += event->self;
+		}
+	}
+	fprintf(_profile_file, "\n]}\n");
+	fclose(_profile_file);
+	_profile_file = NULL;
+	printf("Profile: %-28s %10s %14s %14s\n", "link", "calls", "self (ns)", "mean self (ns)");
+	for (size_t i = 0; i < num_totals; i++)
+		printf("Profile: %-28s %10llu %14llu %14llu\n", totals[i].name,
+			(unsigned long long)totals[i].calls, (unsigned long long)totals[i].self,
+			(unsigned long long)(totals[i].self / totals[i].calls));
+	free(totals);
+	pthread_key_delete(_profile_key);
+	struct profile_thread_s *thread = _profile_threads;
+	while (thread) {
+		struct profile_thread_s *next = thread->next;
+		free(thread->frames);
+		free(thread->events);
+		free(thread);
+		thread = next;
+	}
+	_profile_threads = NULL;
+	_profile_thread = NULL;
+}
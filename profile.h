@@ -0,0 +1,61 @@
+/**
+ * Per link profiling of the call chains, used by the loader when the
+ * LAYER_PROFILE environment variable is set.
+ *
+ * The loader then inserts timing shims between the links of the call chains
+ * (instance layers, global layers, and the driver behind the global layer
+ * terminator). A shim enters the frame of the link it calls, and exits it
+ * when the link returns. Frames are kept on a per thread stack, so the time
+ * spent in a link minus the time spent in the links it called is its self
+ * time. The top of the stack also tells shims which link called them, as the
+ * shims called by the layers are shared by all the links of a chain.
+ *
+ * Completed frames are recorded in per thread buffers, without locking, and
+ * written at loader unload as a Chrome JSON trace (complete events, one per
+ * frame, with the API and self time as arguments) that can be opened in
+ * Perfetto or chrome://tracing. The total self time of each link is also
+ * printed.
+ */
+
+#include <stdint.h>
+
+#define PROFILE_INTERNAL __attribute__((visibility("hidden")))
+
+enum profile_link_e {
+	PROFILE_INSTANCE,
+	PROFILE_GLOBAL,
+	PROFILE_DRIVER
+};
+
+/**
+ * Open the trace file. Returns 0 on success.
+ */
+PROFILE_INTERNAL int
+profileInit(const char *path);
+
+/**
+ * Enter the frame of link, of kind kind, for a call to api. name and api must
+ * remain valid until profileFini.
+ */
+PROFILE_INTERNAL void
+profileEnter(const void *link, enum profile_link_e kind, const char *name, const char *api);
+
+/**
+ * Exit the last frame entered.
+ */
+PROFILE_INTERNAL void
+profileExit(void);
+
+/**
+ * Return the link of the last frame entered by the calling thread, or NULL if
+ * it is not of kind kind.
+ */
+PROFILE_INTERNAL const void *
+profileTop(enum profile_link_e kind);
+
+/**
+ * Write the trace and print the self times. Must be called while the names
+ * of the links are still valid, and no API call is in progress.
+ */
+PROFILE_INTERNAL void
+profileFini(void);
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include "queue.h"
+
+/**
+ * Implementation of the work queues of queue.h, following Dmitry Vyukov's
+ * intrusive MPSC queue.
+ */
+
+static void
+workQueueLink(struct work_queue_s *queue, struct work_s *work) {
+	__atomic_store_n(&work->next, NULL, __ATOMIC_RELAXED);
+	struct work_s *prev = __atomic_exchange_n(&queue->head, work, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, work, __ATOMIC_RELEASE);
+}
+
+void
+workQueuePush(struct work_queue_s *queue, struct work_s *work) {
+	workQueueLink(queue, work);
+	sem_post(&queue->pending);
+}
+
+/**
+ * Consumer side, returns NULL if the queue is empty or if a producer has
+ * swapped the head but not linked its item yet.
+ */
+static struct work_s *
+workQueuePop(struct work_queue_s *queue) {
+	struct work_s *tail = queue->tail;
+	struct work_s *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &queue->stub) {
+		if (!next)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+		return NULL;
+	workQueueLink(queue, &queue->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/**
+ * The semaphore counts pushed items, so once it is acquired an item is
+ * available, or about to be linked. An item without callback stops the
+ * worker.
+ */
+static void *
+workQueueWorker(void *arg) {
+	struct work_queue_s *queue = (struct work_queue_s *)arg;
+	for (;;) {
+		while (sem_wait(&queue->pending) && errno == EINTR)
+			;
+		struct work_s *work;
+		while (!(work = workQueuePop(queue)))
+			sched_yield();
+		if (!work->callback)
+			break;
+		work->callback(work);
+	}
+	return NULL;
+}
+
+int
+workQueueInit(struct work_queue_s *queue) {
+	queue->stub.next = NULL;
+	queue->stub.callback = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+	if (sem_init(&queue->pending, 0, 0))
+		return -1;
+	if (pthread_create(&queue->worker, NULL, &workQueueWorker, queue)) {
+		sem_destroy(&queue->pending);
+		return -1;
+	}
+	return 0;
+}
+
+void
+workQueueFini(struct work_queue_s *queue) {
+	struct work_s stop = { NULL, NULL };
+	workQueuePush(queue, &stop);
+	pthread_join(queue->worker, NULL);
+	sem_destroy(&queue->pending);
+}
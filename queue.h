@@ -0,0 +1,56 @@
+/**
+ * Work queues, used by the loader to execute asynchronous API calls.
+ *
+ * Work items are pushed on an intrusive multiple producers single consumer
+ * list: producers never lock, and only swap the head of the list then link
+ * the previous head to the new item. Each queue is consumed, in push order,
+ * by a worker thread owned by the loader, that sleeps on a semaphore while
+ * the queue is empty.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#define QUEUE_INTERNAL __attribute__((visibility("hidden")))
+
+struct work_s;
+typedef void workCallback_t(struct work_s *work);
+
+/**
+ * A work item, to be embedded in the structure describing the work.
+ */
+struct work_s {
+	struct work_s  *next;
+	workCallback_t *callback;
+};
+
+/**
+ * head is the last pushed item, tail the next item to consume, and stub a
+ * placeholder keeping the list non empty.
+ */
+struct work_queue_s {
+	struct work_s *head;
+	struct work_s *tail;
+	struct work_s  stub;
+	sem_t          pending;
+	pthread_t      worker;
+};
+
+/**
+ * Initialize a work queue and start its worker thread.
+ */
+QUEUE_INTERNAL int
+workQueueInit(struct work_queue_s *queue);
+
+/**
+ * Push a work item, its callback will be called by the worker thread after
+ * the callbacks of the items previously pushed.
+ */
+QUEUE_INTERNAL void
+workQueuePush(struct work_queue_s *queue, struct work_s *work);
+
+/**
+ * Wait for the pushed items to be processed, then stop the worker thread.
+ */
+QUEUE_INTERNAL void
+workQueueFini(struct work_queue_s *queue);
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include "epoch.h"
+#include "registry.h"
+
+/**
+ * Implementation of the live handle registry of registry.h.
+ */
+
+#define REGISTRY_MIN_SIZE 64
+
+/**
+ * Returned when a table is frozen, the operation must be retried on the
+ * table replacing it.
+ */
+#define REGISTRY_RETRY 1
+
+static struct registry_table_s *
+registryTableAlloc(size_t size) {
+	struct registry_table_s *table = (struct registry_table_s *)
+		calloc(1, sizeof(struct registry_table_s) + size * sizeof(uintptr_t));
+	if (table)
+		table->mask = size - 1;
+	return table;
+}
+
+int
+registryInit(struct registry_s *registry) {
+	registry->table = registryTableAlloc(REGISTRY_MIN_SIZE);
+	if (!registry->table)
+		return -1;
+	if (pthread_mutex_init(&registry->grow_mutex, NULL)) {
+		free(registry->table);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Wait for the thread growing a frozen table to publish its replacement.
+ */
+static void
+registryWait(struct registry_s *registry) {
+	pthread_mutex_lock(&registry->grow_mutex);
+	pthread_mutex_unlock(&registry->grow_mutex);
+}
+
+/**
+ * Replace a table by a table four times larger than the number of live
+ * handles. If the new table can't be allocated, the old one is thawed and
+ * stays in use.
+ */
+static void
+registryGrow(struct registry_s *registry, struct registry_table_s *table) {
+	pthread_mutex_lock(&registry->grow_mutex);
+	if (__atomic_load_n(&registry->table, __ATOMIC_ACQUIRE) != table)
+		goto end;
+	size_t live = 0;
+	for (size_t i = 0; i <= table->mask; i++) {
+		uintptr_t slot = __atomic_fetch_or(&table->slots[i], REGISTRY_FROZEN, __ATOMIC_ACQ_REL);
+		if (slot != REGISTRY_EMPTY && slot != REGISTRY_REMOVED)
+			live++;
+	}
+	size_t size = REGISTRY_MIN_SIZE;
+	while (size < live * 4)
+		size *= 2;
+	struct registry_table_s *new_table = registryTableAlloc(size);
+	if (!new_table) {
+		for (size_t i = 0; i <= table->mask; i++)
+			__atomic_fetch_and(&table->slots[i], ~REGISTRY_FROZEN, __ATOMIC_ACQ_REL);
+		goto end;
+	}
+	for (size_t i = 0; i <= table->mask; i++) {
+		uintptr_t key = table->slots[i] & ~REGISTRY_FROZEN;
+		if (key == REGISTRY_EMPTY || key == REGISTRY_REMOVED)
+			continue;
+		size_t j = registryHash(key) & new_table->mask;
+		while (new_table->slots[j] != REGISTRY_EMPTY)
+			j = (j + 1) & new_table->mask;
+		new_table->slots[j] = key;
+		new_table->used++;
+	}
+	__atomic_store_n(&registry->table, new_table, __ATOMIC_RELEASE);
+	epochDefer(&free, table);
+end:
+	pthread_mutex_unlock(&registry->grow_mutex);
+}
+
+/**
+ * Claim the first empty slot or tombstone of the probe sequence of key.
+ * Reusing tombstones keeps the probe sequences short when drivers reuse the
+ * memory of destroyed handles, as a handle is only inserted once it was
+ * removed. Returns -1 if the table is full.
+ */
+static int
+registryClaim(struct registry_table_s *table, uintptr_t key) {
+	size_t i = registryHash(key) & table->mask;
+	for (size_t n = 0; n <= table->mask;) {
+		uintptr_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if (slot & REGISTRY_FROZEN)
+			return REGISTRY_RETRY;
+		if (slot == REGISTRY_EMPTY || slot == REGISTRY_REMOVED) {
+			if (__atomic_compare_exchange_n(&table->slots[i], &slot, key, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				if (slot == REGISTRY_EMPTY)
+					__atomic_fetch_add(&table->used, 1, __ATOMIC_RELAXED);
+				return 0;
+			}
+			/* another thread claimed or froze the slot, look again */
+			continue;
+		}
+		i = (i + 1) & table->mask;
+		n++;
+	}
+	return -1;
+}
+
+/**
+ * Replace key by a tombstone. Returns -1 if key is not in the table.
+ */
+static int
+registryRelease(struct registry_table_s *table, uintptr_t key) {
+	size_t i = registryHash(key) & table->mask;
+	for (size_t n = 0; n <= table->mask; n++) {
+		uintptr_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if (slot & REGISTRY_FROZEN)
+			return REGISTRY_RETRY;
+		if (slot == key) {
+			if (__atomic_compare_exchange_n(&table->slots[i], &slot, REGISTRY_REMOVED, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return 0;
+			/* removed by another thread, or frozen */
+			return (slot & REGISTRY_FROZEN) ? REGISTRY_RETRY : -1;
+		}
+		if (slot == REGISTRY_EMPTY)
+			return -1;
+		i = (i + 1) & table->mask;
+	}
+	return -1;
+}
+
+int
+registryInsert(struct registry_s *registry, const void *handle) {
+	uintptr_t key = (uintptr_t)handle;
+	int res;
+	if (key == REGISTRY_EMPTY || (key & REGISTRY_TAG_MASK))
+		return -1;
+	epochEnter();
+	do {
+		struct registry_table_s *table =
+			__atomic_load_n(&registry->table, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&table->used, __ATOMIC_RELAXED) * 2 >= table->mask + 1) {
+			registryGrow(registry, table);
+			/* when out of memory, the remaining empty slots are used */
+			table = __atomic_load_n(&registry->table, __ATOMIC_ACQUIRE);
+		}
+		res = registryClaim(table, key);
+		if (res == REGISTRY_RETRY)
+			registryWait(registry);
+	} while (res == REGISTRY_RETRY);
+	epochExit();
+	return res;
+}
+
+int
+registryRemove(struct registry_s *registry, const void *handle) {
+	uintptr_t key = (uintptr_t)handle;
+	int res;
+	if (key == REGISTRY_EMPTY || (key & REGISTRY_TAG_MASK))
+		return -1;
+	epochEnter();
+	do {
+		res = registryRelease(__atomic_load_n(&registry->table, __ATOMIC_ACQUIRE), key);
+		if (res == REGISTRY_RETRY)
+			registryWait(registry);
+	} while (res == REGISTRY_RETRY);
+	epochExit();
+	return res;
+}
+
+void
+registryFini(struct registry_s *registry) {
+	free(registry->table);
+	registry->table = NULL;
+	pthread_mutex_destroy(&registry->grow_mutex);
+}
@@ -0,0 +1,101 @@
+/**
+ * Registry of the live handles, used by the loader to validate handles before
+ * dereferencing them.
+ *
+ * The registry is an open addressing hash set of pointers, with linear
+ * probing. Lookups never lock nor write to shared memory, and must happen in
+ * an epoch read side critical section (see epoch.h), as a lookup may go
+ * through a table that is being replaced. Insertions and removals don't lock
+ * either: they claim a slot with a single compare and swap, removed handles
+ * leaving a tombstone behind, that later insertions can claim.
+ *
+ * When a table is more than half used, the thread inserting grows it: it
+ * freezes every slot of the old table, so that concurrent insertions and
+ * removals fail and wait for the new table, copies the live handles (dropping
+ * the tombstones) into a new table, and publishes it. Frozen tables still
+ * answer lookups, and are reclaimed after a grace period.
+ *
+ * Handles are pointers to structures starting with a pointer, so their two
+ * low bits are free to encode empty, removed and frozen slots.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define REGISTRY_INTERNAL __attribute__((visibility("hidden")))
+
+#define REGISTRY_EMPTY   ((uintptr_t)0)
+#define REGISTRY_FROZEN  ((uintptr_t)1)
+#define REGISTRY_REMOVED ((uintptr_t)2)
+#define REGISTRY_TAG_MASK ((uintptr_t)3)
+
+/**
+ * used counts the slots that are not empty, including tombstones, and mask is
+ * the number of slots minus one.
+ */
+struct registry_table_s {
+	size_t    mask;
+	size_t    used;
+	uintptr_t slots[];
+};
+
+struct registry_s {
+	struct registry_table_s *table;
+	pthread_mutex_t          grow_mutex;
+};
+
+static inline size_t
+registryHash(uintptr_t key) {
+	uint64_t h = (uint64_t)key >> 3;
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+/**
+ * Return non zero if the handle is live. Must be called in an epoch read side
+ * critical section.
+ */
+static inline int
+registryContains(struct registry_s *registry, const void *handle) {
+	uintptr_t key = (uintptr_t)handle;
+	if (key & REGISTRY_TAG_MASK)
+		return 0;
+	struct registry_table_s *table =
+		__atomic_load_n(&registry->table, __ATOMIC_ACQUIRE);
+	for (size_t i = registryHash(key) & table->mask;; i = (i + 1) & table->mask) {
+		uintptr_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if ((slot & ~REGISTRY_FROZEN) == key)
+			return 1;
+		if ((slot & ~REGISTRY_FROZEN) == REGISTRY_EMPTY)
+			return 0;
+	}
+}
+
+/**
+ * Initialize an empty registry.
+ */
+REGISTRY_INTERNAL int
+registryInit(struct registry_s *registry);
+
+/**
+ * Add a live handle. Fails if the handle is misaligned, or when out of
+ * memory.
+ */
+REGISTRY_INTERNAL int
+registryInsert(struct registry_s *registry, const void *handle);
+
+/**
+ * Remove a handle, failing if it was not live. When several threads remove
+ * the same handle, only one succeeds.
+ */
+REGISTRY_INTERNAL int
+registryRemove(struct registry_s *registry, const void *handle);
+
+/**
+ * Release the registry, only called when the loader is unloaded.
+ */
+REGISTRY_INTERNAL void
+registryFini(struct registry_s *registry);
@@ -1,2 +1,14 @@
 LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so valgrind -- ./test
 LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so valgrind -- ./test_dlopen
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so LAZY_DISPATCH=1 valgrind -- ./test
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so VALIDATE_HANDLES=1 valgrind -- ./test
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so:libhistogram_layer.so valgrind -- ./test
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so LAYER_PROFILE=profile.json valgrind -- ./test
+rm -f trace.*.trace
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so LAYER_TRACE=trace ./test && ./trace_decode trace.*.trace
+rm -f discovery.cache
+LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so LOADER_CACHE=discovery.cache ./test > /dev/null && LD_LIBRARY_PATH=`pwd` DRIVERS=libdriver1.so:libdriver2.so LAYERS=liblayer1.so:liblayer2.so LOADER_CACHE=discovery.cache valgrind -- ./test
+# baked loader, if built with build_baked.sh
+if [ -x baked/test ]; then
+	LD_LIBRARY_PATH=`pwd`/baked:`pwd` valgrind -- ./baked/test
+fi
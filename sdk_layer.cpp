@@ -0,0 +1,77 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include "layer.hpp"
+
+/**
+ * This file contains an implementation of a global and of an instance layer
+ * written with the C++ layer SDK of layer.hpp. Both only intercept deviceFunc2
+ * and deviceDestroy, counting the deviceFunc2 calls of each device, and the
+ * loader bypasses them for the other APIs. Depending on the
+ * FFI_INSTANCE_LAYERS macro definition the FFI or regular flavor of the
+ * instance layer is built.
+ */
+
+/**
+ * Calls of each override of the instance layer, on all the platforms and
+ * devices it is attached to, that the tests query through layerCallCount, as
+ * for the layers of instance_layer.c.
+ */
+static std::atomic<size_t> instance_deviceFunc2_calls(0);
+static std::atomic<size_t> instance_deviceDestroy_calls(0);
+
+extern "C" size_t layerCallCount(const char *api_name) {
+	if (!strcmp(api_name, "deviceFunc2"))
+		return instance_deviceFunc2_calls;
+	if (!strcmp(api_name, "deviceDestroy"))
+		return instance_deviceDestroy_calls;
+	return 0;
+}
+
+struct counting_global_layer : exp_layer::global_layer<counting_global_layer> {
+	unsigned long calls = 0;
+
+	int deviceFunc2(next_t next, device_t device, int param) {
+		int res = next.deviceFunc2(device, param);
+		printf("SDK LAYER: deviceFunc2(device = %p, param %d), result = %d, call %lu\n",
+			(void *)device, param, res, ++calls);
+		return res;
+	}
+
+	int deviceDestroy(next_t next, device_t device) {
+		printf("SDK LAYER: deviceDestroy(device = %p), after %lu deviceFunc2 calls\n",
+			(void *)device, calls);
+		return next.deviceDestroy(device);
+	}
+};
+
+struct counting_instance_layer : exp_layer::instance_layer<counting_instance_layer> {
+	unsigned long calls = 0;
+
+	int deviceFunc2(next_t next, device_t device, int param) {
+		instance_deviceFunc2_calls++;
+		int res = next.deviceFunc2(device, param);
+		printf("SDK INSTANCE LAYER: deviceFunc2(device = %p, param %d), result = %d, call %lu\n",
+			(void *)device, param, res, ++calls);
+		return res;
+	}
+
+	int deviceDestroy(next_t next, device_t device) {
+		instance_deviceDestroy_calls++;
+		printf("SDK INSTANCE LAYER: deviceDestroy(device = %p), after %lu deviceFunc2 calls\n",
+			(void *)device, calls);
+		return next.deviceDestroy(device);
+	}
+};
+
+static_assert(counting_global_layer::intercept_mask() ==
+	(exp_layer::api_mask(exp_layer::slot::deviceFunc2) |
+	 exp_layer::api_mask(exp_layer::slot::deviceDestroy)),
+	"the global layer only intercepts deviceFunc2 and deviceDestroy");
+static_assert(counting_instance_layer::intercept_mask() ==
+	(exp_layer::api_mask(exp_layer::instance_slot::deviceFunc2) |
+	 exp_layer::api_mask(exp_layer::instance_slot::deviceDestroy)),
+	"the instance layer only intercepts deviceFunc2 and deviceDestroy");
+
+EXP_GLOBAL_LAYER(counting_global_layer)
+EXP_INSTANCE_LAYER(counting_instance_layer)
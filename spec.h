@@ -1,3 +1,5 @@
+/* Generated from spec.api by gen_api.py, do not edit. */
+
 /**
  * A simple toy API that defines a set of platform available,
  * and APIs to create objects (called device here) and invoke
@@ -13,9 +15,12 @@
 
 /**
  * This API uses opaque handle to transfer ownership of objects to the user.
+ * Queues and events are loader objects, see platformCreateQueue.
  */
 typedef struct platform_s * platform_t;
 typedef struct device_s * device_t;
+typedef struct queue_s * queue_t;
+typedef struct event_s * event_t;
 
 /**
  * Query available platforms (see OpenCL clGetPlatformIDs).
@@ -53,11 +58,172 @@ deviceFunc2_t(device_t device, int param);
 typedef int
 deviceDestroy_t(device_t device);
 
+/**
+ * Query the address of an API entry point, or of an extension function
+ * supported by a platform (see OpenCL
+ * clGetExtensionFunctionAddressForPlatform). Extension functions are wrapped
+ * by the instance layers of the platform that support them. Addresses remain
+ * valid until the loader is unloaded, but instance layers attached to the
+ * platform afterwards only wrap addresses queried after they were attached.
+ */
+typedef int
+platformGetFunc_t(platform_t platform, const char *name, void **func_ret);
+
+/**
+ * Batched versions of deviceFunc1 and deviceFunc2, calling the function on the
+ * device once for each of the num_params parameters in params, and storing
+ * the result of each call in results. Returns SPEC_SUCCESS if every call
+ * succeeded, or the error of the first failing call.
+ */
+typedef int
+deviceFunc1Batch_t(device_t device, size_t num_params, const int *params, int *results);
+
+typedef int
+deviceFunc2Batch_t(device_t device, size_t num_params, const int *params, int *results);
+
+/**
+ * Create a queue executing asynchronous calls on the platform or device. Calls
+ * enqueued on a queue are executed in order by a worker thread owned by the
+ * loader, and go through the global and instance layers like any other call.
+ * Calls on different queues execute concurrently.
+ */
+typedef int
+platformCreateQueue_t(platform_t platform, queue_t *queue_ret);
+
+typedef int
+deviceCreateQueue_t(device_t device, queue_t *queue_ret);
+
+/**
+ * Wait for the calls enqueued on the queue to complete, and destroy it.
+ */
+typedef int
+queueDestroy_t(queue_t queue);
+
+/**
+ * Non blocking query of an event. *complete_ret is set to 1 if the call has
+ * completed, in which case its result is stored in *result_ret, and to 0
+ * otherwise.
+ */
+typedef int
+eventQuery_t(event_t event, int *complete_ret, int *result_ret);
+
+/**
+ * Wait for the completion of the calls of the given events. Returns
+ * SPEC_SUCCESS if every call succeeded, or the error of the first failing
+ * call in events order.
+ */
+typedef int
+eventWait_t(size_t num_events, const event_t *events);
+
+/**
+ * Release an event, which can be done before it completes.
+ */
+typedef int
+eventRelease_t(event_t event);
+
+/**
+ * Asynchronous versions of the driver APIs, enqueued on a queue created for a
+ * handle of the type the API is called on, and called with that handle. Return
+ * SPEC_SUCCESS once the call is enqueued, and if event_ret is not NULL an
+ * event to query the call with, which must be released. Memory the parameters
+ * point to must remain valid until the call completes.
+ */
+typedef int
+platformCreateDeviceEnqueue_t(queue_t queue, device_t *device_ret, event_t *event_ret);
+
+typedef int
+deviceFunc1Enqueue_t(queue_t queue, int param, event_t *event_ret);
+
+typedef int
+deviceFunc2Enqueue_t(queue_t queue, int param, event_t *event_ret);
+
+typedef int
+deviceDestroyEnqueue_t(queue_t queue, event_t *event_ret);
+
+typedef int
+deviceFunc1BatchEnqueue_t(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret);
+
+typedef int
+deviceFunc2BatchEnqueue_t(queue_t queue, size_t num_params, const int *params, int *results, event_t *event_ret);
+
+/**
+ * Create num_devices devices at once, returned in devices.
+ */
+typedef int
+platformCreateDevices_t(platform_t platform, size_t num_devices, device_t *devices);
+
+/**
+ * Destroy num_devices devices of the same platform at once. Returns
+ * SPEC_SUCCESS if every device was destroyed, or the error of the first
+ * failing destruction.
+ */
+typedef int
+devicesDestroy_t(size_t num_devices, const device_t *devices);
+
+/**
+ * Enable or disable a global layer loaded through the LAYERS environment
+ * variable, given its name as listed there. Disabled layers stay loaded, but
+ * calls don't go through them until they are enabled again. Returns
+ * SPEC_ERROR if no such layer is loaded.
+ */
+typedef int
+layerSetEnabled_t(const char *layer_name, int enabled);
+
+/**
+ * Detach from a platform the instance layer most recently attached to it with
+ * platformAddLayer under the given name. Returns once no API call can be
+ * executing in the layer anymore, the layer being deinitialized and unloaded,
+ * unless it wrapped extension functions, whose addresses remain valid until
+ * the loader is unloaded. Returns SPEC_ERROR if no such layer is attached.
+ */
+typedef int
+platformRemoveLayer_t(platform_t platform, const char *layer_name);
+
+/**
+ * Load a driver library at runtime, given its name as it would be listed in
+ * the DRIVERS environment variable, and append its platforms to the ones
+ * returned by getPlatforms. API calls in progress are not blocked, and
+ * enumerations see either none or all of the platforms of the driver.
+ * Returns SPEC_ERROR if the driver can't be loaded, or is already loaded.
+ */
+typedef int
+addDriver_t(const char *driver_name);
+
+/**
+ * Attach an instance layer to a device only. The device stops sharing the
+ * instance layer chain of its platform: its calls go through its own layers,
+ * then through the instance layers of the platform, platform layers attached
+ * or removed afterwards applying to the device as well.
+ */
+typedef int
+deviceAddLayer_t(device_t device, const char *layer_name);
+
 #ifndef NO_PROTOTYPES
-extern getPlatforms_t         getPlatforms;
-extern platformAddLayer_t     platformAddLayer;
-extern platformCreateDevice_t platformCreateDevice;
-extern deviceFunc1_t          deviceFunc1;
-extern deviceFunc2_t          deviceFunc2;
-extern deviceDestroy_t        deviceDestroy;
+extern getPlatforms_t                getPlatforms;
+extern platformAddLayer_t            platformAddLayer;
+extern platformCreateDevice_t        platformCreateDevice;
+extern deviceFunc1_t                 deviceFunc1;
+extern deviceFunc2_t                 deviceFunc2;
+extern deviceDestroy_t               deviceDestroy;
+extern platformGetFunc_t             platformGetFunc;
+extern deviceFunc1Batch_t            deviceFunc1Batch;
+extern deviceFunc2Batch_t            deviceFunc2Batch;
+extern platformCreateQueue_t         platformCreateQueue;
+extern deviceCreateQueue_t           deviceCreateQueue;
+extern queueDestroy_t                queueDestroy;
+extern eventQuery_t                  eventQuery;
+extern eventWait_t                   eventWait;
+extern eventRelease_t                eventRelease;
+extern platformCreateDeviceEnqueue_t platformCreateDeviceEnqueue;
+extern deviceFunc1Enqueue_t          deviceFunc1Enqueue;
+extern deviceFunc2Enqueue_t          deviceFunc2Enqueue;
+extern deviceDestroyEnqueue_t        deviceDestroyEnqueue;
+extern deviceFunc1BatchEnqueue_t     deviceFunc1BatchEnqueue;
+extern deviceFunc2BatchEnqueue_t     deviceFunc2BatchEnqueue;
+extern platformCreateDevices_t       platformCreateDevices;
+extern devicesDestroy_t              devicesDestroy;
+extern layerSetEnabled_t             layerSetEnabled;
+extern platformRemoveLayer_t         platformRemoveLayer;
+extern addDriver_t                   addDriver;
+extern deviceAddLayer_t              deviceAddLayer;
 #endif
@@ -0,0 +1,16 @@
+/**
+ * A toy vendor extension to the API defined in spec.h. Extensions are not part
+ * of the loader dispatch tables: they are implemented by some drivers only,
+ * and applications query them by name through platformGetFunc.
+ */
+
+/**
+ * A function on a device, only supported by the platforms of the second
+ * driver.
+ */
+#define DEVICE_EXT_FUNC_NAME "deviceExtFunc"
+
+typedef int
+deviceExtFunc_t(device_t device, int param);
+
+typedef deviceExtFunc_t *pfn_deviceExtFunc_t;
@@ -1,17 +1,41 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
 #include "spec.h"
+#include "spec_ext.h"
 
 #ifdef NO_PROTOTYPES
-#include <dlfcn.h>
 #include <inttypes.h>
 static getPlatforms_t         *getPlatforms;
 static platformAddLayer_t     *platformAddLayer;
+static platformGetFunc_t      *platformGetFunc;
 static platformCreateDevice_t *platformCreateDevice;
 static deviceFunc1_t          *deviceFunc1;
 static deviceFunc2_t          *deviceFunc2;
 static deviceDestroy_t        *deviceDestroy;
+static deviceFunc1Batch_t     *deviceFunc1Batch;
+static deviceFunc2Batch_t     *deviceFunc2Batch;
+static platformCreateQueue_t  *platformCreateQueue;
+static deviceCreateQueue_t    *deviceCreateQueue;
+static queueDestroy_t         *queueDestroy;
+static eventQuery_t           *eventQuery;
+static eventWait_t            *eventWait;
+static eventRelease_t         *eventRelease;
+static platformCreateDeviceEnqueue_t *platformCreateDeviceEnqueue;
+static deviceFunc1Enqueue_t          *deviceFunc1Enqueue;
+static deviceFunc2BatchEnqueue_t     *deviceFunc2BatchEnqueue;
+static deviceDestroyEnqueue_t        *deviceDestroyEnqueue;
+static platformCreateDevices_t       *platformCreateDevices;
+static devicesDestroy_t              *devicesDestroy;
+static layerSetEnabled_t             *layerSetEnabled;
+static platformRemoveLayer_t         *platformRemoveLayer;
+static addDriver_t                   *addDriver;
+static deviceAddLayer_t              *deviceAddLayer;
 
 #define GET_SYM(sym) \
 do { \
@@ -20,6 +44,28 @@ do { \
 } while (0)
 #endif
 
+/**
+ * The showcase instance layers count the calls they see for each API, see
+ * layerCallCount in instance_layer.c. Tests get the layer libraries loaded by
+ * the loader, keeping them mapped after the loader releases them, so that
+ * the counters can still be read once the layers are removed.
+ */
+typedef size_t layerCallCount_t(const char *api_name);
+
+static void *
+layerOpen(const char *layer_name) {
+	void *lib = dlopen(layer_name, RTLD_LAZY | RTLD_NOLOAD);
+	assert(lib);
+	return lib;
+}
+
+static size_t
+layerCalls(void *lib, const char *api_name) {
+	layerCallCount_t *count = (layerCallCount_t *)(intptr_t)dlsym(lib, "layerCallCount");
+	assert(count);
+	return count(api_name);
+}
+
 void test_platform(platform_t platform) {
 	device_t device;
 	int err;
@@ -31,11 +77,484 @@ void test_platform(platform_t platform) {
 	printf("Called deviceFunc1, err = %d\n", err);
 	err = deviceFunc2(device, 1);
 	printf("Called deviceFunc2, err = %d\n", err);
+	/* the drivers return the same result for every param */
+	int func2_err = err;
+	int params[3] = { 3, 4, 5 }, results[3];
+	/* results are reset so that stale ones are not mistaken for new ones */
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc1Batch(device, 3, params, results);
+	printf("Called deviceFunc1Batch, err = %d, results = {%d, %d, %d}\n",
+		err, results[0], results[1], results[2]);
+	assert(!err);
+	for (size_t i = 0; i < 3; i++)
+		assert(results[i] == SPEC_SUCCESS);
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc2Batch(device, 3, params, results);
+	printf("Called deviceFunc2Batch, err = %d, results = {%d, %d, %d}\n",
+		err, results[0], results[1], results[2]);
+	assert(err == func2_err);
+	for (size_t i = 0; i < 3; i++)
+		assert(results[i] == func2_err);
+	void *func, *func_again;
+	err = platformGetFunc(platform, "deviceFunc1", &func);
+	assert(!err && func == (void *)(intptr_t)deviceFunc1);
+	err = platformGetFunc(platform, DEVICE_EXT_FUNC_NAME, &func);
+	printf("Queried %s, err = %d\n", DEVICE_EXT_FUNC_NAME, err);
+	if (!err) {
+		err = platformGetFunc(platform, DEVICE_EXT_FUNC_NAME, &func_again);
+		assert(!err && func_again == func);
+		err = ((pfn_deviceExtFunc_t)(intptr_t)func)(device, 2);
+		printf("Called %s, err = %d\n", DEVICE_EXT_FUNC_NAME, err);
+	}
 	err = deviceDestroy(device);
 	printf("Destroyed device = %p, err = %d\n", (void *)device, err);
 	assert(!err);
 }
 
+void test_platform_bulk(platform_t platform) {
+	device_t devices[3];
+	int err;
+	printf("Testing platform %p in bulk\n", (void *)platform);
+	err = platformCreateDevices(platform, 3, devices);
+	printf("Created devices = {%p, %p, %p}, err = %d\n",
+		(void *)devices[0], (void *)devices[1], (void *)devices[2], err);
+	assert(!err);
+	for (int i = 0; i < 3; i++) {
+		err = deviceFunc1(devices[i], i);
+		assert(!err);
+	}
+	err = devicesDestroy(3, devices);
+	printf("Destroyed devices, err = %d\n", err);
+	assert(!err);
+}
+
+void test_platform_async(platform_t platform) {
+	queue_t platform_queue, device_queue;
+	device_t device;
+	event_t events[3];
+	int err, complete, result;
+	printf("Testing platform %p asynchronously\n", (void *)platform);
+	err = platformCreateQueue(platform, &platform_queue);
+	assert(!err);
+	err = platformCreateDeviceEnqueue(platform_queue, &device, &events[0]);
+	printf("Enqueued platformCreateDevice, err = %d\n", err);
+	assert(!err);
+	err = eventWait(1, events);
+	printf("Created device = %p, err = %d\n", (void *)device, err);
+	assert(!err);
+	err = eventQuery(events[0], &complete, &result);
+	assert(!err && complete == 1 && result == SPEC_SUCCESS);
+	eventRelease(events[0]);
+	err = deviceFunc1Enqueue(platform_queue, 0, NULL);
+	assert(err == SPEC_ERROR);
+	err = deviceCreateQueue(device, &device_queue);
+	assert(!err);
+	/* the drivers return the same result for every deviceFunc2 param */
+	int func2_err = deviceFunc2(device, 0);
+	int expected[3] = { SPEC_SUCCESS, func2_err, SPEC_SUCCESS };
+	int params[2] = { 6, 7 }, results[2];
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc1Enqueue(device_queue, 5, &events[0]);
+	assert(!err);
+	err = deviceFunc2BatchEnqueue(device_queue, 2, params, results, &events[1]);
+	assert(!err);
+	err = deviceDestroyEnqueue(device_queue, &events[2]);
+	assert(!err);
+	err = eventWait(3, events);
+	printf("Waited for deviceFunc1, deviceFunc2Batch and deviceDestroy, err = %d\n", err);
+	assert(err == func2_err);
+	for (int i = 0; i < 3; i++) {
+		err = eventQuery(events[i], &complete, &result);
+		assert(!err && complete == 1);
+		printf("Event %d result = %d\n", i, result);
+		assert(result == expected[i]);
+		eventRelease(events[i]);
+	}
+	assert(results[0] == func2_err && results[1] == func2_err);
+	queueDestroy(device_queue);
+	queueDestroy(platform_queue);
+}
+
+/**
+ * Disabled global layers don't see calls anymore, until enabled again. Baked
+ * global layers can't be toggled.
+ */
+void test_layer_toggle(platform_t platform) {
+	device_t device;
+	void *lib1, *lib2;
+	size_t calls1, calls2;
+	int err;
+	int params[3] = { 3, 4, 5 }, results[3];
+	printf("Testing global layer toggling on platform %p\n", (void *)platform);
+	err = layerSetEnabled("libunknown_layer.so", 0);
+	assert(err == SPEC_ERROR);
+	lib1 = dlopen("liblayer1.so", RTLD_LAZY | RTLD_NOLOAD);
+	if (!lib1) {
+		printf("Global layers not loaded, skipping\n");
+		return;
+	}
+	lib2 = layerOpen("liblayer2.so");
+	err = platformCreateDevice(platform, &device);
+	assert(!err);
+	calls1 = layerCalls(lib1, "deviceFunc1");
+	calls2 = layerCalls(lib2, "deviceFunc2");
+	err = layerSetEnabled("liblayer1.so", 0);
+	printf("Disabled layer1, err = %d\n", err);
+	assert(!err);
+	err = layerSetEnabled("liblayer2.so", 0);
+	printf("Disabled layer2, err = %d\n", err);
+	assert(!err);
+	err = deviceFunc1(device, 0);
+	printf("Called deviceFunc1, err = %d\n", err);
+	assert(!err);
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc2Batch(device, 3, params, results);
+	printf("Called deviceFunc2Batch, err = %d\n", err);
+	assert(!err);
+	for (size_t i = 0; i < 3; i++)
+		assert(results[i] == SPEC_SUCCESS);
+	assert(layerCalls(lib1, "deviceFunc1") == calls1);
+	assert(layerCalls(lib2, "deviceFunc2") == calls2);
+	err = layerSetEnabled("liblayer1.so", 1);
+	printf("Enabled layer1, err = %d\n", err);
+	assert(!err);
+	err = layerSetEnabled("liblayer2.so", 1);
+	printf("Enabled layer2, err = %d\n", err);
+	assert(!err);
+	err = deviceFunc1(device, 0);
+	printf("Called deviceFunc1, err = %d\n", err);
+	assert(!err);
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc2Batch(device, 3, params, results);
+	printf("Called deviceFunc2Batch, err = %d\n", err);
+	assert(!err);
+	for (size_t i = 0; i < 3; i++)
+		assert(results[i] == SPEC_SUCCESS);
+	assert(layerCalls(lib1, "deviceFunc1") == calls1 + 1);
+	/* layer2 doesn't intercept deviceFunc2Batch, the call is fanned out */
+	assert(layerCalls(lib2, "deviceFunc2") == calls2 + 3);
+	err = deviceDestroy(device);
+	assert(!err);
+	dlclose(lib2);
+	dlclose(lib1);
+}
+
+/**
+ * Removed instance layers are deinitialized, and don't see calls anymore.
+ */
+void test_layer_removal(platform_t platform) {
+	device_t device;
+	void *lib;
+	size_t calls;
+	int err;
+	printf("Testing instance layer removal on platform %p\n", (void *)platform);
+	err = platformCreateDevice(platform, &device);
+	assert(!err);
+	lib = layerOpen("libinstance_layer1.so");
+	calls = layerCalls(lib, "deviceFunc2");
+	err = deviceFunc2(device, 1);
+	assert(!err);
+	assert(layerCalls(lib, "deviceFunc2") == calls + 1);
+	err = platformRemoveLayer(platform, "libinstance_layer1.so");
+	printf("Removed instance layer1, err = %d\n", err);
+	assert(!err);
+	err = platformRemoveLayer(platform, "libinstance_layer1.so");
+	assert(err == SPEC_ERROR);
+	calls = layerCalls(lib, "deviceFunc1");
+	err = deviceFunc1(device, 0);
+	printf("Called deviceFunc1, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc1") == calls);
+	calls = layerCalls(lib, "deviceFunc2");
+	err = deviceFunc2(device, 1);
+	printf("Called deviceFunc2, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc2") == calls);
+	err = deviceDestroy(device);
+	assert(!err);
+	dlclose(lib);
+}
+
+struct layer_caller_s {
+	device_t device;
+	int      stop;
+	size_t   calls;
+};
+
+static void *
+layerCaller(void *arg) {
+	struct layer_caller_s *caller = (struct layer_caller_s *)arg;
+	while (!__atomic_load_n(&caller->stop, __ATOMIC_ACQUIRE)) {
+		int err = deviceFunc2(caller->device, 1);
+		assert(!err);
+		__atomic_add_fetch(&caller->calls, 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void
+waitCalls(struct layer_caller_s *caller, size_t calls) {
+	while (__atomic_load_n(&caller->calls, __ATOMIC_ACQUIRE) < calls)
+		sched_yield();
+}
+
+/**
+ * Once platformRemoveLayer returns, a layer removed while another thread is
+ * calling through it doesn't see calls anymore. The silent bench driver and
+ * counting layer are used, and the global layers disabled, so that the output
+ * doesn't depend on the number of calls.
+ */
+void test_concurrent_layer_removal(void) {
+	struct layer_caller_s caller = { NULL, 0, 0 };
+	platform_t *platforms;
+	size_t num_platforms, calls;
+	pthread_t thread;
+	void *lib;
+	int err;
+	printf("Testing instance layer removal during calls\n");
+	err = addDriver("libbench_driver.so");
+	assert(!err);
+	err = getPlatforms(0, NULL, &num_platforms);
+	assert(!err);
+	platforms = (platform_t *)malloc(num_platforms * sizeof(platform_t));
+	err = getPlatforms(num_platforms, platforms, NULL);
+	assert(!err);
+	layerSetEnabled("liblayer1.so", 0);
+	layerSetEnabled("liblayer2.so", 0);
+	err = platformAddLayer(platforms[num_platforms - 1], "libinstance_count_layer.so");
+	assert(!err);
+	lib = layerOpen("libinstance_count_layer.so");
+	err = platformCreateDevice(platforms[num_platforms - 1], &caller.device);
+	assert(!err);
+	err = pthread_create(&thread, NULL, layerCaller, &caller);
+	assert(!err);
+	waitCalls(&caller, 100);
+	err = platformRemoveLayer(platforms[num_platforms - 1], "libinstance_count_layer.so");
+	assert(!err);
+	calls = layerCalls(lib, "deviceFunc2");
+	assert(calls >= 100);
+	waitCalls(&caller, __atomic_load_n(&caller.calls, __ATOMIC_ACQUIRE) + 100);
+	__atomic_store_n(&caller.stop, 1, __ATOMIC_RELEASE);
+	err = pthread_join(thread, NULL);
+	assert(!err);
+	assert(layerCalls(lib, "deviceFunc2") == calls);
+	printf("Removed counting instance layer during calls\n");
+	err = deviceDestroy(caller.device);
+	assert(!err);
+	dlclose(lib);
+	layerSetEnabled("liblayer1.so", 1);
+	layerSetEnabled("liblayer2.so", 1);
+	free(platforms);
+}
+
+/**
+ * Device instance layers only see the calls of their device. The calls of the
+ * device then go through the platform layers, that can still be removed and
+ * added.
+ */
+void test_device_layer(platform_t platform) {
+	device_t devices[2];
+	void *lib1, *lib2;
+	size_t calls1, calls2;
+	int err;
+	printf("Testing device instance layers on platform %p\n", (void *)platform);
+	err = platformCreateDevices(platform, 2, devices);
+	assert(!err);
+	err = deviceAddLayer(devices[0], "libunknown_layer.so");
+	assert(err == SPEC_ERROR);
+	err = deviceAddLayer(devices[0], "libinstance_layer1.so");
+	printf("Added instance layer1 to device %p, err = %d\n", (void *)devices[0], err);
+	assert(!err);
+	lib1 = layerOpen("libinstance_layer1.so");
+	lib2 = layerOpen("libinstance_layer2.so");
+	calls1 = layerCalls(lib1, "deviceFunc1");
+	err = deviceFunc1(devices[0], 0);
+	printf("Called deviceFunc1 on device %p, err = %d\n", (void *)devices[0], err);
+	assert(layerCalls(lib1, "deviceFunc1") == calls1 + 1);
+	err = deviceFunc1(devices[1], 0);
+	printf("Called deviceFunc1 on device %p, err = %d\n", (void *)devices[1], err);
+	assert(layerCalls(lib1, "deviceFunc1") == calls1 + 1);
+	calls1 = layerCalls(lib1, "deviceFunc2");
+	calls2 = layerCalls(lib2, "deviceFunc2");
+	err = deviceFunc2(devices[0], 1);
+	assert(!err);
+	assert(layerCalls(lib1, "deviceFunc2") == calls1 + 1);
+	assert(layerCalls(lib2, "deviceFunc2") == calls2 + 1);
+	err = platformRemoveLayer(platform, "libinstance_layer2.so");
+	printf("Removed instance layer2, err = %d\n", err);
+	assert(!err);
+	err = deviceFunc2(devices[0], 1);
+	printf("Called deviceFunc2 on device %p, err = %d\n", (void *)devices[0], err);
+	assert(layerCalls(lib1, "deviceFunc2") == calls1 + 2);
+	assert(layerCalls(lib2, "deviceFunc2") == calls2 + 1);
+	err = platformAddLayer(platform, "libinstance_layer2.so");
+	printf("Added instance layer2, err = %d\n", err);
+	assert(!err);
+	err = deviceFunc2(devices[0], 1);
+	printf("Called deviceFunc2 on device %p, err = %d\n", (void *)devices[0], err);
+	assert(layerCalls(lib1, "deviceFunc2") == calls1 + 3);
+	assert(layerCalls(lib2, "deviceFunc2") == calls2 + 2);
+	err = devicesDestroy(2, devices);
+	printf("Destroyed devices, err = %d\n", err);
+	assert(!err);
+	err = platformRemoveLayer(platform, "libinstance_layer2.so");
+	printf("Removed instance layer2, err = %d\n", err);
+	assert(!err);
+	dlclose(lib1);
+	dlclose(lib2);
+}
+
+/**
+ * The filtering layer only sees the deviceFunc2 calls with a param between 10
+ * and 19: the loader filters the other calls out for the non FFI flavor, and
+ * the FFI flavor forwards them itself.
+ */
+void test_layer_filter(platform_t platform) {
+	device_t device;
+	void *lib;
+	size_t calls;
+	int err;
+	printf("Testing instance layer filters on platform %p\n", (void *)platform);
+	err = platformAddLayer(platform, "libinstance_filter_layer.so");
+	printf("Added filtering instance layer, err = %d\n", err);
+	assert(!err);
+	lib = layerOpen("libinstance_filter_layer.so");
+	err = platformCreateDevice(platform, &device);
+	assert(!err);
+	calls = layerCalls(lib, "deviceFunc2");
+	err = deviceFunc2(device, 1);
+	printf("Called deviceFunc2 outside the filter, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc2") == calls);
+	err = deviceFunc2(device, 12);
+	printf("Called deviceFunc2 inside the filter, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc2") == calls + 1);
+	err = deviceDestroy(device);
+	assert(!err);
+	err = platformRemoveLayer(platform, "libinstance_filter_layer.so");
+	assert(!err);
+	dlclose(lib);
+}
+
+/**
+ * The C++ SDK layer only intercepts deviceFunc2 and deviceDestroy, the loader
+ * bypasses it for the other APIs, and fans deviceFunc2Batch out to deviceFunc2
+ * calls that go through it.
+ */
+void test_sdk_layer(platform_t platform) {
+	device_t device;
+	void *lib;
+	size_t calls;
+	int err;
+	printf("Testing C++ SDK instance layer on platform %p\n", (void *)platform);
+	err = platformAddLayer(platform, "libsdk_layer.so");
+	printf("Added C++ SDK instance layer, err = %d\n", err);
+	assert(!err);
+	lib = layerOpen("libsdk_layer.so");
+	err = platformCreateDevice(platform, &device);
+	assert(!err);
+	err = deviceFunc1(device, 0);
+	printf("Called deviceFunc1, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc1") == 0);
+	calls = layerCalls(lib, "deviceFunc2");
+	err = deviceFunc2(device, 1);
+	printf("Called deviceFunc2, err = %d\n", err);
+	assert(layerCalls(lib, "deviceFunc2") == calls + 1);
+	int params[2] = { 3, 4 }, results[2];
+	memset(results, 0xff, sizeof(results));
+	err = deviceFunc2Batch(device, 2, params, results);
+	printf("Called deviceFunc2Batch, err = %d, results = {%d, %d}\n",
+		err, results[0], results[1]);
+	assert(!err && results[0] == SPEC_SUCCESS && results[1] == SPEC_SUCCESS);
+	assert(layerCalls(lib, "deviceFunc2") == calls + 3);
+	calls = layerCalls(lib, "deviceDestroy");
+	err = deviceDestroy(device);
+	assert(!err);
+	assert(layerCalls(lib, "deviceDestroy") == calls + 1);
+	err = platformRemoveLayer(platform, "libsdk_layer.so");
+	assert(!err);
+	dlclose(lib);
+}
+
+/**
+ * Drivers added at runtime append their platforms, already loaded drivers are
+ * rejected, whatever the path they are named through.
+ */
+void test_driver_addition(size_t num_platforms) {
+	platform_t *platforms;
+	size_t new_num_platforms;
+	int err;
+	printf("Testing driver addition\n");
+	err = addDriver("libdriver1.so");
+	assert(err == SPEC_ERROR);
+	err = addDriver("libunknown_driver.so");
+	assert(err == SPEC_ERROR);
+	err = addDriver("libdriver3.so");
+	printf("Added driver3, err = %d\n", err);
+	assert(!err);
+	/* the same library, named through another path */
+	err = addDriver("./libdriver3.so");
+	assert(err == SPEC_ERROR);
+	err = getPlatforms(0, NULL, &new_num_platforms);
+	assert(!err);
+	assert(new_num_platforms == num_platforms + 1);
+	platforms = (platform_t *)malloc(new_num_platforms * sizeof(platform_t));
+	err = getPlatforms(new_num_platforms, platforms, NULL);
+	assert(!err);
+	test_platform(platforms[num_platforms]);
+	free(platforms);
+}
+
+/**
+ * Only run when handle validation is enabled, as using released handles is
+ * undefined otherwise.
+ */
+void test_platform_validation(platform_t platform) {
+	device_t device, devices[2];
+	int err;
+	printf("Testing platform %p handle validation\n", (void *)platform);
+	err = platformCreateDevice(platform, &device);
+	assert(!err);
+	err = deviceDestroy(device);
+	assert(!err);
+	err = deviceFunc1(device, 0);
+	printf("Called deviceFunc1 on a destroyed device, err = %d\n", err);
+	assert(err == SPEC_ERROR);
+	err = deviceDestroy(device);
+	printf("Destroyed a destroyed device, err = %d\n", err);
+	assert(err == SPEC_ERROR);
+	err = platformCreateDevices(platform, 2, devices);
+	assert(!err);
+	device = devices[1];
+	devices[1] = devices[0];
+	err = devicesDestroy(2, devices);
+	printf("Destroyed a device twice in bulk, err = %d\n", err);
+	assert(err == SPEC_ERROR);
+	devices[1] = device;
+	err = devicesDestroy(2, devices);
+	assert(!err);
+}
+
+/**
+ * Devices of different platforms can't be destroyed together. The failed call
+ * leaves them live, so they can still be used and destroyed.
+ */
+void test_platforms_validation(platform_t platform1, platform_t platform2) {
+	device_t devices[2];
+	int err;
+	printf("Testing mixed platform handle validation\n");
+	err = platformCreateDevice(platform1, &devices[0]);
+	assert(!err);
+	err = platformCreateDevice(platform2, &devices[1]);
+	assert(!err);
+	err = devicesDestroy(2, devices);
+	printf("Destroyed devices of two platforms in bulk, err = %d\n", err);
+	assert(err == SPEC_ERROR);
+	for (int i = 0; i < 2; i++) {
+		err = deviceFunc1(devices[i], 0);
+		assert(!err);
+		err = deviceDestroy(devices[i]);
+		assert(!err);
+	}
+}
+
 int main() {
 	size_t num_platforms = 0;
 	platform_t *platforms = NULL;
@@ -44,10 +563,29 @@ int main() {
 	assert(handle);
 	GET_SYM(getPlatforms);
 	GET_SYM(platformAddLayer);
+	GET_SYM(platformGetFunc);
 	GET_SYM(platformCreateDevice);
 	GET_SYM(deviceFunc1);
 	GET_SYM(deviceFunc2);
 	GET_SYM(deviceDestroy);
+	GET_SYM(deviceFunc1Batch);
+	GET_SYM(deviceFunc2Batch);
+	GET_SYM(platformCreateQueue);
+	GET_SYM(deviceCreateQueue);
+	GET_SYM(queueDestroy);
+	GET_SYM(eventQuery);
+	GET_SYM(eventWait);
+	GET_SYM(eventRelease);
+	GET_SYM(platformCreateDeviceEnqueue);
+	GET_SYM(deviceFunc1Enqueue);
+	GET_SYM(deviceFunc2BatchEnqueue);
+	GET_SYM(deviceDestroyEnqueue);
+	GET_SYM(platformCreateDevices);
+	GET_SYM(devicesDestroy);
+	GET_SYM(layerSetEnabled);
+	GET_SYM(platformRemoveLayer);
+	GET_SYM(addDriver);
+	GET_SYM(deviceAddLayer);
 	printf("Opened loader %p\n", handle);
 #endif
 	int err = getPlatforms(0, NULL, &num_platforms);
@@ -55,16 +593,34 @@ int main() {
 	assert(!err);
 	if (!num_platforms)
 		return 0;
-	platforms = (platform_t *)malloc(num_platforms * sizeof(platform_t));
-	err = getPlatforms(num_platforms, platforms, NULL);
+	/* entries past the platforms are set to NULL */
+	platforms = (platform_t *)malloc((num_platforms + 1) * sizeof(platform_t));
+	err = getPlatforms(num_platforms + 1, platforms, NULL);
 	printf("Got platforms, err = %d\n", err);
 	assert(!err);
+	assert(!platforms[num_platforms]);
 	err = platformAddLayer(platforms[0], "libinstance_layer1.so");
 	printf("Added instance layer1, err = %d\n", err);
 	err = platformAddLayer(platforms[0], "libinstance_layer2.so");
 	printf("Added instance layer2, err = %d\n", err);
 	for (size_t i = 0; i < num_platforms; i++)
 		test_platform(platforms[i]);
+	for (size_t i = 0; i < num_platforms; i++)
+		test_platform_bulk(platforms[i]);
+	for (size_t i = 0; i < num_platforms; i++)
+		test_platform_async(platforms[i]);
+	test_layer_toggle(platforms[0]);
+	test_layer_removal(platforms[0]);
+	test_device_layer(platforms[0]);
+	test_layer_filter(platforms[0]);
+	test_sdk_layer(platforms[0]);
+	test_driver_addition(num_platforms);
+	test_concurrent_layer_removal();
+	if (getenv("VALIDATE_HANDLES"))
+		for (size_t i = 0; i < num_platforms; i++)
+			test_platform_validation(platforms[i]);
+	if (getenv("VALIDATE_HANDLES") && num_platforms > 1)
+		test_platforms_validation(platforms[0], platforms[1]);
 	free(platforms);
 #ifdef NO_PROTOTYPES
 	int res = dlclose(handle);
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+/**
+ * Implementation of the binary logging backend of trace.h. Each layer library
+ * embeds its own copy, with its own rings, drain thread and trace file.
+ */
+
+#define TRACE_RING_SIZE 1024
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_MAX_STRINGS 1024
+#define TRACE_DRAIN_INTERVAL_NS 1000000
+
+/**
+ * Single producer single consumer ring of records. head is only written by
+ * the thread owning the ring, and tail by the drain thread. Rings are never
+ * freed while the layer is loaded, and are reused by new threads once their
+ * thread exits, like epoch reader records.
+ */
+struct trace_ring_s;
+struct trace_ring_s {
+	uint64_t               head;
+	uint64_t               tail;
+	uint64_t               dropped;
+	uint32_t               id;
+	int                    in_use;
+	struct trace_ring_s   *next;
+	struct trace_record_s  records[TRACE_RING_SIZE];
+};
+
+/**
+ * Format strings and strings logged with %s. Entries are published by
+ * incrementing _trace_num_strings, and never modified afterwards. Entry 0 is
+ * unused, identifier 0 meaning unknown.
+ */
+struct trace_string_s {
+	const char    *string;
+	int            interned;
+	size_t         num_args;
+	unsigned char  types[TRACE_MAX_ARGS];
+};
+
+int _trace_enabled = 0;
+
+static __thread struct trace_ring_s *_trace_ring = NULL;
+static struct trace_ring_s   *_trace_first_ring = NULL;
+static uint32_t               _trace_num_rings = 0;
+static struct trace_string_s  _trace_strings[TRACE_MAX_STRINGS];
+static uint32_t               _trace_num_strings = 1;
+static uint32_t               _trace_written_strings = 1;
+static pthread_mutex_t        _trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t          _trace_key;
+static FILE                  *_trace_file = NULL;
+static pthread_t              _trace_drain_thread;
+static int                    _trace_stop = 0;
+
+static inline uint64_t
+traceNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Add a string to the table, with _trace_mutex held.
+ */
+static uint32_t
+traceAddString(const char *string, int interned) {
+	uint32_t id = _trace_num_strings;
+	if (id == TRACE_MAX_STRINGS)
+		return 0;
+	struct trace_string_s *entry = &_trace_strings[id];
+	if (interned) {
+		entry->string = strdup(string);
+		if (!entry->string)
+			return 0;
+	} else
+		entry->string = string;
+	entry->interned = interned;
+	entry->num_args = 0;
+	for (const char *p = string; !interned && (p = strchr(p, '%'));) {
+		int type;
+		p += traceParseSpec(p + 1, &type) + 1;
+		if (type >= 0 && entry->num_args < TRACE_MAX_ARGS)
+			entry->types[entry->num_args++] = (unsigned char)type;
+	}
+	__atomic_store_n(&_trace_num_strings, id + 1, __ATOMIC_RELEASE);
+	return id;
+}
+
+static uint32_t
+traceRegisterFormat(uint32_t *format_id, const char *format) {
+	pthread_mutex_lock(&_trace_mutex);
+	uint32_t id = *format_id;
+	if (!id) {
+		id = traceAddString(format, 0);
+		__atomic_store_n(format_id, id, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&_trace_mutex);
+	return id;
+}
+
+/**
+ * Strings logged with %s are copied once, so they are expected to come from a
+ * small set, like API or extension names.
+ */
+static uint32_t
+traceIntern(const char *string) {
+	uint32_t id = 0;
+	if (!string)
+		return 0;
+	pthread_mutex_lock(&_trace_mutex);
+	for (uint32_t i = 1; i < _trace_num_strings && !id; i++)
+		if (_trace_strings[i].interned && !strcmp(_trace_strings[i].string, string))
+			id = i;
+	if (!id)
+		id = traceAddString(string, 1);
+	pthread_mutex_unlock(&_trace_mutex);
+	return id;
+}
+
+static void
+traceThreadExit(void *arg) {
+	struct trace_ring_s *ring = (struct trace_ring_s *)arg;
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static struct trace_ring_s *
+traceRingRegister(void) {
+	struct trace_ring_s *ring;
+	for (ring = __atomic_load_n(&_trace_first_ring, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		int unused = 0;
+		if (__atomic_compare_exchange_n(&ring->in_use, &unused, 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			goto found;
+	}
+	ring = (struct trace_ring_s *)calloc(1, sizeof(struct trace_ring_s));
+	if (!ring)
+		return NULL;
+	ring->in_use = 1;
+	ring->id = __atomic_fetch_add(&_trace_num_rings, 1, __ATOMIC_RELAXED);
+	ring->next = __atomic_load_n(&_trace_first_ring, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_trace_first_ring, &ring->next, ring, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+found:
+	pthread_setspecific(_trace_key, ring);
+	_trace_ring = ring;
+	return ring;
+}
+
+void
+traceLog(uint32_t *format_id, const char *format, ...) {
+	uint32_t id = __atomic_load_n(format_id, __ATOMIC_ACQUIRE);
+	if (!id && !(id = traceRegisterFormat(format_id, format)))
+		return;
+	struct trace_ring_s *ring = _trace_ring;
+	if (__builtin_expect(!ring, 0) && !(ring = traceRingRegister()))
+		return;
+	uint64_t head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	const struct trace_string_s *entry = &_trace_strings[id];
+	struct trace_record_s *record = &ring->records[head & TRACE_RING_MASK];
+	record->timestamp = traceNow();
+	record->thread = ring->id;
+	record->format = id;
+	va_list ap;
+	va_start(ap, format);
+	for (size_t i = 0; i < entry->num_args; i++)
+		switch (entry->types[i]) {
+		case TRACE_ARG_INT:
+			record->args[i] = (uint64_t)(int64_t)va_arg(ap, int);
+			break;
+		case TRACE_ARG_UINT:
+			record->args[i] = va_arg(ap, unsigned int);
+			break;
+		case TRACE_ARG_LONG:
+			record->args[i] = (uint64_t)va_arg(ap, long);
+			break;
+		case TRACE_ARG_SIZE:
+			record->args[i] = va_arg(ap, size_t);
+			break;
+		case TRACE_ARG_PTR:
+			record->args[i] = (uintptr_t)va_arg(ap, void *);
+			break;
+		case TRACE_ARG_STR:
+			record->args[i] = traceIntern(va_arg(ap, const char *));
+			break;
+		}
+	va_end(ap);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+traceWriteChunk(uint32_t type, uint32_t id, const void *payload, size_t size) {
+	struct trace_chunk_s chunk = { type, id, size };
+	fwrite(&chunk, sizeof(chunk), 1, _trace_file);
+	fwrite(payload, 1, size, _trace_file);
+}
+
+/**
+ * Write the new strings, then the records of every ring. Returns the number of
+ * records written.
+ */
+static size_t
+traceFlush(void) {
+	size_t num_records = 0;
+	uint32_t num_strings = __atomic_load_n(&_trace_num_strings, __ATOMIC_ACQUIRE);
+	for (; _trace_written_strings < num_strings; _trace_written_strings++) {
+		const char *string = _trace_strings[_trace_written_strings].string;
+		traceWriteChunk(TRACE_CHUNK_STRING, _trace_written_strings, string, strlen(string));
+	}
+	for (struct trace_ring_s *ring = __atomic_load_n(&_trace_first_ring, __ATOMIC_ACQUIRE);
+			ring; ring = ring->next) {
+		uint64_t tail = ring->tail;
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (head != tail) {
+			size_t start = tail & TRACE_RING_MASK;
+			size_t num = head - tail;
+			size_t first = num < TRACE_RING_SIZE - start ? num : TRACE_RING_SIZE - start;
+			struct trace_chunk_s chunk = { TRACE_CHUNK_RECORDS, ring->id, num * sizeof(struct trace_record_s) };
+			fwrite(&chunk, sizeof(chunk), 1, _trace_file);
+			fwrite(&ring->records[start], sizeof(struct trace_record_s), first, _trace_file);
+			fwrite(ring->records, sizeof(struct trace_record_s), num - first, _trace_file);
+			__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+			num_records += num;
+		}
+		uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		if (dropped)
+			traceWriteChunk(TRACE_CHUNK_DROPPED, ring->id, &dropped, sizeof(dropped));
+	}
+	if (num_records)
+		fflush(_trace_file);
+	return num_records;
+}
+
+static void *
+traceDrain(void *arg) {
+	(void)arg;
+	struct timespec interval = { 0, TRACE_DRAIN_INTERVAL_NS };
+	while (!__atomic_load_n(&_trace_stop, __ATOMIC_ACQUIRE))
+		if (!traceFlush())
+			nanosleep(&interval, NULL);
+	return NULL;
+}
+
+/**
+ * Trace files are named after the layer library, as several copies of the
+ * same layer can be loaded, and the process. A layer library can also be
+ * unloaded and loaded again by the same process, each load creating a new
+ * file with the next free load number instead of truncating the previous one.
+ */
+#define TRACE_MAX_LOADS 1024
+
+static FILE *
+traceOpen(const char *prefix, const char *library, size_t len) {
+	char *path = (char *)malloc(strlen(prefix) + len + 64);
+	FILE *file = NULL;
+	if (!path)
+		return NULL;
+	for (unsigned int load = 0; !file && load < TRACE_MAX_LOADS; load++) {
+		sprintf(path, "%s.%.*s.%ld.%u.trace", prefix, (int)len, library, (long)getpid(), load);
+		int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd >= 0) {
+			file = fdopen(fd, "wb");
+			if (!file)
+				close(fd);
+		}
+	}
+	free(path);
+	return file;
+}
+
+__attribute__((constructor))
+static void
+traceInit(void) {
+	const char *prefix = getenv("LAYER_TRACE");
+	Dl_info info;
+	if (!prefix || !*prefix || !dladdr((void *)(intptr_t)&traceInit, &info) || !info.dli_fname)
+		return;
+	const char *library = strrchr(info.dli_fname, '/');
+	library = library ? library + 1 : info.dli_fname;
+	size_t len = strlen(library);
+	if (len > 3 && !strcmp(library + len - 3, ".so"))
+		len -= 3;
+	_trace_file = traceOpen(prefix, library, len);
+	if (!_trace_file)
+		return;
+	struct trace_header_s header = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record_s) };
+	fwrite(&header, sizeof(header), 1, _trace_file);
+	if (pthread_key_create(&_trace_key, &traceThreadExit))
+		goto error;
+	if (pthread_create(&_trace_drain_thread, NULL, &traceDrain, NULL)) {
+		pthread_key_delete(_trace_key);
+		goto error;
+	}
+	_trace_enabled = 1;
+	return;
+error:
+	fclose(_trace_file);
+	_trace_file = NULL;
+}
+
+/**
+ * Layers are unloaded once no API call goes through them anymore, so the
+ * remaining records can be drained and the rings released.
+ */
+__attribute__((destructor))
+static void
+traceFini(void) {
+	if (!_trace_enabled)
+		return;
+	_trace_enabled = 0;
+	__atomic_store_n(&_trace_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(_trace_drain_thread, NULL);
+	traceFlush();
+	fclose(_trace_file);
+	_trace_file = NULL;
+	pthread_key_delete(_trace_key);
+	struct trace_ring_s *ring = _trace_first_ring;
+	while (ring) {
+		struct trace_ring_s *next = ring->next;
+		free(ring);
+		ring = next;
+	}
+	_trace_first_ring = NULL;
+	_trace_ring = NULL;
+	for (uint32_t i = 1; i < _trace_num_strings; i++)
+		if (_trace_strings[i].interned)
+			free((void *)(intptr_t)_trace_strings[i].string);
+}
@@ -0,0 +1,129 @@
+/**
+ * Binary logging backend of the showcase layers.
+ *
+ * When the LAYER_TRACE environment variable is set, layers don't print their
+ * logs: each log call appends a fixed size binary record (format of the log
+ * message, timestamp, thread and raw arguments) to a ring buffer owned by the
+ * calling thread, without locking nor formatting. A background thread drains
+ * the rings of a layer library to the file
+ * <LAYER_TRACE>.<library>.<pid>.<load>.trace, load numbering the loads of the
+ * library by the process, and trace_decode reproduces the text logs from the
+ * trace files offline.
+ *
+ * The format strings of the log messages, and the strings logged with %s, are
+ * only written once to the file, and referenced by identifier in records.
+ * When a ring is full, records are dropped and counted rather than blocking
+ * the calling thread.
+ *
+ * A trace file starts with a struct trace_header_s, followed by chunks: a
+ * struct trace_chunk_s followed by size bytes of payload, that is a string
+ * (TRACE_CHUNK_STRING, id being the identifier of the string), an array of
+ * records (TRACE_CHUNK_RECORDS), or the number of records dropped by a thread
+ * as an uint64_t (TRACE_CHUNK_DROPPED, id being the thread). Strings can be
+ * written after the records referencing them.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_INTERNAL __attribute__((visibility("hidden")))
+
+#define TRACE_MAGIC "LAYTRACE"
+#define TRACE_VERSION 1
+#define TRACE_MAX_ARGS 6
+
+struct trace_header_s {
+	char     magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+enum trace_chunk_e {
+	TRACE_CHUNK_STRING = 1,
+	TRACE_CHUNK_RECORDS,
+	TRACE_CHUNK_DROPPED
+};
+
+struct trace_chunk_s {
+	uint32_t type;
+	uint32_t id;
+	uint64_t size;
+};
+
+/**
+ * A log call. timestamp is in ns (CLOCK_MONOTONIC), thread a small
+ * identifier of the calling thread, format the identifier of the format
+ * string, and args the arguments of the format, converted to 64 bits
+ * (string identifiers for %s).
+ */
+struct trace_record_s {
+	uint64_t timestamp;
+	uint32_t thread;
+	uint32_t format;
+	uint64_t args[TRACE_MAX_ARGS];
+};
+
+/**
+ * Types of the format arguments, recorded and decoded according to their
+ * conversion specification.
+ */
+enum trace_arg_e {
+	TRACE_ARG_INT,
+	TRACE_ARG_UINT,
+	TRACE_ARG_LONG,
+	TRACE_ARG_SIZE,
+	TRACE_ARG_PTR,
+	TRACE_ARG_STR
+};
+
+/**
+ * Parse the conversion specification starting at spec (after the %), return
+ * its length, and its argument type in type_ret (-1 for %%). Only the
+ * conversions used by the layers are supported, others are treated as int.
+ */
+static inline size_t
+traceParseSpec(const char *spec, int *type_ret) {
+	size_t len = 0;
+	int size = 0, lng = 0;
+	if (spec[0] == '%') {
+		*type_ret = -1;
+		return 1;
+	}
+	while (spec[len] && strchr("-+ #0123456789.", spec[len]))
+		len++;
+	for (; spec[len] == 'z' || spec[len] == 'l' || spec[len] == 'h'; len++) {
+		size |= spec[len] == 'z';
+		lng |= spec[len] == 'l';
+	}
+	switch (spec[len]) {
+	case 'p':
+		*type_ret = TRACE_ARG_PTR;
+		break;
+	case 's':
+		*type_ret = TRACE_ARG_STR;
+		break;
+	case 'u':
+	case 'x':
+	case 'X':
+		*type_ret = size ? TRACE_ARG_SIZE : lng ? TRACE_ARG_LONG : TRACE_ARG_UINT;
+		break;
+	default:
+		*type_ret = size ? TRACE_ARG_SIZE : lng ? TRACE_ARG_LONG : TRACE_ARG_INT;
+		break;
+	}
+	return spec[len] ? len + 1 : len;
+}
+
+/**
+ * Set when the LAYER_TRACE environment variable was set when the layer was
+ * loaded, and the trace file could be created.
+ */
+extern int _trace_enabled TRACE_INTERNAL;
+
+/**
+ * Record a log message. format_id caches the identifier of the format, and
+ * must point to a zero initialized variable private to the call site.
+ */
+TRACE_INTERNAL void
+traceLog(uint32_t *format_id, const char *format, ...);
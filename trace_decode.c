@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "trace.h"
+
+/**
+ * Decoder of the trace files written by the layers when LAYER_TRACE is set
+ * (see trace.h). The records of all the files given on the command line are
+ * merged in timestamp order, and printed in the text format of the layer
+ * logs:
+ *   trace_decode <LAYER_TRACE>.*.trace
+ */
+
+struct decode_file_s {
+	const char  *path;
+	char        *data;
+	size_t       size;
+	char       **strings;
+	size_t      *lengths;
+	uint32_t     num_strings;
+};
+
+struct decode_record_s {
+	const struct trace_record_s *record;
+	size_t                       file;
+	size_t                       index;
+};
+
+static int
+compare_records(const void *a, const void *b) {
+	const struct decode_record_s *ra = (const struct decode_record_s *)a;
+	const struct decode_record_s *rb = (const struct decode_record_s *)b;
+	if (ra->record->timestamp != rb->record->timestamp)
+		return ra->record->timestamp < rb->record->timestamp ? -1 : 1;
+	if (ra->file != rb->file)
+		return ra->file < rb->file ? -1 : 1;
+	return (ra->index > rb->index) - (ra->index < rb->index);
+}
+
+static int
+read_file(struct decode_file_s *file) {
+	FILE *f = fopen(file->path, "rb");
+	if (!f)
+		return -1;
+	if (fseek(f, 0, SEEK_END) || (long)(file->size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+		goto error;
+	file->data = (char *)malloc(file->size ? file->size : 1);
+	if (!file->data || fread(file->data, 1, file->size, f) != file->size)
+		goto error;
+	fclose(f);
+	return 0;
+error:
+	fclose(f);
+	return -1;
+}
+
+/**
+ * First pass: validate the chunks, collect the strings, and count the
+ * records.
+ */
+static int
+scan_file(struct decode_file_s *file, size_t *num_records) {
+	const struct trace_header_s *header = (const struct trace_header_s *)file->data;
+	if (file->size < sizeof(*header) || memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+	    header->version != TRACE_VERSION || header->record_size != sizeof(struct trace_record_s))
+		return -1;
+	size_t offset = sizeof(*header);
+	while (offset + sizeof(struct trace_chunk_s) <= file->size) {
+		struct trace_chunk_s chunk;
+		memcpy(&chunk, file->data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (chunk.size > file->size - offset)
+			return -1;
+		switch (chunk.type) {
+		case TRACE_CHUNK_STRING:
+			if (chunk.id >= file->num_strings) {
+				uint32_t num = chunk.id + 1;
+				char **strings = (char **)realloc(file->strings, num * sizeof(char *));
+				size_t *lengths = strings ? (size_t *)realloc(file->lengths, num * sizeof(size_t)) : NULL;
+				if (strings)
+					file->strings = strings;
+				if (!lengths)
+					return -1;
+				file->lengths = lengths;
+				for (uint32_t i = file->num_strings; i < num; i++) {
+					file->strings[i] = NULL;
+					file->lengths[i] = 0;
+				}
+				file->num_strings = num;
+			}
+			file->strings[chunk.id] = file->data + offset;
+			file->lengths[chunk.id] = chunk.size;
+			break;
+		case TRACE_CHUNK_RECORDS:
+			if (chunk.size % sizeof(struct trace_record_s))
+				return -1;
+			*num_records += chunk.size / sizeof(struct trace_record_s);
+			break;
+		case TRACE_CHUNK_DROPPED: {
+			uint64_t dropped = 0;
+			if (chunk.size == sizeof(dropped))
+				memcpy(&dropped, file->data + offset, sizeof(dropped));
+			fprintf(stderr, "trace_decode: %s: %" PRIu64 " records dropped by thread %" PRIu32 "\n",
+				file->path, dropped, chunk.id);
+			break;
+		}
+		default:
+			return -1;
+		}
+		offset += chunk.size;
+	}
+	return 0;
+}
+
+static void
+collect_records(struct decode_file_s *file, size_t file_index,
+		struct decode_record_s *records, size_t *num_records) {
+	size_t offset = sizeof(struct trace_header_s);
+	while (offset + sizeof(struct trace_chunk_s) <= file->size) {
+		struct trace_chunk_s chunk;
+		memcpy(&chunk, file->data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (chunk.type == TRACE_CHUNK_RECORDS)
+			for (size_t i = 0; i < chunk.size / sizeof(struct trace_record_s); i++) {
+				struct decode_record_s *r = &records[(*num_records)++];
+				r->record = (const struct trace_record_s *)
+					(file->data + offset + i * sizeof(struct trace_record_s));
+				r->file = file_index;
+				r->index = *num_records;
+			}
+		offset += chunk.size;
+	}
+}
+
+/**
+ * Print a record by printing its format one conversion specification at a
+ * time, each with its argument converted back to its type.
+ */
+static void
+print_record(const struct decode_file_s *file, const struct trace_record_s *record) {
+	if (record->format >= file->num_strings || !file->strings[record->format]) {
+		printf("<unknown format %" PRIu32 ">\n", record->format);
+		return;
+	}
+	size_t len = file->lengths[record->format];
+	char *format = (char *)malloc(len + 1);
+	if (!format)
+		return;
+	memcpy(format, file->strings[record->format], len);
+	format[len] = '\0';
+	char *segment = format;
+	size_t arg = 0;
+	for (;;) {
+		char *spec = strchr(segment, '%');
+		if (!spec) {
+			fputs(segment, stdout);
+			break;
+		}
+		int type;
+		char *end = spec + 1 + traceParseSpec(spec + 1, &type);
+		char saved = *end;
+		*end = '\0';
+		uint64_t value = arg < TRACE_MAX_ARGS && type >= 0 ? record->args[arg++] : 0;
+		switch (type) {
+		case -1:
+			printf(segment, 0);
+			break;
+		case TRACE_ARG_INT:
+			printf(segment, (int)(int64_t)value);
+			break;
+		case TRACE_ARG_UINT:
+			printf(segment, (unsigned int)value);
+			break;
+		case TRACE_ARG_LONG:
+			printf(segment, (long)value);
+			break;
+		case TRACE_ARG_SIZE:
+			printf(segment, (size_t)value);
+			break;
+		case TRACE_ARG_PTR:
+			printf(segment, (void *)(uintptr_t)value);
+			break;
+		case TRACE_ARG_STR: {
+			char *string = NULL;
+			if (value < file->num_strings && file->strings[value]) {
+				string = (char *)malloc(file->lengths[value] + 1);
+				if (string) {
+					memcpy(string, file->strings[value], file->lengths[value]);
+					string[file->lengths[value]] = '\0';
+				}
+			}
+			printf(segment, string ? string : "(null)");
+			free(string);
+			break;
+		}
+		}
+		*end = saved;
+		segment = end;
+	}
+	putchar('\n');
+	free(format);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace_file...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	size_t num_files = argc - 1;
+	struct decode_file_s *files = (struct decode_file_s *)calloc(num_files, sizeof(struct decode_file_s));
+	size_t num_records = 0;
+	if (!files)
+		return EXIT_FAILURE;
+	for (size_t i = 0; i < num_files; i++) {
+		files[i].path = argv[i + 1];
+		if (read_file(&files[i]) || scan_file(&files[i], &num_records)) {
+			fprintf(stderr, "%s: invalid trace file %s\n", argv[0], files[i].path);
+			return EXIT_FAILURE;
+		}
+	}
+	struct decode_record_s *records = (struct decode_record_s *)
+		malloc((num_records ? num_records : 1) * sizeof(struct decode_record_s));
+	if (!records)
+		return EXIT_FAILURE;
+	num_records = 0;
+	for (size_t i = 0; i < num_files; i++)
+		collect_records(&files[i], i, records, &num_records);
+	qsort(records, num_records, sizeof(struct decode_record_s), compare_records);
+	for (size_t i = 0; i < num_records; i++)
+		print_record(&files[records[i].file], records[i].record);
+	free(records);
+	for (size_t i = 0; i < num_files; i++) {
+		free(files[i].data);
+		free(files[i].strings);
+		free(files[i].lengths);
+	}
+	free(files);
+	return EXIT_SUCCESS;
+}